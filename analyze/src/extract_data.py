@@ -30,6 +30,13 @@ def calc_ect(v: float) -> float:
     return 24.21 * v_i - 26.8
 
 
+def calc_logger_us(df: pd.DataFrame) -> pd.Series:
+    # 新しいデータは us の一つ、古いデータは sec と usec に分かれている
+    if "us" in df:
+        return df["us"]
+    return df["sec"] * 1_000_000 + df["usec"]
+
+
 def ecu(base_path: Path) -> None:
     out_path = base_path / "ecu"
     out_path.mkdir(exist_ok=True)
@@ -53,7 +60,7 @@ def ecu(base_path: Path) -> None:
 
         df = df.assign(
             server_ms=df["time"],
-            logger_us=df["sec"] * 1_000_000 + df["usec"],
+            logger_us=calc_logger_us(df),
             ect=df["ect"].apply(calc_ect),
             gear=df["gp"].apply(calc_gear),
         )
@@ -87,7 +94,7 @@ def rpm(base_path: Path) -> None:
 
         df = df.assign(
             server_ms=df["time"],
-            logger_us=df["sec"] * 1_000_000 + df["usec"],
+            logger_us=calc_logger_us(df),
         )
 
         df = df[["server_ms", "logger_us", "rpm"]]
@@ -119,7 +126,7 @@ def water(base_path: Path) -> None:
 
         df = df.assign(
             server_ms=df["time"],
-            logger_us=df["sec"] * 1_000_000 + df["usec"],
+            logger_us=calc_logger_us(df),
             inlet_temp=df["inlet_temp"] - 273.15,
             outlet_temp=df["outlet_temp"] - 273.15,
         )
@@ -153,7 +160,7 @@ def stroke_front(base_path: Path) -> None:
 
         df = df.assign(
             server_ms=df["time"],
-            logger_us=df["sec"] * 1_000_000 + df["usec"],
+            logger_us=calc_logger_us(df),
         )
 
         df = df[["server_ms", "logger_us", "left", "right"]]
@@ -185,7 +192,7 @@ def stroke_rear(base_path: Path) -> None:
 
         df = df.assign(
             server_ms=df["time"],
-            logger_us=df["sec"] * 1_000_000 + df["usec"],
+            logger_us=calc_logger_us(df),
         )
 
         df = df[["server_ms", "logger_us", "left", "right"]]
@@ -217,7 +224,7 @@ def acc(base_path: Path) -> None:
 
         df = df.assign(
             server_ms=df["time"],
-            logger_us=df["sec"] * 1_000_000 + df["usec"],
+            logger_us=calc_logger_us(df),
             accel_x=df["ax"] / 100.0,
             accel_y=df["ay"] / 100.0,
             accel_z=df["az"] / 100.0,
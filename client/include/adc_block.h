@@ -0,0 +1,104 @@
+#ifndef ADC_BLOCK_H
+#define ADC_BLOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 12bitのA/Dコードを複数チャンネル分まとめて送るためのブロック
+ *
+ * 時刻は先頭のサンプルの時刻と一定のサンプル間隔だけを持つ。
+ * コードはチャンネルごとに並べ(列指向)、二つを3byteに詰める。
+ *   [a(11:4)][a(3:0) b(11:8)][b(7:0)]
+ * サンプル数が奇数の時は最後のコードを2byteで書く。
+ * 取り込み時に詰めた位置へ直接書き込むので、送る時にまとめ直す必要はない。
+ */
+
+#define ADC_BLOCK_MAX_CHANNELS (4)
+#define ADC_BLOCK_MAX_SAMPLES (128)
+
+// n個のコードを詰めた時の一チャンネル分のバイト数
+#define ADC_BLOCK_COLUMN_SIZE(n) (((n) * 3 + 1) / 2)
+
+typedef struct {
+    uint8_t channels;
+    uint16_t samples;      // 一つのブロックに詰めるサンプル数
+    uint32_t interval_us;  // サンプル間隔
+    uint16_t count;        // 詰めたサンプル数
+    uint64_t base_us;      // 先頭のサンプルの時刻
+    uint8_t data[ADC_BLOCK_MAX_CHANNELS *
+                 ADC_BLOCK_COLUMN_SIZE(ADC_BLOCK_MAX_SAMPLES)];
+} adc_block_t;
+
+/**
+ * @brief ブロックを初期化する
+ *
+ * @param[out] block       初期化対象
+ * @param[in]  channels    チャンネル数 (ADC_BLOCK_MAX_CHANNELS以下)
+ * @param[in]  samples     一つのブロックのサンプル数
+ *                         (ADC_BLOCK_MAX_SAMPLES以下)
+ * @param[in]  interval_us サンプル間隔
+ * @return 範囲外の値を渡すとfalse
+ */
+bool adc_block_init(adc_block_t* block, uint8_t channels, uint16_t samples,
+                    uint32_t interval_us);
+
+/**
+ * @brief 中身を捨てて次のブロックを始める
+ */
+void adc_block_reset(adc_block_t* block);
+
+/**
+ * @brief サンプルを一つ追加する
+ *
+ * 時刻が先頭からの予定時刻と半周期以上ずれた場合は間隔が一定でなくなるので
+ * 追加しない。溜まっている分を送ってから追加し直すこと。
+ *
+ * @param[in] time_us サンプルの時刻
+ * @param[in] codes   チャンネル数分のA/Dコード (下位12bitのみ使う)
+ * @return 一杯かずれていて追加できなければfalse
+ */
+bool adc_block_add(adc_block_t* block, uint64_t time_us,
+                   const uint16_t* codes);
+
+static inline bool adc_block_is_full(const adc_block_t* block) {
+    return block->count >= block->samples;
+}
+
+static inline bool adc_block_is_empty(const adc_block_t* block) {
+    return block->count == 0;
+}
+
+/**
+ * @brief 送るためにチャンネル間の隙間を詰める
+ *
+ * 途中で区切ったブロックは列の間に空きがあるので前に寄せる。
+ * 以降はresetするまでaddしないこと。
+ *
+ * @return block->dataの先頭から送るバイト数
+ */
+size_t adc_block_finish(adc_block_t* block);
+
+/**
+ * @brief 詰めたコードを戻す (ホスト側のデコード用)
+ *
+ * @param[in]  packed   adc_block_finishで詰めたデータ
+ * @param[in]  size     packedのバイト数
+ * @param[in]  channels チャンネル数
+ * @param[in]  count    一チャンネルあたりのサンプル数
+ * @param[out] codes    channels * count個。チャンネルごとに並べて書く
+ * @return サイズが合わなければfalse
+ */
+bool adc_block_unpack(const uint8_t* packed, size_t size, uint8_t channels,
+                      uint16_t count, uint16_t* codes);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: ADC_BLOCK_H */
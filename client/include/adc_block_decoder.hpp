@@ -0,0 +1,136 @@
+#ifndef ADC_BLOCK_DECODER_HPP
+#define ADC_BLOCK_DECODER_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <cmp.h>
+
+#include "adc_block.h"
+
+// 保存したブロックのpayload(MsgPack)を戻すホスト側のデコーダ
+// マイコンでは使わないので、std::vectorなどを気にせず使っている
+struct AdcBlock {
+    uint64_t base_us = 0;
+    uint32_t interval_us = 0;
+    uint16_t count = 0;
+    std::vector<std::string> channels;
+    std::vector<uint16_t> codes;  // チャンネルごとにcount個ずつ並ぶ
+
+    uint64_t timeUs(uint16_t i) const {
+        return base_us + static_cast<uint64_t>(i) * interval_us;
+    }
+
+    uint16_t code(size_t ch, uint16_t i) const {
+        return codes[ch * count + i];
+    }
+
+    // キーは文字列であること (data-serverが整数から戻した後のもの)
+    bool decode(const uint8_t* payload, size_t size) {
+        reader_t r = {payload, size, 0};
+        cmp_ctx_t cmp;
+        cmp_init(&cmp, &r, read_, skip_, nullptr);
+
+        uint32_t map_size;
+        if (!cmp_read_map(&cmp, &map_size)) {
+            return false;
+        }
+
+        const uint8_t* packed = nullptr;
+        uint32_t packed_size = 0;
+        bool has_time = false;
+        for (uint32_t i = 0; i < map_size; i++) {
+            char key[16];
+            uint32_t key_size = sizeof(key);
+            if (!cmp_read_str(&cmp, key, &key_size)) {
+                return false;
+            }
+
+            bool ok = true;
+            uint64_t u;
+            if (strcmp(key, "us") == 0) {
+                ok = cmp_read_uinteger(&cmp, &base_us);
+                has_time = true;
+            } else if (strcmp(key, "dt") == 0) {
+                ok = cmp_read_uinteger(&cmp, &u) && u <= UINT32_MAX;
+                interval_us = static_cast<uint32_t>(u);
+            } else if (strcmp(key, "n") == 0) {
+                ok = cmp_read_uinteger(&cmp, &u) && u <= UINT16_MAX;
+                count = static_cast<uint16_t>(u);
+            } else if (strcmp(key, "ch") == 0) {
+                ok = readNames_(&cmp);
+            } else if (strcmp(key, "codes") == 0) {
+                // 読み飛ばさずにその場を指す
+                ok = cmp_read_bin_size(&cmp, &packed_size) &&
+                     r.pos + packed_size <= r.size;
+                if (ok) {
+                    packed = &r.buf[r.pos];
+                    r.pos += packed_size;
+                }
+            } else {
+                ok = cmp_skip_object_no_limit(&cmp);
+            }
+            if (!ok) {
+                return false;
+            }
+        }
+
+        if (!has_time || !packed || channels.empty() ||
+            channels.size() > ADC_BLOCK_MAX_CHANNELS) {
+            return false;
+        }
+        codes.resize(channels.size() * count);
+        return adc_block_unpack(packed, packed_size,
+                                static_cast<uint8_t>(channels.size()), count,
+                                codes.data());
+    }
+
+private:
+    struct reader_t {
+        const uint8_t* buf;
+        size_t size;
+        size_t pos;
+    };
+
+    static bool read_(cmp_ctx_t* ctx, void* data, size_t limit) {
+        reader_t* r = static_cast<reader_t*>(ctx->buf);
+        if (r->pos + limit > r->size) {
+            return false;
+        }
+        memcpy(data, &r->buf[r->pos], limit);
+        r->pos += limit;
+        return true;
+    }
+
+    static bool skip_(cmp_ctx_t* ctx, size_t count) {
+        reader_t* r = static_cast<reader_t*>(ctx->buf);
+        if (r->pos + count > r->size) {
+            return false;
+        }
+        r->pos += count;
+        return true;
+    }
+
+    bool readNames_(cmp_ctx_t* cmp) {
+        uint32_t n;
+        if (!cmp_read_array(cmp, &n)) {
+            return false;
+        }
+        channels.clear();
+        for (uint32_t i = 0; i < n; i++) {
+            char name[32];
+            uint32_t name_size = sizeof(name);
+            if (!cmp_read_str(cmp, name, &name_size)) {
+                return false;
+            }
+            channels.emplace_back(name, name_size);
+        }
+        return true;
+    }
+};
+
+#endif /* end of include guard: ADC_BLOCK_DECODER_HPP */
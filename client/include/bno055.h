@@ -6,6 +6,8 @@
 
 #include <hardware/i2c.h>
 
+#include "i2c_dma.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -93,26 +95,121 @@ typedef struct {
     int16_t mag_radius;
 } bno055_calib_data_t;
 
+// モードを切り替えてから次に操作するまでの時間
+#define BNO055_TO_CONFIG_MS (19)
+#define BNO055_FROM_CONFIG_MS (7)
+
+// bno055_read_blockで読む項目
+#define BNO055_FIELD_ACCEL (1u << 0)         // 0x08-0x0D
+#define BNO055_FIELD_MAG (1u << 1)           // 0x0E-0x13
+#define BNO055_FIELD_GYRO (1u << 2)          // 0x14-0x19
+#define BNO055_FIELD_EULER (1u << 3)         // 0x1A-0x1F
+#define BNO055_FIELD_QUATERNION (1u << 4)    // 0x20-0x27
+#define BNO055_FIELD_LINEAR_ACCEL (1u << 5)  // 0x28-0x2D
+#define BNO055_FIELD_GRAVITY (1u << 6)       // 0x2E-0x33
+#define BNO055_FIELD_TEMP (1u << 7)          // 0x34
+#define BNO055_FIELD_CALIB_STATUS (1u << 8)  // 0x35
+#define BNO055_FIELD_ALL (0x1FF)
+
+// 0x08-0x35の大きさ。bno055_start_read_blockに渡すバッファはこれだけ要る
+#define BNO055_BLOCK_SIZE (46)
+
+// 0x08-0x35をまとめて読んだ値。読まなかった項目はそのまま残る
+typedef struct {
+    bno055_accel_t accel;
+    bno055_mag_t mag;
+    bno055_gyro_t gyro;
+    bno055_euler_t euler;
+    bno055_quaternion_t quaternion;
+    bno055_linear_accel_t linear_accel;
+    bno055_gravity_t gravity;
+    int8_t temp;
+    bno055_calib_status_t calib_status;
+} bno055_block_t;
+
 typedef struct {
     i2c_inst_t* i2c_id;
     uint8_t addr;
 } bno055_dev_t;
 
+/**
+ * @brief チップIDを読む
+ *
+ * 読めなかった時は0を返すので、bno055_is_chip_id_validで弾ける。
+ */
 uint8_t bno055_get_chip_id(bno055_dev_t* dev);
 bool bno055_is_chip_id_valid(uint8_t chip_id);
 
-void bno055_set_mode(bno055_dev_t* dev, uint8_t mode);
-
-void bno055_read_accel(bno055_dev_t* dev, bno055_accel_t* acc);
-void bno055_read_gyro(bno055_dev_t* dev, bno055_gyro_t* gyro);
-void bno055_read_mag(bno055_dev_t* dev, bno055_mag_t* mag);
-void bno055_read_euler(bno055_dev_t* dev, bno055_euler_t* euler);
-void bno055_read_quaternion(bno055_dev_t* dev, bno055_quaternion_t* quaternion);
-void bno055_read_linear_accel(bno055_dev_t* dev,
+/**
+ * 以下の読み書きは終わるまで待ち、バスが応えなかった時はfalseを返す。
+ * 読めなかった時は出力を書き換えない。
+ */
+bool bno055_set_mode(bno055_dev_t* dev, uint8_t mode);
+
+bool bno055_read_accel(bno055_dev_t* dev, bno055_accel_t* acc);
+bool bno055_read_gyro(bno055_dev_t* dev, bno055_gyro_t* gyro);
+bool bno055_read_mag(bno055_dev_t* dev, bno055_mag_t* mag);
+bool bno055_read_euler(bno055_dev_t* dev, bno055_euler_t* euler);
+bool bno055_read_quaternion(bno055_dev_t* dev, bno055_quaternion_t* quaternion);
+bool bno055_read_linear_accel(bno055_dev_t* dev,
                               bno055_linear_accel_t* linear_accel);
-void bno055_read_gravity(bno055_dev_t* dev, bno055_gravity_t* gravity);
-void bno055_read_calib_status(bno055_dev_t* dev, bno055_calib_status_t* status);
-void bno055_read_calib_data(bno055_dev_t* dev, bno055_calib_data_t* data);
+bool bno055_read_gravity(bno055_dev_t* dev, bno055_gravity_t* gravity);
+bool bno055_read_calib_status(bno055_dev_t* dev, bno055_calib_status_t* status);
+
+/**
+ * @brief 較正値を読む
+ *
+ * 全て較正し終えてから、CONFIGモードに切り替えて呼ぶこと。
+ */
+bool bno055_read_calib_data(bno055_dev_t* dev, bno055_calib_data_t* data);
+
+/**
+ * @brief 残しておいた較正値を書き戻す
+ *
+ * CONFIGモードで呼び、書いてから動作モードに切り替えること。
+ */
+bool bno055_write_calib_data(bno055_dev_t* dev,
+                             const bno055_calib_data_t* data);
+
+bool bno055_is_fully_calibrated(const bno055_calib_status_t* status);
+
+/**
+ * @brief maskの項目を一度のI2Cの転送で読む (終わるまで待つ)
+ *
+ * maskの項目をすべて含む連続したレジスタを読み、maskの項目だけを埋める。
+ * 全項目なら0x08-0x35の46byteになる。
+ *
+ * @param[in]  mask  BNO055_FIELD_*の組み合わせ
+ * @param[out] block 読んだ値
+ * @return 読めなかった時、maskが空の時はfalse
+ */
+bool bno055_read_block(bno055_dev_t* dev, uint32_t mask,
+                       bno055_block_t* block);
+
+/**
+ * @brief maskの項目の読み出しをDMAで始める
+ *
+ * 読んだものはrawのレジスタと同じ位置に入るので、
+ * コールバックがi2c_dma_okで呼ばれたらbno055_decode_blockで取り出す。
+ *
+ * @param[out] raw BNO055_BLOCK_SIZE byte
+ * @return バスが転送中ならfalse
+ */
+bool bno055_start_read_block(bno055_dev_t* dev, i2c_dma_bus_t* bus,
+                             uint32_t mask, uint8_t* raw,
+                             uint32_t timeout_us,
+                             i2c_dma_callback_t callback, void* ctx);
+
+/**
+ * @brief bno055_start_read_blockで読んだものからmaskの項目を埋める
+ */
+void bno055_decode_block(uint32_t mask, const uint8_t* raw,
+                         bno055_block_t* block);
+
+/**
+ * @brief bno055_read_blockで読むbyte数
+ */
+uint8_t bno055_block_size(uint32_t mask);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,86 @@
+#ifndef BOOT_SEQ_H
+#define BOOT_SEQ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 起動時の機器の初期化を、機器ごとに並べて少しずつ進める
+ *
+ * 機器ごとに初期化を段階に分けた関数を登録し、メインループから
+ * boot_seq_taskを呼ぶ。待ちが要る段階はsleepせず、boot_seq_waitで
+ * 次に呼ばれる時刻を遅らせるので、その間も他の機器の初期化や
+ * 計測は進み、準備できた機器から使い始められる。
+ * 機器ごとに準備できた時刻を残すので、起動にかかった時間を送れる。
+ */
+
+#define BOOT_SEQ_MAX_DEVS (8)
+
+typedef enum {
+    boot_pending,
+    boot_ready,
+    boot_failed,
+} boot_state_t;
+
+typedef struct boot_dev boot_dev_t;
+
+// 一段階だけ進めて、機器の状態を返す
+typedef boot_state_t (*boot_step_t)(boot_dev_t* dev, uint64_t now_us);
+
+struct boot_dev {
+    const char* name;
+    boot_step_t step_fn;
+    void* ctx;
+    uint8_t step;  // step_fnが使う段階の番号。最初は0
+
+    uint64_t deadline_us;    // これまでに準備できなければ諦める
+    uint64_t wait_until_us;  // これより前には呼ばない
+    boot_state_t state;
+    uint64_t done_us;  // 準備できたか諦めた時刻 (起動からのus)
+};
+
+typedef struct {
+    boot_dev_t devs[BOOT_SEQ_MAX_DEVS];
+    uint8_t count;
+} boot_seq_t;
+
+void boot_seq_init(boot_seq_t* seq);
+
+/**
+ * @brief 機器を登録する
+ *
+ * @param[in] timeout_us 登録してからこの時間で準備できなければ諦める
+ * @return 機器の番号。登録できなければBOOT_SEQ_MAX_DEVS
+ */
+uint8_t boot_seq_add(boot_seq_t* seq, const char* name, boot_step_t step_fn,
+                     void* ctx, uint64_t now_us, uint32_t timeout_us);
+
+/**
+ * @brief 待っていない機器の初期化をそれぞれ一段階ずつ進める
+ */
+void boot_seq_task(boot_seq_t* seq, uint64_t now_us);
+
+/**
+ * @brief step_fnの中で、次に呼ばれるのをdelay_usだけ遅らせる
+ */
+static inline void boot_seq_wait(boot_dev_t* dev, uint64_t now_us,
+                                 uint32_t delay_us) {
+    dev->wait_until_us = now_us + delay_us;
+}
+
+bool boot_seq_is_ready(const boot_seq_t* seq, uint8_t id);
+
+/**
+ * @brief 全ての機器が準備できたか諦めたかを返す
+ */
+bool boot_seq_is_done(const boot_seq_t* seq);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: BOOT_SEQ_H */
@@ -0,0 +1,51 @@
+#ifndef CALIB_STORE_H
+#define CALIB_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "flash_log.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * BNO055の較正値をフラッシュに残す
+ *
+ * フラッシュのログの手前の4KBのセクタの先頭ページに
+ * [magic 4byte][len 2byte][crc 2byte][較正値] を書く。
+ * 同じ内容が既に書いてあれば書かないので、消すのは較正値が変わった時だけ。
+ * 消去と書き込みの間はflash_log_execでもう一方のコアを止める。
+ */
+
+#define CALIB_STORE_SECTOR_SIZE (4096)
+#define CALIB_STORE_OFFSET (FLASH_LOG_OFFSET - CALIB_STORE_SECTOR_SIZE)
+#define CALIB_STORE_MAGIC (0x42494c43)  // "CLIB"
+#define CALIB_STORE_HEADER_SIZE (8)
+
+// 1ページに収まる大きさ
+#define CALIB_STORE_MAX_LEN (256 - CALIB_STORE_HEADER_SIZE)
+
+/**
+ * @brief 残しておいた較正値を読む
+ *
+ * @return 書いてないか、長さが違うか、壊れていればfalse
+ */
+bool calib_store_load(void* data, uint16_t len);
+
+/**
+ * @brief 較正値を残す
+ *
+ * flash_log_taskを呼ぶコアから呼ぶこと。
+ * 消去の間 (数十ms) はもう一方のコアも止まる。
+ *
+ * @return 書けたか、同じ内容が既にあればtrue
+ */
+bool calib_store_save(flash_log_t* log, const void* data, uint16_t len);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: CALIB_STORE_H */
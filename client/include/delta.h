@@ -0,0 +1,77 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ゆっくり変わるトピックを項目ごとの差分で送るためのエンコーダ
+ *
+ * 一定間隔で全項目(キーフレーム)を送り、その間は最後に送った値から
+ * 不感帯より大きく変わった項目だけを送る。
+ * どの項目も変わらなければ送らず、ハートビートの間隔ごとに項目の無い
+ * フレームだけを送る。
+ * 比べる相手は最後に「送った」値なので、ホストで組み立て直した値と
+ * 実際の値の差は常に不感帯以内に収まる(不感帯が0なら一致する)。
+ */
+
+#define DELTA_MAX_FIELDS (32)
+
+typedef enum {
+    delta_skip = 0,   // 送らない
+    delta_keyframe,   // 全項目を送る
+    delta_changes,    // maskの項目だけを送る
+    delta_heartbeat,  // 項目無しで時刻だけを送る
+} delta_kind_t;
+
+typedef struct {
+    uint8_t count;
+    const double* deadband;  // 項目ごとの不感帯 (count個)
+    uint32_t keyframe_interval_us;
+    uint32_t heartbeat_interval_us;
+    bool has_keyframe;
+    uint64_t keyframe_us;  // 最後にキーフレームを送った時刻
+    uint64_t sent_us;      // 最後に何かを送った時刻
+    double sent[DELTA_MAX_FIELDS];  // ホストが持っている値
+} delta_t;
+
+/**
+ * @brief エンコーダを初期化する
+ *
+ * @param[out] delta                 初期化対象
+ * @param[in]  count                 項目数 (DELTA_MAX_FIELDS以下)
+ * @param[in]  deadband              項目ごとの不感帯。呼び出し側で保持すること
+ * @param[in]  keyframe_interval_us  キーフレームの間隔
+ * @param[in]  heartbeat_interval_us 変化が無い時に送る間隔
+ * @return 項目数が範囲外ならfalse
+ */
+bool delta_init(delta_t* delta, uint8_t count, const double* deadband,
+                uint32_t keyframe_interval_us, uint32_t heartbeat_interval_us);
+
+/**
+ * @brief 次のキーフレームをすぐに送らせる
+ */
+void delta_force_keyframe(delta_t* delta);
+
+/**
+ * @brief 新しい値を渡し、何を送るかを決める
+ *
+ * delta_skip以外を返した時は、その通りに送ったものとして状態を進める。
+ *
+ * @param[in]  now_us 現在時刻
+ * @param[in]  values count個の値
+ * @param[out] mask   送る項目 (bit iが項目i)
+ * @return 送り方
+ */
+delta_kind_t delta_update(delta_t* delta, uint64_t now_us,
+                          const double* values, uint32_t* mask);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: DELTA_H */
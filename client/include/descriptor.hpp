@@ -0,0 +1,60 @@
+#ifndef DESCRIPTOR_HPP
+#define DESCRIPTOR_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string_view>
+
+#include <pico/time.h>
+
+#include "msgpack.hpp"
+
+// 名前の表をdescトピックのフレームに分けて書く
+// 一つのフレームには一つの表の一部を {"table", "first", "names"} として載せ、
+// Nに収まらない名前は次のフレームに回す。ホストはfirstの位置から継ぎ足す
+// 表が空でもfirstが0のフレームを一つ書くので、ホストは前の表を捨てられる
+// 一つの名前も収まらなければfalse
+template <int N, typename F, typename Publish>
+bool describe_table(std::string_view table, uint8_t count, F name,
+                    absolute_time_t now, Publish publish) {
+    // "names"のキーと、配列の長さに使う最大のヘッダ
+    constexpr uint16_t NAMES_HEADER = 1 + 5 + 3;
+
+    uint8_t first = 0;
+    do {
+        auto msgpack = MsgPack<N>("desc", 3, true);
+        msgpack.addTime(now);
+        msgpack.addStr("table", table);
+        msgpack.add("first", first);
+
+        uint16_t room = msgpack.getRoom();
+        room = room > NAMES_HEADER ? room - NAMES_HEADER : 0;
+        uint8_t n = 0;
+        while (first + n < count) {
+            const size_t len = strlen(name(first + n));
+            const size_t size = len + (len < 32 ? 1 : len < 256 ? 2 : 3);
+            if (size > room) {
+                break;
+            }
+            room -= size;
+            n++;
+        }
+        if (n == 0 && first < count) {
+            return false;
+        }
+
+        msgpack.addNames("names", n,
+                         [&](uint8_t i) { return name(first + i); });
+        uint8_t* buf = msgpack.getBuf();
+        if (buf == nullptr) {
+            return false;
+        }
+        publish(msgpack.getTopic(), buf, msgpack.getSize());
+        first += n;
+    } while (first < count);
+
+    return true;
+}
+
+#endif /* end of include guard: DESCRIPTOR_HPP */
@@ -0,0 +1,88 @@
+#ifndef DOORBELL_H
+#define DOORBELL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pico/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * コア間/割り込みからの起床通知
+ *
+ * producerはキューに積んだ後にdoorbell_ringを呼び、SEVでconsumerを起こす。
+ * consumerはdoorbell_waitの中でWFEにより眠り、通知かタイムアウトで起きる。
+ * 眠っていた時間と、通知から取り出しまでの遅延を統計として記録する。
+ */
+typedef struct {
+    volatile bool pending;
+    volatile uint32_t rung_us;
+    uint32_t timeout_us;
+
+    bool measuring;
+    uint32_t measure_from_us;
+
+    uint32_t window_start_us;
+    uint32_t idle_us;
+    uint32_t wakes;
+    uint32_t latency_sum_us;
+    uint32_t latency_max_us;
+    uint32_t latency_count;
+} doorbell_t;
+
+typedef struct {
+    uint32_t window_us;       // 統計を取った期間
+    uint32_t busy_permille;   // 起きていた割合 (0-1000)
+    uint32_t wakes;           // 通知で起きた回数
+    uint32_t latency_avg_us;  // 通知から取り出しまでの平均
+    uint32_t latency_max_us;  // 通知から取り出しまでの最大
+} doorbell_stats_t;
+
+/**
+ * @brief 初期化する
+ *
+ * @param[in] timeout_us 通知が無くても起きる間隔。起床遅延の上限になる
+ */
+void doorbell_init(doorbell_t* db, uint32_t timeout_us);
+
+/**
+ * @brief consumerを起こす (producer側、割り込みからも呼べる)
+ */
+void doorbell_ring(doorbell_t* db);
+
+/**
+ * @brief 通知が来るかタイムアウトするまで眠る (consumer側)
+ *
+ * @return 通知で起きたらtrue、タイムアウトならfalse
+ */
+bool doorbell_wait(doorbell_t* db);
+
+/**
+ * @brief 通知が来るか指定時刻まで眠る (consumer側)
+ *
+ * 初期化時の間隔より短い期限で起きたい時に使う。
+ *
+ * @return 通知で起きたらtrue、タイムアウトならfalse
+ */
+bool doorbell_wait_until(doorbell_t* db, absolute_time_t timeout);
+
+/**
+ * @brief キューから取り出したことを記録する (consumer側)
+ *
+ * 起床後の最初の呼び出しのみ遅延として集計される。
+ */
+void doorbell_mark_dequeued(doorbell_t* db);
+
+/**
+ * @brief 統計を取得し、集計をリセットする (consumer側)
+ */
+void doorbell_take_stats(doorbell_t* db, doorbell_stats_t* stats);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: DOORBELL_H */
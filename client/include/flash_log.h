@@ -0,0 +1,200 @@
+#ifndef FLASH_LOG_H
+#define FLASH_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "logpack.h"
+#include "ring_buf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ホストへ送ったフレームをフラッシュの後ろ半分に残すブラックボックス
+ *
+ * 64KBのブロックを輪のように順に使い、ブロックの先頭に
+ * [magic 4byte][通し番号 4byte] を書いてから、SPIで送るフレーム
+ * ([len][crc][フレームヘッダ][MsgPack]) を4KBずつlogpackで圧縮した
+ * チャンクを [len][crc][チャンク] として並べる。
+ * 起動時は通し番号が最も大きいブロックの次から書き始めるので、
+ * 再起動を繰り返しても同じブロックばかり消すことはない。
+ *
+ * XIPが止まる消去と書き込みの間は、もう一方のコアを
+ * flash_log_park_pointでRAM上に止めておく。
+ */
+
+#define FLASH_LOG_OFFSET (1024 * 1024)
+#define FLASH_LOG_SIZE (1024 * 1024)
+#define FLASH_LOG_BLOCK_SIZE (64 * 1024)
+#define FLASH_LOG_BLOCK_COUNT (FLASH_LOG_SIZE / FLASH_LOG_BLOCK_SIZE)
+#define FLASH_LOG_BLOCK_HEADER_SIZE (8)
+#define FLASH_LOG_MAGIC (0x474f4c42)  // "BLOG"
+
+#define FLASH_LOG_PRODUCER_COUNT (2)
+#define FLASH_LOG_INGRESS_SIZE (4096)
+
+// 書きかけのページの残りと、縮まなかったチャンクが丸ごと入る大きさ
+#define FLASH_LOG_BUF_SIZE (8192)
+
+// 一度止めた間に書くページ数 (1ページ256byteで約0.7ms)
+#define FLASH_LOG_WRITE_PAGES (8)
+
+// これより長く溜めたままにせず、途中のチャンクやページも書いておく
+#define FLASH_LOG_FLUSH_US (1000000)
+
+typedef struct {
+    uint32_t raw_bytes;      // 受け取ったフレームのバイト数
+    uint32_t stored_bytes;   // 圧縮して書いたバイト数
+    uint32_t chunks;         // 作ったチャンクの数
+    uint32_t encode_us_avg;  // チャンク一つの圧縮にかかった時間
+    uint32_t encode_us_max;
+    uint32_t drops;  // 溢れて捨てたフレームの数
+} flash_log_stats_t;
+
+typedef struct {
+    // コアごとに受け取って、flash_log_taskを呼ぶコアでまとめて書く
+    ring_buf_t ingress[FLASH_LOG_PRODUCER_COUNT];
+    uint8_t ingress_storage[FLASH_LOG_PRODUCER_COUNT][FLASH_LOG_INGRESS_SIZE];
+    void (*wake)(void);  // 止まってもらうコアを起こす
+    uint32_t drops[FLASH_LOG_PRODUCER_COUNT];
+
+    // チャンクにする前のフレームと、作ったチャンク
+    uint8_t stage[LOGPACK_CHUNK_SIZE];
+    uint32_t stage_len;
+    uint64_t stage_us;  // 最初に入れた時刻
+    uint8_t chunk[4 + LOGPACK_BOUND];
+    uint32_t chunk_len;  // まだbufに移していなければ0以外
+    logpack_work_t work;  // 圧縮と取り出しで使い回す
+
+    bool enabled;
+    bool opened;         // 最初のセクタを消し終えた
+    uint32_t block;      // 書いているブロック
+    uint32_t erased;     // ブロック内の消し終えた位置 (セクタ境界)
+    uint32_t block_seq;  // 書いているブロックの通し番号
+    uint32_t pos;        // ブロック内の次に書く位置
+    uint32_t buf_start;  // bufの先頭のブロック内位置 (ページ境界)
+    uint8_t buf[FLASH_LOG_BUF_SIZE];
+    uint64_t flushed_us;
+    bool dirty;  // フラッシュに書いていない分がある
+    bool full;   // 次のチャンクが入らないので、残りを書いたら次のブロックへ
+
+    bool draining;
+    uint64_t drain_since_us;
+    uint32_t drain_block;
+    uint32_t drain_pos;
+    uint32_t drain_left;  // 残りのブロック数
+    uint8_t drain_buf[LOGPACK_CHUNK_SIZE];  // 戻したチャンク
+    uint32_t drain_len;
+    uint32_t drain_off;
+
+    uint32_t stats_raw_bytes;
+    uint32_t stats_stored_bytes;
+    uint32_t stats_chunks;
+    uint32_t stats_encode_us_sum;
+    uint32_t stats_encode_us_max;
+} flash_log_t;
+
+/**
+ * @brief ログを初期化する
+ *
+ * 書き始めるブロックを決めるだけで、消去はflash_log_taskで行うので待たない。
+ * もう一方のコアを起動する前に呼ぶこと。
+ *
+ * @param[in] wake flash_log_park_pointを呼ぶコアを起こす関数
+ * @return プログラムがログの領域まで食い込んでいればfalse
+ */
+bool flash_log_init(flash_log_t* log, void (*wake)(void));
+
+/**
+ * @brief 送ったフレームを積む。コアごとに別のリングを使うので両コアから呼べる
+ *
+ * @return 溢れて捨てた時はfalse
+ */
+bool flash_log_append(flash_log_t* log, const uint8_t* frame, uint16_t len);
+
+/**
+ * @brief 積まれたフレームをフラッシュに書く
+ *
+ * 書き込みはページ単位で少しずつ行い、消去は書く位置より一つ先の
+ * セクタまでを一度に一つずつ行う。
+ * flash_log_initを呼んだコアから繰り返し呼ぶこと。
+ */
+void flash_log_task(flash_log_t* log, uint64_t now_us);
+
+/**
+ * @brief 最初のセクタを消し終え、書き始めたかを返す
+ */
+static inline bool flash_log_is_open(const flash_log_t* log) {
+    return log->opened;
+}
+
+/**
+ * @brief 求められていれば、フラッシュに書き終わるまでRAM上で止まる
+ *
+ * もう一方のコアが、途中で止まっても困らない所で呼ぶこと。
+ * 呼ばれるようになるまで、flash_log_taskは起動時以外に書き込まない。
+ */
+void flash_log_park_point(void);
+
+/**
+ * @brief flash_log_park_pointで止まる直前と、動き出した直後に呼ぶ関数を設定する
+ *
+ * 止まっている間はそのコアの割り込みも入らないので、相手に待ってもらう
+ * 周辺機器の合図などに使う。割り込みを止めた状態で、parkedをtrueにして
+ * 止まる前に一度、falseにして動き出す時に一度呼ぶ。
+ * flash_log_park_pointを呼ぶコアを起動する前に呼ぶこと。
+ */
+void flash_log_set_park_hook(void (*hook)(bool parked));
+
+/**
+ * @brief もう一方のコアと割り込みを止めてfuncを呼ぶ
+ *
+ * ログ以外の領域を消したり書いたりする時に使う。
+ * flash_log_taskを呼ぶコアから呼ぶこと。
+ *
+ * @return 止められなかった時はfuncを呼ばずにfalse
+ */
+bool flash_log_exec(flash_log_t* log, void (*func)(void*), void* param);
+
+/**
+ * @brief 統計を取得し、集計をリセットする
+ *
+ * flash_log_taskを呼ぶコアから呼ぶこと。
+ */
+void flash_log_take_stats(flash_log_t* log, flash_log_stats_t* stats);
+
+/**
+ * @brief 古い順にフレームを取り出し始める
+ *
+ * @param[in] since_us これより前の時刻(ホストの時刻)のフレームは飛ばす
+ *                     0なら時刻合わせ前のものも含めて全て取り出す
+ */
+void flash_log_drain(flash_log_t* log, uint64_t since_us);
+
+/**
+ * @brief まだ取り出し中かを返す
+ */
+static inline bool flash_log_is_draining(const flash_log_t* log) {
+    return log->draining;
+}
+
+/**
+ * @brief 次のフレームを取り出す
+ *
+ * ヘッダにFRAME_FLAG_REPLAYを立ててCRCを計算し直したものを返す。
+ * 一度に読み飛ばす数には上限があり、その時も0を返すので、
+ * 終わったかどうかはflash_log_is_drainingで確かめること。
+ *
+ * @param[out] out  フレームの書き込み先
+ * @param[in]  size outのサイズ
+ * @return 取り出したフレームの長さ、無ければ0
+ */
+uint16_t flash_log_drain_next(flash_log_t* log, uint8_t* out, uint16_t size);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: FLASH_LOG_H */
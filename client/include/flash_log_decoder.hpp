@@ -0,0 +1,82 @@
+#ifndef FLASH_LOG_DECODER_HPP
+#define FLASH_LOG_DECODER_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "crc16.h"
+#include "flash_log.h"
+#include "logpack.h"
+
+// フラッシュのログ領域を読み出したもの
+// (picotool save -r 0x10100000 0x10200000 など) を戻すホスト側のデコーダ
+// マイコンでは使わないので、std::vectorなどを気にせず使っている
+struct FlashLogDecoder {
+    // SPIで送る形 ([len][crc][フレームヘッダ][MsgPack]) で古い順に並ぶ
+    std::vector<std::vector<uint8_t>> records;
+    size_t bad_chunks = 0;  // CRCは合うのに戻せなかったチャンク
+
+    bool decode(const uint8_t* image, size_t size) {
+        if (size < FLASH_LOG_SIZE) {
+            return false;
+        }
+        records.clear();
+        bad_chunks = 0;
+
+        // 通し番号の順にブロックを読む
+        std::vector<std::pair<uint32_t, uint32_t>> blocks;
+        for (uint32_t block = 0; block < FLASH_LOG_BLOCK_COUNT; block++) {
+            const uint8_t* p = &image[block * FLASH_LOG_BLOCK_SIZE];
+            if (getLe32_(p) == FLASH_LOG_MAGIC) {
+                blocks.emplace_back(getLe32_(&p[4]), block);
+            }
+        }
+        std::sort(blocks.begin(), blocks.end());
+
+        for (auto [seq, block] : blocks) {
+            decodeBlock_(&image[block * FLASH_LOG_BLOCK_SIZE]);
+        }
+        return true;
+    }
+
+private:
+    static constexpr uint32_t prefix_size = 4;
+
+    logpack_work_t work_;
+    uint8_t out_[LOGPACK_CHUNK_SIZE];
+
+    static uint32_t getLe32_(const uint8_t* p) {
+        return p[0] | p[1] << 8 | p[2] << 16 |
+               static_cast<uint32_t>(p[3]) << 24;
+    }
+
+    void decodeBlock_(const uint8_t* p) {
+        uint32_t pos = FLASH_LOG_BLOCK_HEADER_SIZE;
+        while (pos + prefix_size < FLASH_LOG_BLOCK_SIZE) {
+            uint32_t len = p[pos] << 8 | p[pos + 1];
+            uint16_t crc = p[pos + 2] << 8 | p[pos + 3];
+            // 消したままの0xFFで終わる
+            if (len == 0 || len > FLASH_LOG_BLOCK_SIZE - pos - prefix_size ||
+                crc16(&p[pos + prefix_size], len) != crc) {
+                break;
+            }
+
+            size_t n = logpack_decode(&work_, &p[pos + prefix_size], len,
+                                      out_, sizeof(out_));
+            if (n == 0) {
+                ++bad_chunks;
+            }
+            for (size_t off = 0; off + prefix_size <= n;) {
+                size_t rec_len = prefix_size + (out_[off] << 8 | out_[off + 1]);
+                records.emplace_back(&out_[off], &out_[off + rec_len]);
+                off += rec_len;
+            }
+            pos += prefix_size + len;
+        }
+    }
+};
+
+#endif /* end of include guard: FLASH_LOG_DECODER_HPP */
@@ -0,0 +1,79 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ホストへ送るフレームの固定ヘッダ
+ *
+ * [version][flags][topic][seq_hi][seq_lo][timestamp_us (8byte, big endian)]
+ *
+ * 本体(MsgPack)の前に置き、ホストは本体を解釈せずに振り分けや
+ * 欠落の検出ができる。seqはトピックごとに発生元で1ずつ増える。
+ */
+
+#define FRAME_VERSION (2)
+#define FRAME_HEADER_SIZE (13)
+
+// timestamp_usがホストの時刻(UNIX時間)に合わせてある
+#define FRAME_FLAG_SYNCED (0x01)
+
+// timestamp_usが発生元のノード(リア)の起動からの時間のまま
+// フロントとの時刻合わせが済む前に転送されたもの
+#define FRAME_FLAG_NODE_CLOCK (0x02)
+
+// 差分で送っているトピックのキーフレーム (全項目が入っている)
+#define FRAME_FLAG_KEYFRAME (0x04)
+
+// 前のフレームから変わった項目だけが入っている
+// 同じトピックのキーフレームから欠番無しで届いた時だけ組み立て直せる
+#define FRAME_FLAG_DELTA (0x08)
+
+// フラッシュに残っていたものを、ホストに求められて送り直したもの
+// 一度送っているので欠落の集計には含めない
+#define FRAME_FLAG_REPLAY (0x10)
+
+// 発生元で決め、転送する時も引き継ぐフラグ
+#define FRAME_FLAGS_ORIGIN (FRAME_FLAG_KEYFRAME | FRAME_FLAG_DELTA)
+
+typedef struct {
+    uint8_t version;
+    uint8_t flags;
+    uint8_t topic;
+    uint16_t seq;
+    uint64_t timestamp_us;
+} frame_header_t;
+
+/**
+ * @brief ヘッダを書き込む
+ *
+ * @param[out] out FRAME_HEADER_SIZE以上の領域
+ */
+void frame_header_write(uint8_t* out, uint8_t flags, uint8_t topic,
+                        uint16_t seq, uint64_t timestamp_us);
+
+/**
+ * @brief ヘッダを読み込む
+ *
+ * @return 長さが足りないかバージョンが違えばfalse
+ */
+bool frame_header_read(const uint8_t* in, size_t len, frame_header_t* header);
+
+/**
+ * @brief トピックの次の番号を返す
+ *
+ * 一つのトピックは一つのコアからのみ発行すること。
+ */
+uint16_t frame_next_seq(uint8_t topic);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: FRAME_H */
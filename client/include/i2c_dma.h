@@ -0,0 +1,111 @@
+#ifndef I2C_DMA_H
+#define I2C_DMA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <hardware/i2c.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * DMAで動かすI2Cのレジスタの読み書き
+ *
+ * コマンドと受信をDMAに任せ、終わったかはi2c_dma_taskで見に行くので、
+ * 呼んだ側は転送の間も止まらない。結果はi2c_dma_taskからコールバックで返す。
+ * 転送ごとに期限を持ち、期限までに終わらなければ打ち切って、
+ * SCLを動かしてバスを解放し、コントローラを初期化し直す。
+ * センサーがバスを掴んだままでも、失うのはその一回の転送だけになる。
+ */
+
+#define I2C_DMA_MAX_LEN (64)
+
+// バスを解放する時にSCLを動かす最大の回数
+#define I2C_DMA_RECOVER_CLOCKS (9)
+
+typedef enum {
+    i2c_dma_ok,
+    i2c_dma_nack,     // 相手が応答しなかった
+    i2c_dma_timeout,  // 期限までに終わらず、バスを解放した
+} i2c_dma_result_t;
+
+typedef void (*i2c_dma_callback_t)(i2c_dma_result_t result, void* ctx);
+
+typedef struct {
+    uint32_t ok;
+    uint32_t nacks;
+    uint32_t timeouts;
+} i2c_dma_stats_t;
+
+typedef struct {
+    i2c_inst_t* i2c_id;
+    uint8_t pin_sda;
+    uint8_t pin_scl;
+    uint baud;
+
+    int dma_tx;
+    int dma_rx;
+    bool busy;
+    uint32_t start_us;
+    uint32_t timeout_us;
+    i2c_dma_callback_t callback;
+    void* ctx;
+
+    // IC_DATA_CMDへ書くコマンド。先頭はレジスタの番地
+    uint32_t cmds[I2C_DMA_MAX_LEN + 1];
+
+    i2c_dma_stats_t stats;
+} i2c_dma_bus_t;
+
+/**
+ * @brief コントローラとピンを初期化し、DMAのチャネルを取る
+ *
+ * i2c_id、ピン、baudを設定してから呼ぶこと。
+ */
+void i2c_dma_init(i2c_dma_bus_t* bus);
+
+/**
+ * @brief regからlen byte読み始める
+ *
+ * bufはコールバックが呼ばれるまで触らないこと。
+ *
+ * @param[in] timeout_us 始めてからこの時間で終わらなければ打ち切る
+ * @return 転送中か、lenが大きすぎればfalse
+ */
+bool i2c_dma_read(i2c_dma_bus_t* bus, uint8_t addr, uint8_t reg, uint8_t* buf,
+                  uint8_t len, uint32_t timeout_us,
+                  i2c_dma_callback_t callback, void* ctx);
+
+/**
+ * @brief regからlen byte書き始める
+ *
+ * dataは呼んだ時にコマンドへ写すので、戻ったら書き換えてよい。
+ *
+ * @return 転送中か、lenが大きすぎればfalse
+ */
+bool i2c_dma_write(i2c_dma_bus_t* bus, uint8_t addr, uint8_t reg,
+                   const uint8_t* data, uint8_t len, uint32_t timeout_us,
+                   i2c_dma_callback_t callback, void* ctx);
+
+/**
+ * @brief 転送が終わったか、期限を過ぎたかを見る
+ *
+ * 終わっていればコールバックを呼ぶ。コールバックの中で次の転送を始めてよい。
+ * 期限を過ぎた時はバスの解放で100us程度待つ。
+ */
+void i2c_dma_task(i2c_dma_bus_t* bus);
+
+bool i2c_dma_is_busy(const i2c_dma_bus_t* bus);
+
+/**
+ * @brief 統計を取得し、集計をリセットする
+ */
+void i2c_dma_take_stats(i2c_dma_bus_t* bus, i2c_dma_stats_t* stats);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: I2C_DMA_H */
@@ -10,11 +10,14 @@
 
 #include <cJSON.h>
 
+#include "topic.h"
+
 class Json {
 public:
     explicit Json(std::string_view topic)
         : root_(cJSON_CreateObject(), cJSON_Delete),
-          payload_(cJSON_CreateObject()) {
+          payload_(cJSON_CreateObject()),
+          topic_(topic_from_name(topic.data(), topic.size())) {
         cJSON_AddStringToObject(root_.get(), "topic", topic.data());
         cJSON_AddItemToObject(root_.get(), "payload", payload_);
     }
@@ -23,12 +26,9 @@ public:
         cJSON_AddNumberToObject(payload_, key.data(), value);
     }
 
+    // 時刻はレコードのヘッダで送るので本体には入れない
     void addTime(absolute_time_t time) {
-        uint64_t usec_total = to_us_since_boot(time);
-        uint32_t sec = static_cast<uint32_t>(usec_total / 1'000'000);
-        uint32_t usec = static_cast<uint32_t>(usec_total % 1'000'000);
-        add("sec", sec);
-        add("usec", usec);
+        time_us_ = to_us_since_boot(time);
     }
 
     bool toBuffer(char* buf, int size) const {
@@ -38,10 +38,30 @@ public:
         return cJSON_PrintPreallocated(root_.get(), buf, size, false);
     }
 
+    uint8_t getTopic() const {
+        return topic_;
+    }
+
+    uint64_t getTimeUs() const {
+        return time_us_;
+    }
+
+    // フレームヘッダに載せるフラグ (差分で送る時など)
+    void setFlags(uint8_t flags) {
+        flags_ = flags;
+    }
+
+    uint8_t getFlags() const {
+        return flags_;
+    }
+
 private:
     using CJSONPtr = std::unique_ptr<cJSON, decltype(&cJSON_Delete)>;
     CJSONPtr root_;
     cJSON* payload_;
+    uint8_t topic_;
+    uint64_t time_us_ = 0;
+    uint8_t flags_ = 0;
 };
 
 #endif /* end of include guard: JSON_HPP */
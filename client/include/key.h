@@ -0,0 +1,41 @@
+#ifndef KEY_H
+#define KEY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * MsgPackのキーを整数にするための表
+ *
+ * MSGPACK_KEY_IDを有効にしてビルドすると、表にあるキーは文字列の代わりに
+ * 表の位置(positive fixintで1byte)で書かれる。
+ * 表はディスクリプタとしてホストに送り、ホストが文字列に戻す。
+ * 古いデータを読めるよう、キーは末尾にだけ足すこと。
+ */
+
+// positive fixintに収まる数まで
+#define KEY_MAX_COUNT (128)
+
+#define KEY_UNKNOWN (0xFF)
+
+/**
+ * @brief キーの名前からIDを求める
+ *
+ * @param[in] name キーの名前 (null終端でなくてもよい)
+ * @param[in] len  キーの名前の長さ
+ * @return 見つからなければKEY_UNKNOWN
+ */
+uint8_t key_from_name(const char* name, size_t len);
+
+const char* key_name(uint8_t id);
+uint8_t key_count(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: KEY_H */
@@ -0,0 +1,77 @@
+#ifndef LOGPACK_H
+#define LOGPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lz.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * フラッシュに残すフレームの圧縮形式
+ *
+ * SPIで送る形のレコード([len][crc][フレームヘッダ][MsgPack])を
+ * 4KBまでまとめて一つのチャンクにする。チャンクは他に頼らず戻せる。
+ *
+ * まず3つの列に分ける。
+ * - ヘッダ: [version][flags][topic][mode] と、同じトピックの直前からの
+ *           seqの飛び、直前のフレームからの時刻の差 (zigzag varint)
+ * - 数値:   直前の同じトピックと形(キーや型)が同じ本体の、
+ *           数値ごとの差 (zigzag varint)
+ * - 本体:   形が変わった本体をそのまま ([長さ varint][MsgPack])
+ * 数値の差はビット列を整数として引くので、浮動小数点も近い値なら縮む。
+ * CRCは戻す時に計算し直す。
+ * これをlzで圧縮し、縮まなければそのまま入れる。
+ *
+ * チャンク: [method] + (LZ: [lzの出力] / STORED: [レコード])
+ * lzの中身: [レコード数 2byte][ヘッダ列の長さ 2byte][数値列の長さ 2byte]
+ *           [ヘッダ列][数値列][本体列]  (2byteはいずれもlittle endian)
+ */
+
+#define LOGPACK_METHOD_STORED (0)
+#define LOGPACK_METHOD_LZ (1)
+
+// 一つのチャンクに入れるレコードの合計の上限
+#define LOGPACK_CHUNK_SIZE (4096)
+#define LOGPACK_MAX_RECORDS (LOGPACK_CHUNK_SIZE / 17 + 1)
+
+// 列に分けた後の上限 (8byteの数値は差が10byteまで膨らむことがある)
+#define LOGPACK_PACKED_SIZE (LOGPACK_CHUNK_SIZE + 512)
+
+// チャンクの最大の大きさ
+#define LOGPACK_BOUND (1 + LOGPACK_CHUNK_SIZE)
+
+typedef struct {
+    uint8_t packed[LOGPACK_PACKED_SIZE];
+    uint16_t table[LZ_HASH_SIZE];
+    uint16_t last[256];  // トピックごとの直前のレコードの位置
+    uint8_t modes[(LOGPACK_MAX_RECORDS + 7) / 8];
+} logpack_work_t;
+
+/**
+ * @brief レコードの列をチャンクにする
+ *
+ * @param[in]  records レコードの列 (LOGPACK_CHUNK_SIZE以下)
+ * @param[out] out     LOGPACK_BOUND以上の領域
+ * @return チャンクの長さ、レコードが壊れていれば0
+ */
+size_t logpack_encode(logpack_work_t* work, const uint8_t* records,
+                      size_t len, uint8_t* out, size_t size);
+
+/**
+ * @brief チャンクをレコードの列に戻す
+ *
+ * @param[out] records LOGPACK_CHUNK_SIZE以上の領域
+ * @return レコードの列の長さ、壊れていれば0
+ */
+size_t logpack_decode(logpack_work_t* work, const uint8_t* chunk, size_t len,
+                      uint8_t* records, size_t size);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: LOGPACK_H */
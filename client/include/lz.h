@@ -0,0 +1,53 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 数KBのRAMで動く小さなLZ77圧縮
+ *
+ * LZ4のブロック形式と同じく、[トークン][リテラル][オフセット 2byte LE]
+ * を繰り返す。トークンの上位4bitがリテラル長、下位4bitが一致長-4で、
+ * 15の時は255未満のbyteが来るまで足していく。
+ * 最後の組はリテラルだけで、オフセットを持たない。
+ * 辞書は入力そのものなので、ブロックごとに独立して戻せる。
+ */
+
+#define LZ_MIN_MATCH (4)
+#define LZ_HASH_BITS (10)
+#define LZ_HASH_SIZE (1u << LZ_HASH_BITS)
+
+// 縮まない入力を圧縮した時の最大の大きさ
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+/**
+ * @brief 圧縮する
+ *
+ * @param[in]  in    入力 (65535byte以下)
+ * @param[in]  len   入力の長さ
+ * @param[out] out   出力先
+ * @param[in]  size  outのサイズ
+ * @param[out] table LZ_HASH_SIZE個の作業領域
+ * @return 出力の長さ、入り切らなければ0
+ */
+size_t lz_compress(const uint8_t* in, size_t len, uint8_t* out, size_t size,
+                   uint16_t* table);
+
+/**
+ * @brief 戻す
+ *
+ * @return 戻した長さ、壊れているか入り切らなければ0
+ */
+size_t lz_decompress(const uint8_t* in, size_t len, uint8_t* out,
+                     size_t size);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: LZ_H */
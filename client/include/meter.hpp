@@ -3,8 +3,6 @@
 
 #include <stdint.h>
 
-#include <optional>
-
 constexpr uint8_t number_table[] = {
     0b11111100,  // 0
     0b01100000,  // 1
@@ -60,6 +58,9 @@ constexpr int level_thresholds[] = {
     // 8
 };
 
+// fillBufで組み立てるbyte数
+constexpr int meter_buf_len = 6;
+
 constexpr int number_table_len = sizeof(number_table) / sizeof(uint8_t);
 constexpr int gear_table_len = sizeof(gear_table) / sizeof(uint8_t);
 constexpr int meter_table_len = sizeof(meter_table) / sizeof(uint8_t);
@@ -71,9 +72,9 @@ uint8_t convertNumber(const int num);
 uint8_t convertGear(const int num);
 uint8_t convertMeter(const int num);
 int calcLevel(const int rpm);
+int calcGear(const int gp_mv);
 
-std::optional<int> parseGear(const char* str);
-std::optional<int> parseRPM(const char* str);
 void fillBuf(int gear, int rpm, uint8_t* buf);
+void fillBlink(int rpm, uint8_t* mask);
 
 #endif /* end of include guard: METER_HPP */
@@ -0,0 +1,101 @@
+#ifndef METER_LINK_H
+#define METER_LINK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * メーターに出す値をJSONを通さずに届けるための経路
+ *
+ * リアはmeterトピックのレコードとして
+ * [rpm 2byte][gp 2byte (mV)] (little endian) を送る。
+ * meterはcriticalクラスなので、バスでは他のレコードより先に、
+ * 最新の一つだけが送られる。
+ * フロントは受け取ったコアでスロットに置き、表示するコアが
+ * 新しい値があれば取り出して表示する。
+ * 値の時刻から表示し終えるまでの時間を集計する。
+ */
+
+#define METER_LINK_RECORD_SIZE (4)
+
+typedef struct {
+    uint16_t rpm;
+    uint16_t gp_mv;     // ギアポジションセンサーの電圧
+    uint64_t input_us;  // 値を取った時刻 (表示する側の時計)。不明なら0
+} meter_value_t;
+
+typedef struct {
+    uint32_t updates;     // 表示した回数
+    uint32_t lat_avg_us;  // 値を取ってから表示し終えるまでの時間
+    uint32_t lat_max_us;
+} meter_link_stats_t;
+
+typedef struct {
+    // 書き込みの前後でseqを進め、読む側はseqが偶数で前後一致するまで読み直す
+    volatile uint32_t seq;
+    meter_value_t value;
+
+    // 読む側だけが触る
+    uint32_t read_seq;
+    uint32_t stats_updates;
+    uint32_t stats_lat_count;
+    uint64_t stats_lat_sum_us;
+    uint32_t stats_lat_max_us;
+} meter_link_t;
+
+/**
+ * @brief レコードの本体を書く
+ *
+ * @param[out] body METER_LINK_RECORD_SIZE byte
+ */
+void meter_link_pack(uint8_t* body, uint16_t rpm, uint16_t gp_mv);
+
+/**
+ * @brief レコードの本体を読む
+ *
+ * input_usは呼んだ側で埋めること。
+ *
+ * @return 長さが合わなければfalse
+ */
+bool meter_link_unpack(const uint8_t* body, uint16_t len,
+                       meter_value_t* value);
+
+void meter_link_init(meter_link_t* link);
+
+/**
+ * @brief 最新の値を置く
+ *
+ * 書くのは一つのコアだけにすること。
+ * リアからのレコードでも、フロントで取った値でもよい。
+ */
+void meter_link_put(meter_link_t* link, const meter_value_t* value);
+
+/**
+ * @brief 前に取り出してから新しい値が置かれていれば取り出す
+ *
+ * 表示するコアから呼ぶ。
+ */
+bool meter_link_take(meter_link_t* link, meter_value_t* value);
+
+/**
+ * @brief 取り出した値を表示し終えたことを記録する
+ */
+void meter_link_mark_shown(meter_link_t* link, const meter_value_t* value,
+                           uint64_t now_us);
+
+/**
+ * @brief 統計を取得し、集計をリセットする
+ *
+ * 表示するコアから呼ぶ。
+ */
+void meter_link_take_stats(meter_link_t* link, meter_link_stats_t* stats);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: METER_LINK_H */
@@ -1,11 +1,12 @@
 #ifndef MSGPACK_HPP
 #define MSGPACK_HPP
 
-#include <math.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
+#include <cmath>
+#include <limits>
 #include <string_view>
 #include <type_traits>
 
@@ -15,12 +16,58 @@
 #include <cmp.h>
 
 #include "crc16.h"
+#include "frame.h"
+#include "key.h"
+#include "timesync.h"
+#include "topic.h"
+
+// 値の書き方。MsgPack::addのテンプレート引数で項目ごとに選ぶ
+namespace encoding {
+
+// 整数は整数、浮動小数点はdouble (9byte)
+struct Natural {};
+
+// 浮動小数点をfloat (5byte) で書く。12bitのA/D値なら精度は十分
+struct Float32 {};
+
+// value / 10^Exp を整数Iに丸め、extで書く (int16で4byte、int32で6byte)
+// extのtypeは EXT_SCALED - Exp で、ホストは 整数 * 10^Exp に戻す
+template <typename I, int Exp>
+struct Scaled {
+    static_assert(std::is_same_v<I, int16_t> || std::is_same_v<I, int32_t>);
+    static_assert(-9 <= Exp && Exp <= 0);
+    using type = I;
+    static constexpr int exp = Exp;
+};
+
+// A/Dのコードなどを換算せず整数のまま書く
+struct Raw {};
+
+constexpr int8_t EXT_SCALED = 0x20;
+
+template <typename E>
+struct is_scaled : std::false_type {};
+template <typename I, int Exp>
+struct is_scaled<Scaled<I, Exp>> : std::true_type {};
+template <typename E>
+constexpr bool is_scaled_v = is_scaled<E>::value;
 
-template <int N>
+}  // namespace encoding
+
+// バッファは [len][crc][フレームヘッダ][MsgPack] の順に並ぶ
+// MSGPACK_KEY_IDを定義するとkey.cの表にあるキーとトピック名を整数で書く
+// DefaultEncはaddで指定しなかった時とJSONを変換する時の値の書き方
+template <int N, typename DefaultEnc = encoding::Natural>
 class MsgPack {
 public:
-    explicit MsgPack(std::string_view json) : ok_(true), mem_({buf_, N, 4}) {
+    // originを渡すと番号と時刻を引き継ぎ、本体にも時刻(us)を足す
+    explicit MsgPack(std::string_view json,
+                     const frame_header_t* origin = nullptr)
+        : ok_(true), topic_(topic_unknown), mem_({buf_, N, BODY_POS_}) {
         memset(buf_, 0, N);
+        if (origin) {
+            setOrigin(*origin);
+        }
 
         cmp_init(&cmp_, &mem_, mem_read_, mem_skip_, mem_write_);
 
@@ -33,26 +80,34 @@ public:
         const char* topic =
             cJSON_GetStringValue(cJSON_GetObjectItem(root, "topic"));
         cJSON* payload = cJSON_GetObjectItem(root, "payload");
+        if (!topic || !payload) {
+            ok_ = false;
+            cJSON_Delete(root);
+            return;
+        }
+        topic_ = topic_from_name(topic, strlen(topic));
 
         size_t size = cJSON_GetArraySize(payload);
 
         ok_ &= cmp_write_map(&cmp_, 2);
-        ok_ &= cmp_write_str(&cmp_, "topic", 5);
-        ok_ &= cmp_write_str(&cmp_, topic, strlen(topic));
-        ok_ &= cmp_write_str(&cmp_, "payload", 7);
-        ok_ &= cmp_write_map(&cmp_, size);
+        writeTopic_(topic);
+        ok_ &= writeKey_("payload");
+        ok_ &= cmp_write_map(&cmp_, origin ? size + 1 : size);
+        if (origin) {
+            add("us", time_us_);
+        }
 
         cJSON* item = payload->child;
         while (item) {
-            ok_ &= cmp_write_str(&cmp_, item->string, strlen(item->string));
+            ok_ &= writeKey_(item->string);
 
             if (cJSON_IsNumber(item)) {
+                // valueintはint32で飽和するので、doubleのまま整数か確かめる
                 double d = item->valuedouble;
-                double i;
-                if (fabs(modf(d, &i)) < 1e-9) {
-                    ok_ &= cmp_write_integer(&cmp_, static_cast<int64_t>(i));
+                if (std::trunc(d) == d && INT64_MIN_ <= d && d < INT64_END_) {
+                    ok_ &= cmp_write_integer(&cmp_, static_cast<int64_t>(d));
                 } else {
-                    ok_ &= cmp_write_double(&cmp_, d);
+                    ok_ &= writeValue_<DefaultEnc>(d);
                 }
             } else {
                 ok_ &= cmp_write_nil(&cmp_);
@@ -64,41 +119,70 @@ public:
         cJSON_Delete(root);
     }
 
-    MsgPack(std::string_view topic, int16_t num)
-        : ok_(true), mem_({buf_, N, 4}) {
+    // plain_keysなら整数にせず常に文字列で書く (ディスクリプタ用)
+    MsgPack(std::string_view topic, int16_t num, bool plain_keys = false)
+        : ok_(true),
+          plain_keys_(plain_keys),
+          topic_(topic_from_name(topic.data(), topic.size())),
+          mem_({buf_, N, BODY_POS_}) {
         memset(buf_, 0, N);
 
         cmp_init(&cmp_, &mem_, mem_read_, mem_skip_, mem_write_);
 
         cmp_write_map(&cmp_, 2);
 
-        cmp_write_str(&cmp_, "topic", 5);
-        cmp_write_str(&cmp_, topic.data(), topic.size());
+        writeTopic_(topic);
 
-        cmp_write_str(&cmp_, "payload", 7);
-        cmp_write_map(&cmp_, num + 2);
+        writeKey_("payload");
+        cmp_write_map(&cmp_, num + 1);
     }
 
-    template <typename T>
+    // msgpack.add<encoding::Scaled<int16_t, -3>>("left", left) のように
+    // 書き方を選べる
+    template <typename E = DefaultEnc, typename T>
     void add(std::string_view key, T value) {
-        ok_ &= cmp_write_str(&cmp_, key.data(), key.size());
-        if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
-            ok_ &= cmp_write_integer(&cmp_, value);
-        } else if constexpr (std::is_integral_v<T> && std::is_unsigned_v<T>) {
-            ok_ &= cmp_write_uinteger(&cmp_, value);
-        } else if constexpr (std::is_floating_point_v<T>) {
-            ok_ &= cmp_write_double(&cmp_, value);
-        } else {
-            ok_ &= cmp_write_nil(&cmp_);
-        }
+        ok_ &= writeKey_(key);
+        ok_ &= writeValue_<E>(value);
     }
 
+    // ホストと同期していればホストの時刻(UNIX時間)で書く
+    // 秒に分けると64bitの割り算になるのでusのまま一つの値で書く
     void addTime(absolute_time_t time) {
-        uint64_t usec_total = to_us_since_boot(time);
-        uint32_t sec = static_cast<uint32_t>(usec_total / 1'000'000);
-        uint32_t usec = static_cast<uint32_t>(usec_total % 1'000'000);
-        add("sec", sec);
-        add("usec", usec);
+        bool synced;
+        time_us_ = timesync_to_host(to_us_since_boot(time), &synced);
+        flags_ = synced ? FRAME_FLAG_SYNCED : 0;
+        add("us", time_us_);
+    }
+
+    // 詰めたA/Dコードなどをバイト列のまま書く
+    void addBin(std::string_view key, const uint8_t* data, uint32_t size) {
+        ok_ &= writeKey_(key);
+        ok_ &= cmp_write_bin(&cmp_, data, size);
+    }
+
+    // 文字列をそのまま書く
+    void addStr(std::string_view key, std::string_view value) {
+        ok_ &= writeKey_(key);
+        ok_ &= cmp_write_str(&cmp_, value.data(), value.size());
+    }
+
+    // 名前の一覧を文字列の配列として書く
+    template <typename F>
+    void addNames(std::string_view key, uint8_t count, F name) {
+        ok_ &= writeKey_(key);
+        ok_ &= cmp_write_array(&cmp_, count);
+        for (uint8_t i = 0; i < count; i++) {
+            const char* s = name(i);
+            ok_ &= cmp_write_str(&cmp_, s, strlen(s));
+        }
+    }
+
+    // 転送してきたフレームの番号と時刻を引き継ぐ
+    void setOrigin(const frame_header_t& header) {
+        seq_ = header.seq;
+        has_seq_ = true;
+        time_us_ = header.timestamp_us;
+        flags_ = header.flags;
     }
 
     uint8_t* getBuf() {
@@ -106,6 +190,13 @@ public:
             return nullptr;
         }
 
+        // 番号は最初に取り出した時に一度だけ振る
+        if (!has_seq_) {
+            seq_ = frame_next_seq(topic_);
+            has_seq_ = true;
+        }
+        frame_header_write(buf_ + 4, flags_, topic_, seq_, time_us_);
+
         const uint16_t length = mem_.pos - 4;
         const uint16_t crc = crc16(buf_ + 4, length);
 
@@ -117,6 +208,19 @@ public:
         return buf_;
     }
 
+    uint16_t getSize() const {
+        return mem_.pos;
+    }
+
+    // まだ書けるバイト数
+    uint16_t getRoom() const {
+        return N - mem_.pos;
+    }
+
+    uint8_t getTopic() const {
+        return topic_;
+    }
+
 private:
     struct mem_t {
         uint8_t* buf;
@@ -153,7 +257,101 @@ private:
         return count;
     }
 
+    template <typename E, typename T>
+    bool writeValue_(T value) {
+        if constexpr (encoding::is_scaled_v<E>) {
+            return writeScaled_<typename E::type, E::exp>(
+                static_cast<double>(value));
+        } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+            return cmp_write_integer(&cmp_, value);
+        } else if constexpr (std::is_integral_v<T> && std::is_unsigned_v<T>) {
+            return cmp_write_uinteger(&cmp_, value);
+        } else if constexpr (std::is_floating_point_v<T> &&
+                             std::is_same_v<E, encoding::Raw>) {
+            return cmp_write_integer(&cmp_, round_<int32_t>(value));
+        } else if constexpr (std::is_floating_point_v<T> &&
+                             std::is_same_v<E, encoding::Float32>) {
+            return cmp_write_float(&cmp_, static_cast<float>(value));
+        } else if constexpr (std::is_floating_point_v<T>) {
+            return cmp_write_double(&cmp_, value);
+        } else {
+            return cmp_write_nil(&cmp_);
+        }
+    }
+
+    // 範囲外は飽和させて最も近い整数にする
+    template <typename I>
+    static I round_(double value) {
+        constexpr double max = std::numeric_limits<I>::max();
+        constexpr double min = std::numeric_limits<I>::min();
+        value += value >= 0 ? 0.5 : -0.5;
+        return value >= max   ? std::numeric_limits<I>::max()
+               : value <= min ? std::numeric_limits<I>::min()
+                              : static_cast<I>(value);
+    }
+
+    static constexpr double pow10_(int n) {
+        double v = 1.0;
+        for (int i = 0; i < n; i++) {
+            v *= 10.0;
+        }
+        return v;
+    }
+
+    template <typename I, int Exp>
+    bool writeScaled_(double value) {
+        constexpr double scale = pow10_(-Exp);
+        const auto v = static_cast<std::make_unsigned_t<I>>(
+            round_<I>(value * scale));
+
+        uint8_t data[sizeof(I)];
+        for (size_t i = 0; i < sizeof(I); i++) {
+            data[i] = static_cast<uint8_t>(v >> (8 * (sizeof(I) - 1 - i)));
+        }
+        constexpr int8_t type = encoding::EXT_SCALED - Exp;
+        if constexpr (sizeof(I) == 2) {
+            return cmp_write_fixext2(&cmp_, type, data);
+        } else {
+            return cmp_write_fixext4(&cmp_, type, data);
+        }
+    }
+
+    bool writeKey_(std::string_view key) {
+#ifdef MSGPACK_KEY_ID
+        if (!plain_keys_) {
+            if (uint8_t id = key_from_name(key.data(), key.size());
+                id != KEY_UNKNOWN) {
+                return cmp_write_pfix(&cmp_, id);
+            }
+        }
+#endif
+        return cmp_write_str(&cmp_, key.data(), key.size());
+    }
+
+    void writeTopic_(std::string_view topic) {
+        ok_ &= writeKey_("topic");
+#ifdef MSGPACK_KEY_ID
+        if (!plain_keys_ && topic_ != topic_unknown) {
+            ok_ &= cmp_write_uinteger(&cmp_, topic_);
+            return;
+        }
+#endif
+        ok_ &= cmp_write_str(&cmp_, topic.data(), topic.size());
+    }
+
+    static constexpr uint16_t BODY_POS_ = 4 + FRAME_HEADER_SIZE;
+
+    // int64に収まるdoubleの範囲 [-2^63, 2^63)
+    static constexpr double INT64_MIN_ = -0x1p63;
+    static constexpr double INT64_END_ = 0x1p63;
+
     bool ok_;
+    bool plain_keys_ = false;
+    uint8_t topic_;
+    bool has_seq_ = false;
+    uint16_t seq_ = 0;
+    uint64_t time_us_ = 0;
+    uint8_t flags_ = 0;
     uint8_t buf_[N];
     mem_t mem_;
     cmp_ctx_t cmp_;
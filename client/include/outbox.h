@@ -0,0 +1,113 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ring_buf.h"
+#include "topic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OUTBOX_PRODUCER_COUNT (2)
+#define OUTBOX_RECORD_SIZE (512)
+#define OUTBOX_INGRESS_SIZE (1024)
+#define OUTBOX_LANE_POOL_SIZE (3584)
+#define OUTBOX_LATEST_SIZE (128)
+
+typedef enum {
+    outbox_policy_drop_newest,  // 溢れたら新しいものを捨てる
+    outbox_policy_drop_oldest,  // 溢れたら古いものから捨てる
+    outbox_policy_coalesce,     // トピックごとに最新の一つだけ残す
+} outbox_policy_t;
+
+/**
+ * 優先度付きの送信キュー
+ *
+ * producerはそれぞれ専用のingressリングに積むだけなのでロック不要。
+ * consumerは取り出しの度にingressを空にし、トピックのクラスに応じた
+ * ポリシーでクラスごとのレーンへ振り分けてから、優先度の高いレーンから
+ * 一つ返す。レーンはconsumerしか触らない。
+ * 捨てたフレームはトピックごとに数える。
+ */
+typedef struct {
+    volatile bool ready;
+
+    ring_buf_t ingress[OUTBOX_PRODUCER_COUNT];
+    ring_buf_t lanes[TOPIC_CLASS_COUNT];
+
+    uint16_t latest_len[TOPIC_COUNT];
+    uint8_t latest_next[TOPIC_CLASS_COUNT];
+
+    // 書き込むのはそれぞれ一つのコンテキストのみ
+    volatile uint32_t drops_ingress[OUTBOX_PRODUCER_COUNT][TOPIC_COUNT];
+    volatile uint32_t drops_policy[TOPIC_COUNT];
+
+    uint8_t ingress_storage[OUTBOX_PRODUCER_COUNT][OUTBOX_INGRESS_SIZE];
+    uint8_t lane_pool[OUTBOX_LANE_POOL_SIZE];
+    uint8_t latest[TOPIC_COUNT][OUTBOX_LATEST_SIZE];
+    uint8_t scratch[OUTBOX_RECORD_SIZE + 1];
+} outbox_t;
+
+bool outbox_init(outbox_t* ob);
+
+/**
+ * @brief フレームを積む (producer側)
+ *
+ * @param[in] producer producerの番号 (コア番号など)
+ * @param[in] topic    トピックID
+ * @return ingressが溢れていたらfalse (破棄数に計上される)
+ */
+bool outbox_push(outbox_t* ob, uint8_t producer, uint8_t topic,
+                 const uint8_t* data, uint16_t len);
+
+/**
+ * @brief 優先度の最も高いフレームを一つ取り出す (consumer側)
+ *
+ * @return コピーした長さ、空なら0
+ */
+uint16_t outbox_pop(outbox_t* ob, uint8_t* data, uint16_t size);
+
+/**
+ * @brief 優先度の最も高いフレームがsizeに収まれば取り出す (consumer側)
+ *
+ * 長さを確かめるのと取り出すのを、ingressを一度空にしただけで行うので、
+ * 間に届いたフレームが先頭になって切り詰められることは無い。
+ *
+ * @return コピーした長さ、空か収まらなければ0
+ */
+uint16_t outbox_pop_fit(outbox_t* ob, uint8_t* data, uint16_t size);
+
+/**
+ * @brief まだ取り出されていないおおよそのバイト数を返す (consumer側)
+ */
+uint32_t outbox_pending_bytes(const outbox_t* ob);
+
+/**
+ * @brief ingressに積まれているおおよそのバイト数を返す (どこからでも呼べる)
+ */
+uint32_t outbox_ingress_bytes(const outbox_t* ob);
+
+/**
+ * @brief 送り直す履歴をあと何byte積めるかを返す (producer側)
+ *
+ * 履歴は専用のレーンに入るので、今のフレームを押しのけることは無い。
+ * ingressに何か残っている間は0を返し、履歴で今のフレームの場所を
+ * 塞がないようにする。積む時はレコードのヘッダ分も見込むこと。
+ */
+uint32_t outbox_replay_room(const outbox_t* ob, uint8_t producer);
+
+/**
+ * @brief トピックごとの破棄数を返す
+ */
+uint32_t outbox_get_drops(const outbox_t* ob, uint8_t topic);
+
+outbox_policy_t outbox_class_policy(uint8_t cls);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: OUTBOX_H */
@@ -0,0 +1,89 @@
+#ifndef RING_BUF_H
+#define RING_BUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 長さ付き可変長レコードを扱うSPSCリングバッファ
+ *
+ * 1レコードは [len_lo][len_hi][data...] の形で格納される。
+ * 書き込み側(producer)はheadのみ、読み込み側(consumer)はtailのみを更新するので
+ * producerとconsumerが一つずつであればロック無しでコア間/割り込み間で使える。
+ * head/tailはラップせずに増え続け、容量(2の冪)のマスクで位置を求める。
+ */
+typedef struct {
+    uint8_t* buf;
+    uint32_t mask;
+    volatile uint32_t head;
+    volatile uint32_t tail;
+} ring_buf_t;
+
+#define RING_BUF_HEADER_SIZE (2)
+
+/**
+ * @brief リングバッファを初期化する
+ *
+ * @param[out] rb      初期化対象
+ * @param[in]  storage 格納領域
+ * @param[in]  size    格納領域のサイズ (2の冪であること)
+ * @return sizeが2の冪でなければfalse
+ */
+bool ring_buf_init(ring_buf_t* rb, uint8_t* storage, uint32_t size);
+
+/**
+ * @brief レコードを一つ追加する (producer側)
+ *
+ * @param[in] data 追加するデータ
+ * @param[in] len  データの長さ (1以上)
+ * @return 空きが足りなければ何もせずfalse
+ */
+bool ring_buf_push(ring_buf_t* rb, const uint8_t* data, uint16_t len);
+
+/**
+ * @brief 二つのデータを連結したものをレコードとして追加する (producer側)
+ *
+ * ヘッダと本体を別々に持っている時に一時バッファ無しで積むためのもの。
+ */
+bool ring_buf_push2(ring_buf_t* rb, const uint8_t* head, uint16_t head_len,
+                    const uint8_t* body, uint16_t body_len);
+
+/**
+ * @brief 先頭のレコードを一つ取り出す (consumer側)
+ *
+ * レコードがsizeより長い場合はsize分だけコピーし、残りは捨てる。
+ *
+ * @param[out] data コピー先
+ * @param[in]  size コピー先のサイズ
+ * @return コピーした長さ、空なら0
+ */
+uint16_t ring_buf_pop(ring_buf_t* rb, uint8_t* data, uint16_t size);
+
+/**
+ * @brief 先頭のレコードの長さを返す (consumer側)
+ *
+ * @return レコードの長さ、空なら0
+ */
+uint16_t ring_buf_peek_len(const ring_buf_t* rb);
+
+/**
+ * @brief 先頭のレコードを読まずに捨てる (consumer側)
+ *
+ * @return 空ならfalse
+ */
+bool ring_buf_discard(ring_buf_t* rb);
+
+bool ring_buf_is_empty(const ring_buf_t* rb);
+uint32_t ring_buf_used(const ring_buf_t* rb);
+uint32_t ring_buf_free(const ring_buf_t* rb);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: RING_BUF_H */
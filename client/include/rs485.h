@@ -0,0 +1,71 @@
+#ifndef RS485_H
+#define RS485_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hardware/uart.h>
+#include <pico/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ビルド時に -D RS485_BAUD=... で変更できる
+#ifndef RS485_BAUD
+#define RS485_BAUD (2000000)
+#endif
+
+// DEを上げてから送信を始めるまでの待ち (トランシーバのイネーブル時間)
+#define RS485_DE_SETUP_US (1)
+
+typedef void (*rs485_callback_t)(void);
+typedef void (*rs485_rx_callback_t)(uint8_t ch);
+
+typedef struct {
+    uart_inst_t* uart;
+    uint8_t pin_tx;
+    uint8_t pin_rx;
+    uint8_t pin_de;
+    uint baud;
+    rs485_callback_t tx_done_callback;  // 送信完了時に割り込みから呼ばれる
+    rs485_rx_callback_t rx_callback;    // 1byte受信ごとに割り込みから呼ばれる
+
+    int dma_chan;
+    volatile bool busy;
+    size_t tx_len;
+} rs485_dev_t;
+
+/**
+ * @brief UARTとDMAを初期化する
+ *
+ * DEはLow(受信)の状態で初期化される。
+ * rx_callbackがあれば、呼び出したコアでUARTの受信割り込みを有効にする。
+ */
+void rs485_init(rs485_dev_t* dev);
+
+/**
+ * @brief ボーレートを変更する
+ *
+ * @return 実際に設定されたボーレート、送信中なら0
+ */
+uint rs485_set_baud(rs485_dev_t* dev, uint baud);
+
+/**
+ * @brief DMAで送信を開始する
+ *
+ * DEを上げてから送信を始め、最後のストップビットを送り終えた時点でDEを下げる。
+ * dataは送信完了まで書き換えないこと。
+ *
+ * @return 送信中ならfalse
+ */
+bool rs485_send(rs485_dev_t* dev, const uint8_t* data, size_t len);
+
+bool rs485_is_busy(const rs485_dev_t* dev);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: RS485_H */
@@ -0,0 +1,341 @@
+#ifndef RS485_BUS_H
+#define RS485_BUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * RS485マルチドロップバスのポーリングプロトコル
+ *
+ * フロントがマスタとなり、ノードのアドレスを順にポーリングする。
+ * ノードはポーリングされた時だけ、許可されたバイト数までのレコードを
+ * 一つのデータフレームにまとめて返すので、バス上で衝突は起きない。
+ *
+ * フレーム: [sync][addr][type][len_lo][len_hi][payload...][crc_hi][crc_lo]
+ * CRCはaddrからpayloadの末尾までのCRC-16/CCITT-FALSE。
+ * addrはpollでは宛先、dataでは送信元のノード。
+ *
+ * poll (マスタ→ノード) のpayload: [credit_lo][credit_hi]
+ * data (ノード→マスタ) のpayload: [pending_lo][pending_hi][base_us(8byte)]
+ *                                   [record...]
+ *   record: [len_lo][len_hi][flags][topic][seq_lo][seq_hi][dt_us(4byte)]
+ *           [body...]
+ *   pendingは返信後もノードに残っているバイト数 (65535で飽和)
+ *   recordの時刻はbase_usからの差(符号付き)で持ち、lenはbodyの長さ。
+ *
+ * 時刻合わせ (数値はリトルエンディアン)
+ * time_req (マスタ→ノード) のpayload: [seq]
+ * time_resp (ノード→マスタ) のpayload:
+ *   [seq][rx_us(8byte)][prev_seq][prev_tx_us(8byte)]
+ *   rx_usはtime_reqを受け取り終えた時刻、prev_tx_usは前回のtime_respを
+ *   送り終えた時刻 (どちらもノードの起動からの時間)。
+ *   送り終えた時刻は送った後でしか分からないので次の応答で届ける。
+ */
+
+#define RS485_BUS_SYNC (0x7E)
+
+#define RS485_BUS_ADDR_MASTER (0x00)
+#define RS485_BUS_ADDR_REAR (0x01)
+
+#define RS485_BUS_HEADER_SIZE (5)
+#define RS485_BUS_CRC_SIZE (2)
+#define RS485_BUS_MAX_PAYLOAD (1024)
+#define RS485_BUS_FRAME_SIZE \
+    (RS485_BUS_HEADER_SIZE + RS485_BUS_MAX_PAYLOAD + RS485_BUS_CRC_SIZE)
+
+#define RS485_BUS_POLL_SIZE (2)
+#define RS485_BUS_DATA_HEADER_SIZE (10)
+#define RS485_BUS_RECORD_HEADER_SIZE (10)
+#define RS485_BUS_TIME_REQ_SIZE (1)
+#define RS485_BUS_TIME_RESP_SIZE (18)
+
+// ポーリングで許可するバイト数の範囲
+#define RS485_BUS_MIN_CREDIT (256)
+#define RS485_BUS_MAX_CREDIT (RS485_BUS_MAX_PAYLOAD)
+
+// 受信完了からノードが送信を始めるまでの最小間隔 (マスタのDE解放待ち)
+#define RS485_BUS_TURNAROUND_US (20)
+
+// 応答タイムアウトに足す余裕
+#define RS485_BUS_TIMEOUT_MARGIN_US (200)
+
+// 全ノードが空だった時の次のポーリングまでの間隔
+#define RS485_BUS_IDLE_POLL_US (1000)
+
+// スケジューラで空のノードにも毎回加える持ち分 (バイト相当)
+#define RS485_BUS_BASE_WEIGHT (64)
+
+#define RS485_BUS_MAX_NODES (8)
+
+// 時刻合わせの交換を行う間隔
+#define RS485_BUS_TIME_INTERVAL_US (10000)
+
+// 推定したずれと比べてこれ以上離れていたら推定をやり直す
+#define RS485_BUS_CLOCK_STEP_US (1000)
+
+// 最小の往復時間よりこれ以上遅かった交換は待たされたものとして捨てる
+#define RS485_BUS_CLOCK_DELAY_MARGIN_US (30)
+
+typedef enum {
+    rs485_bus_type_poll = 0x01,
+    rs485_bus_type_data = 0x02,
+    rs485_bus_type_time_req = 0x03,
+    rs485_bus_type_time_resp = 0x04,
+} rs485_bus_type_t;
+
+typedef struct {
+    uint8_t addr;
+    uint8_t type;
+    uint16_t len;
+    const uint8_t* payload;
+} rs485_bus_frame_t;
+
+// データフレームの中の一つのレコード
+typedef struct {
+    uint8_t flags;
+    uint8_t topic;
+    uint16_t seq;
+    uint64_t timestamp_us;
+    const uint8_t* body;
+    uint16_t len;
+} rs485_bus_record_t;
+
+/**
+ * 受信バイト列からフレームを切り出すパーサ
+ *
+ * bufにはsyncを除いた [addr][type][len_lo][len_hi][payload...][crc]
+ * が溜まる。
+ */
+typedef struct {
+    uint8_t buf[RS485_BUS_FRAME_SIZE - 1];
+    uint16_t pos;
+    uint16_t need;
+    bool in_frame;
+    uint32_t errors;  // ヘッダかCRCが壊れていたフレームの数
+} rs485_bus_parser_t;
+
+/**
+ * ノードの時計とマスタの時計のずれの推定
+ *
+ * 一回の交換で以下の4つの時刻が揃う。
+ * t1: マスタがtime_reqを送り終えた (マスタの時計)
+ * t2: ノードがtime_reqを受け取り終えた (ノードの時計)
+ * t3: ノードがtime_respを送り終えた (ノードの時計)
+ * t4: マスタがtime_respを受け取り終えた (マスタの時計)
+ * 行きと帰りで同じ種類の時刻を取っているので、
+ * 受信割り込みの遅れは往復で打ち消し合う。
+ * offset = ((t2 - t1) + (t3 - t4)) / 2
+ * delay = (t4 - t1) - (t3 - t2)
+ */
+typedef struct {
+    // t3を待っている前回の交換
+    bool has_prev;
+    uint8_t prev_seq;
+    uint64_t prev_t1;
+    uint64_t prev_t2;
+    uint64_t prev_t4;
+
+    bool valid;
+    int64_t offset_us;  // ノードの時計 - マスタの時計
+    uint32_t delay_us;  // 最後に採用した交換の往復時間
+    uint32_t min_delay_us;
+    int32_t last_error_us;  // 最後に採用した交換と推定の差
+    uint32_t samples;
+    uint32_t rejected;
+    uint32_t steps;
+} rs485_bus_clock_t;
+
+typedef struct {
+    uint8_t addr;
+    uint16_t pending;
+    bool idle;  // 前回の応答が空だった
+    uint32_t deficit;
+
+    uint32_t polls;
+    uint32_t timeouts;
+
+    rs485_bus_clock_t clock;
+} rs485_bus_node_t;
+
+/**
+ * マスタのポーリングスケジューラ
+ *
+ * ポーリングの度に各ノードの持ち分に (基本重み + 申告された残量) を加え、
+ * 持ち分が最大のノードを選ぶ。溜まっているノードほど頻繁に、
+ * 空のノードも最低限の頻度でポーリングされる。
+ */
+typedef struct {
+    rs485_bus_node_t nodes[RS485_BUS_MAX_NODES];
+    uint8_t node_count;
+    uint8_t current;
+
+    uint8_t time_current;  // 時刻合わせ中のノード
+    uint8_t time_seq;
+} rs485_bus_master_t;
+
+void rs485_bus_parser_init(rs485_bus_parser_t* p);
+
+/**
+ * @brief 受信した1byteをパーサに入れる
+ *
+ * @return CRCの合ったフレームが揃ったらtrue
+ */
+bool rs485_bus_parser_feed(rs485_bus_parser_t* p, uint8_t ch);
+
+/**
+ * @brief 揃ったフレームのCRCを除いた部分の長さを返す
+ */
+uint16_t rs485_bus_parser_len(const rs485_bus_parser_t* p);
+
+/**
+ * @brief CRCを除いたフレーム ([addr][type][len][payload]) を解釈する
+ *
+ * @return 長さが合わなければfalse
+ */
+bool rs485_bus_decode(const uint8_t* raw, uint16_t raw_len,
+                      rs485_bus_frame_t* frame);
+
+/**
+ * @brief フレームを組み立てる
+ *
+ * payloadはあらかじめ out + RS485_BUS_HEADER_SIZE に書いておくこと。
+ * ヘッダとCRCを書き足す。
+ *
+ * @return フレーム全体の長さ
+ */
+size_t rs485_bus_finish(uint8_t* out, uint8_t addr, uint8_t type,
+                        uint16_t len);
+
+/**
+ * @brief ポーリングフレームを組み立てる
+ *
+ * @param[out] out RS485_BUS_HEADER_SIZE + RS485_BUS_POLL_SIZE
+ *                 + RS485_BUS_CRC_SIZE 以上
+ */
+size_t rs485_bus_make_poll(uint8_t* out, uint8_t addr, uint16_t credit);
+
+/**
+ * @brief 時刻合わせの要求を組み立てる
+ *
+ * @param[out] out RS485_BUS_HEADER_SIZE + RS485_BUS_TIME_REQ_SIZE
+ *                 + RS485_BUS_CRC_SIZE 以上
+ */
+size_t rs485_bus_make_time_req(uint8_t* out, uint8_t addr, uint8_t seq);
+
+/**
+ * @brief 時刻合わせの応答を組み立てる
+ *
+ * @param[in] rx_us      time_reqを受け取り終えた時刻
+ * @param[in] prev_seq   前回応答したtime_reqのseq
+ * @param[in] prev_tx_us 前回のtime_respを送り終えた時刻、無ければ0
+ */
+size_t rs485_bus_make_time_resp(uint8_t* out, uint8_t addr, uint8_t seq,
+                                uint64_t rx_us, uint8_t prev_seq,
+                                uint64_t prev_tx_us);
+
+/**
+ * @brief データフレームのpayloadの先頭を書く
+ */
+void rs485_bus_put_data_header(uint8_t* payload, uint16_t pending,
+                               uint64_t base_us);
+
+/**
+ * @brief レコードのヘッダを書く
+ *
+ * bodyはあらかじめ out + RS485_BUS_RECORD_HEADER_SIZE に書いておくこと。
+ *
+ * @return 基準時刻との差が符号付き32bitに収まらなければfalse
+ */
+bool rs485_bus_put_record_header(uint8_t* out, uint8_t flags, uint8_t topic,
+                                 uint16_t seq, uint64_t timestamp_us,
+                                 uint16_t len, uint64_t base_us);
+
+/**
+ * @brief データフレームのレコードを一つ取り出す
+ *
+ * @param[in,out] pos payload内の位置、最初はRS485_BUS_DATA_HEADER_SIZE
+ * @return 残りが無いか壊れていればfalse
+ */
+bool rs485_bus_next_record(const rs485_bus_frame_t* frame, uint16_t* pos,
+                           rs485_bus_record_t* rec);
+
+void rs485_bus_master_init(rs485_bus_master_t* m, const uint8_t* addrs,
+                           uint8_t count);
+
+/**
+ * @brief 次にポーリングするノードを選ぶ
+ *
+ * @param[out] addr   ノードのアドレス
+ * @param[out] credit 返信に許可するバイト数
+ */
+void rs485_bus_master_next(rs485_bus_master_t* m, uint8_t* addr,
+                           uint16_t* credit);
+
+/**
+ * @brief ポーリングへの応答を待つ時間を返す
+ */
+uint32_t rs485_bus_master_timeout_us(uint16_t credit, uint32_t baud);
+
+/**
+ * @brief 応答を受け取った時に残量を記録する
+ *
+ * @return ポーリング中のノードからの応答でなければfalse
+ */
+bool rs485_bus_master_on_data(rs485_bus_master_t* m,
+                              const rs485_bus_frame_t* frame);
+
+/**
+ * @brief 応答が来なかった時に呼ぶ
+ */
+void rs485_bus_master_on_timeout(rs485_bus_master_t* m);
+
+/**
+ * @brief 全ノードが空で、ポーリング間隔を空けてよいか
+ */
+bool rs485_bus_master_is_idle(const rs485_bus_master_t* m);
+
+/**
+ * @brief アドレスからノードを探す
+ *
+ * @return 見つからなければNULL
+ */
+rs485_bus_node_t* rs485_bus_master_find(rs485_bus_master_t* m, uint8_t addr);
+
+/**
+ * @brief 次に時刻合わせをするノードを選ぶ
+ *
+ * @param[out] addr ノードのアドレス
+ * @param[out] seq  time_reqに載せる番号
+ */
+void rs485_bus_master_next_time(rs485_bus_master_t* m, uint8_t* addr,
+                                uint8_t* seq);
+
+/**
+ * @brief time_respを受け取った時に時計のずれを推定し直す
+ *
+ * @param[in] t1 time_reqを送り終えた時刻
+ * @param[in] t4 time_respを受け取り終えた時刻
+ * @return 時刻合わせ中のノードからの応答でなければfalse
+ */
+bool rs485_bus_master_on_time(rs485_bus_master_t* m,
+                              const rs485_bus_frame_t* frame, uint64_t t1,
+                              uint64_t t4);
+
+/**
+ * @brief ノードの時刻をマスタの時刻に変換する
+ *
+ * @return 変換後の時刻、まだ推定できていなければnode_usをそのまま返す
+ */
+uint64_t rs485_bus_clock_to_master(const rs485_bus_clock_t* c,
+                                   uint64_t node_us);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: RS485_BUS_H */
@@ -0,0 +1,120 @@
+#ifndef SD_CARD_H
+#define SD_CARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <hardware/pio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * PIOで作ったSPIにつなぐmicroSDカードのドライバ
+ *
+ * 初期化はsd_card_init_stepで一度に一つずつコマンドを送って進めるので、
+ * カードの準備ができるまでの間も呼んだ側は止まらない。
+ * 1ブロックの読み書きは終わるまで待つ。
+ * 複数ブロックの書き込み(CMD25)は、データをDMAで送り、
+ * カードのbusyはsd_card_taskで少しずつ見に行くので、呼んだ側は止まらない。
+ */
+
+#define SD_CARD_BLOCK_SIZE (512)
+
+// 初期化中のクロック
+#define SD_CARD_INIT_BAUD (400000)
+
+// 書き込みのbusyをこれより長く待ったら失敗とする
+#define SD_CARD_WRITE_TIMEOUT_US (500000)
+
+// 一度のsd_card_taskで使う時間の目安
+#define SD_CARD_TASK_BUDGET_US (50)
+
+typedef enum {
+    sd_card_init_pending,  // まだカードの準備ができていない
+    sd_card_init_done,     // 読み書きできる
+    sd_card_init_failed,   // カードが無いか応答が無い
+} sd_card_init_result_t;
+
+typedef struct {
+    PIO pio;
+    uint8_t pin_sck;
+    uint8_t pin_mosi;
+    uint8_t pin_miso;
+    uint8_t pin_cs;
+    uint baud;  // 初期化後のクロック (25MHz以下)
+
+    uint sm;
+    uint offset;
+    int dma_tx;
+    int dma_rx;
+    uint8_t dma_dummy;
+    bool block_addr;  // SDHC/SDXCはブロック単位、SDSCはbyte単位で指す
+    bool v2;          // CMD8に応答した (v2以降のカード)
+
+    // 初期化と複数ブロックの書き込み
+    uint8_t state;
+    const uint8_t* write_buf;
+    uint32_t write_left;     // 残りのブロック数
+    uint32_t wait_start_us;  // 応答やbusyを待ち始めた時刻
+    bool error;
+} sd_card_dev_t;
+
+/**
+ * @brief カードの初期化を始める
+ *
+ * PIOとDMAを用意してクロックを送るだけで、カードとのやり取りは
+ * sd_card_init_stepで進める。
+ * pio、ピン、baudを設定してから呼ぶこと。
+ */
+void sd_card_init_start(sd_card_dev_t* dev);
+
+/**
+ * @brief 初期化を進める
+ *
+ * コマンドを一つ送って戻る。sd_card_init_pendingの間は繰り返し呼ぶこと。
+ */
+sd_card_init_result_t sd_card_init_step(sd_card_dev_t* dev);
+
+/**
+ * @brief 1ブロック読む (終わるまで待つ)
+ */
+bool sd_card_read(sd_card_dev_t* dev, uint32_t lba, uint8_t* buf);
+
+/**
+ * @brief 1ブロック書く (終わるまで待つ)
+ */
+bool sd_card_write(sd_card_dev_t* dev, uint32_t lba, const uint8_t* buf);
+
+/**
+ * @brief 複数ブロックの書き込みを始める
+ *
+ * bufは書き終わるまで書き換えないこと。
+ *
+ * @return 書き込み中か、カードが受け付けなければfalse
+ */
+bool sd_card_write_start(sd_card_dev_t* dev, uint32_t lba, const uint8_t* buf,
+                         uint32_t count);
+
+/**
+ * @brief 書き込みを進める
+ *
+ * busyの間は数byteだけ読んで戻る。
+ */
+void sd_card_task(sd_card_dev_t* dev);
+
+bool sd_card_is_busy(const sd_card_dev_t* dev);
+
+/**
+ * @brief 書き込みに失敗したか
+ *
+ * 一度失敗すると、それ以降の書き込みは受け付けない。
+ */
+bool sd_card_has_error(const sd_card_dev_t* dev);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: SD_CARD_H */
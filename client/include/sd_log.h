@@ -0,0 +1,192 @@
+#ifndef SD_LOG_H
+#define SD_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ring_buf.h"
+#include "sd_card.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ホストへ送ったフレームをmicroSDカードに残すロガー
+ *
+ * FAT32のカードのルートに、起動ごとにdata-serverと同じ連番の名前
+ * (000.BIN, 001.BIN, ...) でファイルを作る。
+ * 作る時に連続したクラスタを丸ごと確保しておくので、
+ * 書く時はFATを読まず、ファイルの先頭から順にブロックを書くだけで済む。
+ * ファイルがSD_LOG_MAX_FILES個あるか空きが無ければ、最も古いファイルの
+ * 名前を次の番号に変えて、確保してある領域をそのまま使い直す。
+ *
+ * ファイルは書き込みの単位ごとに、ブロックの境界から
+ * [magic 4byte][nonce 4byte][len 4byte] (little endian) に続けて
+ * len byteのフレーム ([len][crc][フレームヘッダ][MsgPack]) を並べ、
+ * 単位の残りは0xFFで埋める。
+ * nonceは起動ごとに変わるので、確保した領域に残っていた
+ * 古いデータと見分けられる。
+ *
+ * バッファを二つ持ち、一方をカードに書いている間にもう一方に溜める。
+ */
+
+#define SD_LOG_MAGIC (0x474c4453)  // "SDLG"
+#define SD_LOG_UNIT_HEADER_SIZE (12)
+
+// 一つのファイルに確保する大きさ (10KB/sで7時間ほど)
+#define SD_LOG_FILE_SIZE (256u * 1024 * 1024)
+
+// カードに残すファイルの数 (2GB)
+#define SD_LOG_MAX_FILES (8)
+
+#define SD_LOG_PRODUCER_COUNT (2)
+#define SD_LOG_INGRESS_SIZE (4096)
+
+// 一度に書く最大の大きさ (16ブロック)
+#define SD_LOG_BUF_SIZE (16 * SD_CARD_BLOCK_SIZE)
+
+// これより長く溜めたままにせず、途中でも書いておく
+#define SD_LOG_FLUSH_US (1000000)
+
+// sd_log_init_stepで一度に読むブロック数の目安
+#define SD_LOG_INIT_BLOCKS (8)
+
+typedef enum {
+    sd_log_init_pending,  // まだファイルを決めている
+    sd_log_init_done,     // 書ける
+    sd_log_init_failed,   // FAT32でないか、置ける所が無い
+} sd_log_init_result_t;
+
+// ファイルを作るのに使うFAT32の配置
+typedef struct {
+    uint32_t fat_lba;
+    uint32_t fat_size;  // FAT一つのブロック数
+    uint8_t fat_count;
+    uint8_t cluster_blocks;
+    uint32_t cluster_count;
+    uint32_t data_lba;
+    uint32_t root_cluster;
+    uint32_t fsinfo_lba;
+} sd_log_fat32_t;
+
+// ルートディレクトリを見て決めた、次のファイルを置く所
+typedef struct {
+    uint32_t number;  // 次の番号
+    bool has_free;    // 空いているエントリがある
+    uint32_t free_lba;
+    uint32_t free_off;
+
+    // このロガーが作った大きさのファイルのうち、最も番号の小さいもの
+    uint32_t files;
+    uint32_t oldest_number;
+    uint32_t oldest_lba;
+    uint32_t oldest_off;
+    uint32_t oldest_first;
+} sd_log_dir_t;
+
+// sd_log_init_stepで読み進めている途中の状態
+typedef struct {
+    uint8_t step;
+    uint8_t blocks;  // この回に読み書きしたブロック数
+    sd_log_fat32_t fat;
+    sd_log_dir_t dir;
+    uint32_t clusters;    // 一つのファイルのクラスタ数
+    uint32_t fat_cached;  // 作業領域に読んであるFATのブロック
+    uint32_t cluster;     // 次に見るクラスタ
+    uint32_t pos;         // クラスタの中のブロックか、FATのブロック
+    uint8_t fat_copy;     // 次に書くFATの番号
+    uint32_t count;       // 見たクラスタの数か、続いて空いている数
+    uint32_t first;       // ファイルの最初のクラスタ
+    uint32_t entry_lba;   // ファイルのエントリを書く所
+    uint32_t entry_off;
+    bool is_new;          // 空きに新しく作る
+} sd_log_init_t;
+
+typedef struct {
+    uint32_t bytes;         // 書いたバイト数
+    uint32_t write_us_max;  // 一つの単位を書き終えるまでの最大の時間
+    uint32_t drops;         // 溢れて捨てたフレームの数
+} sd_log_stats_t;
+
+typedef struct {
+    // コアごとに受け取って、sd_log_taskを呼ぶコアでまとめて書く
+    ring_buf_t ingress[SD_LOG_PRODUCER_COUNT];
+    uint8_t ingress_storage[SD_LOG_PRODUCER_COUNT][SD_LOG_INGRESS_SIZE];
+    uint32_t drops[SD_LOG_PRODUCER_COUNT];
+
+    sd_card_dev_t* card;
+    sd_log_init_t init;
+    bool enabled;  // 他を全て書いてから立てる
+    uint32_t number;   // ファイルの番号
+    uint32_t nonce;
+    uint32_t lba;      // 次に書くブロック
+    uint32_t end_lba;  // ファイルの終わり
+
+    uint8_t buf[2][SD_LOG_BUF_SIZE];
+    uint8_t fill;  // 溜めている方
+    uint32_t fill_len;
+    uint64_t fill_us;  // 最初に入れた時刻
+    bool sealed;       // 溜めている方が、もう一方を書き終えるのを待っている
+    bool writing;      // もう一方をカードに書いている
+    uint32_t write_start_us;
+
+    uint32_t stats_bytes;
+    uint32_t stats_write_us_max;
+} sd_log_t;
+
+/**
+ * @brief このセッションのファイルを作り始める
+ *
+ * 受け口を空にして、sd_log_init_stepで進める。
+ * cardは初期化しておくこと。
+ * 有効になるまでsd_log_appendは何もしないので、
+ * もう一方のコアが積んでいる間に呼んでもよい。
+ */
+void sd_log_init_start(sd_log_t* log, sd_card_dev_t* card);
+
+/**
+ * @brief カードのファイルシステムを少し読み進める
+ *
+ * 一度に読むのはSD_LOG_INIT_BLOCKS程度のブロックなので、
+ * 大きなカードでFATを全て見る時も計測を止めない。
+ * 書き込みは一度に1ブロックを始めるだけで、busyの間は次の回で
+ * sd_card_taskを呼んで戻るので、カードが遅くても待たない。
+ * sd_log_init_pendingの間は繰り返し呼ぶこと。
+ * sd_log_init_doneを返した時にはsd_log_appendで積める。
+ */
+sd_log_init_result_t sd_log_init_step(sd_log_t* log);
+
+/**
+ * @brief フレームを残すよう積む
+ *
+ * どちらのコアから呼んでもよい。
+ *
+ * @return 使えないか溢れたらfalse
+ */
+bool sd_log_append(sd_log_t* log, const uint8_t* frame, uint16_t len);
+
+/**
+ * @brief 溜まったフレームをカードに書く
+ *
+ * カードのbusyを待たずに戻るので、メインループで毎回呼ぶこと。
+ * カードが失敗するかファイルがいっぱいになると、以降は使わない。
+ */
+void sd_log_task(sd_log_t* log, uint64_t now_us);
+
+/**
+ * @brief 統計を取得し、集計をリセットする
+ *
+ * sd_log_taskを呼ぶコアから呼ぶこと。
+ */
+void sd_log_take_stats(sd_log_t* log, sd_log_stats_t* stats);
+
+static inline bool sd_log_is_enabled(const sd_log_t* log) {
+    return log->enabled;
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: SD_LOG_H */
@@ -1,6 +1,7 @@
 #ifndef SHIFT_OUT_H
 #define SHIFT_OUT_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <hardware/pio.h>
@@ -9,17 +10,70 @@
 extern "C" {
 #endif
 
+/**
+ * 74HC595などのシフトレジスタのドライバ
+ *
+ * PIOがデータとクロックに加えてラッチも動かし、DMAがフレームバッファを
+ * 繰り返し流し続けるので、表示を変える時にCPUは待たない。
+ *
+ * 明るさは一周期をSHIFT_OUT_SUBFRAMES枚のサブフレームに分け、
+ * 点けるサブフレームの数で決める (PWM)。
+ * 点滅はSHIFT_OUT_PATTERN_LEN周期を一組とし、周期ごとに
+ * 点滅させるビットを点けるか消すかをパターンで決める。
+ * 周期の並びはDMAが順に読むので、点滅にもCPUは関わらない。
+ */
+
+#define SHIFT_OUT_MAX_LEN (8)
+#define SHIFT_OUT_SUBFRAMES (16)
+#define SHIFT_OUT_PATTERN_LEN (64)
+
+// 点滅しない
+#define SHIFT_OUT_BLINK_NONE (~0ull)
+
 typedef struct {
     PIO pio;
-    uint sm;
-    uint offset;
     uint8_t pin_data;
     uint8_t pin_clock;
     uint8_t pin_latch;
+    uint8_t len;          // 1フレームのbyte数 (SHIFT_OUT_MAX_LEN以下)
+    uint16_t refresh_hz;  // PWMの一周期を流す頻度
+
+    uint sm;
+    uint offset;
+    int dma_data;
+    int dma_ctrl;
+    uint8_t back;  // 次に書く方のバンク
+
+    // [バンク][点灯, 消灯][サブフレーム * len]
+    uint8_t frames[2][2][SHIFT_OUT_SUBFRAMES * SHIFT_OUT_MAX_LEN];
+
+    // DMAが順に読む周期の並び。リングで回すので大きさに揃える
+    const uint8_t* cycles[SHIFT_OUT_PATTERN_LEN]
+        __attribute__((aligned(SHIFT_OUT_PATTERN_LEN * sizeof(void*))));
 } shift_out_dev_t;
 
+/**
+ * @brief 全て消した状態で流し始める
+ *
+ * pio、ピン、len、refresh_hzを設定してから呼ぶこと。
+ */
 void shift_out_init(shift_out_dev_t* dev);
-void shift_out_send(shift_out_dev_t* dev, const uint8_t* buf, size_t len);
+
+/**
+ * @brief 表示を変える
+ *
+ * 書いている間も前の表示を流し続け、書き終えてから切り替える。
+ * 前に切り替えた周期をまだ流している時は、書かずにfalseを返すので、
+ * 後でもう一度呼ぶこと。
+ *
+ * @param[in] buf        len byteの表示
+ * @param[in] blink      点滅させるビット (len byte)。NULLなら点滅しない
+ * @param[in] brightness 0からSHIFT_OUT_SUBFRAMESまで
+ * @param[in] pattern    ビットiが1なら、i番目の周期で点滅するビットを点ける
+ */
+bool shift_out_show(shift_out_dev_t* dev, const uint8_t* buf,
+                    const uint8_t* blink, uint8_t brightness,
+                    uint64_t pattern);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -1,6 +1,7 @@
 #ifndef SPI_SLAVE_H
 #define SPI_SLAVE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <hardware/pio.h>
@@ -10,10 +11,98 @@ extern "C" {
 #endif
 
 #define SPI_SLAVE_BUF_SIZE (512)
-#define SPI_SLAVE_QUEUE_COUNT (32)
+
+// ホストからのコマンド (rx_bufの先頭byte)
+#define SPI_SLAVE_CMD_NEXT (0x01)       // 次のフレームを送信バッファに載せる
+#define SPI_SLAVE_CMD_TIME_SYNC (0x02)  // [cmd][host_time_us 8byte BE]
+#define SPI_SLAVE_TIME_SYNC_SIZE (9)
+#define SPI_SLAVE_CMD_DESCRIBE (0x03)  // ディスクリプタを送り直してもらう
+#define SPI_SLAVE_CMD_DRAIN (0x04)  // [cmd][since_us 8byte BE] 履歴を送らせる
+#define SPI_SLAVE_DRAIN_SIZE (9)
+// [cmd][offset 2byte BE][len 2byte BE] 最新値の表の一部を次の転送で返す
+// 送信バッファに載せるので、載っていたフレームを読み終えてから頼むこと
+#define SPI_SLAVE_CMD_READ_REGS (0x05)
+#define SPI_SLAVE_READ_REGS_SIZE (5)
+
+// 最新値の表は [count][flags][0][0] に続けて、チャンネルごとに
+// [時刻(us) 8byte BE][値 4byte BE] を並べる
+// 時刻はホストと同期していればホストの時刻で、まだ値が無ければ0
+#define SPI_SLAVE_REG_MAX_COUNT (32)
+#define SPI_SLAVE_REG_HEADER_SIZE (4)
+#define SPI_SLAVE_REG_ENTRY_SIZE (12)
+#define SPI_SLAVE_REG_FLAG_SYNCED (0x01)
 
 void spi_slave_init();
-bool spi_slave_push_bytes(uint8_t* data);
+
+/**
+ * @brief ホストへ送るデータがあることを知らせるピンを設定する
+ *
+ * spi_slave_initより前に呼ぶこと。呼ばなければピンは使わない。
+ * 送信バッファにフレームが載っているか、キューにhigh_bytes以上溜まったら
+ * Highにし、取り出されてlow_bytes以下になったらLowに戻す。
+ * high_bytes=1, low_bytes=0なら空かどうかだけで切り替わる。
+ */
+void spi_slave_set_data_ready(uint pin, uint32_t high_bytes,
+                              uint32_t low_bytes);
+
+/**
+ * @brief ホストに読みに来ないよう、DATA_READYをLowにしたままにする
+ *
+ * CSの割り込みを受けられない間に使う。その間の転送は送信バッファを
+ * 載せ直せず、時刻合わせの始まりの時刻も分からない。
+ * holdをfalseにすると、送るものがあればHighに戻す。
+ * CSの割り込みが入らない所から、consumer側のコアで呼ぶこと。
+ */
+void spi_slave_hold_data_ready(bool hold);
+
+/**
+ * @brief 最新値の表のチャンネル数を設定する
+ *
+ * spi_slave_initより前に呼ぶこと。呼ばなければ表は空になる。
+ */
+void spi_slave_set_reg_count(uint8_t count);
+
+/**
+ * @brief チャンネルの最新値を書く
+ *
+ * 一つのチャンネルに書くのは一つのコアだけにすること。
+ * チャンネルごとに二面持ち、書き終えてから切り替えるので、
+ * 転送の割り込みが書いている途中に入っても前の値をそのまま返せる。
+ *
+ * @param[in] id      チャンネル
+ * @param[in] time_us 値を取った時刻 (us_since_boot)
+ * @param[in] value   値
+ */
+void spi_slave_set_reg(uint8_t id, uint64_t time_us, int32_t value);
+
+// 送信フレームをキューに積む。コアごとに別のリングを使うので両コアから呼べる
+// トピックの優先度クラスに従って送る順番と溢れた時の捨て方が決まる
+bool spi_slave_push_bytes(uint8_t topic, const uint8_t* data, uint16_t len);
+uint32_t spi_slave_get_drops(uint8_t topic);
+
+/**
+ * @brief ホストからディスクリプタを要求されていたかを返し、要求を消す
+ */
+bool spi_slave_take_describe_request();
+
+/**
+ * @brief ホストから履歴を要求されていたかを返し、要求を消す
+ *
+ * @param[out] since_us 要求された始まりの時刻 (ホストの時刻)
+ */
+bool spi_slave_take_drain_request(uint64_t* since_us);
+
+/**
+ * @brief まだホストに取り出されていないおおよそのバイト数を返す
+ */
+uint32_t spi_slave_pending_bytes();
+
+/**
+ * @brief 送り直す履歴をあと何byte積めるかを返す
+ *
+ * 履歴はtopic_replayとして積み、他に送るものが無い時だけ送られる。
+ */
+uint32_t spi_slave_replay_room();
 
 #ifdef __cplusplus
 } /* extern "C" */
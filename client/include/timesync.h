@@ -0,0 +1,56 @@
+#ifndef TIMESYNC_H
+#define TIMESYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ホストの時計(UNIX時間のus)に合わせるための時刻変換
+ *
+ * ホストから時刻を受け取る度に、起動からの時間とのずれ(offset)と
+ * 進み方の差(drift)を推定し直す。
+ * host = local + offset + (local - ref) * drift
+ * driftは2^-32単位の固定小数点で持つので、変換に割り算は要らない。
+ *
+ * 更新は一つのコンテキストのみ、変換はどこからでも呼べる。
+ */
+
+// これ以上ずれていたらホストの時計が飛んだとみなして推定をやり直す
+#define TIMESYNC_STEP_US (10000)
+
+typedef struct {
+    bool valid;
+    int64_t offset_us;
+    int32_t drift_ppb;
+    int32_t last_error_us;  // 最後の更新で予測と実測がずれた量
+    uint32_t updates;
+    uint32_t steps;
+} timesync_status_t;
+
+/**
+ * @brief ホストの時刻を一つ取り込む
+ *
+ * @param[in] local_us 受け取った時点の起動からの時間
+ * @param[in] host_us  ホストの時刻
+ */
+void timesync_update(uint64_t local_us, uint64_t host_us);
+
+/**
+ * @brief 起動からの時間をホストの時刻に変換する
+ *
+ * @param[out] synced 変換できたか (NULL可)
+ * @return ホストの時刻、まだ同期していなければlocal_usをそのまま返す
+ */
+uint64_t timesync_to_host(uint64_t local_us, bool* synced);
+
+void timesync_get_status(timesync_status_t* status);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: TIMESYNC_H */
@@ -0,0 +1,63 @@
+#ifndef TOPIC_H
+#define TOPIC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    topic_unknown = 0,
+    topic_stroke_front,
+    topic_stroke_rear,
+    topic_water,
+    topic_ecu,
+    topic_rpm,
+    topic_acc,
+    topic_env,
+    topic_af,
+    topic_core1_front,
+    topic_core1_rear,
+    topic_drop_front,
+    topic_drop_rear,
+    topic_sync_front,
+    topic_sync_rear,
+    topic_desc,
+    topic_block_stroke_front,
+    topic_log_front,
+    topic_meter,
+    topic_meter_front,
+    topic_i2c_front,
+    topic_boot_front,
+    topic_replay,  // フラッシュから送り直す履歴。本当のトピックはヘッダにある
+    TOPIC_COUNT,
+} topic_id_t;
+
+// 送信の優先度クラス。値が小さいほど先に送られる
+typedef enum {
+    topic_class_critical = 0,  // メーターやECUなど遅れると困るもの
+    topic_class_normal,        // 通常のセンサー値
+    topic_class_diag,          // 診断情報
+    topic_class_replay,        // 送り直す履歴。他に送るものが無い時だけ
+    TOPIC_CLASS_COUNT,
+} topic_class_t;
+
+/**
+ * @brief トピック名からIDを求める
+ *
+ * @param[in] name トピック名 (null終端でなくてもよい)
+ * @param[in] len  トピック名の長さ
+ * @return 見つからなければtopic_unknown
+ */
+uint8_t topic_from_name(const char* name, size_t len);
+
+const char* topic_name(uint8_t id);
+uint8_t topic_class(uint8_t id);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* end of include guard: TOPIC_H */
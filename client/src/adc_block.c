@@ -0,0 +1,93 @@
+#include "adc_block.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+bool adc_block_init(adc_block_t* block, uint8_t channels, uint16_t samples,
+                    uint32_t interval_us) {
+    if (channels == 0 || channels > ADC_BLOCK_MAX_CHANNELS || samples == 0 ||
+        samples > ADC_BLOCK_MAX_SAMPLES || interval_us == 0) {
+        return false;
+    }
+    block->channels = channels;
+    block->samples = samples;
+    block->interval_us = interval_us;
+    adc_block_reset(block);
+    return true;
+}
+
+void adc_block_reset(adc_block_t* block) {
+    block->count = 0;
+    block->base_us = 0;
+}
+
+bool adc_block_add(adc_block_t* block, uint64_t time_us,
+                   const uint16_t* codes) {
+    if (adc_block_is_full(block)) {
+        return false;
+    }
+    if (block->count == 0) {
+        block->base_us = time_us;
+    } else {
+        uint64_t expected =
+            block->base_us + (uint64_t)block->count * block->interval_us;
+        int64_t diff = (int64_t)(time_us - expected);
+        if (diff < 0) {
+            diff = -diff;
+        }
+        if ((uint64_t)diff * 2 > block->interval_us) {
+            return false;
+        }
+    }
+
+    // 偶数番目は前の1.5byte、奇数番目は後ろの1.5byteに書く
+    size_t stride = ADC_BLOCK_COLUMN_SIZE(block->samples);
+    uint8_t* p = &block->data[(size_t)(block->count / 2) * 3];
+    bool odd = block->count & 1;
+    for (uint8_t ch = 0; ch < block->channels; ch++, p += stride) {
+        uint16_t code = codes[ch] & 0x0FFF;
+        if (odd) {
+            p[1] |= (uint8_t)(code >> 8);
+            p[2] = (uint8_t)(code & 0xFF);
+        } else {
+            p[0] = (uint8_t)(code >> 4);
+            p[1] = (uint8_t)((code & 0x0F) << 4);
+        }
+    }
+    block->count++;
+    return true;
+}
+
+size_t adc_block_finish(adc_block_t* block) {
+    size_t stride = ADC_BLOCK_COLUMN_SIZE(block->samples);
+    size_t column = ADC_BLOCK_COLUMN_SIZE(block->count);
+    if (column != stride) {
+        // 後ろの列ほど前へずらすだけなので先頭から順に動かせばよい
+        for (uint8_t ch = 1; ch < block->channels; ch++) {
+            memmove(&block->data[ch * column], &block->data[ch * stride],
+                    column);
+        }
+    }
+    return column * block->channels;
+}
+
+bool adc_block_unpack(const uint8_t* packed, size_t size, uint8_t channels,
+                      uint16_t count, uint16_t* codes) {
+    size_t column = ADC_BLOCK_COLUMN_SIZE(count);
+    if (size != column * channels) {
+        return false;
+    }
+    for (uint8_t ch = 0; ch < channels; ch++) {
+        const uint8_t* p = &packed[ch * column];
+        uint16_t* out = &codes[(size_t)ch * count];
+        for (uint16_t i = 0; i < count; i += 2, p += 3) {
+            out[i] = (uint16_t)(p[0] << 4 | p[1] >> 4);
+            if (i + 1 < count) {
+                out[i + 1] = (uint16_t)((p[1] & 0x0F) << 8 | p[2]);
+            }
+        }
+    }
+    return true;
+}
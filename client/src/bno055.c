@@ -5,24 +5,82 @@
 
 #include <hardware/i2c.h>
 
-static void write_register(bno055_dev_t* dev, uint8_t reg, uint8_t val) {
+#include "i2c_dma.h"
+
+// 待って読み書きする時も、バスが止まったらこの時間で諦める
+#define BLOCKING_TIMEOUT_US (10000)
+
+// i2c_*_timeout_usは送れたbyte数か負のエラーを返すので、全て送れた時だけtrue
+static bool write_bytes(bno055_dev_t* dev, const uint8_t* buf, uint8_t len) {
+    return i2c_write_timeout_us(dev->i2c_id, dev->addr, buf, len, false,
+                                BLOCKING_TIMEOUT_US) == len;
+}
+
+static bool write_register(bno055_dev_t* dev, uint8_t reg, uint8_t val) {
     uint8_t buf[2] = {reg, val};
-    i2c_write_blocking(dev->i2c_id, dev->addr, buf, 2, false);
+    return write_bytes(dev, buf, 2);
 }
 
-static void read_registers(bno055_dev_t* dev, uint8_t reg, uint8_t* buf,
+// 番地を送れなかった時は読まずに返す
+static bool read_registers(bno055_dev_t* dev, uint8_t reg, uint8_t* buf,
                            uint8_t len) {
-    i2c_write_blocking(dev->i2c_id, dev->addr, &reg, 1, true);
-    i2c_read_blocking(dev->i2c_id, dev->addr, buf, len, false);
+    if (i2c_write_timeout_us(dev->i2c_id, dev->addr, &reg, 1, true,
+                             BLOCKING_TIMEOUT_US) != 1) {
+        return false;
+    }
+    return i2c_read_timeout_us(dev->i2c_id, dev->addr, buf, len, false,
+                               BLOCKING_TIMEOUT_US) == len;
 }
 
 static inline int16_t to_int16(uint8_t lsb, uint8_t msb) {
     return (int16_t)((msb << 8) | lsb);
 }
 
+static inline void put_int16(uint8_t* p, int16_t val) {
+    p[0] = (uint8_t)(val & 0xFF);
+    p[1] = (uint8_t)((uint16_t)val >> 8);
+}
+
+// BNO055_FIELD_*のビットの順に並べたレジスタの位置と長さ
+static const struct {
+    uint8_t reg;
+    uint8_t len;
+} block_fields[] = {
+    {0x08, 6}, {0x0E, 6}, {0x14, 6}, {0x1A, 6}, {0x20, 8},
+    {0x28, 6}, {0x2E, 6}, {0x34, 1}, {0x35, 1},
+};
+
+#define BLOCK_FIELD_COUNT (sizeof(block_fields) / sizeof(block_fields[0]))
+#define BLOCK_REG (0x08)
+
+static void block_span(uint32_t mask, uint8_t* first, uint8_t* end) {
+    *first = BLOCK_REG + BNO055_BLOCK_SIZE;
+    *end = BLOCK_REG;
+    for (uint8_t i = 0; i < BLOCK_FIELD_COUNT; i++) {
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        uint8_t reg = block_fields[i].reg;
+        if (reg < *first) {
+            *first = reg;
+        }
+        if (reg + block_fields[i].len > *end) {
+            *end = reg + block_fields[i].len;
+        }
+    }
+}
+
+static void to_xyz(const uint8_t* p, int16_t* x, int16_t* y, int16_t* z) {
+    *x = to_int16(p[0], p[1]);
+    *y = to_int16(p[2], p[3]);
+    *z = to_int16(p[4], p[5]);
+}
+
 uint8_t bno055_get_chip_id(bno055_dev_t* dev) {
     uint8_t buf;
-    read_registers(dev, 0x00, &buf, 1);
+    if (!read_registers(dev, 0x00, &buf, 1)) {
+        return 0;
+    }
     return buf;
 }
 
@@ -30,95 +88,230 @@ bool bno055_is_chip_id_valid(uint8_t chip_id) {
     return chip_id == 0xA0;
 }
 
-void bno055_set_mode(bno055_dev_t* dev, uint8_t mode) {
-    write_register(dev, 0x3D, 0x0C);
+bool bno055_set_mode(bno055_dev_t* dev, uint8_t mode) {
+    return write_register(dev, 0x3D, mode);
 }
 
-void bno055_read_accel(bno055_dev_t* dev, bno055_accel_t* acc) {
+bool bno055_read_accel(bno055_dev_t* dev, bno055_accel_t* acc) {
     uint8_t buf[6];
-    read_registers(dev, 0x08, buf, 6);
+    if (!read_registers(dev, 0x08, buf, 6)) {
+        return false;
+    }
     acc->x = to_int16(buf[0], buf[1]);
     acc->y = to_int16(buf[2], buf[3]);
     acc->z = to_int16(buf[4], buf[5]);
+    return true;
 }
 
-void bno055_read_gyro(bno055_dev_t* dev, bno055_gyro_t* gyro) {
+bool bno055_read_gyro(bno055_dev_t* dev, bno055_gyro_t* gyro) {
     uint8_t buf[6];
-    read_registers(dev, 0x14, buf, 6);
+    if (!read_registers(dev, 0x14, buf, 6)) {
+        return false;
+    }
     gyro->x = to_int16(buf[0], buf[1]);
     gyro->y = to_int16(buf[2], buf[3]);
     gyro->z = to_int16(buf[4], buf[5]);
+    return true;
 }
 
-void bno055_read_mag(bno055_dev_t* dev, bno055_mag_t* mag) {
+bool bno055_read_mag(bno055_dev_t* dev, bno055_mag_t* mag) {
     uint8_t buf[6];
-    read_registers(dev, 0x0E, buf, 6);
+    if (!read_registers(dev, 0x0E, buf, 6)) {
+        return false;
+    }
     mag->x = to_int16(buf[0], buf[1]);
     mag->y = to_int16(buf[2], buf[3]);
     mag->z = to_int16(buf[4], buf[5]);
+    return true;
 }
 
-void bno055_read_euler(bno055_dev_t* dev, bno055_euler_t* euler) {
+bool bno055_read_euler(bno055_dev_t* dev, bno055_euler_t* euler) {
     uint8_t buf[6];
-    read_registers(dev, 0x1A, buf, 6);
+    if (!read_registers(dev, 0x1A, buf, 6)) {
+        return false;
+    }
     euler->heading = to_int16(buf[0], buf[1]);
     euler->roll = to_int16(buf[2], buf[3]);
     euler->pitch = to_int16(buf[4], buf[5]);
+    return true;
 }
 
-void bno055_read_quaternion(bno055_dev_t* dev,
+bool bno055_read_quaternion(bno055_dev_t* dev,
                             bno055_quaternion_t* quaternion) {
     uint8_t buf[8];
-    read_registers(dev, 0x20, buf, 8);
+    if (!read_registers(dev, 0x20, buf, 8)) {
+        return false;
+    }
     quaternion->w = to_int16(buf[0], buf[1]);
     quaternion->x = to_int16(buf[2], buf[3]);
     quaternion->y = to_int16(buf[4], buf[5]);
     quaternion->z = to_int16(buf[6], buf[7]);
+    return true;
 }
 
-void bno055_read_linear_accel(bno055_dev_t* dev,
+bool bno055_read_linear_accel(bno055_dev_t* dev,
                               bno055_linear_accel_t* linear_accel) {
     uint8_t buf[6];
-    read_registers(dev, 0x28, buf, 6);
+    if (!read_registers(dev, 0x28, buf, 6)) {
+        return false;
+    }
     linear_accel->x = to_int16(buf[0], buf[1]);
     linear_accel->y = to_int16(buf[2], buf[3]);
     linear_accel->z = to_int16(buf[4], buf[5]);
+    return true;
 }
 
-void bno055_read_gravity(bno055_dev_t* dev, bno055_gravity_t* gravity) {
+bool bno055_read_gravity(bno055_dev_t* dev, bno055_gravity_t* gravity) {
     uint8_t buf[6];
-    read_registers(dev, 0x2E, buf, 6);
+    if (!read_registers(dev, 0x2E, buf, 6)) {
+        return false;
+    }
     gravity->x = to_int16(buf[0], buf[1]);
     gravity->y = to_int16(buf[2], buf[3]);
     gravity->z = to_int16(buf[4], buf[5]);
+    return true;
 }
 
-void bno055_read_calib_status(bno055_dev_t* dev,
+bool bno055_read_calib_status(bno055_dev_t* dev,
                               bno055_calib_status_t* status) {
     uint8_t val;
-    read_registers(dev, 0x35, &val, 1);
+    if (!read_registers(dev, 0x35, &val, 1)) {
+        return false;
+    }
     status->sys = (val >> 6) & 0x03;
     status->gyro = (val >> 4) & 0x03;
     status->accel = (val >> 2) & 0x03;
     status->mag = val & 0x03;
+    return true;
 }
 
-void bno055_read_calib_data(bno055_dev_t* dev, bno055_calib_data_t* data) {
+bool bno055_read_calib_data(bno055_dev_t* dev, bno055_calib_data_t* data) {
     uint8_t buf[22];
-    read_registers(dev, 0x55, buf, 22);
+    if (!read_registers(dev, 0x55, buf, 22)) {
+        return false;
+    }
 
     data->accel_x = to_int16(buf[0], buf[1]);
     data->accel_y = to_int16(buf[2], buf[3]);
     data->accel_z = to_int16(buf[4], buf[5]);
 
-    data->gyro_x = to_int16(buf[6], buf[7]);
-    data->gyro_y = to_int16(buf[8], buf[9]);
-    data->gyro_z = to_int16(buf[10], buf[11]);
+    data->mag_x = to_int16(buf[6], buf[7]);
+    data->mag_y = to_int16(buf[8], buf[9]);
+    data->mag_z = to_int16(buf[10], buf[11]);
 
-    data->mag_x = to_int16(buf[12], buf[13]);
-    data->mag_y = to_int16(buf[14], buf[15]);
-    data->mag_z = to_int16(buf[16], buf[17]);
+    data->gyro_x = to_int16(buf[12], buf[13]);
+    data->gyro_y = to_int16(buf[14], buf[15]);
+    data->gyro_z = to_int16(buf[16], buf[17]);
 
     data->accel_radius = to_int16(buf[18], buf[19]);
     data->mag_radius = to_int16(buf[20], buf[21]);
+    return true;
+}
+
+bool bno055_write_calib_data(bno055_dev_t* dev,
+                             const bno055_calib_data_t* data) {
+    // 先頭はレジスタの番地
+    uint8_t buf[1 + 22];
+    buf[0] = 0x55;
+
+    put_int16(&buf[1], data->accel_x);
+    put_int16(&buf[3], data->accel_y);
+    put_int16(&buf[5], data->accel_z);
+
+    put_int16(&buf[7], data->mag_x);
+    put_int16(&buf[9], data->mag_y);
+    put_int16(&buf[11], data->mag_z);
+
+    put_int16(&buf[13], data->gyro_x);
+    put_int16(&buf[15], data->gyro_y);
+    put_int16(&buf[17], data->gyro_z);
+
+    put_int16(&buf[19], data->accel_radius);
+    put_int16(&buf[21], data->mag_radius);
+
+    return write_bytes(dev, buf, sizeof(buf));
+}
+
+bool bno055_is_fully_calibrated(const bno055_calib_status_t* status) {
+    return status->sys == 3 && status->gyro == 3 && status->accel == 3 &&
+           status->mag == 3;
+}
+
+uint8_t bno055_block_size(uint32_t mask) {
+    uint8_t first, end;
+    block_span(mask, &first, &end);
+    return first < end ? end - first : 0;
+}
+
+bool bno055_read_block(bno055_dev_t* dev, uint32_t mask,
+                       bno055_block_t* block) {
+    uint8_t first, end;
+    block_span(mask, &first, &end);
+    if (first >= end) {
+        return false;
+    }
+
+    // 添字はBLOCK_REGからの位置なので、読んだ範囲はレジスタと同じ所に入る
+    uint8_t raw[BNO055_BLOCK_SIZE];
+    if (!read_registers(dev, first, &raw[first - BLOCK_REG], end - first)) {
+        return false;
+    }
+    bno055_decode_block(mask, raw, block);
+    return true;
+}
+
+bool bno055_start_read_block(bno055_dev_t* dev, i2c_dma_bus_t* bus,
+                             uint32_t mask, uint8_t* raw,
+                             uint32_t timeout_us,
+                             i2c_dma_callback_t callback, void* ctx) {
+    uint8_t first, end;
+    block_span(mask, &first, &end);
+    if (first >= end) {
+        return false;
+    }
+    return i2c_dma_read(bus, dev->addr, first, &raw[first - BLOCK_REG],
+                        end - first, timeout_us, callback, ctx);
+}
+
+void bno055_decode_block(uint32_t mask, const uint8_t* raw,
+                         bno055_block_t* block) {
+    if (mask & BNO055_FIELD_ACCEL) {
+        bno055_accel_t* a = &block->accel;
+        to_xyz(&raw[0x08 - BLOCK_REG], &a->x, &a->y, &a->z);
+    }
+    if (mask & BNO055_FIELD_MAG) {
+        bno055_mag_t* m = &block->mag;
+        to_xyz(&raw[0x0E - BLOCK_REG], &m->x, &m->y, &m->z);
+    }
+    if (mask & BNO055_FIELD_GYRO) {
+        bno055_gyro_t* g = &block->gyro;
+        to_xyz(&raw[0x14 - BLOCK_REG], &g->x, &g->y, &g->z);
+    }
+    if (mask & BNO055_FIELD_EULER) {
+        bno055_euler_t* e = &block->euler;
+        to_xyz(&raw[0x1A - BLOCK_REG], &e->heading, &e->roll, &e->pitch);
+    }
+    if (mask & BNO055_FIELD_QUATERNION) {
+        bno055_quaternion_t* q = &block->quaternion;
+        q->w = to_int16(raw[0x20 - BLOCK_REG], raw[0x21 - BLOCK_REG]);
+        to_xyz(&raw[0x22 - BLOCK_REG], &q->x, &q->y, &q->z);
+    }
+    if (mask & BNO055_FIELD_LINEAR_ACCEL) {
+        bno055_linear_accel_t* l = &block->linear_accel;
+        to_xyz(&raw[0x28 - BLOCK_REG], &l->x, &l->y, &l->z);
+    }
+    if (mask & BNO055_FIELD_GRAVITY) {
+        bno055_gravity_t* g = &block->gravity;
+        to_xyz(&raw[0x2E - BLOCK_REG], &g->x, &g->y, &g->z);
+    }
+    if (mask & BNO055_FIELD_TEMP) {
+        block->temp = (int8_t)raw[0x34 - BLOCK_REG];
+    }
+    if (mask & BNO055_FIELD_CALIB_STATUS) {
+        uint8_t val = raw[0x35 - BLOCK_REG];
+        block->calib_status.sys = (val >> 6) & 0x03;
+        block->calib_status.gyro = (val >> 4) & 0x03;
+        block->calib_status.accel = (val >> 2) & 0x03;
+        block->calib_status.mag = val & 0x03;
+    }
 }
@@ -0,0 +1,53 @@
+#include "boot_seq.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+void boot_seq_init(boot_seq_t* seq) {
+    memset(seq, 0, sizeof(*seq));
+}
+
+uint8_t boot_seq_add(boot_seq_t* seq, const char* name, boot_step_t step_fn,
+                     void* ctx, uint64_t now_us, uint32_t timeout_us) {
+    if (seq->count >= BOOT_SEQ_MAX_DEVS) {
+        return BOOT_SEQ_MAX_DEVS;
+    }
+    boot_dev_t* dev = &seq->devs[seq->count];
+    memset(dev, 0, sizeof(*dev));
+    dev->name = name;
+    dev->step_fn = step_fn;
+    dev->ctx = ctx;
+    dev->deadline_us = now_us + timeout_us;
+    dev->state = boot_pending;
+    return seq->count++;
+}
+
+void boot_seq_task(boot_seq_t* seq, uint64_t now_us) {
+    for (uint8_t i = 0; i < seq->count; i++) {
+        boot_dev_t* dev = &seq->devs[i];
+        if (dev->state != boot_pending || now_us < dev->wait_until_us) {
+            continue;
+        }
+        dev->state = dev->step_fn(dev, now_us);
+        if (dev->state == boot_pending && now_us >= dev->deadline_us) {
+            dev->state = boot_failed;
+        }
+        if (dev->state != boot_pending) {
+            dev->done_us = now_us;
+        }
+    }
+}
+
+bool boot_seq_is_ready(const boot_seq_t* seq, uint8_t id) {
+    return id < seq->count && seq->devs[id].state == boot_ready;
+}
+
+bool boot_seq_is_done(const boot_seq_t* seq) {
+    for (uint8_t i = 0; i < seq->count; i++) {
+        if (seq->devs[i].state == boot_pending) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,93 @@
+#include "calib_store.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hardware/flash.h>
+
+#include "crc16.h"
+#include "flash_log.h"
+
+static_assert(CALIB_STORE_SECTOR_SIZE == FLASH_SECTOR_SIZE,
+              "CALIB_STORE_SECTOR_SIZE must be the erase size");
+static_assert(CALIB_STORE_HEADER_SIZE + CALIB_STORE_MAX_LEN == FLASH_PAGE_SIZE,
+              "calibration does not fit in a page");
+
+// リンカが置くプログラムの終わり
+extern char __flash_binary_end;
+
+static const uint8_t* sector_ptr(void) {
+    return (const uint8_t*)(XIP_BASE + CALIB_STORE_OFFSET);
+}
+
+static bool overlaps_binary(void) {
+    return (uintptr_t)&__flash_binary_end - XIP_BASE > CALIB_STORE_OFFSET;
+}
+
+static uint32_t get_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+static void put_le32(uint8_t* p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+// 書いてあるものが長さlenで壊れていなければ、その中身を指す
+static const uint8_t* stored(uint16_t len) {
+    const uint8_t* p = sector_ptr();
+    if (get_le32(&p[0]) != CALIB_STORE_MAGIC) {
+        return NULL;
+    }
+    if ((uint16_t)(p[4] | p[5] << 8) != len) {
+        return NULL;
+    }
+    const uint8_t* data = &p[CALIB_STORE_HEADER_SIZE];
+    if ((uint16_t)(p[6] | p[7] << 8) != crc16(data, len)) {
+        return NULL;
+    }
+    return data;
+}
+
+static void write_page(void* param) {
+    flash_range_erase(CALIB_STORE_OFFSET, CALIB_STORE_SECTOR_SIZE);
+    flash_range_program(CALIB_STORE_OFFSET, param, FLASH_PAGE_SIZE);
+}
+
+bool calib_store_load(void* data, uint16_t len) {
+    if (overlaps_binary() || len > CALIB_STORE_MAX_LEN) {
+        return false;
+    }
+    const uint8_t* p = stored(len);
+    if (p == NULL) {
+        return false;
+    }
+    memcpy(data, p, len);
+    return true;
+}
+
+bool calib_store_save(flash_log_t* log, const void* data, uint16_t len) {
+    if (overlaps_binary() || len > CALIB_STORE_MAX_LEN) {
+        return false;
+    }
+    const uint8_t* p = stored(len);
+    if (p != NULL && memcmp(p, data, len) == 0) {
+        return true;
+    }
+
+    uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+    put_le32(&page[0], CALIB_STORE_MAGIC);
+    uint16_t crc = crc16(data, len);
+    page[4] = len & 0xFF;
+    page[5] = len >> 8;
+    page[6] = crc & 0xFF;
+    page[7] = crc >> 8;
+    memcpy(&page[CALIB_STORE_HEADER_SIZE], data, len);
+    return flash_log_exec(log, write_page, page);
+}
@@ -0,0 +1,60 @@
+#include "delta.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+bool delta_init(delta_t* delta, uint8_t count, const double* deadband,
+                uint32_t keyframe_interval_us, uint32_t heartbeat_interval_us) {
+    if (count == 0 || count > DELTA_MAX_FIELDS) {
+        return false;
+    }
+    delta->count = count;
+    delta->deadband = deadband;
+    delta->keyframe_interval_us = keyframe_interval_us;
+    delta->heartbeat_interval_us = heartbeat_interval_us;
+    delta->has_keyframe = false;
+    delta->keyframe_us = 0;
+    delta->sent_us = 0;
+    return true;
+}
+
+void delta_force_keyframe(delta_t* delta) {
+    delta->has_keyframe = false;
+}
+
+delta_kind_t delta_update(delta_t* delta, uint64_t now_us,
+                          const double* values, uint32_t* mask) {
+    if (!delta->has_keyframe ||
+        now_us - delta->keyframe_us >= delta->keyframe_interval_us) {
+        for (uint8_t i = 0; i < delta->count; i++) {
+            delta->sent[i] = values[i];
+        }
+        delta->has_keyframe = true;
+        delta->keyframe_us = now_us;
+        delta->sent_us = now_us;
+        *mask = UINT32_MAX >> (32 - delta->count);
+        return delta_keyframe;
+    }
+
+    uint32_t changed = 0;
+    for (uint8_t i = 0; i < delta->count; i++) {
+        // NaNになった時も変化として送る
+        double d = fabs(values[i] - delta->sent[i]);
+        if (!(d <= delta->deadband[i])) {
+            delta->sent[i] = values[i];
+            changed |= 1u << i;
+        }
+    }
+    *mask = changed;
+
+    if (changed != 0) {
+        delta->sent_us = now_us;
+        return delta_changes;
+    }
+    if (now_us - delta->sent_us >= delta->heartbeat_interval_us) {
+        delta->sent_us = now_us;
+        return delta_heartbeat;
+    }
+    return delta_skip;
+}
@@ -0,0 +1,101 @@
+#include "doorbell.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <hardware/sync.h>
+#include <pico/time.h>
+
+void doorbell_init(doorbell_t* db, uint32_t timeout_us) {
+    db->pending = false;
+    db->rung_us = 0;
+    db->timeout_us = timeout_us;
+
+    db->measuring = false;
+    db->measure_from_us = 0;
+
+    db->window_start_us = time_us_32();
+    db->idle_us = 0;
+    db->wakes = 0;
+    db->latency_sum_us = 0;
+    db->latency_max_us = 0;
+    db->latency_count = 0;
+}
+
+void doorbell_ring(doorbell_t* db) {
+    // 最初の通知の時刻だけを残す
+    if (!db->pending) {
+        db->rung_us = time_us_32();
+        __compiler_memory_barrier();
+        db->pending = true;
+    }
+    __sev();
+}
+
+bool doorbell_wait(doorbell_t* db) {
+    return doorbell_wait_until(db, make_timeout_time_us(db->timeout_us));
+}
+
+bool doorbell_wait_until(doorbell_t* db, absolute_time_t timeout) {
+    if (!db->pending) {
+        uint32_t start_us = time_us_32();
+
+        // SEVはイベントレジスタにラッチされるので、確認とWFEの間に
+        // 鳴らされても取りこぼさない
+        while (!db->pending) {
+            if (best_effort_wfe_or_timeout(timeout)) {
+                break;
+            }
+        }
+
+        db->idle_us += time_us_32() - start_us;
+    }
+
+    if (!db->pending) {
+        return false;
+    }
+
+    db->measure_from_us = db->rung_us;
+    db->measuring = true;
+    __compiler_memory_barrier();
+    db->pending = false;
+    db->wakes++;
+    return true;
+}
+
+void doorbell_mark_dequeued(doorbell_t* db) {
+    if (!db->measuring) {
+        return;
+    }
+    db->measuring = false;
+
+    uint32_t latency_us = time_us_32() - db->measure_from_us;
+    db->latency_sum_us += latency_us;
+    db->latency_count++;
+    if (db->latency_max_us < latency_us) {
+        db->latency_max_us = latency_us;
+    }
+}
+
+void doorbell_take_stats(doorbell_t* db, doorbell_stats_t* stats) {
+    uint32_t now_us = time_us_32();
+    uint32_t window_us = now_us - db->window_start_us;
+
+    stats->window_us = window_us;
+    stats->busy_permille =
+        window_us == 0 || db->idle_us >= window_us
+            ? 0
+            : (uint32_t)((uint64_t)(window_us - db->idle_us) * 1000 /
+                         window_us);
+    stats->wakes = db->wakes;
+    stats->latency_avg_us =
+        db->latency_count == 0 ? 0 : db->latency_sum_us / db->latency_count;
+    stats->latency_max_us = db->latency_max_us;
+
+    db->window_start_us = now_us;
+    db->idle_us = 0;
+    db->wakes = 0;
+    db->latency_sum_us = 0;
+    db->latency_max_us = 0;
+    db->latency_count = 0;
+}
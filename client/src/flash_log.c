@@ -0,0 +1,469 @@
+#include "flash_log.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hardware/flash.h>
+#include <hardware/sync.h>
+#include <pico/platform.h>
+#include <pico/time.h>
+
+#include "crc16.h"
+#include "frame.h"
+#include "logpack.h"
+#include "ring_buf.h"
+
+// SPIで送るフレームの [len 2byte][crc 2byte]
+#define RECORD_PREFIX_SIZE (4)
+
+// これだけ待っても止まらなければ、書き込みを次の機会に回す
+#define PARK_TIMEOUT_US (50000)
+
+// 一度のflash_log_drain_nextで読み飛ばすフレームとチャンクの上限
+#define DRAIN_SCAN_LIMIT (32)
+
+static_assert(FLASH_LOG_BLOCK_SIZE % FLASH_SECTOR_SIZE == 0,
+              "FLASH_LOG_BLOCK_SIZE must be a multiple of the sector size");
+static_assert(FLASH_LOG_BUF_SIZE % FLASH_PAGE_SIZE == 0,
+              "FLASH_LOG_BUF_SIZE must be a multiple of the page size");
+static_assert(FLASH_LOG_WRITE_PAGES * FLASH_PAGE_SIZE <= FLASH_LOG_BUF_SIZE,
+              "FLASH_LOG_WRITE_PAGES does not fit in the buffer");
+#ifdef PICO_FLASH_SIZE_BYTES
+static_assert(FLASH_LOG_OFFSET + FLASH_LOG_SIZE <= PICO_FLASH_SIZE_BYTES,
+              "flash log does not fit in the flash");
+#endif
+
+// リンカが置くプログラムの終わり
+extern char __flash_binary_end;
+
+static volatile bool park_requested = false;
+static volatile bool parked = false;
+static volatile bool park_ready = false;  // 相手がpark_pointを呼び始めた
+static void (*park_hook)(bool parked) = NULL;
+
+static uint32_t get_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+static void put_le32(uint8_t* p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static uint32_t block_offset(uint32_t block) {
+    return FLASH_LOG_OFFSET + block * FLASH_LOG_BLOCK_SIZE;
+}
+
+static const uint8_t* block_ptr(uint32_t block) {
+    return (const uint8_t*)(XIP_BASE + block_offset(block));
+}
+
+// 壊れていない [len][crc][チャンク] ならその長さ、それ以外は0
+// 消したままの0xFFもここで弾かれるので、ブロックの終わりの印はいらない
+static uint32_t record_size(const uint8_t* p, uint32_t avail) {
+    if (avail <= RECORD_PREFIX_SIZE) {
+        return 0;
+    }
+    uint32_t len = (uint32_t)p[0] << 8 | p[1];
+    if (len == 0 || len > avail - RECORD_PREFIX_SIZE) {
+        return 0;
+    }
+    uint16_t crc = (uint16_t)(p[2] << 8 | p[3]);
+    if (crc16(&p[RECORD_PREFIX_SIZE], len) != crc) {
+        return 0;
+    }
+    return RECORD_PREFIX_SIZE + len;
+}
+
+// 相手のコアをRAM上で止めてから、こちらの割り込みも止める
+static bool begin_flash_op(const flash_log_t* log, uint32_t* irq) {
+    if (!park_ready) {
+        // 起動時 (相手がまだ動いていない) 以外は止められるまで待つ
+        if (log->enabled) {
+            return false;
+        }
+    } else {
+        // 前回あきらめた時の相手が戻りきるのを待つ
+        while (parked) {
+            tight_loop_contents();
+        }
+        park_requested = true;
+        if (log->wake) {
+            log->wake();
+        }
+        absolute_time_t timeout = make_timeout_time_us(PARK_TIMEOUT_US);
+        while (!parked) {
+            if (time_reached(timeout)) {
+                park_requested = false;
+                return false;
+            }
+        }
+    }
+    *irq = save_and_disable_interrupts();
+    return true;
+}
+
+static void end_flash_op(uint32_t irq) {
+    restore_interrupts(irq);
+    if (park_requested) {
+        park_requested = false;
+        while (parked) {
+            tight_loop_contents();
+        }
+    }
+}
+
+void __not_in_flash_func(flash_log_park_point)(void) {
+    park_ready = true;
+    if (!park_requested) {
+        return;
+    }
+    uint32_t irq = save_and_disable_interrupts();
+    if (park_hook) {
+        park_hook(true);
+    }
+    parked = true;
+    while (park_requested) {
+        tight_loop_contents();
+    }
+    parked = false;
+    if (park_hook) {
+        park_hook(false);
+    }
+    restore_interrupts(irq);
+}
+
+void flash_log_set_park_hook(void (*hook)(bool parked)) {
+    park_hook = hook;
+}
+
+// 消すのは書く前にセクタずつ行うので、ここでは位置を決めるだけ
+static void open_block(flash_log_t* log, uint32_t block, uint32_t seq) {
+    log->block = block;
+    log->block_seq = seq;
+    log->erased = 0;
+    memset(log->buf, 0xFF, FLASH_LOG_BUF_SIZE);
+    put_le32(&log->buf[0], FLASH_LOG_MAGIC);
+    put_le32(&log->buf[4], seq);
+    log->pos = FLASH_LOG_BLOCK_HEADER_SIZE;
+    log->buf_start = 0;
+    log->dirty = true;
+    log->full = false;
+}
+
+// 次のセクタを一つだけ消す。ブロックを丸ごと消すより一度に止まる時間が短い
+static bool erase_sector(flash_log_t* log) {
+    uint32_t irq;
+    if (!begin_flash_op(log, &irq)) {
+        return false;
+    }
+    flash_range_erase(block_offset(log->block) + log->erased,
+                      FLASH_SECTOR_SIZE);
+    end_flash_op(irq);
+
+    log->erased += FLASH_SECTOR_SIZE;
+    log->opened = true;
+    return true;
+}
+
+// 書いてよいページ数
+// 最後のレコードの直後が消していない古いデータだと続きとして読まれるので、
+// ブロックの終わりまで消すまでは、消した所の最後のページを空けておく
+static uint32_t writable_pages(const flash_log_t* log) {
+    uint32_t limit = log->erased;
+    if (limit < FLASH_LOG_BLOCK_SIZE) {
+        limit = limit >= FLASH_PAGE_SIZE ? limit - FLASH_PAGE_SIZE : 0;
+    }
+    return limit > log->buf_start ? (limit - log->buf_start) / FLASH_PAGE_SIZE
+                                  : 0;
+}
+
+static bool program_pages(flash_log_t* log, uint32_t pages) {
+    uint32_t irq;
+    if (!begin_flash_op(log, &irq)) {
+        return false;
+    }
+    flash_range_program(block_offset(log->block) + log->buf_start, log->buf,
+                        pages * FLASH_PAGE_SIZE);
+    end_flash_op(irq);
+    return true;
+}
+
+// 書き終えたページをbufから落とす
+static void advance(flash_log_t* log, uint32_t pages) {
+    uint32_t done = pages * FLASH_PAGE_SIZE;
+    uint32_t rest = log->pos - log->buf_start - done;
+    memmove(log->buf, &log->buf[done], rest);
+    memset(&log->buf[rest], 0xFF, FLASH_LOG_BUF_SIZE - rest);
+    log->buf_start += done;
+}
+
+bool flash_log_init(flash_log_t* log, void (*wake)(void)) {
+    memset(log, 0, sizeof(*log));
+    for (uint8_t i = 0; i < FLASH_LOG_PRODUCER_COUNT; i++) {
+        ring_buf_init(&log->ingress[i], log->ingress_storage[i],
+                      FLASH_LOG_INGRESS_SIZE);
+    }
+    log->wake = wake;
+
+    // プログラムが大きくなってログの領域に食い込んだら使わない
+    if ((uintptr_t)&__flash_binary_end - XIP_BASE > FLASH_LOG_OFFSET) {
+        return false;
+    }
+
+    // 通し番号が最も大きいブロックの次から書く
+    uint32_t newest = FLASH_LOG_BLOCK_COUNT - 1;
+    uint32_t seq = 0;
+    for (uint32_t block = 0; block < FLASH_LOG_BLOCK_COUNT; block++) {
+        const uint8_t* p = block_ptr(block);
+        if (get_le32(p) == FLASH_LOG_MAGIC && get_le32(&p[4]) >= seq) {
+            newest = block;
+            seq = get_le32(&p[4]);
+        }
+    }
+
+    // 消去は待たせず、ブロックを使い切った時と同じくflash_log_taskで
+    // セクタずつ行う。それまでのフレームはリングに溜めておく
+    log->block = newest;
+    log->block_seq = seq;
+    log->full = true;
+    log->enabled = true;
+    return true;
+}
+
+bool flash_log_append(flash_log_t* log, const uint8_t* frame, uint16_t len) {
+    if (!log->enabled) {
+        return false;
+    }
+    uint8_t core = get_core_num();
+    if (len > LOGPACK_CHUNK_SIZE ||
+        !ring_buf_push(&log->ingress[core], frame, len)) {
+        ++log->drops[core];
+        return false;
+    }
+    return true;
+}
+
+// 溜めたフレームを圧縮して [len][crc][チャンク] にする
+static void seal_stage(flash_log_t* log) {
+    uint32_t start_us = time_us_32();
+    size_t n = logpack_encode(&log->work, log->stage, log->stage_len,
+                              &log->chunk[RECORD_PREFIX_SIZE], LOGPACK_BOUND);
+    uint32_t elapsed_us = time_us_32() - start_us;
+
+    log->stats_raw_bytes += log->stage_len;
+    log->stage_len = 0;
+    if (n == 0) {
+        return;
+    }
+
+    uint16_t crc = crc16(&log->chunk[RECORD_PREFIX_SIZE], n);
+    log->chunk[0] = (n >> 8) & 0xFF;
+    log->chunk[1] = n & 0xFF;
+    log->chunk[2] = crc >> 8;
+    log->chunk[3] = crc & 0xFF;
+    log->chunk_len = RECORD_PREFIX_SIZE + n;
+
+    log->stats_stored_bytes += log->chunk_len;
+    ++log->stats_chunks;
+    log->stats_encode_us_sum += elapsed_us;
+    if (elapsed_us > log->stats_encode_us_max) {
+        log->stats_encode_us_max = elapsed_us;
+    }
+}
+
+void flash_log_task(flash_log_t* log, uint64_t now_us) {
+    if (!log->enabled) {
+        return;
+    }
+
+    // 受け取ったフレームを溜め、入り切らなくなるか時間が経てばチャンクにする
+    for (uint8_t i = 0; i < FLASH_LOG_PRODUCER_COUNT; i++) {
+        ring_buf_t* rb = &log->ingress[i];
+        for (uint16_t len;
+             log->chunk_len == 0 && (len = ring_buf_peek_len(rb)) != 0;) {
+            if (log->stage_len + len > LOGPACK_CHUNK_SIZE) {
+                seal_stage(log);
+                break;
+            }
+            if (log->stage_len == 0) {
+                log->stage_us = now_us;
+            }
+            ring_buf_pop(rb, &log->stage[log->stage_len], len);
+            log->stage_len += len;
+        }
+    }
+    if (log->chunk_len == 0 && log->stage_len != 0 &&
+        now_us - log->stage_us >= FLASH_LOG_FLUSH_US) {
+        seal_stage(log);
+    }
+
+    // チャンクはブロックをまたがせない
+    if (log->chunk_len != 0 && !log->full) {
+        uint32_t fill = log->pos - log->buf_start;
+        if (log->pos + log->chunk_len > FLASH_LOG_BLOCK_SIZE) {
+            log->full = true;
+        } else if (fill + log->chunk_len <= FLASH_LOG_BUF_SIZE) {
+            memcpy(&log->buf[fill], log->chunk, log->chunk_len);
+            log->pos += log->chunk_len;
+            log->chunk_len = 0;
+            log->dirty = true;
+        }
+    }
+
+    uint32_t fill = log->pos - log->buf_start;
+    uint32_t pages = fill / FLASH_PAGE_SIZE;
+    if (pages == 0 && !log->dirty && log->full) {
+        open_block(log, (log->block + 1) % FLASH_LOG_BLOCK_COUNT,
+                   log->block_seq + 1);
+        return;
+    }
+
+    // 書く位置より一つ先のセクタまで消しておく。一度に消すのは一つだけ
+    if (log->erased < FLASH_LOG_BLOCK_SIZE &&
+        log->erased < log->pos + FLASH_SECTOR_SIZE) {
+        erase_sector(log);
+        return;
+    }
+    uint32_t writable = writable_pages(log);
+    if (writable == 0) {
+        return;
+    }
+
+    if (pages == 0) {
+        if (!log->dirty) {
+            return;
+        }
+        if (!log->full && now_us - log->flushed_us < FLASH_LOG_FLUSH_US) {
+            return;
+        }
+        // 端数のページを0xFFで埋めて書く。続きは同じページに書き足せる
+        if (program_pages(log, 1)) {
+            log->flushed_us = now_us;
+            log->dirty = false;
+        }
+        return;
+    }
+
+    if (pages > FLASH_LOG_WRITE_PAGES) {
+        pages = FLASH_LOG_WRITE_PAGES;
+    }
+    if (pages > writable) {
+        pages = writable;
+    }
+    if (program_pages(log, pages)) {
+        log->flushed_us = now_us;
+        advance(log, pages);
+        log->dirty = log->pos != log->buf_start;
+    }
+}
+
+bool flash_log_exec(flash_log_t* log, void (*func)(void*), void* param) {
+    uint32_t irq;
+    if (!begin_flash_op(log, &irq)) {
+        return false;
+    }
+    func(param);
+    end_flash_op(irq);
+    return true;
+}
+
+void flash_log_take_stats(flash_log_t* log, flash_log_stats_t* stats) {
+    stats->raw_bytes = log->stats_raw_bytes;
+    stats->stored_bytes = log->stats_stored_bytes;
+    stats->chunks = log->stats_chunks;
+    stats->encode_us_avg = log->stats_chunks == 0
+                               ? 0
+                               : log->stats_encode_us_sum / log->stats_chunks;
+    stats->encode_us_max = log->stats_encode_us_max;
+    stats->drops = 0;
+    for (uint8_t i = 0; i < FLASH_LOG_PRODUCER_COUNT; i++) {
+        stats->drops += log->drops[i];
+    }
+
+    log->stats_raw_bytes = 0;
+    log->stats_stored_bytes = 0;
+    log->stats_chunks = 0;
+    log->stats_encode_us_sum = 0;
+    log->stats_encode_us_max = 0;
+}
+
+void flash_log_drain(flash_log_t* log, uint64_t since_us) {
+    if (!log->enabled) {
+        return;
+    }
+    // 書いているブロックの次が最も古い
+    log->draining = true;
+    log->drain_since_us = since_us;
+    log->drain_block = (log->block + 1) % FLASH_LOG_BLOCK_COUNT;
+    log->drain_pos = FLASH_LOG_BLOCK_HEADER_SIZE;
+    log->drain_left = FLASH_LOG_BLOCK_COUNT;
+    log->drain_len = 0;
+    log->drain_off = 0;
+}
+
+// 次のチャンクを戻す。ブロックの終わりなら次のブロックへ進む
+static void drain_load(flash_log_t* log) {
+    const uint8_t* p = block_ptr(log->drain_block);
+    uint32_t len = 0;
+    if (get_le32(p) == FLASH_LOG_MAGIC) {
+        len = record_size(&p[log->drain_pos],
+                          FLASH_LOG_BLOCK_SIZE - log->drain_pos);
+    }
+    if (len == 0) {
+        if (--log->drain_left == 0) {
+            log->draining = false;
+        }
+        log->drain_block = (log->drain_block + 1) % FLASH_LOG_BLOCK_COUNT;
+        log->drain_pos = FLASH_LOG_BLOCK_HEADER_SIZE;
+        return;
+    }
+
+    // 戻せなければ飛ばす
+    log->drain_len = logpack_decode(
+        &log->work, &p[log->drain_pos + RECORD_PREFIX_SIZE],
+        len - RECORD_PREFIX_SIZE, log->drain_buf, LOGPACK_CHUNK_SIZE);
+    log->drain_off = 0;
+    log->drain_pos += len;
+}
+
+uint16_t flash_log_drain_next(flash_log_t* log, uint8_t* out, uint16_t size) {
+    for (uint32_t scan = 0; log->draining && scan < DRAIN_SCAN_LIMIT;
+         scan++) {
+        if (log->drain_off >= log->drain_len) {
+            drain_load(log);
+            continue;
+        }
+
+        const uint8_t* rec = &log->drain_buf[log->drain_off];
+        uint32_t len = RECORD_PREFIX_SIZE + ((uint32_t)rec[0] << 8 | rec[1]);
+        log->drain_off += len;
+
+        frame_header_t header;
+        if (len > size || !frame_header_read(&rec[RECORD_PREFIX_SIZE],
+                                             len - RECORD_PREFIX_SIZE,
+                                             &header)) {
+            continue;
+        }
+        // 起動からの時間のままのものは、ホストの時刻と比べられない
+        if (log->drain_since_us != 0 &&
+            (!(header.flags & FRAME_FLAG_SYNCED) ||
+             header.timestamp_us < log->drain_since_us)) {
+            continue;
+        }
+
+        memcpy(out, rec, len);
+        out[RECORD_PREFIX_SIZE + 1] |= FRAME_FLAG_REPLAY;
+        uint16_t crc =
+            crc16(&out[RECORD_PREFIX_SIZE], len - RECORD_PREFIX_SIZE);
+        out[2] = crc >> 8;
+        out[3] = crc & 0xFF;
+        return len;
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+#include "frame.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "topic.h"
+
+static uint16_t seq_table[TOPIC_COUNT];
+
+void frame_header_write(uint8_t* out, uint8_t flags, uint8_t topic,
+                        uint16_t seq, uint64_t timestamp_us) {
+    out[0] = FRAME_VERSION;
+    out[1] = flags;
+    out[2] = topic;
+    out[3] = (uint8_t)(seq >> 8);
+    out[4] = (uint8_t)(seq & 0xFF);
+    for (int i = 0; i < 8; i++) {
+        out[5 + i] = (uint8_t)(timestamp_us >> (56 - 8 * i));
+    }
+}
+
+bool frame_header_read(const uint8_t* in, size_t len, frame_header_t* header) {
+    if (len < FRAME_HEADER_SIZE || in[0] != FRAME_VERSION) {
+        return false;
+    }
+    header->version = in[0];
+    header->flags = in[1];
+    header->topic = in[2];
+    header->seq = (uint16_t)(in[3] << 8 | in[4]);
+    header->timestamp_us = 0;
+    for (int i = 0; i < 8; i++) {
+        header->timestamp_us = header->timestamp_us << 8 | in[5 + i];
+    }
+    return true;
+}
+
+uint16_t frame_next_seq(uint8_t topic) {
+    if (topic >= TOPIC_COUNT) {
+        topic = topic_unknown;
+    }
+    return seq_table[topic]++;
+}
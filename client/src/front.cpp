@@ -13,24 +13,47 @@
 #include <pico/mutex.h>
 #include <pico/stdio.h>
 #include <pico/time.h>
-#include <pico/util/queue.h>
 
 #include <cJSON.h>
 #include <cmp.h>
 
-// #include "bme280.h"
-// #include "bno055.h"
+#include "adc_block.h"
+#include "bme280.h"
+#include "bno055.h"
+#include "boot_seq.h"
+#include "calib_store.h"
 #include "crc16.h"
+#include "doorbell.h"
+#include "flash_log.h"
+#include "frame.h"
+#include "i2c_dma.h"
+#include "key.h"
 #include "mcp3208.h"
+#include "meter_link.h"
+#include "ring_buf.h"
+#include "rs485.h"
+#include "rs485_bus.h"
+#include "sd_card.h"
+#include "sd_log.h"
 #include "shift_out.h"
 #include "spi_slave.h"
+#include "timesync.h"
+#include "topic.h"
 
+#include "descriptor.hpp"
 #include "json.hpp"
 #include "meter.hpp"
 #include "msgpack.hpp"
 
 #define STR_SIZE (512)
-#define QUEUE_SIZE (32)
+#define RING_SIZE (4096)
+
+#define CORE1_WAKE_TIMEOUT_US (10'000)
+#define DIAG_INTERVAL_MS (1000)
+
+// ダンパーのストロークは1kHzで取り込み、128サンプルずつまとめて送る
+#define STROKE_BLOCK_INTERVAL_US (1000)
+#define STROKE_BLOCK_SAMPLES (128)
 
 #define SPI_ID (spi0)
 #define SPI_BAUD (1'000'000)
@@ -38,12 +61,36 @@
 #define I2C_ID (i2c0)
 #define I2C_BAUD (400'000)
 #define I2C_ADDR_BNO055 (0x28)
+// 解析で使う加速度と角速度だけを読んで送る
+#define BNO055_FIELDS (BNO055_FIELD_ACCEL | BNO055_FIELD_GYRO)
+// 400kHzで46byte読んでも1.2ms程度
+#define BNO055_TIMEOUT_US (2000)
 
 #define UART_ID (uart1)
-#define UART_BAUD (115'200)
+#define UART_BAUD (RS485_BAUD)
 
 #define PIO_ID (pio0)
 
+#define SD_BAUD (20'000'000)
+
+// これまでに準備できなければその機器は使わない
+#define BOOT_TIMEOUT_FLASH_US (1'000'000)
+// SDはFATを少しずつ読むので、大きなカードでは数秒かかることがある
+#define BOOT_TIMEOUT_SD_US (10'000'000)
+// BNO055は電源を入れてから応答するまで650ms程度かかる
+#define BOOT_TIMEOUT_BNO055_US (1'500'000)
+#define BOOT_TIMEOUT_BME280_US (100'000)
+#define BOOT_POLL_BNO055_US (10'000)
+#define BOOT_POLL_BME280_US (1'000)
+// 較正し終えたかを見に行く間隔
+#define BNO055_CALIB_POLL_US (1'000'000)
+
+// メーターの表示を切り替えるのは一周期 (2.5ms) ごと
+#define METER_REFRESH_HZ (400)
+#define METER_BRIGHTNESS (SHIFT_OUT_SUBFRAMES)
+// 一組 (160ms) の前半だけ点ける
+#define METER_BLINK_PATTERN (0x00000000FFFFFFFFull)
+
 #define PIN_SPI_SCK (2)
 #define PIN_SPI_TX (3)
 #define PIN_SPI_RX (4)
@@ -62,6 +109,14 @@
 #define PIN_UART_RX (21)
 #define PIN_RS485_ENABLE (22)
 
+#define PIN_SPI_SLAVE_DATA_READY (14)
+
+// ハードウェアのSPIに使えるピンが残っていないので、PIOでSPIを作る
+#define PIN_SD_CS (15)
+#define PIN_SD_SCK (16)
+#define PIN_SD_MOSI (17)
+#define PIN_SD_MISO (28)
+
 #define PIN_LED (25)
 
 bi_decl(bi_3pins_with_func(PIN_SPI_SCK, PIN_SPI_TX, PIN_SPI_RX, GPIO_FUNC_SPI));
@@ -72,6 +127,9 @@ bi_decl(bi_1pin_with_name(PIN_74HC595_DATA, "74HC595 data"));
 bi_decl(bi_1pin_with_name(PIN_74HC595_CLOCK, "74HC595 clock"));
 bi_decl(bi_1pin_with_name(PIN_74HC595_LATCH, "74HC595 latch"));
 bi_decl(bi_2pins_with_func(PIN_UART_TX, PIN_UART_RX, GPIO_FUNC_UART));
+bi_decl(bi_1pin_with_name(PIN_SPI_SLAVE_DATA_READY, "SPI slave data ready"));
+bi_decl(bi_4pins_with_names(PIN_SD_CS, "SD CS", PIN_SD_SCK, "SD SCK",
+                            PIN_SD_MOSI, "SD MOSI", PIN_SD_MISO, "SD MISO"));
 bi_decl(bi_1pin_with_name(PIN_LED, "LED"));
 
 typedef struct {
@@ -109,32 +167,131 @@ static size_t mem_write(cmp_ctx_t* ctx, const void* data, size_t count) {
     return count;
 }
 
-queue_t uart_queue;
-
-// shift_out_dev_t shift_out = {
-//     .pio = PIO_ID,
-//     .pin_data = PIN_74HC595_DATA,
-//     .pin_clock = PIN_74HC595_CLOCK,
-//     .pin_latch = PIN_74HC595_LATCH,
-// };
-
-void on_uart_rx() {
-    static char buf[STR_SIZE];
-    static int index = 0;
-
-    while (uart_is_readable(UART_ID)) {
-        uint8_t ch = uart_getc(UART_ID);
-        buf[index] = ch;
-        if (ch == '\n' || index >= STR_SIZE - 1) {
-            buf[index] = '\0';
-            queue_try_add(&uart_queue, &buf);
-            index = 0;
-        } else {
-            ++index;
-        }
+ring_buf_t uart_ring;
+uint8_t uart_ring_storage[RING_SIZE];
+
+doorbell_t core1_doorbell;
+
+flash_log_t flash_log;
+
+sd_card_dev_t sd_card = {
+    .pio = PIO_ID,
+    .pin_sck = PIN_SD_SCK,
+    .pin_mosi = PIN_SD_MOSI,
+    .pin_miso = PIN_SD_MISO,
+    .pin_cs = PIN_SD_CS,
+    .baud = SD_BAUD,
+};
+sd_log_t sd_log;
+
+i2c_dma_bus_t i2c_bus = {
+    .i2c_id = I2C_ID,
+    .pin_sda = PIN_I2C_SDA,
+    .pin_scl = PIN_I2C_SCL,
+    .baud = I2C_BAUD,
+};
+
+bno055_dev_t bno055 = {
+    .i2c_id = I2C_ID,
+    .addr = I2C_ADDR_BNO055,
+};
+
+// 較正値を残す手順の段階と、次に進める時刻
+// 起動時に書き戻せていれば、その較正値を使い続けて残し直さない
+uint8_t bno055_calib_step = 0;
+uint64_t bno055_calib_wait_until_us = 0;
+bool bno055_calib_saved = false;
+
+// BNO055から読んでいる途中の値と、読み始めた時刻
+uint8_t acc_raw[BNO055_BLOCK_SIZE];
+absolute_time_t acc_time;
+
+bme280_dev_t bme280 = {
+    .spi_id = SPI_ID,
+    .pin_cs = PIN_SPI_CS_BME280,
+};
+bme280_calib_data_t bme280_calib;
+
+// 機器の初期化は待たずに並べて進め、準備できたものから使う
+boot_seq_t boot;
+uint8_t boot_id_bno055 = BOOT_SEQ_MAX_DEVS;
+
+// 最初にA/Dを読んだ時刻と、core1がホストに応えられるようになった時刻
+uint64_t first_sample_us = 0;
+volatile uint64_t core1_ready_us = 0;
+
+void wake_core1() {
+    doorbell_ring(&core1_doorbell);
+}
+
+shift_out_dev_t shift_out = {
+    .pio = PIO_ID,
+    .pin_data = PIN_74HC595_DATA,
+    .pin_clock = PIN_74HC595_CLOCK,
+    .pin_latch = PIN_74HC595_LATCH,
+    .len = meter_buf_len,
+    .refresh_hz = METER_REFRESH_HZ,
+};
+
+// core1がリアから受け取り、core0が表示する
+meter_link_t meter_link;
+
+// SPIで最新値を読めるチャンネル。ホストへはディスクリプタで名前を渡す
+// ストロークはA/Dのコード、回転数はrpm、ギアポジションはmVのまま置く
+enum reg_id_t : uint8_t {
+    reg_stroke_front_left,
+    reg_stroke_front_right,
+    reg_meter_rpm,
+    reg_meter_gp,
+    REG_COUNT,
+};
+
+const char* const reg_names[REG_COUNT] = {
+    "stroke/front/left",
+    "stroke/front/right",
+    "meter/rpm",
+    "meter/gp",
+};
+
+// バスにぶら下がっているノード
+const uint8_t bus_nodes[] = {
+    RS485_BUS_ADDR_REAR,
+};
+
+rs485_bus_master_t bus_master;
+rs485_bus_parser_t bus_parser;
+
+// 最後に送り終えた時刻 (時刻合わせのt1)
+volatile uint64_t rs485_tx_done_us = 0;
+
+void on_rs485_tx_done() {
+    rs485_tx_done_us = time_us_64();
+}
+
+void on_rs485_rx(uint8_t ch) {
+    if (!rs485_bus_parser_feed(&bus_parser, ch)) {
+        return;
+    }
+
+    // CRCの合ったフレームだけを、受け取り終えた時刻を付けてcore1に渡す
+    uint64_t now_us = time_us_64();
+    if (ring_buf_push2(&uart_ring, reinterpret_cast<const uint8_t*>(&now_us),
+                       sizeof(now_us), bus_parser.buf,
+                       rs485_bus_parser_len(&bus_parser))) {
+        doorbell_ring(&core1_doorbell);
     }
 }
 
+rs485_dev_t rs485 = {
+    .uart = UART_ID,
+    .pin_tx = PIN_UART_TX,
+    .pin_rx = PIN_UART_RX,
+    .pin_de = PIN_RS485_ENABLE,
+    .baud = UART_BAUD,
+    .tx_done_callback = on_rs485_tx_done,
+    .rx_callback = on_rs485_rx,
+};
+
 // void msg_publish(const char* topic, const char* payload) {
 //     cJSON* root = cJSON_CreateObject();
 //     cJSON_AddStringToObject(root, "topic", topic);
@@ -143,61 +300,685 @@ void on_uart_rx() {
 //     char buf[STR_SIZE];
 //     cJSON_PrintPreallocated(root, buf, STR_SIZE, false);
 //
-//     queue_try_add(&msg_queue, &buf);
+//     ring_buf_push(&msg_ring, buf, strlen(buf));
 //
 //     cJSON_Delete(root);
 // }
 
+// ホストへ送り、フラッシュとSDカードにも残す
+void publish_frame(uint8_t topic, const uint8_t* buf, uint16_t len) {
+    spi_slave_push_bytes(topic, buf, len);
+    flash_log_append(&flash_log, buf, len);
+    sd_log_append(&sd_log, buf, len);
+}
+
+void publish_core1_stats() {
+    doorbell_stats_t stats;
+    doorbell_take_stats(&core1_doorbell, &stats);
+
+    auto msgpack = MsgPack<SPI_SLAVE_BUF_SIZE>("core1/front", 4);
+    msgpack.addTime(get_absolute_time());
+    msgpack.add("busy", stats.busy_permille);
+    msgpack.add("wakes", stats.wakes);
+    msgpack.add("lat_avg", stats.latency_avg_us);
+    msgpack.add("lat_max", stats.latency_max_us);
+
+    if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
+        publish_frame(msgpack.getTopic(), buf, msgpack.getSize());
+    }
+}
+
+void publish_drop_stats() {
+    int16_t num = 0;
+    for (uint8_t topic = 0; topic < TOPIC_COUNT; topic++) {
+        if (spi_slave_get_drops(topic) != 0) {
+            ++num;
+        }
+    }
+    if (num == 0) {
+        return;
+    }
+
+    auto msgpack = MsgPack<SPI_SLAVE_BUF_SIZE>("drop/front", num);
+    msgpack.addTime(get_absolute_time());
+    for (uint8_t topic = 0; topic < TOPIC_COUNT && num > 0; topic++) {
+        if (uint32_t drops = spi_slave_get_drops(topic); drops != 0) {
+            msgpack.add(topic == topic_unknown ? "unknown" : topic_name(topic),
+                        drops);
+            --num;
+        }
+    }
+
+    if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
+        publish_frame(msgpack.getTopic(), buf, msgpack.getSize());
+    }
+}
+
+// メーターのレコードはJSONを通さず、そのままメーターへ渡す
+// ホストへは送らない (同じ値はecuとrpmで送られる)
+void put_meter_record(const rs485_bus_clock_t* clock,
+                      const rs485_bus_record_t* rec) {
+    meter_value_t value;
+    if (!meter_link_unpack(rec->body, rec->len, &value)) {
+        return;
+    }
+    value.input_us = clock->valid
+                         ? rs485_bus_clock_to_master(clock, rec->timestamp_us)
+                         : 0;
+    meter_link_put(&meter_link, &value);
+
+    uint64_t time_us = value.input_us != 0 ? value.input_us : time_us_64();
+    spi_slave_set_reg(reg_meter_rpm, time_us, value.rpm);
+    spi_slave_set_reg(reg_meter_gp, time_us, value.gp_mv);
+}
+
+// リアからのレコード (JSON) をMsgPackにして流す
+// 時刻はリアの時計からフロントの時計、さらにホストの時計に直す
+void publish_record(const rs485_bus_clock_t* clock,
+                    const rs485_bus_record_t* rec) {
+    if (rec->topic == topic_meter) {
+        put_meter_record(clock, rec);
+        return;
+    }
+
+    frame_header_t header = {
+        .version = FRAME_VERSION,
+        .topic = rec->topic,
+        .seq = rec->seq,
+        .timestamp_us = rec->timestamp_us,
+    };
+    if (clock->valid) {
+        bool synced;
+        header.timestamp_us = timesync_to_host(
+            rs485_bus_clock_to_master(clock, header.timestamp_us), &synced);
+        header.flags = synced ? FRAME_FLAG_SYNCED : 0;
+    } else {
+        header.flags = FRAME_FLAG_NODE_CLOCK;
+    }
+    header.flags |= rec->flags & FRAME_FLAGS_ORIGIN;
+
+    const uint8_t* data = rec->body;
+    uint16_t len = rec->len;
+    char str[STR_SIZE];
+    if (len > STR_SIZE - 1) {
+        len = STR_SIZE - 1;
+    }
+    memcpy(str, data, len);
+    str[len] = '\0';
+    printf("%s\n", str);
+    auto msgpack =
+        MsgPack<SPI_SLAVE_BUF_SIZE, encoding::Float32>(str, &header);
+
+    if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
+        publish_frame(msgpack.getTopic(), buf, msgpack.getSize());
+    }
+}
+
+// 全ノードが空なら少し間を空け、そうでなければすぐ次をポーリングする
+absolute_time_t next_poll_time() {
+    return rs485_bus_master_is_idle(&bus_master)
+               ? make_timeout_time_us(RS485_BUS_IDLE_POLL_US)
+               : get_absolute_time();
+}
+
+void publish_sync_stats() {
+    timesync_status_t status;
+    timesync_get_status(&status);
+
+    auto msgpack = MsgPack<SPI_SLAVE_BUF_SIZE>("sync/front", 5);
+    msgpack.addTime(get_absolute_time());
+    msgpack.add("valid", status.valid ? 1 : 0);
+    msgpack.add("offset", status.offset_us);
+    msgpack.add("drift_ppb", status.drift_ppb);
+    msgpack.add("err", status.last_error_us);
+    msgpack.add("steps", status.steps);
+
+    if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
+        publish_frame(msgpack.getTopic(), buf, msgpack.getSize());
+    }
+}
+
+void publish_rear_sync_stats() {
+    const rs485_bus_node_t* node =
+        rs485_bus_master_find(&bus_master, RS485_BUS_ADDR_REAR);
+    if (!node) {
+        return;
+    }
+    const rs485_bus_clock_t* clock = &node->clock;
+
+    auto msgpack = MsgPack<SPI_SLAVE_BUF_SIZE>("sync/rear", 6);
+    msgpack.addTime(get_absolute_time());
+    msgpack.add("valid", clock->valid ? 1 : 0);
+    msgpack.add("offset", clock->offset_us);
+    msgpack.add("delay", clock->delay_us);
+    msgpack.add("err", clock->last_error_us);
+    msgpack.add("samples", clock->samples);
+    msgpack.add("rejected", clock->rejected);
+
+    if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
+        publish_frame(msgpack.getTopic(), buf, msgpack.getSize());
+    }
+}
+
+// キーとトピックの表をホストへ送る
+// ホストはこれを受け取るまで整数のキーを戻せないので、キーは文字列で書く
+// 表ごとに一つのフレームへ収まるだけ載せ、残りは次のフレームで送る
+void publish_descriptor() {
+    const absolute_time_t now = get_absolute_time();
+    describe_table<SPI_SLAVE_BUF_SIZE>("keys", key_count(), key_name, now,
+                                       publish_frame);
+    describe_table<SPI_SLAVE_BUF_SIZE>("topics", TOPIC_COUNT, topic_name,
+                                       now, publish_frame);
+    describe_table<SPI_SLAVE_BUF_SIZE>(
+        "regs", REG_COUNT, [](uint8_t i) { return reg_names[i]; }, now,
+        publish_frame);
+}
+
+// ブロックのチャンネルの並び
+const char* const stroke_front_channels[] = {"left", "right"};
+
+// 溜めたA/Dコードを一つのフレームで送り、次のブロックを始める
+void publish_adc_block(std::string_view topic, adc_block_t* block,
+                       const char* const* channels) {
+    if (adc_block_is_empty(block)) {
+        return;
+    }
+    size_t size = adc_block_finish(block);
+
+    auto msgpack = MsgPack<SPI_SLAVE_BUF_SIZE>(topic, 4);
+    msgpack.addTime(from_us_since_boot(block->base_us));
+    msgpack.addNames("ch", block->channels,
+                     [channels](uint8_t i) { return channels[i]; });
+    msgpack.add("dt", block->interval_us);
+    msgpack.add("n", block->count);
+    msgpack.addBin("codes", block->data, size);
+
+    if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
+        publish_frame(msgpack.getTopic(), buf, msgpack.getSize());
+    }
+    adc_block_reset(block);
+}
+
+// BNO055_FIELDSで選んだ項目の値の数
+constexpr int16_t count_acc_fields(uint32_t mask) {
+    int16_t num = 0;
+    num += mask & BNO055_FIELD_ACCEL ? 3 : 0;
+    num += mask & BNO055_FIELD_MAG ? 3 : 0;
+    num += mask & BNO055_FIELD_GYRO ? 3 : 0;
+    num += mask & BNO055_FIELD_EULER ? 3 : 0;
+    num += mask & BNO055_FIELD_QUATERNION ? 4 : 0;
+    num += mask & BNO055_FIELD_LINEAR_ACCEL ? 3 : 0;
+    num += mask & BNO055_FIELD_GRAVITY ? 3 : 0;
+    num += mask & BNO055_FIELD_TEMP ? 1 : 0;
+    num += mask & BNO055_FIELD_CALIB_STATUS ? 4 : 0;
+    return num;
+}
+
+void publish_acc(absolute_time_t time, const bno055_block_t& block) {
+    auto msgpack = MsgPack<SPI_SLAVE_BUF_SIZE>(
+        "acc", count_acc_fields(BNO055_FIELDS));
+    msgpack.addTime(time);
+    if constexpr (BNO055_FIELDS & BNO055_FIELD_ACCEL) {
+        msgpack.add("ax", block.accel.x);
+        msgpack.add("ay", block.accel.y);
+        msgpack.add("az", block.accel.z);
+    }
+    if constexpr (BNO055_FIELDS & BNO055_FIELD_MAG) {
+        msgpack.add("mx", block.mag.x);
+        msgpack.add("my", block.mag.y);
+        msgpack.add("mz", block.mag.z);
+    }
+    if constexpr (BNO055_FIELDS & BNO055_FIELD_GYRO) {
+        msgpack.add("gx", block.gyro.x);
+        msgpack.add("gy", block.gyro.y);
+        msgpack.add("gz", block.gyro.z);
+    }
+    if constexpr (BNO055_FIELDS & BNO055_FIELD_EULER) {
+        msgpack.add("h", block.euler.heading);
+        msgpack.add("r", block.euler.roll);
+        msgpack.add("p", block.euler.pitch);
+    }
+    if constexpr (BNO055_FIELDS & BNO055_FIELD_QUATERNION) {
+        msgpack.add("qw", block.quaternion.w);
+        msgpack.add("qx", block.quaternion.x);
+        msgpack.add("qy", block.quaternion.y);
+        msgpack.add("qz", block.quaternion.z);
+    }
+    if constexpr (BNO055_FIELDS & BNO055_FIELD_LINEAR_ACCEL) {
+        msgpack.add("lx", block.linear_accel.x);
+        msgpack.add("ly", block.linear_accel.y);
+        msgpack.add("lz", block.linear_accel.z);
+    }
+    if constexpr (BNO055_FIELDS & BNO055_FIELD_GRAVITY) {
+        msgpack.add("x", block.gravity.x);
+        msgpack.add("y", block.gravity.y);
+        msgpack.add("z", block.gravity.z);
+    }
+    if constexpr (BNO055_FIELDS & BNO055_FIELD_TEMP) {
+        msgpack.add("temp", block.temp);
+    }
+    if constexpr (BNO055_FIELDS & BNO055_FIELD_CALIB_STATUS) {
+        msgpack.add("ss", block.calib_status.sys);
+        msgpack.add("sg", block.calib_status.gyro);
+        msgpack.add("sa", block.calib_status.accel);
+        msgpack.add("sm", block.calib_status.mag);
+    }
+
+    if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
+        publish_frame(msgpack.getTopic(), buf, msgpack.getSize());
+    }
+}
+
+// 読めなかった回は送らない。期限切れならバスは解放されている
+void on_acc_read(i2c_dma_result_t result, void* ctx) {
+    if (result != i2c_dma_ok) {
+        return;
+    }
+    bno055_block_t block;
+    bno055_decode_block(BNO055_FIELDS, acc_raw, &block);
+    publish_acc(acc_time, block);
+}
+
+// 全て較正し終えたら、一度だけCONFIGモードにして較正値を読んで残す
+// モードが切り替わるのはboot_seqと同じく時刻で待つので、その間も計測は進む
+// 読む間の30ms程度は融合が止まるので、stepが0の時だけ読み出しを始める
+void save_bno055_calib(bno055_dev_t* dev, uint64_t now_us) {
+    static bno055_calib_data_t calib;
+    static bool calib_read = false;
+    if (bno055_calib_saved || now_us < bno055_calib_wait_until_us ||
+        i2c_dma_is_busy(&i2c_bus)) {
+        return;
+    }
+    switch (bno055_calib_step) {
+        case 0:
+            bno055_calib_wait_until_us = now_us + BNO055_CALIB_POLL_US;
+            if (bno055_calib_status_t status;
+                !bno055_read_calib_status(dev, &status) ||
+                !bno055_is_fully_calibrated(&status) ||
+                !bno055_set_mode(dev, bno055_mode_configmode)) {
+                return;
+            }
+            bno055_calib_wait_until_us = now_us + BNO055_TO_CONFIG_MS * 1000;
+            bno055_calib_step = 1;
+            return;
+        case 1:
+            calib_read = bno055_read_calib_data(dev, &calib);
+            bno055_calib_step = 2;
+            [[fallthrough]];
+        case 2:
+            // NDOFに戻せるまで繰り返す
+            if (!bno055_set_mode(dev, bno055_mode_ndof)) {
+                bno055_calib_wait_until_us = now_us + BOOT_POLL_BNO055_US;
+                return;
+            }
+            bno055_calib_wait_until_us = now_us + BNO055_FROM_CONFIG_MS * 1000;
+            bno055_calib_step = 3;
+            return;
+        default:
+            // 読めなかった時も書けなかった時も、次の周回で読み直す
+            if (calib_read) {
+                bno055_calib_saved =
+                    calib_store_save(&flash_log, &calib, sizeof(calib));
+            }
+            bno055_calib_step = 0;
+            return;
+    }
+}
+
+void publish_i2c_stats() {
+    i2c_dma_stats_t stats;
+    i2c_dma_take_stats(&i2c_bus, &stats);
+
+    auto msgpack = MsgPack<SPI_SLAVE_BUF_SIZE>("i2c/front", 3);
+    msgpack.addTime(get_absolute_time());
+    msgpack.add("ok", stats.ok);
+    msgpack.add("nacks", stats.nacks);
+    msgpack.add("timeouts", stats.timeouts);
+
+    if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
+        publish_frame(msgpack.getTopic(), buf, msgpack.getSize());
+    }
+}
+
+// フラッシュの履歴を、専用のレーンに空きがある分だけ少しずつ流す
+// 取り出した履歴は戻せないので、最も長いフレームが入る時だけ取り出す
+void drain_flash_log() {
+    static uint8_t buf[SPI_SLAVE_BUF_SIZE];
+    const uint32_t need = sizeof(buf) + RING_BUF_HEADER_SIZE + 1;
+    while (flash_log_is_draining(&flash_log) &&
+           spi_slave_replay_room() >= need) {
+        uint16_t len = flash_log_drain_next(&flash_log, buf, sizeof(buf));
+        if (len == 0) {
+            break;
+        }
+        spi_slave_push_bytes(topic_replay, buf, len);
+    }
+}
+
+// フラッシュのログの圧縮率と圧縮にかかる時間、SDカードの書き込みの遅れ
+// flash_log_task、sd_log_taskと同じコアから呼ぶ
+void publish_log_stats() {
+    flash_log_stats_t stats;
+    flash_log_take_stats(&flash_log, &stats);
+    sd_log_stats_t sd_stats;
+    sd_log_take_stats(&sd_log, &sd_stats);
+
+    auto msgpack = MsgPack<SPI_SLAVE_BUF_SIZE>("log/front", 9);
+    msgpack.addTime(get_absolute_time());
+    msgpack.add("raw", stats.raw_bytes);
+    msgpack.add("stored", stats.stored_bytes);
+    msgpack.add("chunks", stats.chunks);
+    msgpack.add("enc_avg", stats.encode_us_avg);
+    msgpack.add("enc_max", stats.encode_us_max);
+    msgpack.add("drops", stats.drops);
+    msgpack.add("sd_bytes", sd_stats.bytes);
+    msgpack.add("sd_lat_max", sd_stats.write_us_max);
+    msgpack.add("sd_drops", sd_stats.drops);
+
+    if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
+        publish_frame(msgpack.getTopic(), buf, msgpack.getSize());
+    }
+}
+
+void publish_meter_stats() {
+    meter_link_stats_t stats;
+    meter_link_take_stats(&meter_link, &stats);
+
+    auto msgpack = MsgPack<SPI_SLAVE_BUF_SIZE>("meter/front", 3);
+    msgpack.addTime(get_absolute_time());
+    msgpack.add("updates", stats.updates);
+    msgpack.add("lat_avg", stats.lat_avg_us);
+    msgpack.add("lat_max", stats.lat_max_us);
+
+    if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
+        publish_frame(msgpack.getTopic(), buf, msgpack.getSize());
+    }
+}
+
+// 新しい値が届いていればメーターに出す
+// シフトレジスタへはDMAが流し続けるので、表示を差し替えるだけで待たない
+// 差し替えられなかった値は次の周回でもう一度出す
+void update_meter() {
+    static meter_value_t value;
+    static bool pending = false;
+
+    if (meter_link_take(&meter_link, &value)) {
+        pending = true;
+    }
+    if (!pending) {
+        return;
+    }
+
+    uint8_t buf[meter_buf_len];
+    uint8_t blink[meter_buf_len];
+    fillBuf(calcGear(value.gp_mv), value.rpm, buf);
+    fillBlink(value.rpm, blink);
+    if (!shift_out_show(&shift_out, buf, blink, METER_BRIGHTNESS,
+                        METER_BLINK_PATTERN)) {
+        return;
+    }
+    pending = false;
+    meter_link_mark_shown(&meter_link, &value, time_us_64());
+}
+
+// 最初のブロックはflash_log_taskが消すので、それを待つだけ
+boot_state_t boot_flash_log(boot_dev_t* dev, uint64_t now_us) {
+    flash_log_t* log = static_cast<flash_log_t*>(dev->ctx);
+    if (!log->enabled) {
+        return boot_failed;
+    }
+    return flash_log_is_open(log) ? boot_ready : boot_pending;
+}
+
+// カードの準備はコマンド一つずつ、ファイルを決めるのはFATを少しずつ読んで進める
+boot_state_t boot_sd(boot_dev_t* dev, uint64_t now_us) {
+    sd_card_dev_t* card = static_cast<sd_card_dev_t*>(dev->ctx);
+    switch (dev->step) {
+        case 0:
+            sd_card_init_start(card);
+            dev->step = 1;
+            return boot_pending;
+        case 1:
+            switch (sd_card_init_step(card)) {
+                case sd_card_init_pending:
+                    return boot_pending;
+                case sd_card_init_failed:
+                    printf("sd log disabled\n");
+                    return boot_failed;
+                case sd_card_init_done:
+                    break;
+            }
+            sd_log_init_start(&sd_log, card);
+            dev->step = 2;
+            return boot_pending;
+        default:
+            // FATは少しずつ読み、書き込みはbusyを待たないので計測は止まらない
+            switch (sd_log_init_step(&sd_log)) {
+                case sd_log_init_pending:
+                    return boot_pending;
+                case sd_log_init_failed:
+                    printf("sd log disabled\n");
+                    return boot_failed;
+                case sd_log_init_done:
+                    break;
+            }
+            printf("sd log: %03lu.BIN\n", (unsigned long)sd_log.number);
+            return boot_ready;
+    }
+}
+
+// 応答するまで待ってから、残しておいた較正値を書き戻してNDOFで動かす
+boot_state_t boot_bno055(boot_dev_t* dev, uint64_t now_us) {
+    bno055_dev_t* bno = static_cast<bno055_dev_t*>(dev->ctx);
+    switch (dev->step) {
+        case 0:
+            if (!bno055_is_chip_id_valid(bno055_get_chip_id(bno))) {
+                boot_seq_wait(dev, now_us, BOOT_POLL_BNO055_US);
+                return boot_pending;
+            }
+            if (!bno055_set_mode(bno, bno055_mode_configmode)) {
+                boot_seq_wait(dev, now_us, BOOT_POLL_BNO055_US);
+                return boot_pending;
+            }
+            boot_seq_wait(dev, now_us, BNO055_TO_CONFIG_MS * 1000);
+            dev->step = 1;
+            return boot_pending;
+        case 1:
+            // 書けなかった時はもう一度書く。較正値が無ければ書かずに進む
+            if (bno055_calib_data_t calib;
+                calib_store_load(&calib, sizeof(calib))) {
+                if (!bno055_write_calib_data(bno, &calib)) {
+                    boot_seq_wait(dev, now_us, BOOT_POLL_BNO055_US);
+                    return boot_pending;
+                }
+                bno055_calib_saved = true;
+            }
+            if (!bno055_set_mode(bno, bno055_mode_ndof)) {
+                boot_seq_wait(dev, now_us, BOOT_POLL_BNO055_US);
+                return boot_pending;
+            }
+            boot_seq_wait(dev, now_us, BNO055_FROM_CONFIG_MS * 1000);
+            dev->step = 2;
+            return boot_pending;
+        default:
+            return boot_ready;
+    }
+}
+
+// リセットしてから較正値を読み終えるまで待ち、測定の設定を書く
+boot_state_t boot_bme280(boot_dev_t* dev, uint64_t now_us) {
+    bme280_dev_t* bme = static_cast<bme280_dev_t*>(dev->ctx);
+    if (dev->step == 0) {
+        bme280_reset(bme);
+        boot_seq_wait(dev, now_us, BOOT_POLL_BME280_US);
+        dev->step = 1;
+        return boot_pending;
+    }
+    if (bme280_is_status_im_update(bme280_get_status(bme))) {
+        boot_seq_wait(dev, now_us, BOOT_POLL_BME280_US);
+        return boot_pending;
+    }
+    if (!bme280_is_chip_id_valid(bme280_get_chip_id(bme))) {
+        return boot_failed;
+    }
+    bme280_get_calib_data(bme, &bme280_calib);
+
+    bme280_settings_t settings = {
+        .osr_t = bme280_osr_x4,
+        .osr_p = bme280_osr_x4,
+        .osr_h = bme280_osr_x4,
+        .filter = bme280_filter_x2,
+        .standby_time = bme280_standby_time_1000ms,
+    };
+    bme280_set_settings(bme, &settings);
+    return boot_ready;
+}
+
+// 起動してからそれぞれが準備できるまでの時間 (us)。諦めた機器は-1
+void publish_boot_timing() {
+    auto msgpack = MsgPack<SPI_SLAVE_BUF_SIZE>("boot/front", 2 + boot.count);
+    msgpack.addTime(get_absolute_time());
+    msgpack.add("adc", first_sample_us);
+    msgpack.add("core1", static_cast<uint64_t>(core1_ready_us));
+    for (uint8_t i = 0; i < boot.count; i++) {
+        const boot_dev_t* dev = &boot.devs[i];
+        msgpack.add(dev->name, dev->state == boot_ready
+                                   ? static_cast<int64_t>(dev->done_us)
+                                   : -1);
+    }
+
+    if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
+        publish_frame(msgpack.getTopic(), buf, msgpack.getSize());
+    }
+}
+
 void core1_main() {
-    uart_init(UART_ID, UART_BAUD);
-    uart_set_format(UART_ID, 8, 1, UART_PARITY_NONE);
-    uart_set_fifo_enabled(UART_ID, true);
-    uart_set_hw_flow(UART_ID, false, false);
-    gpio_set_function(PIN_UART_TX, UART_FUNCSEL_NUM(UART_ID, PIN_UART_TX));
-    gpio_set_function(PIN_UART_RX, UART_FUNCSEL_NUM(UART_ID, PIN_UART_RX));
-
-    int uart_irq = UART_ID == uart0 ? UART0_IRQ : UART1_IRQ;
-    irq_set_exclusive_handler(uart_irq, on_uart_rx);
-    irq_set_enabled(uart_irq, true);
-    uart_set_irq_enables(UART_ID, true, false);
-
-    gpio_init(PIN_RS485_ENABLE);
-    gpio_set_dir(PIN_RS485_ENABLE, GPIO_OUT);
-    gpio_put(PIN_RS485_ENABLE, 0);
+    rs485_bus_parser_init(&bus_parser);
+    rs485_bus_master_init(&bus_master, bus_nodes, count_of(bus_nodes));
+    rs485_init(&rs485);
 
+    spi_slave_set_data_ready(PIN_SPI_SLAVE_DATA_READY, 1, 0);
+    spi_slave_set_reg_count(REG_COUNT);
     spi_slave_init();
+    publish_descriptor();
+    core1_ready_us = time_us_64();
 
-    char str[STR_SIZE];
-    // int gear, rpm;
-    // bool meter_update = false;
+    // [受け取り終えた時刻(8byte)][フレーム]
+    static uint8_t frame_buf[sizeof(uint64_t) + RS485_BUS_FRAME_SIZE];
+    static uint8_t poll_buf[RS485_BUS_HEADER_SIZE + RS485_BUS_POLL_SIZE +
+                            RS485_BUS_CRC_SIZE];
+
+    // polling中は応答の期限、それ以外は次にポーリングする時刻
+    bool polling = false;
+    bool timing = false;  // 送ったのがtime_req
+    auto poll_at = get_absolute_time();
+    auto time_next = get_absolute_time();
+
+    auto diag_next = make_timeout_time_ms(DIAG_INTERVAL_MS);
 
     for (;;) {
-        if (queue_try_remove(&uart_queue, &str)) {
-            printf("%s\n", str);
-            auto msgpack = MsgPack<SPI_SLAVE_BUF_SIZE>(str);
+        doorbell_wait_until(
+            &core1_doorbell,
+            absolute_time_min(polling ? poll_at
+                                      : absolute_time_min(poll_at, time_next),
+                              diag_next));
+
+        while (uint16_t len =
+                   ring_buf_pop(&uart_ring, frame_buf, sizeof(frame_buf))) {
+            doorbell_mark_dequeued(&core1_doorbell);
+
+            uint64_t rx_us;
+            memcpy(&rx_us, frame_buf, sizeof(rx_us));
 
-            if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
-                spi_slave_push_bytes(buf);
+            rs485_bus_frame_t frame;
+            if (len < sizeof(rx_us) ||
+                !rs485_bus_decode(&frame_buf[sizeof(rx_us)],
+                                  len - sizeof(rx_us), &frame)) {
+                continue;
             }
 
-            // auto gear_opt = parseGear(str);
-            // if (gear_opt) {
-            //     gear = *gear_opt;
-            //     meter_update = true;
-            // }
-            //
-            // auto rpm_opt = parseRPM(str);
-            // if (rpm_opt) {
-            //     rpm = *rpm_opt;
-            //     meter_update = true;
-            // }
-            //
-            // if (meter_update) {
-            //     uint8_t buf[6];
-            //     fillBuf(gear, rpm, buf);
-            //     shift_out_send(&shift_out, buf, 6);
-            //     meter_update = false;
-            // }
+            if (frame.type == rs485_bus_type_time_resp) {
+                if (polling && timing &&
+                    rs485_bus_master_on_time(&bus_master, &frame,
+                                             rs485_tx_done_us, rx_us)) {
+                    polling = false;
+                    poll_at = get_absolute_time();
+                }
+                continue;
+            }
+            if (frame.type != rs485_bus_type_data) {
+                continue;
+            }
+
+            if (polling && !timing &&
+                rs485_bus_master_on_data(&bus_master, &frame)) {
+                polling = false;
+                poll_at = next_poll_time();
+            }
+
+            const rs485_bus_node_t* node =
+                rs485_bus_master_find(&bus_master, frame.addr);
+            if (!node) {
+                continue;
+            }
+            uint16_t pos = RS485_BUS_DATA_HEADER_SIZE;
+            rs485_bus_record_t rec;
+            while (rs485_bus_next_record(&frame, &pos, &rec)) {
+                publish_record(&node->clock, &rec);
+            }
+        }
+
+        if (polling && time_reached(poll_at)) {
+            if (!timing) {
+                rs485_bus_master_on_timeout(&bus_master);
+            }
+            polling = false;
+            poll_at = next_poll_time();
+        }
+
+        // 応答を待っていない間なら、フラッシュに書き込む間止まっていられる
+        if (!polling && !rs485_is_busy(&rs485)) {
+            flash_log_park_point();
+        }
+
+        // 時刻合わせはポーリングの合間に割り込ませる
+        if (!polling && time_reached(time_next) && !rs485_is_busy(&rs485)) {
+            uint8_t addr;
+            uint8_t seq;
+            rs485_bus_master_next_time(&bus_master, &addr, &seq);
+            size_t len = rs485_bus_make_time_req(poll_buf, addr, seq);
+            if (rs485_send(&rs485, poll_buf, len)) {
+                polling = true;
+                timing = true;
+                poll_at = make_timeout_time_us(rs485_bus_master_timeout_us(
+                    RS485_BUS_TIME_RESP_SIZE, rs485.baud));
+            }
+            time_next = make_timeout_time_us(RS485_BUS_TIME_INTERVAL_US);
+        }
+
+        if (!polling && time_reached(poll_at) && !rs485_is_busy(&rs485)) {
+            uint8_t addr;
+            uint16_t credit;
+            rs485_bus_master_next(&bus_master, &addr, &credit);
+            size_t len = rs485_bus_make_poll(poll_buf, addr, credit);
+            if (rs485_send(&rs485, poll_buf, len)) {
+                polling = true;
+                timing = false;
+                poll_at = make_timeout_time_us(
+                    rs485_bus_master_timeout_us(credit, rs485.baud));
+            }
+        }
+
+        if (spi_slave_take_describe_request()) {
+            publish_descriptor();
+        }
+
+        if (time_reached(diag_next)) {
+            publish_core1_stats();
+            publish_drop_stats();
+            publish_sync_stats();
+            publish_rear_sync_stats();
+            diag_next = delayed_by_ms(diag_next, DIAG_INTERVAL_MS);
         }
     }
 }
@@ -223,12 +1004,6 @@ int main() {
     gpio_set_dir(PIN_SPI_CS_BME280, GPIO_OUT);
     gpio_put(PIN_SPI_CS_BME280, 1);
 
-    i2c_init(I2C_ID, I2C_BAUD);
-    gpio_set_function(PIN_I2C_SDA, GPIO_FUNC_I2C);
-    gpio_set_function(PIN_I2C_SCL, GPIO_FUNC_I2C);
-    gpio_pull_up(PIN_I2C_SDA);
-    gpio_pull_up(PIN_I2C_SCL);
-
     gpio_init(PIN_LED);
     gpio_set_dir(PIN_LED, GPIO_OUT);
     gpio_put(PIN_LED, 0);
@@ -243,62 +1018,71 @@ int main() {
         .pin_cs = PIN_SPI_CS_MCP3208_2,
     };
 
-    // bme280_dev_t bme280 = {
-    //     .spi_id = SPI_ID,
-    //     .pin_cs = PIN_SPI_CS_BME280,
-    // };
-    //
-    // bme280_reset(&bme280);
-    //
-    // do {
-    //     sleep_ms(1);
-    // } while (bme280_is_status_im_update(bme280_get_status(&bme280)));
-    //
-    // if (uint8_t chip_id = bme280_get_chip_id(&bme280);
-    //     bme280_is_chip_id_valid(chip_id)) {
-    //     printf("chip_id: %#x is valid\n", chip_id);
-    // }
-    //
-    // bme280_calib_data_t calib_data;
-    // bme280_get_calib_data(&bme280, &calib_data);
-    //
-    // bme280_settings_t settings = {
-    //     .osr_t = bme280_osr_x4,
-    //     .osr_p = bme280_osr_x4,
-    //     .osr_h = bme280_osr_x4,
-    //     .filter = bme280_filter_x2,
-    //     .standby_time = bme280_standby_time_1000ms,
-    // };
-    // bme280_set_settings(&bme280, &settings);
-
-    // bno055_dev_t bno055 = {
-    //     .i2c_id = I2C_ID,
-    //     .addr = I2C_ADDR_BNO055,
-    // };
-
-    // sleep_ms(1000);
-
-    // if (uint8_t chip_id = bno055_get_chip_id(&bno055);
-    //     bno055_is_chip_id_valid(chip_id)) {
-    //     printf("chip_id: %#x is valid\n", chip_id);
-    // }
-    //
-    // bno055_set_mode(&bno055, bno055_mode_ndof);
-    // sleep_ms(50);
-
-    // shift_out_init(&shift_out);
+    shift_out_init(&shift_out);
 
     // bool is_bme280_measure = false;
 
-    queue_init(&uart_queue, STR_SIZE, QUEUE_SIZE);
+    meter_link_init(&meter_link);
+    ring_buf_init(&uart_ring, uart_ring_storage, RING_SIZE);
+    doorbell_init(&core1_doorbell, CORE1_WAKE_TIMEOUT_US);
+    if (!flash_log_init(&flash_log, wake_core1)) {
+        printf("flash log disabled\n");
+    }
+    // コア1が止まっている間はCSの割り込みが入らないので、ホストに待ってもらう
+    flash_log_set_park_hook(spi_slave_hold_data_ready);
     multicore_launch_core1(core1_main);
 
+    // 残りの機器はメインループの中で準備し、計測はすぐに始める
+    uint64_t now_us = time_us_64();
+    boot_seq_init(&boot);
+    boot_seq_add(&boot, "flash", boot_flash_log, &flash_log, now_us,
+                 BOOT_TIMEOUT_FLASH_US);
+    boot_seq_add(&boot, "sd", boot_sd, &sd_card, now_us, BOOT_TIMEOUT_SD_US);
+    // boot_seq_add(&boot, "bme280", boot_bme280, &bme280, now_us,
+    //              BOOT_TIMEOUT_BME280_US);
+    // boot_id_bno055 = boot_seq_add(&boot, "bno055", boot_bno055, &bno055,
+    //                               now_us, BOOT_TIMEOUT_BNO055_US);
+    // I2CのバスにはBNO055しかつながないので、使う時だけDMAのチャネルを取る
+    if (boot_id_bno055 != BOOT_SEQ_MAX_DEVS) {
+        i2c_dma_init(&i2c_bus);
+    }
+    bool boot_published = false;
+
+    static adc_block_t stroke_block;
+    adc_block_init(&stroke_block, count_of(stroke_front_channels),
+                   STROKE_BLOCK_SAMPLES, STROKE_BLOCK_INTERVAL_US);
+
     char buf[STR_SIZE];
+    auto sample_time = get_absolute_time();
+    auto publish_time = sample_time;
     for (;;) {
-        for (int i = 0; i < 10; i++) {
-            gpio_put(PIN_LED, 1);
+        auto time_start = get_absolute_time();
+        uint16_t left_raw =
+            mcp3208_get_raw(&mcp3208_1, mcp3208_channel_single_ch0);
+        uint16_t right_raw =
+            mcp3208_get_raw(&mcp3208_1, mcp3208_channel_single_ch1);
 
-            auto time_start = get_absolute_time();
+        uint64_t start_us = to_us_since_boot(time_start);
+        if (first_sample_us == 0) {
+            first_sample_us = start_us;
+        }
+        spi_slave_set_reg(reg_stroke_front_left, start_us, left_raw);
+        spi_slave_set_reg(reg_stroke_front_right, start_us, right_raw);
+
+        // 間隔が乱れて追加できなければ、そこまでを送ってから始め直す
+        const uint16_t codes[] = {left_raw, right_raw};
+        if (!adc_block_add(&stroke_block, start_us, codes)) {
+            publish_adc_block("block/stroke/front", &stroke_block,
+                              stroke_front_channels);
+            adc_block_add(&stroke_block, start_us, codes);
+        }
+        if (adc_block_is_full(&stroke_block)) {
+            publish_adc_block("block/stroke/front", &stroke_block,
+                              stroke_front_channels);
+        }
+
+        if (time_reached(publish_time)) {
+            gpio_put(PIN_LED, 1);
 
             // if (i % 10 == 0) {
             //     bme280_set_mode(&bme280, bme280_mode_forced);
@@ -312,12 +1096,13 @@ int main() {
             //
             //     int32_t t_fine = 0;
             //     double temp = bme280_compensate_temperature(
-            //         raw_data.temperature, &calib_data, &t_fine);
+            //         raw_data.temperature, &bme280_calib, &t_fine);
             //     double pres = bme280_compensate_pressure(raw_data.pressure,
-            //                                              &calib_data,
+            //                                              &bme280_calib,
             //                                              t_fine);
             //     double hum = bme280_compensate_humidity(raw_data.humidity,
-            //                                             &calib_data, t_fine);
+            //                                             &bme280_calib,
+            //                                             t_fine);
             //
             //     auto json_env = Json();
             //     json_env.addTime(get_absolute_time());
@@ -328,11 +1113,6 @@ int main() {
             //     msg_publish("env", buf);
             // }
 
-            uint16_t left_raw =
-                mcp3208_get_raw(&mcp3208_1, mcp3208_channel_single_ch0);
-            uint16_t right_raw =
-                mcp3208_get_raw(&mcp3208_1, mcp3208_channel_single_ch1);
-
             double left = left_raw * 3.3 / 4096;
             double right = right_raw * 3.3 / 4096;
 
@@ -344,12 +1124,13 @@ int main() {
             // msg_publish("stroke/front", buf);
             {
                 auto msgpack = MsgPack<SPI_SLAVE_BUF_SIZE>("stroke/front", 2);
-                msgpack.addTime(get_absolute_time());
-                msgpack.add("left", left);
-                msgpack.add("right", right);
+                msgpack.addTime(time_start);
+                // 1LSBが約0.8mVなので1mV単位で十分
+                msgpack.add<encoding::Scaled<int16_t, -3>>("left", left);
+                msgpack.add<encoding::Scaled<int16_t, -3>>("right", right);
 
                 if (uint8_t* buf = msgpack.getBuf(); buf != nullptr) {
-                    spi_slave_push_bytes(buf);
+                    publish_frame(msgpack.getTopic(), buf, msgpack.getSize());
                 }
             }
 
@@ -364,58 +1145,49 @@ int main() {
             // json_af.toBuffer(buf, STR_SIZE);
             // msg_publish("af", buf);
 
-            // bno055_accel_t acc;
-            // bno055_gyro_t gyro;
-            // bno055_mag_t mag;
-            // bno055_euler_t euler;
-            // bno055_quaternion_t quaternion;
-            // bno055_linear_accel_t linear_accel;
-            // bno055_gravity_t gravity;
-            // bno055_calib_status_t status;
-            // bno055_read_accel(&bno055, &acc);
-            // bno055_read_gyro(&bno055, &gyro);
-            // bno055_read_mag(&bno055, &mag);
-            // bno055_read_euler(&bno055, &euler);
-            // bno055_read_quaternion(&bno055, &quaternion);
-            // bno055_read_linear_accel(&bno055, &linear_accel);
-            // bno055_read_gravity(&bno055, &gravity);
-            // bno055_read_calib_status(&bno055, &status);
-
-            // auto json_acc = Json();
-            // json_acc.addTime(get_absolute_time());
-            // json_acc.addNumber("ax", acc.x);
-            // json_acc.addNumber("ay", acc.y);
-            // json_acc.addNumber("az", acc.z);
-            // json_acc.addNumber("gx", gyro.x);
-            // json_acc.addNumber("gy", gyro.y);
-            // json_acc.addNumber("gz", gyro.z);
-            // json_acc.addNumber("mx", mag.x);
-            // json_acc.addNumber("my", mag.y);
-            // json_acc.addNumber("mz", mag.z);
-            // json_acc.addNumber("h", euler.heading);
-            // json_acc.addNumber("r", euler.roll);
-            // json_acc.addNumber("p", euler.pitch);
-            // json_acc.addNumber("qw", quaternion.w);
-            // json_acc.addNumber("qx", quaternion.x);
-            // json_acc.addNumber("qy", quaternion.y);
-            // json_acc.addNumber("qz", quaternion.z);
-            // json_acc.addNumber("lx", linear_accel.x);
-            // json_acc.addNumber("ly", linear_accel.y);
-            // json_acc.addNumber("lz", linear_accel.z);
-            // json_acc.addNumber("x", gravity.x);
-            // json_acc.addNumber("y", gravity.y);
-            // json_acc.addNumber("z", gravity.z);
-            // json_acc.addNumber("ss", status.sys);
-            // json_acc.addNumber("sg", status.gyro);
-            // json_acc.addNumber("sa", status.accel);
-            // json_acc.addNumber("sm", status.mag);
-            // json_acc.toBuffer(buf, STR_SIZE);
-            // msg_publish("acc", buf);
+            // if (boot_seq_is_ready(&boot, boot_id_bno055) &&
+            //     bno055_calib_step == 0) {
+            //     acc_time = get_absolute_time();
+            //     bno055_start_read_block(&bno055, &i2c_bus, BNO055_FIELDS,
+            //                             acc_raw, BNO055_TIMEOUT_US,
+            //                             on_acc_read, nullptr);
+            // }
+
+            publish_log_stats();
+            publish_meter_stats();
+            if (boot_id_bno055 != BOOT_SEQ_MAX_DEVS) {
+                publish_i2c_stats();
+            }
 
             gpio_put(PIN_LED, 0);
 
-            auto time_next = delayed_by_ms(time_start, 10000);
-            sleep_until(time_next);
+            publish_time = delayed_by_ms(publish_time, 10000);
+        }
+
+        flash_log_task(&flash_log, time_us_64());
+        sd_log_task(&sd_log, time_us_64());
+        if (uint64_t since_us; spi_slave_take_drain_request(&since_us)) {
+            flash_log_drain(&flash_log, since_us);
+        }
+        drain_flash_log();
+        update_meter();
+        i2c_dma_task(&i2c_bus);
+        if (boot_seq_is_ready(&boot, boot_id_bno055)) {
+            save_bno055_calib(&bno055, time_us_64());
+        }
+
+        boot_seq_task(&boot, time_us_64());
+        if (!boot_published && boot_seq_is_done(&boot)) {
+            publish_boot_timing();
+            boot_published = true;
+        }
+
+        // 遅れた時は詰めて取らず、ブロックを区切って今から数え直す
+        sample_time = delayed_by_us(sample_time, STROKE_BLOCK_INTERVAL_US);
+        if (time_reached(sample_time)) {
+            sample_time =
+                delayed_by_us(get_absolute_time(), STROKE_BLOCK_INTERVAL_US);
         }
+        sleep_until(sample_time);
     }
 }
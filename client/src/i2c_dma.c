@@ -0,0 +1,178 @@
+#include "i2c_dma.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hardware/dma.h>
+#include <hardware/gpio.h>
+#include <hardware/i2c.h>
+#include <pico/time.h>
+
+// バスを解放する時のSCLの半周期 (100kHz)
+#define RECOVER_HALF_US (5)
+
+static void start(i2c_dma_bus_t* bus, uint8_t addr, uint32_t count,
+                  uint8_t* buf, uint8_t len, uint32_t timeout_us,
+                  i2c_dma_callback_t callback, void* ctx) {
+    i2c_hw_t* hw = i2c_get_hw(bus->i2c_id);
+    hw->enable = 0;
+    hw->tar = addr;
+    hw->enable = 1;
+    (void)hw->clr_tx_abrt;
+    (void)hw->clr_stop_det;
+
+    bus->busy = true;
+    bus->start_us = time_us_32();
+    bus->timeout_us = timeout_us;
+    bus->callback = callback;
+    bus->ctx = ctx;
+
+    uint32_t mask = 1u << bus->dma_tx;
+    if (len != 0) {
+        dma_channel_set_write_addr(bus->dma_rx, buf, false);
+        dma_channel_set_trans_count(bus->dma_rx, len, false);
+        mask |= 1u << bus->dma_rx;
+    }
+    dma_channel_set_read_addr(bus->dma_tx, bus->cmds, false);
+    dma_channel_set_trans_count(bus->dma_tx, count, false);
+    dma_start_channel_mask(mask);
+}
+
+static void stop_dma(i2c_dma_bus_t* bus) {
+    dma_channel_abort(bus->dma_tx);
+    dma_channel_abort(bus->dma_rx);
+}
+
+// コントローラから切り離し、相手がSDAを離すまでSCLを動かしてSTOPを出す
+// Lowは出力、Highは入力にしてプルアップに任せる
+static void recover(i2c_dma_bus_t* bus) {
+    gpio_init(bus->pin_sda);
+    gpio_init(bus->pin_scl);
+    for (uint8_t i = 0; i < I2C_DMA_RECOVER_CLOCKS && !gpio_get(bus->pin_sda);
+         i++) {
+        gpio_set_dir(bus->pin_scl, GPIO_OUT);
+        busy_wait_us_32(RECOVER_HALF_US);
+        gpio_set_dir(bus->pin_scl, GPIO_IN);
+        busy_wait_us_32(RECOVER_HALF_US);
+    }
+    gpio_set_dir(bus->pin_sda, GPIO_OUT);
+    busy_wait_us_32(RECOVER_HALF_US);
+    gpio_set_dir(bus->pin_sda, GPIO_IN);
+    busy_wait_us_32(RECOVER_HALF_US);
+
+    // 途中の状態を残さないよう、コントローラはリセットからやり直す
+    i2c_init(bus->i2c_id, bus->baud);
+    gpio_set_function(bus->pin_sda, GPIO_FUNC_I2C);
+    gpio_set_function(bus->pin_scl, GPIO_FUNC_I2C);
+}
+
+void i2c_dma_init(i2c_dma_bus_t* bus) {
+    i2c_init(bus->i2c_id, bus->baud);
+    gpio_set_function(bus->pin_sda, GPIO_FUNC_I2C);
+    gpio_set_function(bus->pin_scl, GPIO_FUNC_I2C);
+    gpio_pull_up(bus->pin_sda);
+    gpio_pull_up(bus->pin_scl);
+
+    bus->busy = false;
+    bus->stats = (i2c_dma_stats_t){0};
+
+    i2c_hw_t* hw = i2c_get_hw(bus->i2c_id);
+
+    // 読み出しもコマンドを書くことで始まるので、送る側は常に動かす
+    bus->dma_tx = dma_claim_unused_channel(true);
+    dma_channel_config c_tx = dma_channel_get_default_config(bus->dma_tx);
+    channel_config_set_transfer_data_size(&c_tx, DMA_SIZE_32);
+    channel_config_set_dreq(&c_tx, i2c_get_dreq(bus->i2c_id, true));
+    channel_config_set_read_increment(&c_tx, true);
+    channel_config_set_write_increment(&c_tx, false);
+    dma_channel_configure(bus->dma_tx, &c_tx, &hw->data_cmd, bus->cmds, 0,
+                          false);
+
+    bus->dma_rx = dma_claim_unused_channel(true);
+    dma_channel_config c_rx = dma_channel_get_default_config(bus->dma_rx);
+    channel_config_set_transfer_data_size(&c_rx, DMA_SIZE_8);
+    channel_config_set_dreq(&c_rx, i2c_get_dreq(bus->i2c_id, false));
+    channel_config_set_read_increment(&c_rx, false);
+    channel_config_set_write_increment(&c_rx, true);
+    dma_channel_configure(bus->dma_rx, &c_rx, NULL, &hw->data_cmd, 0, false);
+}
+
+bool i2c_dma_read(i2c_dma_bus_t* bus, uint8_t addr, uint8_t reg, uint8_t* buf,
+                  uint8_t len, uint32_t timeout_us,
+                  i2c_dma_callback_t callback, void* ctx) {
+    if (bus->busy || len == 0 || len > I2C_DMA_MAX_LEN) {
+        return false;
+    }
+    bus->cmds[0] = reg;
+    for (uint8_t i = 0; i < len; i++) {
+        uint32_t cmd = I2C_IC_DATA_CMD_CMD_BITS;
+        if (i == 0) {
+            cmd |= I2C_IC_DATA_CMD_RESTART_BITS;
+        }
+        if (i == len - 1) {
+            cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+        }
+        bus->cmds[1 + i] = cmd;
+    }
+    start(bus, addr, 1 + len, buf, len, timeout_us, callback, ctx);
+    return true;
+}
+
+bool i2c_dma_write(i2c_dma_bus_t* bus, uint8_t addr, uint8_t reg,
+                   const uint8_t* data, uint8_t len, uint32_t timeout_us,
+                   i2c_dma_callback_t callback, void* ctx) {
+    if (bus->busy || len > I2C_DMA_MAX_LEN) {
+        return false;
+    }
+    bus->cmds[0] = reg;
+    for (uint8_t i = 0; i < len; i++) {
+        bus->cmds[1 + i] = data[i];
+    }
+    bus->cmds[len] |= I2C_IC_DATA_CMD_STOP_BITS;
+    start(bus, addr, 1 + len, NULL, 0, timeout_us, callback, ctx);
+    return true;
+}
+
+void i2c_dma_task(i2c_dma_bus_t* bus) {
+    if (!bus->busy) {
+        return;
+    }
+    i2c_hw_t* hw = i2c_get_hw(bus->i2c_id);
+    uint32_t raw = hw->raw_intr_stat;
+
+    i2c_dma_result_t result;
+    if (raw & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS) {
+        // 打ち切られるとコントローラはSTOPを出してFIFOを捨てるので、
+        // DMAは来ないDREQを待ったままになる
+        stop_dma(bus);
+        (void)hw->clr_tx_abrt;
+        result = i2c_dma_nack;
+        bus->stats.nacks++;
+    } else if ((raw & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS) &&
+               !dma_channel_is_busy(bus->dma_rx)) {
+        result = i2c_dma_ok;
+        bus->stats.ok++;
+    } else if (time_us_32() - bus->start_us > bus->timeout_us) {
+        stop_dma(bus);
+        recover(bus);
+        result = i2c_dma_timeout;
+        bus->stats.timeouts++;
+    } else {
+        return;
+    }
+
+    bus->busy = false;
+    if (bus->callback) {
+        bus->callback(result, bus->ctx);
+    }
+}
+
+bool i2c_dma_is_busy(const i2c_dma_bus_t* bus) {
+    return bus->busy;
+}
+
+void i2c_dma_take_stats(i2c_dma_bus_t* bus, i2c_dma_stats_t* stats) {
+    *stats = bus->stats;
+    bus->stats = (i2c_dma_stats_t){0};
+}
@@ -0,0 +1,133 @@
+#include "key.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    const char* name;
+    uint8_t len;
+} key_info_t;
+
+#define KEY(s) {s, sizeof(s) - 1}
+
+static const key_info_t key_table[] = {
+    // MsgPack本体の外側
+    KEY("topic"),
+    KEY("payload"),
+    KEY("us"),
+
+    // センサー値
+    KEY("left"),
+    KEY("right"),
+    KEY("inlet_temp"),
+    KEY("outlet_temp"),
+    KEY("ect"),
+    KEY("tps"),
+    KEY("iap"),
+    KEY("gp"),
+    KEY("rpm"),
+    KEY("temp"),
+    KEY("pres"),
+    KEY("hum"),
+    KEY("af"),
+    KEY("ax"),
+    KEY("ay"),
+    KEY("az"),
+    KEY("gx"),
+    KEY("gy"),
+    KEY("gz"),
+    KEY("mx"),
+    KEY("my"),
+    KEY("mz"),
+    KEY("h"),
+    KEY("r"),
+    KEY("p"),
+    KEY("qw"),
+    KEY("qx"),
+    KEY("qy"),
+    KEY("qz"),
+    KEY("lx"),
+    KEY("ly"),
+    KEY("lz"),
+    KEY("x"),
+    KEY("y"),
+    KEY("z"),
+    KEY("ss"),
+    KEY("sg"),
+    KEY("sa"),
+    KEY("sm"),
+
+    // 診断情報
+    KEY("busy"),
+    KEY("wakes"),
+    KEY("lat_avg"),
+    KEY("lat_max"),
+    KEY("valid"),
+    KEY("offset"),
+    KEY("drift_ppb"),
+    KEY("err"),
+    KEY("steps"),
+    KEY("delay"),
+    KEY("samples"),
+    KEY("rejected"),
+
+    // A/Dのブロック
+    KEY("dt"),
+    KEY("n"),
+    KEY("ch"),
+    KEY("codes"),
+
+    // フラッシュのログ
+    KEY("raw"),
+    KEY("stored"),
+    KEY("chunks"),
+    KEY("enc_avg"),
+    KEY("enc_max"),
+    KEY("drops"),
+    KEY("sd_bytes"),
+    KEY("sd_lat_max"),
+    KEY("sd_drops"),
+
+    // メーター
+    KEY("updates"),
+
+    // I2C
+    KEY("ok"),
+    KEY("nacks"),
+    KEY("timeouts"),
+
+    // 起動
+    KEY("adc"),
+    KEY("core1"),
+    KEY("flash"),
+    KEY("sd"),
+    KEY("bno055"),
+    KEY("bme280"),
+};
+
+#define KEY_COUNT (sizeof(key_table) / sizeof(key_table[0]))
+
+static_assert(KEY_COUNT <= KEY_MAX_COUNT, "too many keys");
+
+uint8_t key_from_name(const char* name, size_t len) {
+    if (!name) {
+        return KEY_UNKNOWN;
+    }
+    for (uint8_t id = 0; id < KEY_COUNT; id++) {
+        const key_info_t* k = &key_table[id];
+        if (k->len == len && memcmp(k->name, name, len) == 0) {
+            return id;
+        }
+    }
+    return KEY_UNKNOWN;
+}
+
+const char* key_name(uint8_t id) {
+    return id < KEY_COUNT ? key_table[id].name : "";
+}
+
+uint8_t key_count(void) {
+    return (uint8_t)KEY_COUNT;
+}
@@ -0,0 +1,484 @@
+#include "logpack.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc16.h"
+#include "frame.h"
+#include "lz.h"
+
+#define RECORD_PREFIX_SIZE (4)  // [len 2byte][crc 2byte]
+#define STREAMS_HEADER_SIZE (6)
+#define NO_RECORD (0xFFFF)
+
+#define MODE_RAW (0)    // 本体をそのまま本体列に入れた
+#define MODE_DELTA (1)  // 直前の同じトピックとの数値の差だけを入れた
+
+typedef struct {
+    uint8_t* p;
+    size_t pos;
+    size_t size;
+    bool ok;
+} writer_t;
+
+typedef struct {
+    const uint8_t* p;
+    size_t pos;
+    size_t size;
+    bool ok;
+} reader_t;
+
+// MsgPackの一つの要素
+typedef struct {
+    uint32_t head;  // 形として比べるbyte数
+    uint32_t num;   // headに続く数値のbyte数 (0なら数値ではない)
+    uint32_t size;
+} token_t;
+
+static void put_byte(writer_t* w, uint8_t b) {
+    if (w->pos >= w->size) {
+        w->ok = false;
+        return;
+    }
+    w->p[w->pos++] = b;
+}
+
+static void put_bytes(writer_t* w, const uint8_t* data, size_t len) {
+    if (len > w->size - w->pos) {
+        w->ok = false;
+        return;
+    }
+    memcpy(&w->p[w->pos], data, len);
+    w->pos += len;
+}
+
+static void put_varint(writer_t* w, uint64_t v) {
+    while (v >= 0x80) {
+        put_byte(w, (uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    put_byte(w, (uint8_t)v);
+}
+
+static void put_zigzag(writer_t* w, int64_t v) {
+    put_varint(w, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static uint8_t get_byte(reader_t* r) {
+    if (r->pos >= r->size) {
+        r->ok = false;
+        return 0;
+    }
+    return r->p[r->pos++];
+}
+
+static uint64_t get_varint(reader_t* r) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t b = get_byte(r);
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+    r->ok = false;
+    return 0;
+}
+
+static int64_t get_zigzag(reader_t* r) {
+    uint64_t v = get_varint(r);
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static uint64_t read_be(const uint8_t* p, uint32_t n) {
+    uint64_t v = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+static void write_be(uint8_t* p, uint32_t n, uint64_t v) {
+    for (uint32_t i = n; i > 0; i--) {
+        p[i - 1] = v & 0xFF;
+        v >>= 8;
+    }
+}
+
+static bool next_token(const uint8_t* p, size_t avail, token_t* t) {
+    if (avail == 0) {
+        return false;
+    }
+    uint8_t b = p[0];
+    uint32_t head = 1;
+    uint32_t num = 0;
+    uint32_t extra = 0;
+    uint32_t len_bytes = 0;  // p[1]からの長さのbyte数
+
+    if (b <= 0x9F || b >= 0xE0 || b == 0xC0 || b == 0xC2 || b == 0xC3) {
+        // fixint, fixmap, fixarray, nil, bool
+    } else if (b <= 0xBF) {
+        extra = b & 0x1F;  // fixstr
+    } else {
+        switch (b) {
+            case 0xC4:  // bin8
+            case 0xD9:  // str8
+                head = 2;
+                len_bytes = 1;
+                break;
+            case 0xC5:
+            case 0xDA:
+                head = 3;
+                len_bytes = 2;
+                break;
+            case 0xC6:
+            case 0xDB:
+                head = 5;
+                len_bytes = 4;
+                break;
+            case 0xC7:  // ext8
+                head = 3;
+                len_bytes = 1;
+                break;
+            case 0xC8:
+                head = 4;
+                len_bytes = 2;
+                break;
+            case 0xC9:
+                head = 6;
+                len_bytes = 4;
+                break;
+            case 0xCA:  // float32
+            case 0xCE:  // uint32
+            case 0xD2:  // int32
+                num = 4;
+                break;
+            case 0xCB:  // float64
+            case 0xCF:  // uint64
+            case 0xD3:  // int64
+                num = 8;
+                break;
+            case 0xCC:
+            case 0xD0:
+                num = 1;
+                break;
+            case 0xCD:
+            case 0xD1:
+                num = 2;
+                break;
+            case 0xD4:  // fixext1-8は型を形として、中身を数値として扱う
+                head = 2;
+                num = 1;
+                break;
+            case 0xD5:
+                head = 2;
+                num = 2;
+                break;
+            case 0xD6:
+                head = 2;
+                num = 4;
+                break;
+            case 0xD7:
+                head = 2;
+                num = 8;
+                break;
+            case 0xD8:
+                head = 2;
+                extra = 16;
+                break;
+            case 0xDC:  // array16
+            case 0xDE:  // map16
+                head = 3;
+                break;
+            case 0xDD:
+            case 0xDF:
+                head = 5;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    if (avail < head) {
+        return false;
+    }
+    if (len_bytes != 0) {
+        extra = (uint32_t)read_be(&p[1], len_bytes);
+    }
+    if (extra > avail - head || num > avail - head - extra) {
+        return false;
+    }
+    t->size = head + extra + num;
+    t->num = num;
+    t->head = num != 0 ? head : t->size;
+    return true;
+}
+
+// 数値の値以外が同じか
+static bool same_shape(const uint8_t* a, const uint8_t* b, size_t len) {
+    for (size_t pos = 0; pos < len;) {
+        token_t ta, tb;
+        if (!next_token(&a[pos], len - pos, &ta) ||
+            !next_token(&b[pos], len - pos, &tb) || ta.size != tb.size ||
+            ta.head != tb.head || memcmp(&a[pos], &b[pos], ta.head) != 0) {
+            return false;
+        }
+        pos += ta.size;
+    }
+    return true;
+}
+
+// nbyteの差を符号付きに直す
+static int64_t sign_extend(uint64_t v, uint32_t n) {
+    uint32_t shift = 64 - 8 * n;
+    return (int64_t)(v << shift) >> shift;
+}
+
+static uint16_t record_len(const uint8_t* rec) {
+    return (uint16_t)(rec[0] << 8 | rec[1]);
+}
+
+static uint16_t record_seq(const uint8_t* rec) {
+    return (uint16_t)(rec[RECORD_PREFIX_SIZE + 3] << 8 |
+                      rec[RECORD_PREFIX_SIZE + 4]);
+}
+
+static uint64_t record_time(const uint8_t* rec) {
+    return read_be(&rec[RECORD_PREFIX_SIZE + 5], 8);
+}
+
+static bool get_mode(const logpack_work_t* work, size_t i) {
+    return work->modes[i / 8] & (1u << (i % 8));
+}
+
+size_t logpack_encode(logpack_work_t* work, const uint8_t* records,
+                      size_t len, uint8_t* out, size_t size) {
+    if (len == 0 || len > LOGPACK_CHUNK_SIZE || size < 1 + len) {
+        return 0;
+    }
+
+    // ヘッダ列
+    writer_t w = {work->packed, STREAMS_HEADER_SIZE, LOGPACK_PACKED_SIZE, true};
+    memset(work->last, 0xFF, sizeof(work->last));
+    memset(work->modes, 0, sizeof(work->modes));
+    size_t count = 0;
+    uint64_t prev_us = 0;
+    for (size_t pos = 0; pos < len; count++) {
+        const uint8_t* rec = &records[pos];
+        if (len - pos < RECORD_PREFIX_SIZE + FRAME_HEADER_SIZE ||
+            record_len(rec) < FRAME_HEADER_SIZE ||
+            record_len(rec) > len - pos - RECORD_PREFIX_SIZE ||
+            count >= LOGPACK_MAX_RECORDS) {
+            return 0;
+        }
+        const uint8_t* hdr = &rec[RECORD_PREFIX_SIZE];
+        size_t body_len = record_len(rec) - FRAME_HEADER_SIZE;
+        uint8_t topic = hdr[2];
+
+        uint16_t expected = 0;
+        uint8_t mode = MODE_RAW;
+        if (work->last[topic] != NO_RECORD) {
+            const uint8_t* prev = &records[work->last[topic]];
+            expected = record_seq(prev) + 1;
+            if (record_len(prev) == record_len(rec) &&
+                same_shape(&prev[RECORD_PREFIX_SIZE + FRAME_HEADER_SIZE],
+                           &hdr[FRAME_HEADER_SIZE], body_len)) {
+                mode = MODE_DELTA;
+                work->modes[count / 8] |= 1u << (count % 8);
+            }
+        }
+
+        put_bytes(&w, hdr, 3);  // version, flags, topic
+        put_byte(&w, mode);
+        put_zigzag(&w, (int16_t)(uint16_t)(record_seq(rec) - expected));
+        put_zigzag(&w, (int64_t)(record_time(rec) - prev_us));
+
+        prev_us = record_time(rec);
+        work->last[topic] = (uint16_t)pos;
+        pos += RECORD_PREFIX_SIZE + record_len(rec);
+    }
+    size_t meta_end = w.pos;
+
+    // 数値列
+    memset(work->last, 0xFF, sizeof(work->last));
+    size_t i = 0;
+    for (size_t pos = 0; pos < len; i++) {
+        const uint8_t* rec = &records[pos];
+        uint8_t topic = rec[RECORD_PREFIX_SIZE + 2];
+        if (get_mode(work, i)) {
+            size_t off = RECORD_PREFIX_SIZE + FRAME_HEADER_SIZE;
+            const uint8_t* a = &records[work->last[topic] + off];
+            const uint8_t* b = &rec[off];
+            size_t body_len = record_len(rec) - FRAME_HEADER_SIZE;
+            for (size_t k = 0; k < body_len;) {
+                token_t t;
+                next_token(&b[k], body_len - k, &t);
+                if (t.num != 0) {
+                    uint64_t d = read_be(&b[k + t.head], t.num) -
+                                 read_be(&a[k + t.head], t.num);
+                    put_zigzag(&w, sign_extend(d, t.num));
+                }
+                k += t.size;
+            }
+        }
+        work->last[topic] = (uint16_t)pos;
+        pos += RECORD_PREFIX_SIZE + record_len(rec);
+    }
+    size_t values_end = w.pos;
+
+    // 本体列
+    i = 0;
+    for (size_t pos = 0; pos < len; i++) {
+        const uint8_t* rec = &records[pos];
+        if (!get_mode(work, i)) {
+            size_t body_len = record_len(rec) - FRAME_HEADER_SIZE;
+            put_varint(&w, body_len);
+            put_bytes(&w, &rec[RECORD_PREFIX_SIZE + FRAME_HEADER_SIZE],
+                      body_len);
+        }
+        pos += RECORD_PREFIX_SIZE + record_len(rec);
+    }
+
+    if (w.ok) {
+        uint8_t* p = work->packed;
+        size_t meta_len = meta_end - STREAMS_HEADER_SIZE;
+        size_t values_len = values_end - meta_end;
+        p[0] = count & 0xFF;
+        p[1] = (count >> 8) & 0xFF;
+        p[2] = meta_len & 0xFF;
+        p[3] = (meta_len >> 8) & 0xFF;
+        p[4] = values_len & 0xFF;
+        p[5] = (values_len >> 8) & 0xFF;
+
+        // 縮まなければそのまま入れる
+        size_t n = lz_compress(work->packed, w.pos, &out[1], len, work->table);
+        if (n != 0 && n < len) {
+            out[0] = LOGPACK_METHOD_LZ;
+            return 1 + n;
+        }
+    }
+    out[0] = LOGPACK_METHOD_STORED;
+    memcpy(&out[1], records, len);
+    return 1 + len;
+}
+
+size_t logpack_decode(logpack_work_t* work, const uint8_t* chunk, size_t len,
+                      uint8_t* records, size_t size) {
+    if (len < 1) {
+        return 0;
+    }
+    if (chunk[0] == LOGPACK_METHOD_STORED) {
+        if (len - 1 > size) {
+            return 0;
+        }
+        memcpy(records, &chunk[1], len - 1);
+        return len - 1;
+    }
+    if (chunk[0] != LOGPACK_METHOD_LZ) {
+        return 0;
+    }
+
+    size_t packed_len = lz_decompress(&chunk[1], len - 1, work->packed,
+                                      LOGPACK_PACKED_SIZE);
+    if (packed_len < STREAMS_HEADER_SIZE) {
+        return 0;
+    }
+    const uint8_t* p = work->packed;
+    size_t count = p[0] | (size_t)p[1] << 8;
+    size_t meta_len = p[2] | (size_t)p[3] << 8;
+    size_t values_len = p[4] | (size_t)p[5] << 8;
+    if (meta_len + values_len > packed_len - STREAMS_HEADER_SIZE) {
+        return 0;
+    }
+    size_t meta_end = STREAMS_HEADER_SIZE + meta_len;
+    size_t values_end = meta_end + values_len;
+    reader_t meta = {p, STREAMS_HEADER_SIZE, meta_end, true};
+    reader_t values = {p, meta_end, values_end, true};
+    reader_t bodies = {p, values_end, packed_len, true};
+
+    memset(work->last, 0xFF, sizeof(work->last));
+    writer_t w = {records, 0, size, true};
+    uint64_t prev_us = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t hdr[FRAME_HEADER_SIZE];
+        hdr[0] = get_byte(&meta);
+        hdr[1] = get_byte(&meta);
+        hdr[2] = get_byte(&meta);
+        uint8_t mode = get_byte(&meta);
+        int64_t seq_skip = get_zigzag(&meta);
+        int64_t dt = get_zigzag(&meta);
+        if (!meta.ok || (mode != MODE_RAW && mode != MODE_DELTA)) {
+            return 0;
+        }
+
+        uint8_t topic = hdr[2];
+        const uint8_t* prev = NULL;
+        uint16_t expected = 0;
+        if (work->last[topic] != NO_RECORD) {
+            prev = &records[work->last[topic]];
+            expected = record_seq(prev) + 1;
+        }
+        uint16_t seq = (uint16_t)(expected + seq_skip);
+        uint64_t us = prev_us + (uint64_t)dt;
+        hdr[3] = seq >> 8;
+        hdr[4] = seq & 0xFF;
+        write_be(&hdr[5], 8, us);
+        prev_us = us;
+
+        size_t start = w.pos;
+        for (size_t k = 0; k < RECORD_PREFIX_SIZE; k++) {
+            put_byte(&w, 0);  // 長さとCRCは最後に書く
+        }
+        put_bytes(&w, hdr, FRAME_HEADER_SIZE);
+        size_t body_len;
+        if (mode == MODE_RAW) {
+            body_len = (size_t)get_varint(&bodies);
+            if (!bodies.ok || body_len > bodies.size - bodies.pos) {
+                return 0;
+            }
+            put_bytes(&w, &p[bodies.pos], body_len);
+            bodies.pos += body_len;
+        } else {
+            if (prev == NULL) {
+                return 0;
+            }
+            body_len = record_len(prev) - FRAME_HEADER_SIZE;
+            put_bytes(&w, &prev[RECORD_PREFIX_SIZE + FRAME_HEADER_SIZE],
+                      body_len);
+            if (!w.ok) {
+                return 0;
+            }
+            // 直前の本体に差を足していく
+            uint8_t* b = &records[w.pos - body_len];
+            for (size_t k = 0; k < body_len;) {
+                token_t t;
+                if (!next_token(&b[k], body_len - k, &t)) {
+                    return 0;
+                }
+                if (t.num != 0) {
+                    uint64_t v = read_be(&b[k + t.head], t.num) +
+                                 (uint64_t)get_zigzag(&values);
+                    write_be(&b[k + t.head], t.num, v);
+                }
+                k += t.size;
+            }
+            if (!values.ok) {
+                return 0;
+            }
+        }
+        if (!w.ok) {
+            return 0;
+        }
+
+        uint16_t frame_len = (uint16_t)(FRAME_HEADER_SIZE + body_len);
+        uint16_t crc = crc16(&records[start + RECORD_PREFIX_SIZE], frame_len);
+        records[start] = frame_len >> 8;
+        records[start + 1] = frame_len & 0xFF;
+        records[start + 2] = crc >> 8;
+        records[start + 3] = crc & 0xFF;
+        work->last[topic] = (uint16_t)start;
+    }
+    return w.pos;
+}
@@ -0,0 +1,164 @@
+#include "lz.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NO_POS (0xFFFF)
+#define MAX_OFFSET (0xFFFF)
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// 15を超えた分を255ずつ書く
+static uint8_t* put_length(uint8_t* op, size_t n) {
+    for (; n >= 255; n -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+static size_t length_bytes(size_t n) {
+    return n < 15 ? 0 : (n - 15) / 255 + 1;
+}
+
+// [トークン][リテラル]と、一致があれば[オフセット][一致長の続き]を書く
+static uint8_t* put_sequence(uint8_t* op, const uint8_t* end,
+                             const uint8_t* lit, size_t lit_len,
+                             size_t offset, size_t match_len) {
+    size_t need = 1 + length_bytes(lit_len) + lit_len;
+    if (match_len != 0) {
+        need += 2 + length_bytes(match_len - LZ_MIN_MATCH);
+    }
+    if ((size_t)(end - op) < need) {
+        return NULL;
+    }
+
+    uint8_t* token = op++;
+    *token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15) {
+        op = put_length(op, lit_len - 15);
+    }
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len != 0) {
+        size_t m = match_len - LZ_MIN_MATCH;
+        *token |= (uint8_t)(m < 15 ? m : 15);
+        *op++ = offset & 0xFF;
+        *op++ = (offset >> 8) & 0xFF;
+        if (m >= 15) {
+            op = put_length(op, m - 15);
+        }
+    }
+    return op;
+}
+
+size_t lz_compress(const uint8_t* in, size_t len, uint8_t* out, size_t size,
+                   uint16_t* table) {
+    if (len > MAX_OFFSET) {
+        return 0;
+    }
+    for (size_t i = 0; i < LZ_HASH_SIZE; i++) {
+        table[i] = NO_POS;
+    }
+
+    uint8_t* op = out;
+    const uint8_t* end = out + size;
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= len) {
+        uint32_t v = read32(&in[i]);
+        uint32_t h = hash(v);
+        size_t cand = table[h];
+        table[h] = (uint16_t)i;
+        if (cand == NO_POS || read32(&in[cand]) != v) {
+            ++i;
+            continue;
+        }
+
+        size_t m = LZ_MIN_MATCH;
+        while (i + m < len && in[cand + m] == in[i + m]) {
+            ++m;
+        }
+        op = put_sequence(op, end, &in[anchor], i - anchor, i - cand, m);
+        if (op == NULL) {
+            return 0;
+        }
+        i += m;
+        anchor = i;
+    }
+
+    op = put_sequence(op, end, &in[anchor], len - anchor, 0, 0);
+    if (op == NULL) {
+        return 0;
+    }
+    return (size_t)(op - out);
+}
+
+// 15の時に続く長さを読む
+static const uint8_t* get_length(const uint8_t* ip, const uint8_t* end,
+                                 size_t* n) {
+    uint8_t b;
+    do {
+        if (ip == end) {
+            return NULL;
+        }
+        b = *ip++;
+        *n += b;
+    } while (b == 255);
+    return ip;
+}
+
+size_t lz_decompress(const uint8_t* in, size_t len, uint8_t* out,
+                     size_t size) {
+    const uint8_t* ip = in;
+    const uint8_t* end = in + len;
+    size_t pos = 0;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && (ip = get_length(ip, end, &lit_len)) == NULL) {
+            return 0;
+        }
+        if (lit_len > (size_t)(end - ip) || lit_len > size - pos) {
+            return 0;
+        }
+        memcpy(&out[pos], ip, lit_len);
+        ip += lit_len;
+        pos += lit_len;
+
+        if (ip == end) {
+            break;  // 最後の組
+        }
+
+        if (end - ip < 2) {
+            return 0;
+        }
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t m = token & 0x0F;
+        if (m == 15 && (ip = get_length(ip, end, &m)) == NULL) {
+            return 0;
+        }
+        m += LZ_MIN_MATCH;
+        if (offset == 0 || offset > pos || m > size - pos) {
+            return 0;
+        }
+        // 重なっていることがあるので1byteずつ
+        for (size_t k = 0; k < m; k++, pos++) {
+            out[pos] = out[pos - offset];
+        }
+    }
+    return pos;
+}
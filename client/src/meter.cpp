@@ -1,13 +1,7 @@
 #include "meter.hpp"
 
 #include <assert.h>
-#include <math.h>
 #include <stdint.h>
-#include <string.h>
-
-#include <optional>
-
-#include <cJSON.h>
 
 uint8_t convertNumber(const int num) {
     assert(0 <= num && num < number_table_len);
@@ -33,62 +27,19 @@ int calcLevel(const int rpm) {
     return level_thresholds_len;
 }
 
-int calc_gear(double v) {
-    double v_ref[] = {0.0, 0.88, 1.10, 1.46, 1.77, 2.09, 2.38, 3.0};
+// ギアポジションセンサーの電圧(mV)からギアを求める。どれにも当たらなければ0
+int calcGear(const int gp_mv) {
+    constexpr int v_ref[] = {0, 880, 1100, 1460, 1770, 2090, 2380, 3000};
     for (int i = 0; i < 6; i++) {
-        double low = (v_ref[i] + v_ref[i + 1]) / 2.0;
-        double high = (v_ref[i + 1] + v_ref[i + 2]) / 2.0;
-        if (low <= v && v < high) {
+        int low = (v_ref[i] + v_ref[i + 1]) / 2;
+        int high = (v_ref[i + 1] + v_ref[i + 2]) / 2;
+        if (low <= gp_mv && gp_mv < high) {
             return i + 1;
         }
     }
     return 0;
 }
 
-std::optional<int> parseGear(const char* str) {
-    std::optional<int> gear;
-
-    cJSON* root = cJSON_Parse(str);
-
-    char* topic = cJSON_GetStringValue(cJSON_GetObjectItem(root, "topic"));
-    if (strcmp(topic, "ecu") == 0) {
-        char* payload =
-            cJSON_GetStringValue(cJSON_GetObjectItem(root, "payload"));
-        cJSON* payload_root = cJSON_Parse(payload);
-
-        double gp =
-            cJSON_GetNumberValue(cJSON_GetObjectItem(payload_root, "gp"));
-        gear = calc_gear(gp);
-
-        cJSON_Delete(payload_root);
-    }
-
-    cJSON_Delete(root);
-
-    return gear;
-}
-
-std::optional<int> parseRPM(const char* str) {
-    std::optional<int> rpm;
-
-    cJSON* root = cJSON_Parse(str);
-
-    char* topic = cJSON_GetStringValue(cJSON_GetObjectItem(root, "topic"));
-    if (strcmp(topic, "rpm") == 0) {
-        char* payload =
-            cJSON_GetStringValue(cJSON_GetObjectItem(root, "payload"));
-        cJSON* payload_root = cJSON_Parse(payload);
-
-        rpm = cJSON_GetNumberValue(cJSON_GetObjectItem(payload_root, "rpm"));
-
-        cJSON_Delete(payload_root);
-    }
-
-    cJSON_Delete(root);
-
-    return rpm;
-}
-
 void fillBuf(int gear, int rpm, uint8_t* buf) {
     if (!buf) {
         return;
@@ -101,3 +52,17 @@ void fillBuf(int gear, int rpm, uint8_t* buf) {
     buf[4] = convertGear(gear);
     buf[5] = convertMeter(calcLevel(rpm));
 }
+
+// レベルメーターが振り切れたらシフトライトとして点滅させる
+void fillBlink(int rpm, uint8_t* mask) {
+    if (!mask) {
+        return;
+    }
+
+    for (int i = 0; i < meter_buf_len; i++) {
+        mask[i] = 0;
+    }
+    if (calcLevel(rpm) == level_thresholds_len) {
+        mask[5] = 0xFF;
+    }
+}
@@ -0,0 +1,85 @@
+#include "meter_link.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hardware/sync.h>
+
+void meter_link_pack(uint8_t* body, uint16_t rpm, uint16_t gp_mv) {
+    body[0] = (uint8_t)(rpm & 0xFF);
+    body[1] = (uint8_t)(rpm >> 8);
+    body[2] = (uint8_t)(gp_mv & 0xFF);
+    body[3] = (uint8_t)(gp_mv >> 8);
+}
+
+bool meter_link_unpack(const uint8_t* body, uint16_t len,
+                       meter_value_t* value) {
+    if (len != METER_LINK_RECORD_SIZE) {
+        return false;
+    }
+    value->rpm = (uint16_t)(body[0] | body[1] << 8);
+    value->gp_mv = (uint16_t)(body[2] | body[3] << 8);
+    return true;
+}
+
+void meter_link_init(meter_link_t* link) {
+    memset(link, 0, sizeof(*link));
+}
+
+void meter_link_put(meter_link_t* link, const meter_value_t* value) {
+    __atomic_store_n(&link->seq, link->seq + 1, __ATOMIC_RELEASE);
+    __dmb();
+    link->value = *value;
+    __dmb();
+    __atomic_store_n(&link->seq, link->seq + 1, __ATOMIC_RELEASE);
+}
+
+bool meter_link_take(meter_link_t* link, meter_value_t* value) {
+    uint32_t s;
+    do {
+        s = __atomic_load_n(&link->seq, __ATOMIC_ACQUIRE);
+        if (s == link->read_seq) {
+            return false;
+        }
+        __dmb();
+        *value = link->value;
+        __dmb();
+    } while ((s & 1) != 0 ||
+             s != __atomic_load_n(&link->seq, __ATOMIC_ACQUIRE));
+    link->read_seq = s;
+    return true;
+}
+
+void meter_link_mark_shown(meter_link_t* link, const meter_value_t* value,
+                           uint64_t now_us) {
+    link->stats_updates++;
+
+    // 時計が合う前の値は時間を測れない
+    if (value->input_us == 0 || now_us < value->input_us) {
+        return;
+    }
+    uint64_t lat = now_us - value->input_us;
+    if (lat > UINT32_MAX) {
+        lat = UINT32_MAX;
+    }
+    link->stats_lat_count++;
+    link->stats_lat_sum_us += lat;
+    if (lat > link->stats_lat_max_us) {
+        link->stats_lat_max_us = (uint32_t)lat;
+    }
+}
+
+void meter_link_take_stats(meter_link_t* link, meter_link_stats_t* stats) {
+    stats->updates = link->stats_updates;
+    stats->lat_avg_us =
+        link->stats_lat_count != 0
+            ? (uint32_t)(link->stats_lat_sum_us / link->stats_lat_count)
+            : 0;
+    stats->lat_max_us = link->stats_lat_max_us;
+
+    link->stats_updates = 0;
+    link->stats_lat_count = 0;
+    link->stats_lat_sum_us = 0;
+    link->stats_lat_max_us = 0;
+}
@@ -0,0 +1,270 @@
+#include "outbox.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ring_buf.h"
+#include "topic.h"
+
+typedef struct {
+    outbox_policy_t policy;
+    uint32_t lane_size;
+} outbox_class_config_t;
+
+// coalesceのクラスはトピックごとの最新スロットを使うのでレーンは持たない
+// レーンのサイズは2の冪で、合計をOUTBOX_LANE_POOL_SIZEに収めること
+static const outbox_class_config_t class_config[TOPIC_CLASS_COUNT] = {
+    [topic_class_critical] = {outbox_policy_coalesce, 0},
+    [topic_class_normal] = {outbox_policy_drop_oldest, 2048},
+    [topic_class_diag] = {outbox_policy_drop_newest, 512},
+    [topic_class_replay] = {outbox_policy_drop_newest, 1024},
+};
+
+static void count_drop(outbox_t* ob, uint8_t topic) {
+    if (topic >= TOPIC_COUNT) {
+        topic = topic_unknown;
+    }
+    ob->drops_policy[topic]++;
+}
+
+// scratchにある [topic][frame...] をポリシーに従ってレーンへ移す
+static void dispatch(outbox_t* ob, uint16_t len) {
+    uint8_t topic = ob->scratch[0];
+    if (topic >= TOPIC_COUNT) {
+        topic = topic_unknown;
+    }
+    uint8_t cls = topic_class(topic);
+    ring_buf_t* lane = &ob->lanes[cls];
+
+    switch (class_config[cls].policy) {
+        case outbox_policy_coalesce:
+            if (len - 1 > OUTBOX_LATEST_SIZE) {
+                count_drop(ob, topic);
+                break;
+            }
+            if (ob->latest_len[topic] != 0) {
+                count_drop(ob, topic);
+            }
+            memcpy(ob->latest[topic], &ob->scratch[1], len - 1);
+            ob->latest_len[topic] = len - 1;
+            break;
+
+        case outbox_policy_drop_oldest:
+            while (!ring_buf_push(lane, ob->scratch, len)) {
+                // 先頭1byteだけ読めば捨てるレコードのトピックが分かる
+                uint8_t old_topic;
+                if (ring_buf_pop(lane, &old_topic, 1) == 0) {
+                    count_drop(ob, topic);
+                    break;
+                }
+                count_drop(ob, old_topic);
+            }
+            break;
+
+        case outbox_policy_drop_newest:
+        default:
+            if (!ring_buf_push(lane, ob->scratch, len)) {
+                count_drop(ob, topic);
+            }
+            break;
+    }
+}
+
+static void drain_ingress(outbox_t* ob) {
+    for (uint8_t i = 0; i < OUTBOX_PRODUCER_COUNT; i++) {
+        uint16_t len;
+        while ((len = ring_buf_pop(&ob->ingress[i], ob->scratch,
+                                   sizeof(ob->scratch))) != 0) {
+            dispatch(ob, len);
+        }
+    }
+}
+
+// 同じクラス内ではトピックを順番に回すので、次に返すトピックを探す
+static uint8_t next_latest(const outbox_t* ob, uint8_t cls) {
+    for (uint8_t n = 0; n < TOPIC_COUNT; n++) {
+        uint8_t topic = (ob->latest_next[cls] + n) % TOPIC_COUNT;
+        if (topic_class(topic) == cls && ob->latest_len[topic] != 0) {
+            return topic;
+        }
+    }
+    return TOPIC_COUNT;
+}
+
+static uint16_t pop_latest(outbox_t* ob, uint8_t topic, uint8_t* data,
+                           uint16_t size) {
+    uint16_t len = ob->latest_len[topic];
+    if (len > size) {
+        len = size;
+    }
+    memcpy(data, ob->latest[topic], len);
+    ob->latest_len[topic] = 0;
+    ob->latest_next[topic_class(topic)] = (topic + 1) % TOPIC_COUNT;
+    return len;
+}
+
+static uint16_t pop_lane(outbox_t* ob, uint8_t cls, uint8_t* data,
+                         uint16_t size) {
+    ring_buf_t* lane = &ob->lanes[cls];
+    uint16_t len = ring_buf_pop(lane, ob->scratch, sizeof(ob->scratch));
+    if (len <= 1) {
+        return 0;
+    }
+
+    len -= 1;
+    if (len > size) {
+        len = size;
+    }
+    memcpy(data, &ob->scratch[1], len);
+    return len;
+}
+
+// 優先度の最も高いフレームの長さと、それがあるクラスとトピックを返す
+// レーンのトピックは取り出すまで分からないのでTOPIC_COUNTにする
+static uint16_t find_head(const outbox_t* ob, uint8_t* cls, uint8_t* topic) {
+    for (uint8_t c = 0; c < TOPIC_CLASS_COUNT; c++) {
+        uint16_t len = 0;
+        *cls = c;
+        *topic = TOPIC_COUNT;
+        if (class_config[c].policy == outbox_policy_coalesce) {
+            *topic = next_latest(ob, c);
+            len = *topic < TOPIC_COUNT ? ob->latest_len[*topic] : 0;
+        } else if (class_config[c].lane_size != 0) {
+            // 先頭1byteはトピックID
+            len = ring_buf_peek_len(&ob->lanes[c]);
+            len = len > 1 ? len - 1 : 0;
+        }
+        if (len != 0) {
+            return len;
+        }
+    }
+    return 0;
+}
+
+// ingressを空にしてから先頭を一つ取り出す
+// max_lenより長ければ取り出さずに残す
+static uint16_t pop_head(outbox_t* ob, uint8_t* data, uint16_t size,
+                         uint16_t max_len) {
+    if (!ob->ready) {
+        return 0;
+    }
+
+    drain_ingress(ob);
+
+    uint8_t cls;
+    uint8_t topic;
+    uint16_t len = find_head(ob, &cls, &topic);
+    if (len == 0 || len > max_len) {
+        return 0;
+    }
+    return topic < TOPIC_COUNT ? pop_latest(ob, topic, data, size)
+                               : pop_lane(ob, cls, data, size);
+}
+
+bool outbox_init(outbox_t* ob) {
+    memset(ob, 0, sizeof(*ob));
+
+    for (uint8_t i = 0; i < OUTBOX_PRODUCER_COUNT; i++) {
+        ring_buf_init(&ob->ingress[i], ob->ingress_storage[i],
+                      OUTBOX_INGRESS_SIZE);
+    }
+
+    uint32_t pool_pos = 0;
+    for (uint8_t cls = 0; cls < TOPIC_CLASS_COUNT; cls++) {
+        uint32_t size = class_config[cls].lane_size;
+        if (size == 0) {
+            continue;
+        }
+        if (pool_pos + size > OUTBOX_LANE_POOL_SIZE ||
+            !ring_buf_init(&ob->lanes[cls], &ob->lane_pool[pool_pos], size)) {
+            return false;
+        }
+        pool_pos += size;
+    }
+
+    // 初期化が終わるまで他のコアからのpushは受け付けない
+    __atomic_store_n(&ob->ready, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool outbox_push(outbox_t* ob, uint8_t producer, uint8_t topic,
+                 const uint8_t* data, uint16_t len) {
+    if (producer >= OUTBOX_PRODUCER_COUNT ||
+        !__atomic_load_n(&ob->ready, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    if (topic >= TOPIC_COUNT) {
+        topic = topic_unknown;
+    }
+
+    // トピックIDを先頭に付けて一つのレコードにする
+    if (len == 0 || len > OUTBOX_RECORD_SIZE ||
+        !ring_buf_push2(&ob->ingress[producer], &topic, 1, data, len)) {
+        ob->drops_ingress[producer][topic]++;
+        return false;
+    }
+    return true;
+}
+
+uint16_t outbox_pop(outbox_t* ob, uint8_t* data, uint16_t size) {
+    return pop_head(ob, data, size, UINT16_MAX);
+}
+
+uint16_t outbox_pop_fit(outbox_t* ob, uint8_t* data, uint16_t size) {
+    return pop_head(ob, data, size, size);
+}
+
+uint32_t outbox_pending_bytes(const outbox_t* ob) {
+    if (!ob->ready) {
+        return 0;
+    }
+
+    // レコードのヘッダ分も含むのでおおよその値
+    uint32_t bytes = outbox_ingress_bytes(ob);
+    for (uint8_t cls = 0; cls < TOPIC_CLASS_COUNT; cls++) {
+        if (class_config[cls].lane_size != 0) {
+            bytes += ring_buf_used(&ob->lanes[cls]);
+        }
+    }
+    for (uint8_t topic = 0; topic < TOPIC_COUNT; topic++) {
+        bytes += ob->latest_len[topic];
+    }
+    return bytes;
+}
+
+uint32_t outbox_ingress_bytes(const outbox_t* ob) {
+    uint32_t bytes = 0;
+    for (uint8_t i = 0; i < OUTBOX_PRODUCER_COUNT; i++) {
+        bytes += ring_buf_used(&ob->ingress[i]);
+    }
+    return bytes;
+}
+
+uint32_t outbox_replay_room(const outbox_t* ob, uint8_t producer) {
+    if (producer >= OUTBOX_PRODUCER_COUNT ||
+        !__atomic_load_n(&ob->ready, __ATOMIC_ACQUIRE) ||
+        !ring_buf_is_empty(&ob->ingress[producer])) {
+        return 0;
+    }
+    // 履歴を積むのは呼び出し元だけでingressも空なので、レーンは空く一方
+    return ring_buf_free(&ob->lanes[topic_class_replay]);
+}
+
+uint32_t outbox_get_drops(const outbox_t* ob, uint8_t topic) {
+    if (topic >= TOPIC_COUNT) {
+        return 0;
+    }
+    uint32_t drops = ob->drops_policy[topic];
+    for (uint8_t i = 0; i < OUTBOX_PRODUCER_COUNT; i++) {
+        drops += ob->drops_ingress[i][topic];
+    }
+    return drops;
+}
+
+outbox_policy_t outbox_class_policy(uint8_t cls) {
+    if (cls >= TOPIC_CLASS_COUNT) {
+        return outbox_policy_drop_newest;
+    }
+    return class_config[cls].policy;
+}
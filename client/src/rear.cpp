@@ -1,31 +1,51 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <hardware/gpio.h>
 #include <hardware/spi.h>
 #include <hardware/uart.h>
 #include <pico/binary_info.h>
 #include <pico/multicore.h>
+#include <pico/platform.h>
 #include <pico/stdio.h>
 #include <pico/time.h>
-#include <pico/util/queue.h>
 
 #include <cJSON.h>
 
+#include "delta.h"
+#include "doorbell.h"
+#include "frame.h"
 #include "mcp3208.h"
+#include "meter_link.h"
+#include "outbox.h"
+#include "rs485.h"
+#include "rs485_bus.h"
+#include "topic.h"
 
 #include "json.hpp"
 
 #define STR_SIZE (512)
-#define QUEUE_SIZE (32)
+
+#define BUS_ADDR (RS485_BUS_ADDR_REAR)
+
+#define CORE1_WAKE_TIMEOUT_US (10'000)
+#define DIAG_INTERVAL_MS (1000)
 
 #define ALPHA (0.2)
 
+// 差分で送るトピックのキーフレームと、変化が無い時に送る間隔
+#define DELTA_KEYFRAME_INTERVAL_US (5'000'000)
+#define DELTA_HEARTBEAT_INTERVAL_US (1'000'000)
+
+// 水温は0.1度より細かい変化を見ない
+#define WATER_DEADBAND (0.1)
+
 #define SPI_ID (spi0)
 #define SPI_BAUD (1'000'000)
 
 #define UART_ID (uart1)
-#define UART_BAUD (115'200)
+#define UART_BAUD (RS485_BAUD)
 
 #define PIN_SPI_SCK (2)
 #define PIN_SPI_TX (3)
@@ -67,7 +87,226 @@ void gpio_callback(uint gpio, uint32_t events) {
     last_time_us = now_us;
 }
 
-queue_t msg_queue;
+outbox_t msg_outbox;
+
+doorbell_t core1_doorbell;
+
+// 時刻合わせの応答を送っている間true、送り終えた時刻を次の応答で返す
+volatile bool time_resp_sending = false;
+volatile uint8_t time_resp_seq = 0;
+volatile uint64_t time_resp_tx_us = 0;
+
+void on_rs485_tx_done() {
+    if (time_resp_sending) {
+        time_resp_tx_us = time_us_64();
+        time_resp_sending = false;
+    }
+    doorbell_ring(&core1_doorbell);
+}
+
+rs485_bus_parser_t bus_parser;
+
+volatile bool poll_pending = false;
+volatile uint16_t poll_credit = 0;
+volatile uint32_t poll_time_us = 0;
+
+volatile bool time_req_pending = false;
+volatile uint8_t time_req_seq = 0;
+volatile uint64_t time_req_rx_us = 0;
+
+void on_rs485_rx(uint8_t ch) {
+    if (!rs485_bus_parser_feed(&bus_parser, ch)) {
+        return;
+    }
+    uint64_t now_us = time_us_64();
+
+    // 自分宛てのものだけを拾う
+    rs485_bus_frame_t frame;
+    if (!rs485_bus_decode(bus_parser.buf, rs485_bus_parser_len(&bus_parser),
+                          &frame) ||
+        frame.addr != BUS_ADDR) {
+        return;
+    }
+
+    if (frame.type == rs485_bus_type_poll &&
+        frame.len == RS485_BUS_POLL_SIZE) {
+        poll_credit = frame.payload[0] | frame.payload[1] << 8;
+        poll_time_us = (uint32_t)now_us;
+        poll_pending = true;
+    } else if (frame.type == rs485_bus_type_time_req &&
+               frame.len == RS485_BUS_TIME_REQ_SIZE) {
+        time_req_seq = frame.payload[0];
+        time_req_rx_us = now_us;
+        poll_time_us = (uint32_t)now_us;
+        time_req_pending = true;
+    } else {
+        return;
+    }
+    doorbell_ring(&core1_doorbell);
+}
+
+rs485_dev_t rs485 = {
+    .uart = UART_ID,
+    .pin_tx = PIN_UART_TX,
+    .pin_rx = PIN_UART_RX,
+    .pin_de = PIN_RS485_ENABLE,
+    .baud = UART_BAUD,
+    .tx_done_callback = on_rs485_tx_done,
+    .rx_callback = on_rs485_rx,
+};
+
+// [フレームヘッダ][JSON] を一つのレコードとして積む
+// 番号は発生元で振るので、途中で捨てられたものはホストで欠番として見える
+// 番号を振る前に失敗した時だけfalseを返す
+bool msg_publish(const Json& json) {
+    uint8_t buf[FRAME_HEADER_SIZE + STR_SIZE];
+    char* str = reinterpret_cast<char*>(&buf[FRAME_HEADER_SIZE]);
+    if (!json.toBuffer(str, STR_SIZE)) {
+        return false;
+    }
+    frame_header_write(buf, json.getFlags(), json.getTopic(),
+                       frame_next_seq(json.getTopic()), json.getTimeUs());
+    if (outbox_push(&msg_outbox, get_core_num(), json.getTopic(), buf,
+                    FRAME_HEADER_SIZE + strlen(str))) {
+        doorbell_ring(&core1_doorbell);
+    }
+    return true;
+}
+
+// メーターに出す値はJSONにせず [フレームヘッダ][rpm][gp] として積む
+// criticalクラスなので最新の一つだけが残り、次のポーリングで先に送られる
+void msg_publish_meter(absolute_time_t time, double rpm, double gp) {
+    uint16_t rpm_u16 = rpm < 0.0 ? 0 : rpm > UINT16_MAX ? UINT16_MAX : rpm;
+    uint16_t gp_mv = gp < 0.0 ? 0 : gp * 1000;
+
+    uint8_t buf[FRAME_HEADER_SIZE + METER_LINK_RECORD_SIZE];
+    frame_header_write(buf, 0, topic_meter, frame_next_seq(topic_meter),
+                       to_us_since_boot(time));
+    meter_link_pack(&buf[FRAME_HEADER_SIZE], rpm_u16, gp_mv);
+    if (outbox_push(&msg_outbox, get_core_num(), topic_meter, buf,
+                    sizeof(buf))) {
+        doorbell_ring(&core1_doorbell);
+    }
+}
+
+const char* const water_keys[] = {"inlet_temp", "outlet_temp"};
+const double water_deadband[] = {WATER_DEADBAND, WATER_DEADBAND};
+delta_t water_delta;
+
+// 前に送った値から変わった項目だけを積む
+// 欠番はホストで分かるが、番号を振る前に失敗すると分からないので
+// キーフレームからやり直す
+void msg_publish_delta(const char* topic, delta_t* delta, absolute_time_t time,
+                       const char* const* keys, const double* values) {
+    uint32_t mask;
+    delta_kind_t kind =
+        delta_update(delta, to_us_since_boot(time), values, &mask);
+    if (kind == delta_skip) {
+        return;
+    }
+
+    auto json = Json(topic);
+    json.addTime(time);
+    json.setFlags(kind == delta_keyframe ? FRAME_FLAG_KEYFRAME
+                                         : FRAME_FLAG_DELTA);
+    for (uint8_t i = 0; i < delta->count; i++) {
+        if (mask & (1u << i)) {
+            json.add(keys[i], values[i]);
+        }
+    }
+    if (!msg_publish(json)) {
+        delta_force_keyframe(delta);
+    }
+}
+
+void publish_core1_stats() {
+    doorbell_stats_t stats;
+    doorbell_take_stats(&core1_doorbell, &stats);
+
+    auto json = Json("core1/rear");
+    json.addTime(get_absolute_time());
+    json.add("busy", stats.busy_permille);
+    json.add("wakes", stats.wakes);
+    json.add("lat_avg", stats.latency_avg_us);
+    json.add("lat_max", stats.latency_max_us);
+    msg_publish(json);
+}
+
+void publish_drop_stats() {
+    bool any = false;
+    for (uint8_t topic = 0; topic < TOPIC_COUNT && !any; topic++) {
+        any = outbox_get_drops(&msg_outbox, topic) != 0;
+    }
+    if (!any) {
+        return;
+    }
+
+    auto json = Json("drop/rear");
+    json.addTime(get_absolute_time());
+    for (uint8_t topic = 0; topic < TOPIC_COUNT; topic++) {
+        if (uint32_t drops = outbox_get_drops(&msg_outbox, topic); drops != 0) {
+            json.add(topic == topic_unknown ? "unknown" : topic_name(topic),
+                     drops);
+        }
+    }
+    msg_publish(json);
+}
+
+// 許可されたバイト数に収まるだけレコードを詰めてデータフレームを作る
+// 時刻は最初のレコードを基準にした差にして、フレームヘッダより短くする
+size_t build_data_frame(uint8_t* out, uint16_t credit) {
+    if (credit > RS485_BUS_MAX_PAYLOAD) {
+        credit = RS485_BUS_MAX_PAYLOAD;
+    }
+
+    uint8_t* payload = &out[RS485_BUS_HEADER_SIZE];
+    uint16_t pos = RS485_BUS_DATA_HEADER_SIZE;
+    uint64_t base_us = 0;
+    while (pos + RS485_BUS_RECORD_HEADER_SIZE < credit) {
+        // 取り出した直後はフレームヘッダの分だけはみ出すので両方確かめる
+        uint16_t room = credit - pos - RS485_BUS_RECORD_HEADER_SIZE +
+                        FRAME_HEADER_SIZE;
+        uint16_t max_room =
+            RS485_BUS_MAX_PAYLOAD - pos - RS485_BUS_RECORD_HEADER_SIZE;
+        if (room > max_room) {
+            room = max_room;
+        }
+        uint8_t* rec = &payload[pos];
+        uint8_t* body = &rec[RS485_BUS_RECORD_HEADER_SIZE];
+        uint16_t len = outbox_pop_fit(&msg_outbox, body, room);
+        if (len == 0) {
+            break;
+        }
+        doorbell_mark_dequeued(&core1_doorbell);
+
+        frame_header_t header;
+        if (len < FRAME_HEADER_SIZE ||
+            !frame_header_read(body, len, &header)) {
+            continue;
+        }
+        uint16_t body_len = len - FRAME_HEADER_SIZE;
+        if (pos == RS485_BUS_DATA_HEADER_SIZE) {
+            base_us = header.timestamp_us;
+        }
+        // 基準から30分以上離れた時刻は壊れているとみなして捨てる
+        if (!rs485_bus_put_record_header(rec, header.flags, header.topic,
+                                         header.seq, header.timestamp_us,
+                                         body_len, base_us)) {
+            continue;
+        }
+        memmove(body, &body[FRAME_HEADER_SIZE], body_len);
+        pos += RS485_BUS_RECORD_HEADER_SIZE + body_len;
+    }
+
+    // 残量を申告してマスタに次の割り当てを決めてもらう
+    uint32_t pending = outbox_pending_bytes(&msg_outbox);
+    if (pending > UINT16_MAX) {
+        pending = UINT16_MAX;
+    }
+    rs485_bus_put_data_header(payload, pending, base_us);
+
+    return rs485_bus_finish(out, BUS_ADDR, rs485_bus_type_data, pos);
+}
 
 void core1_main() {
     gpio_init(PIN_RPM);
@@ -75,24 +314,45 @@ void core1_main() {
     gpio_set_irq_enabled_with_callback(PIN_RPM, GPIO_IRQ_EDGE_RISE, true,
                                        gpio_callback);
 
-    uart_init(UART_ID, UART_BAUD);
-    uart_set_format(UART_ID, 8, 1, UART_PARITY_NONE);
-    uart_set_fifo_enabled(UART_ID, true);
-    uart_set_hw_flow(UART_ID, false, false);
-    gpio_set_function(PIN_UART_TX, UART_FUNCSEL_NUM(UART_ID, PIN_UART_TX));
-    gpio_set_function(PIN_UART_RX, UART_FUNCSEL_NUM(UART_ID, PIN_UART_RX));
+    rs485_bus_parser_init(&bus_parser);
+    rs485_init(&rs485);
 
-    gpio_init(PIN_RS485_ENABLE);
-    gpio_set_dir(PIN_RS485_ENABLE, GPIO_OUT);
-    gpio_put(PIN_RS485_ENABLE, 1);
+    static uint8_t tx_buf[RS485_BUS_FRAME_SIZE];
 
-    char str[STR_SIZE];
+    auto diag_next = make_timeout_time_ms(DIAG_INTERVAL_MS);
 
     for (;;) {
-        if (queue_try_remove(&msg_queue, &str)) {
-            uart_puts(UART_ID, str);
-            uart_putc(UART_ID, '\n');
+        doorbell_wait(&core1_doorbell);
+
+        if (time_reached(diag_next)) {
+            publish_core1_stats();
+            publish_drop_stats();
+            diag_next = delayed_by_ms(diag_next, DIAG_INTERVAL_MS);
         }
+
+        if ((!poll_pending && !time_req_pending) || rs485_is_busy(&rs485)) {
+            continue;
+        }
+
+        size_t len;
+        if (time_req_pending) {
+            time_req_pending = false;
+            len = rs485_bus_make_time_resp(tx_buf, BUS_ADDR, time_req_seq,
+                                           time_req_rx_us, time_resp_seq,
+                                           time_resp_tx_us);
+            time_resp_seq = time_req_seq;
+            time_resp_tx_us = 0;
+            time_resp_sending = true;
+        } else {
+            poll_pending = false;
+            len = build_data_frame(tx_buf, poll_credit);
+        }
+
+        // マスタがDEを下げ終わるまで待ってから送り返す
+        while (time_us_32() - poll_time_us < RS485_BUS_TURNAROUND_US) {
+            tight_loop_contents();
+        }
+        rs485_send(&rs485, tx_buf, len);
     }
 }
 
@@ -131,10 +391,13 @@ int main() {
         .pin_cs = PIN_SPI_CS_MCP3208_1,
     };
 
-    queue_init(&msg_queue, STR_SIZE, QUEUE_SIZE);
+    delta_init(&water_delta, count_of(water_keys), water_deadband,
+               DELTA_KEYFRAME_INTERVAL_US, DELTA_HEARTBEAT_INTERVAL_US);
+
+    outbox_init(&msg_outbox);
+    doorbell_init(&core1_doorbell, CORE1_WAKE_TIMEOUT_US);
     multicore_launch_core1(core1_main);
 
-    char buf[STR_SIZE];
     for (;;) {
         for (int i = 0; i < 4; i++) {
             auto time_start = get_absolute_time();
@@ -151,12 +414,9 @@ int main() {
                 double in = calc_103jt_k(raw_in);
                 double out = calc_103jt_k(raw_out);
 
-                auto json_water = Json("water");
-                json_water.addTime(get_absolute_time());
-                json_water.add("inlet_temp", in);
-                json_water.add("outlet_temp", out);
-                json_water.toBuffer(buf, STR_SIZE);
-                queue_try_add(&msg_queue, &buf);
+                const double water[] = {in, out};
+                msg_publish_delta("water", &water_delta, get_absolute_time(),
+                                  water_keys, water);
 
                 // stroke/rear (10hz)
                 uint16_t raw_right =
@@ -171,8 +431,7 @@ int main() {
                 json_stroke_rear.addTime(get_absolute_time());
                 json_stroke_rear.add("right", right);
                 json_stroke_rear.add("left", left);
-                json_stroke_rear.toBuffer(buf, STR_SIZE);
-                queue_try_add(&msg_queue, &buf);
+                msg_publish(json_stroke_rear);
             }
 
             // ECU (100hz)
@@ -196,8 +455,7 @@ int main() {
             // json_ecu.add("tps", tps);
             // json_ecu.add("iap", iap);
             // json_ecu.add("gp", gp);
-            // json_ecu.toBuffer(buf, STR_SIZE);
-            // queue_try_add(&msg_queue, &buf);
+            // msg_publish(json_ecu);
             //
             // // RPM (20hz)
             // if (last_time_us != 0 &&
@@ -209,9 +467,11 @@ int main() {
             //     auto json_rpm = Json("rpm");
             //     json_rpm.addTime(get_absolute_time());
             //     json_rpm.add("rpm", frequency * 120);
-            //     json_rpm.toBuffer(buf, STR_SIZE);
-            //     queue_try_add(&msg_queue, &buf);
+            //     msg_publish(json_rpm);
             // }
+            //
+            // // meter (100hz)
+            // msg_publish_meter(time_start, frequency * 120, gp);
 
             gpio_put(PIN_LED, 0);
 
@@ -0,0 +1,137 @@
+#include "ring_buf.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// 相手側が更新する位置はacquireで読み、自分側の位置はreleaseで書く
+// データのコピーが位置の公開より前に見えることを保証する
+static inline uint32_t load_acquire(const volatile uint32_t* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(volatile uint32_t* p, uint32_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static void copy_in(ring_buf_t* rb, uint32_t pos, const uint8_t* data,
+                    uint32_t len) {
+    if (len == 0) {
+        return;
+    }
+    uint32_t idx = pos & rb->mask;
+    uint32_t first = rb->mask + 1 - idx;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(&rb->buf[idx], data, first);
+    memcpy(rb->buf, data + first, len - first);
+}
+
+static void copy_out(const ring_buf_t* rb, uint32_t pos, uint8_t* data,
+                     uint32_t len) {
+    uint32_t idx = pos & rb->mask;
+    uint32_t first = rb->mask + 1 - idx;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(data, &rb->buf[idx], first);
+    memcpy(data + first, rb->buf, len - first);
+}
+
+static inline uint16_t read_len(const ring_buf_t* rb, uint32_t pos) {
+    uint8_t hdr[RING_BUF_HEADER_SIZE];
+    copy_out(rb, pos, hdr, RING_BUF_HEADER_SIZE);
+    return (uint16_t)(hdr[0] | hdr[1] << 8);
+}
+
+bool ring_buf_init(ring_buf_t* rb, uint8_t* storage, uint32_t size) {
+    if (size < RING_BUF_HEADER_SIZE * 2 || (size & (size - 1)) != 0) {
+        return false;
+    }
+    rb->buf = storage;
+    rb->mask = size - 1;
+    rb->head = 0;
+    rb->tail = 0;
+    return true;
+}
+
+bool ring_buf_push(ring_buf_t* rb, const uint8_t* data, uint16_t len) {
+    return ring_buf_push2(rb, data, len, NULL, 0);
+}
+
+bool ring_buf_push2(ring_buf_t* rb, const uint8_t* head, uint16_t head_len,
+                    const uint8_t* body, uint16_t body_len) {
+    uint32_t total = (uint32_t)head_len + body_len;
+    if (total == 0 || total > UINT16_MAX) {
+        return false;
+    }
+    uint16_t len = (uint16_t)total;
+
+    uint32_t pos = rb->head;
+    uint32_t tail = load_acquire(&rb->tail);
+    uint32_t need = (uint32_t)len + RING_BUF_HEADER_SIZE;
+    if (rb->mask + 1 - (pos - tail) < need) {
+        return false;
+    }
+
+    uint8_t hdr[RING_BUF_HEADER_SIZE] = {
+        (uint8_t)(len & 0xFF),
+        (uint8_t)(len >> 8),
+    };
+    copy_in(rb, pos, hdr, RING_BUF_HEADER_SIZE);
+    copy_in(rb, pos + RING_BUF_HEADER_SIZE, head, head_len);
+    copy_in(rb, pos + RING_BUF_HEADER_SIZE + head_len, body, body_len);
+
+    store_release(&rb->head, pos + need);
+    return true;
+}
+
+uint16_t ring_buf_pop(ring_buf_t* rb, uint8_t* data, uint16_t size) {
+    uint32_t tail = rb->tail;
+    uint32_t head = load_acquire(&rb->head);
+    if (head == tail) {
+        return 0;
+    }
+
+    uint16_t len = read_len(rb, tail);
+    uint16_t copy = len < size ? len : size;
+    copy_out(rb, tail + RING_BUF_HEADER_SIZE, data, copy);
+
+    store_release(&rb->tail, tail + RING_BUF_HEADER_SIZE + len);
+    return copy;
+}
+
+uint16_t ring_buf_peek_len(const ring_buf_t* rb) {
+    uint32_t tail = rb->tail;
+    uint32_t head = load_acquire(&rb->head);
+    if (head == tail) {
+        return 0;
+    }
+    return read_len(rb, tail);
+}
+
+bool ring_buf_discard(ring_buf_t* rb) {
+    uint32_t tail = rb->tail;
+    uint32_t head = load_acquire(&rb->head);
+    if (head == tail) {
+        return false;
+    }
+
+    uint16_t len = read_len(rb, tail);
+    store_release(&rb->tail, tail + RING_BUF_HEADER_SIZE + len);
+    return true;
+}
+
+bool ring_buf_is_empty(const ring_buf_t* rb) {
+    return load_acquire(&rb->head) == load_acquire(&rb->tail);
+}
+
+uint32_t ring_buf_used(const ring_buf_t* rb) {
+    return load_acquire(&rb->head) - load_acquire(&rb->tail);
+}
+
+uint32_t ring_buf_free(const ring_buf_t* rb) {
+    return rb->mask + 1 - ring_buf_used(rb);
+}
@@ -0,0 +1,143 @@
+#include "rs485.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hardware/dma.h>
+#include <hardware/gpio.h>
+#include <hardware/irq.h>
+#include <hardware/uart.h>
+#include <pico/time.h>
+
+#define UART_FIFO_DEPTH (32)
+#define UART_BITS_PER_CHAR (10)
+
+static rs485_dev_t* dma_devs[NUM_DMA_CHANNELS];
+static rs485_dev_t* uart_devs[NUM_UARTS];
+static bool irq_installed = false;
+
+static int64_t de_release_callback(alarm_id_t id, void* user_data) {
+    rs485_dev_t* dev = (rs485_dev_t*)user_data;
+    uart_hw_t* hw = uart_get_hw(dev->uart);
+
+    // 見積もりより早かった場合でも最後の1文字分を待つだけで済む
+    while (hw->fr & UART_UARTFR_BUSY_BITS) {
+        tight_loop_contents();
+    }
+    gpio_put(dev->pin_de, 0);
+
+    dev->busy = false;
+    if (dev->tx_done_callback) {
+        dev->tx_done_callback();
+    }
+    return 0;
+}
+
+static void dma_irq_handler() {
+    for (uint ch = 0; ch < NUM_DMA_CHANNELS; ch++) {
+        rs485_dev_t* dev = dma_devs[ch];
+        if (!dev || !dma_channel_get_irq1_status(ch)) {
+            continue;
+        }
+        dma_channel_acknowledge_irq1(ch);
+
+        // DMA完了時点でFIFOとシフトレジスタに残っている文字数から
+        // 送信が終わる時刻を見積もる
+        size_t chars = dev->tx_len < UART_FIFO_DEPTH + 1 ? dev->tx_len
+                                                         : UART_FIFO_DEPTH + 1;
+        uint64_t wait_us =
+            ((uint64_t)chars * UART_BITS_PER_CHAR * 1000000 + dev->baud - 1) /
+            dev->baud;
+        // アラームが取れなければ、ここで送り終わりを待って離す
+        // busyのままにすると二度と送れなくなる
+        if (add_alarm_in_us(wait_us, de_release_callback, dev, true) < 0) {
+            de_release_callback(0, dev);
+        }
+    }
+}
+
+static void uart_irq_handler() {
+    for (uint i = 0; i < NUM_UARTS; i++) {
+        rs485_dev_t* dev = uart_devs[i];
+        if (!dev) {
+            continue;
+        }
+        while (uart_is_readable(dev->uart)) {
+            dev->rx_callback((uint8_t)uart_getc(dev->uart));
+        }
+    }
+}
+
+void rs485_init(rs485_dev_t* dev) {
+    dev->baud = uart_init(dev->uart, dev->baud);
+    uart_set_format(dev->uart, 8, 1, UART_PARITY_NONE);
+    uart_set_fifo_enabled(dev->uart, true);
+    uart_set_hw_flow(dev->uart, false, false);
+    gpio_set_function(dev->pin_tx, UART_FUNCSEL_NUM(dev->uart, dev->pin_tx));
+    gpio_set_function(dev->pin_rx, UART_FUNCSEL_NUM(dev->uart, dev->pin_rx));
+
+    gpio_init(dev->pin_de);
+    gpio_set_dir(dev->pin_de, GPIO_OUT);
+    gpio_put(dev->pin_de, 0);
+
+    dev->busy = false;
+    dev->tx_len = 0;
+
+    dev->dma_chan = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(dev->dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, uart_get_dreq(dev->uart, true));
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(dev->dma_chan, &c,
+                          &uart_get_hw(dev->uart)->dr,  // 書き込み先
+                          NULL,                         // 読み込み元
+                          0,                            // 転送サイズ
+                          false                         // 自動スタートしない
+    );
+
+    dma_devs[dev->dma_chan] = dev;
+    dma_channel_set_irq1_enabled(dev->dma_chan, true);
+    if (!irq_installed) {
+        irq_add_shared_handler(DMA_IRQ_1, dma_irq_handler,
+                               PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(DMA_IRQ_1, true);
+        irq_installed = true;
+    }
+
+    if (dev->rx_callback) {
+        uint index = uart_get_index(dev->uart);
+        int uart_irq = index == 0 ? UART0_IRQ : UART1_IRQ;
+        uart_devs[index] = dev;
+        irq_set_exclusive_handler(uart_irq, uart_irq_handler);
+        irq_set_enabled(uart_irq, true);
+        uart_set_irq_enables(dev->uart, true, false);
+    }
+}
+
+uint rs485_set_baud(rs485_dev_t* dev, uint baud) {
+    if (dev->busy) {
+        return 0;
+    }
+    dev->baud = uart_set_baudrate(dev->uart, baud);
+    return dev->baud;
+}
+
+bool rs485_send(rs485_dev_t* dev, const uint8_t* data, size_t len) {
+    if (dev->busy || len == 0) {
+        return false;
+    }
+    dev->busy = true;
+    dev->tx_len = len;
+
+    gpio_put(dev->pin_de, 1);
+    busy_wait_us_32(RS485_DE_SETUP_US);
+
+    dma_channel_transfer_from_buffer_now(dev->dma_chan, data, len);
+    return true;
+}
+
+bool rs485_is_busy(const rs485_dev_t* dev) {
+    return dev->busy;
+}
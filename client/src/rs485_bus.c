@@ -0,0 +1,373 @@
+#include "rs485_bus.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc16.h"
+
+#define UART_BITS_PER_CHAR (10)
+
+// syncの後ろ、lenまでの長さ
+#define PRE_LEN_SIZE (RS485_BUS_HEADER_SIZE - 1)
+
+// 推定したずれに交換の結果をどれだけ反映するか (2^-n)
+#define CLOCK_GAIN_SHIFT (3)
+
+static inline uint16_t get_u16(const uint8_t* p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline void put_u16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)(v & 0xFF);
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+static inline void put_u32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static inline uint64_t get_u64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+static inline void put_u64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+void rs485_bus_parser_init(rs485_bus_parser_t* p) {
+    memset(p, 0, sizeof(*p));
+}
+
+static void start_frame(rs485_bus_parser_t* p) {
+    p->in_frame = true;
+    p->pos = 0;
+    p->need = PRE_LEN_SIZE;
+}
+
+static bool is_valid_type(uint8_t type) {
+    return type >= rs485_bus_type_poll && type <= rs485_bus_type_time_resp;
+}
+
+bool rs485_bus_parser_feed(rs485_bus_parser_t* p, uint8_t ch) {
+    if (!p->in_frame) {
+        if (ch == RS485_BUS_SYNC) {
+            start_frame(p);
+        }
+        return false;
+    }
+
+    p->buf[p->pos++] = ch;
+    bool bad_header = false;
+    if (p->pos == 2) {
+        bad_header = !is_valid_type(ch);
+    } else if (p->pos == PRE_LEN_SIZE) {
+        uint16_t len = get_u16(&p->buf[2]);
+        bad_header = len > RS485_BUS_MAX_PAYLOAD;
+        p->need = PRE_LEN_SIZE + len + RS485_BUS_CRC_SIZE;
+    }
+    if (bad_header) {
+        // ノイズを拾っていたので、今のbyteがsyncならそこからやり直す
+        p->in_frame = false;
+        p->errors++;
+        if (ch == RS485_BUS_SYNC) {
+            start_frame(p);
+        }
+        return false;
+    }
+    if (p->pos < p->need) {
+        return false;
+    }
+
+    p->in_frame = false;
+    uint16_t body = p->need - RS485_BUS_CRC_SIZE;
+    uint16_t crc = (uint16_t)(p->buf[body] << 8 | p->buf[body + 1]);
+    if (crc16(p->buf, body) != crc) {
+        p->errors++;
+        return false;
+    }
+    return true;
+}
+
+uint16_t rs485_bus_parser_len(const rs485_bus_parser_t* p) {
+    return p->need - RS485_BUS_CRC_SIZE;
+}
+
+bool rs485_bus_decode(const uint8_t* raw, uint16_t raw_len,
+                      rs485_bus_frame_t* frame) {
+    if (raw_len < PRE_LEN_SIZE) {
+        return false;
+    }
+    frame->addr = raw[0];
+    frame->type = raw[1];
+    frame->len = get_u16(&raw[2]);
+    frame->payload = &raw[PRE_LEN_SIZE];
+    return frame->len == raw_len - PRE_LEN_SIZE;
+}
+
+size_t rs485_bus_finish(uint8_t* out, uint8_t addr, uint8_t type,
+                        uint16_t len) {
+    out[0] = RS485_BUS_SYNC;
+    out[1] = addr;
+    out[2] = type;
+    put_u16(&out[3], len);
+
+    size_t body = PRE_LEN_SIZE + len;
+    uint16_t crc = crc16(&out[1], body);
+    out[1 + body] = (uint8_t)(crc >> 8);
+    out[2 + body] = (uint8_t)(crc & 0xFF);
+    return RS485_BUS_HEADER_SIZE + len + RS485_BUS_CRC_SIZE;
+}
+
+size_t rs485_bus_make_poll(uint8_t* out, uint8_t addr, uint16_t credit) {
+    put_u16(&out[RS485_BUS_HEADER_SIZE], credit);
+    return rs485_bus_finish(out, addr, rs485_bus_type_poll,
+                            RS485_BUS_POLL_SIZE);
+}
+
+size_t rs485_bus_make_time_req(uint8_t* out, uint8_t addr, uint8_t seq) {
+    out[RS485_BUS_HEADER_SIZE] = seq;
+    return rs485_bus_finish(out, addr, rs485_bus_type_time_req,
+                            RS485_BUS_TIME_REQ_SIZE);
+}
+
+size_t rs485_bus_make_time_resp(uint8_t* out, uint8_t addr, uint8_t seq,
+                                uint64_t rx_us, uint8_t prev_seq,
+                                uint64_t prev_tx_us) {
+    uint8_t* payload = &out[RS485_BUS_HEADER_SIZE];
+    payload[0] = seq;
+    put_u64(&payload[1], rx_us);
+    payload[9] = prev_seq;
+    put_u64(&payload[10], prev_tx_us);
+    return rs485_bus_finish(out, addr, rs485_bus_type_time_resp,
+                            RS485_BUS_TIME_RESP_SIZE);
+}
+
+void rs485_bus_put_data_header(uint8_t* payload, uint16_t pending,
+                               uint64_t base_us) {
+    put_u16(payload, pending);
+    put_u64(&payload[2], base_us);
+}
+
+bool rs485_bus_put_record_header(uint8_t* out, uint8_t flags, uint8_t topic,
+                                 uint16_t seq, uint64_t timestamp_us,
+                                 uint16_t len, uint64_t base_us) {
+    int64_t dt = (int64_t)(timestamp_us - base_us);
+    if (dt < INT32_MIN || dt > INT32_MAX) {
+        return false;
+    }
+    put_u16(out, len);
+    out[2] = flags;
+    out[3] = topic;
+    put_u16(&out[4], seq);
+    put_u32(&out[6], (uint32_t)dt);
+    return true;
+}
+
+bool rs485_bus_next_record(const rs485_bus_frame_t* frame, uint16_t* pos,
+                           rs485_bus_record_t* rec) {
+    if (frame->len < RS485_BUS_DATA_HEADER_SIZE ||
+        *pos + RS485_BUS_RECORD_HEADER_SIZE > frame->len) {
+        return false;
+    }
+    const uint8_t* p = &frame->payload[*pos];
+    uint16_t len = get_u16(p);
+    if (*pos + RS485_BUS_RECORD_HEADER_SIZE + len > frame->len) {
+        return false;
+    }
+    uint64_t base_us = get_u64(&frame->payload[2]);
+
+    rec->flags = p[2];
+    rec->topic = p[3];
+    rec->seq = get_u16(&p[4]);
+    rec->timestamp_us = base_us + (int64_t)(int32_t)get_u32(&p[6]);
+    rec->body = &p[RS485_BUS_RECORD_HEADER_SIZE];
+    rec->len = len;
+    *pos += RS485_BUS_RECORD_HEADER_SIZE + len;
+    return true;
+}
+
+void rs485_bus_master_init(rs485_bus_master_t* m, const uint8_t* addrs,
+                           uint8_t count) {
+    memset(m, 0, sizeof(*m));
+    if (count > RS485_BUS_MAX_NODES) {
+        count = RS485_BUS_MAX_NODES;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        m->nodes[i].addr = addrs[i];
+    }
+    m->node_count = count;
+}
+
+void rs485_bus_master_next(rs485_bus_master_t* m, uint8_t* addr,
+                           uint16_t* credit) {
+    // deficit round robin: 溜まっている量に比例してポーリングの機会を配る
+    uint8_t best = 0;
+    for (uint8_t i = 0; i < m->node_count; i++) {
+        rs485_bus_node_t* node = &m->nodes[i];
+        node->deficit += RS485_BUS_BASE_WEIGHT + node->pending;
+        if (node->deficit > m->nodes[best].deficit) {
+            best = i;
+        }
+    }
+
+    rs485_bus_node_t* node = &m->nodes[best];
+    node->deficit = 0;
+    node->polls++;
+    m->current = best;
+
+    // 申告された残量を一度で受け取れるだけ許可する
+    uint16_t c = node->pending;
+    if (c < RS485_BUS_MIN_CREDIT) {
+        c = RS485_BUS_MIN_CREDIT;
+    }
+    if (c > RS485_BUS_MAX_CREDIT) {
+        c = RS485_BUS_MAX_CREDIT;
+    }
+    *addr = node->addr;
+    *credit = c;
+}
+
+uint32_t rs485_bus_master_timeout_us(uint16_t credit, uint32_t baud) {
+    // ポーリングの送信と、許可した分の最大の返信にかかる時間
+    uint32_t bytes = RS485_BUS_HEADER_SIZE * 2 + RS485_BUS_CRC_SIZE * 2 +
+                     RS485_BUS_POLL_SIZE + credit;
+    uint64_t us =
+        ((uint64_t)bytes * UART_BITS_PER_CHAR * 1000000 + baud - 1) / baud;
+    return (uint32_t)us + RS485_BUS_TURNAROUND_US +
+           RS485_BUS_TIMEOUT_MARGIN_US;
+}
+
+bool rs485_bus_master_on_data(rs485_bus_master_t* m,
+                              const rs485_bus_frame_t* frame) {
+    rs485_bus_node_t* node = &m->nodes[m->current];
+    if (frame->type != rs485_bus_type_data || frame->addr != node->addr ||
+        frame->len < RS485_BUS_DATA_HEADER_SIZE) {
+        return false;
+    }
+    node->pending = get_u16(frame->payload);
+    node->idle = node->pending == 0 && frame->len == RS485_BUS_DATA_HEADER_SIZE;
+    return true;
+}
+
+void rs485_bus_master_on_timeout(rs485_bus_master_t* m) {
+    // 応答しないノードは空として扱い、ポーリング頻度を落とす
+    rs485_bus_node_t* node = &m->nodes[m->current];
+    node->timeouts++;
+    node->pending = 0;
+    node->idle = true;
+}
+
+bool rs485_bus_master_is_idle(const rs485_bus_master_t* m) {
+    for (uint8_t i = 0; i < m->node_count; i++) {
+        if (!m->nodes[i].idle) {
+            return false;
+        }
+    }
+    return true;
+}
+
+rs485_bus_node_t* rs485_bus_master_find(rs485_bus_master_t* m, uint8_t addr) {
+    for (uint8_t i = 0; i < m->node_count; i++) {
+        if (m->nodes[i].addr == addr) {
+            return &m->nodes[i];
+        }
+    }
+    return NULL;
+}
+
+void rs485_bus_master_next_time(rs485_bus_master_t* m, uint8_t* addr,
+                                uint8_t* seq) {
+    // ノードの数は少ないので順番に回す
+    m->time_current = (uint8_t)((m->time_current + 1) % m->node_count);
+    m->time_seq++;
+    *addr = m->nodes[m->time_current].addr;
+    *seq = m->time_seq;
+}
+
+static void clock_sample(rs485_bus_clock_t* c, int64_t offset,
+                         int64_t delay) {
+    if (delay < 0) {
+        delay = 0;
+    }
+
+    // 往復が遅かった交換は片道だけ待たされた可能性が高いので使わない
+    // 最小値は少しずつ緩め、状況が変わっても追従できるようにする
+    if (c->samples == 0 || delay < c->min_delay_us) {
+        c->min_delay_us = (uint32_t)delay;
+    } else {
+        c->min_delay_us++;
+    }
+    if (delay > (int64_t)c->min_delay_us + RS485_BUS_CLOCK_DELAY_MARGIN_US) {
+        c->rejected++;
+        return;
+    }
+    c->samples++;
+    c->delay_us = (uint32_t)delay;
+
+    int64_t error = offset - c->offset_us;
+    if (!c->valid || llabs(error) > RS485_BUS_CLOCK_STEP_US) {
+        if (c->valid) {
+            c->steps++;
+        }
+        c->valid = true;
+        c->offset_us = offset;
+        c->last_error_us = 0;
+        return;
+    }
+    c->offset_us += error / (1 << CLOCK_GAIN_SHIFT);
+    c->last_error_us = (int32_t)error;
+}
+
+bool rs485_bus_master_on_time(rs485_bus_master_t* m,
+                              const rs485_bus_frame_t* frame, uint64_t t1,
+                              uint64_t t4) {
+    rs485_bus_node_t* node = &m->nodes[m->time_current];
+    if (frame->type != rs485_bus_type_time_resp ||
+        frame->addr != node->addr || frame->len != RS485_BUS_TIME_RESP_SIZE ||
+        frame->payload[0] != m->time_seq) {
+        return false;
+    }
+
+    rs485_bus_clock_t* c = &node->clock;
+    uint64_t t2 = get_u64(&frame->payload[1]);
+    uint8_t prev_seq = frame->payload[9];
+    uint64_t t3 = get_u64(&frame->payload[10]);
+
+    // 前回の交換が取りこぼしなく続いていればt3が揃う
+    if (c->has_prev && prev_seq == c->prev_seq && t3 != 0) {
+        int64_t offset = ((int64_t)(c->prev_t2 - c->prev_t1) +
+                          (int64_t)(t3 - c->prev_t4)) /
+                         2;
+        int64_t delay = (int64_t)(c->prev_t4 - c->prev_t1) -
+                        (int64_t)(t3 - c->prev_t2);
+        clock_sample(c, offset, delay);
+    }
+
+    c->has_prev = true;
+    c->prev_seq = m->time_seq;
+    c->prev_t1 = t1;
+    c->prev_t2 = t2;
+    c->prev_t4 = t4;
+    return true;
+}
+
+uint64_t rs485_bus_clock_to_master(const rs485_bus_clock_t* c,
+                                   uint64_t node_us) {
+    return c->valid ? (uint64_t)((int64_t)node_us - c->offset_us) : node_us;
+}
@@ -0,0 +1,382 @@
+#include "sd_card.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <hardware/clocks.h>
+#include <hardware/dma.h>
+#include <hardware/gpio.h>
+#include <hardware/pio.h>
+#include <pico/time.h>
+
+#include "sd_card.pio.h"
+
+#define CMD0 (0)     // GO_IDLE_STATE
+#define CMD8 (8)     // SEND_IF_COND
+#define CMD16 (16)   // SET_BLOCKLEN
+#define CMD17 (17)   // READ_SINGLE_BLOCK
+#define CMD24 (24)   // WRITE_BLOCK
+#define CMD25 (25)   // WRITE_MULTIPLE_BLOCK
+#define CMD55 (55)   // APP_CMD
+#define CMD58 (58)   // READ_OCR
+#define ACMD23 (23)  // SET_WR_BLK_ERASE_COUNT
+#define ACMD41 (41)  // SD_SEND_OP_COND
+
+#define R1_IDLE (0x01)
+#define R1_ILLEGAL_COMMAND (0x04)
+
+#define TOKEN_SINGLE (0xFE)  // 読み込みと1ブロックの書き込み
+#define TOKEN_MULTI (0xFC)
+#define TOKEN_STOP (0xFD)
+#define DATA_ACCEPTED (0x05)
+
+#define CMD_TIMEOUT_US (100000)
+#define INIT_TIMEOUT_US (1000000)
+
+enum {
+    state_idle = 0,
+    state_init_idle,   // CMD0を受け付けるのを待っている
+    state_init_ready,  // ACMD41で準備ができるのを待っている
+    state_data,  // DMAでブロックを送っている
+    state_busy,  // カードがブロックを書いている
+    state_stop,  // 終わりのトークンの後のbusy
+};
+
+static void set_baud(sd_card_dev_t* dev, uint baud) {
+    // 1bitあたり4クロック
+    pio_sm_set_clkdiv(dev->pio, dev->sm,
+                      (float)clock_get_hz(clk_sys) / (4.0f * baud));
+}
+
+static uint8_t xfer(sd_card_dev_t* dev, uint8_t out) {
+    // 8bitで書くと32bitに複製され、8bitで読むと下位を取れる
+    *(io_rw_8*)&dev->pio->txf[dev->sm] = out;
+    while (pio_sm_is_rx_fifo_empty(dev->pio, dev->sm)) {
+        tight_loop_contents();
+    }
+    return *(io_rw_8*)&dev->pio->rxf[dev->sm];
+}
+
+static void chip_select(sd_card_dev_t* dev) {
+    gpio_put(dev->pin_cs, 0);
+    xfer(dev, 0xFF);
+}
+
+static void chip_deselect(sd_card_dev_t* dev) {
+    gpio_put(dev->pin_cs, 1);
+    xfer(dev, 0xFF);  // DOを離してもらう
+}
+
+static bool wait_ready(sd_card_dev_t* dev, uint32_t timeout_us) {
+    uint32_t start_us = time_us_32();
+    while (xfer(dev, 0xFF) != 0xFF) {
+        if (time_us_32() - start_us > timeout_us) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool wait_token(sd_card_dev_t* dev, uint8_t token) {
+    uint32_t start_us = time_us_32();
+    uint8_t b;
+    while ((b = xfer(dev, 0xFF)) == 0xFF) {
+        if (time_us_32() - start_us > CMD_TIMEOUT_US) {
+            return false;
+        }
+    }
+    return b == token;
+}
+
+// コマンドを送ってR1を返す。応答が無ければ0xFF
+static uint8_t send_cmd(sd_card_dev_t* dev, uint8_t cmd, uint32_t arg) {
+    if (!wait_ready(dev, CMD_TIMEOUT_US)) {
+        return 0xFF;
+    }
+
+    // SPIモードでCRCを見るのはCMD0とCMD8だけ
+    uint8_t crc = cmd == CMD0 ? 0x95 : cmd == CMD8 ? 0x87 : 0x01;
+    const uint8_t frame[] = {
+        0x40 | cmd, arg >> 24, arg >> 16, arg >> 8, arg, crc,
+    };
+    for (uint8_t i = 0; i < sizeof(frame); i++) {
+        xfer(dev, frame[i]);
+    }
+
+    uint8_t r1 = 0xFF;
+    for (uint8_t i = 0; i < 8 && ((r1 = xfer(dev, 0xFF)) & 0x80); i++) {
+    }
+    return r1;
+}
+
+static uint8_t send_acmd(sd_card_dev_t* dev, uint8_t cmd, uint32_t arg) {
+    uint8_t r1 = send_cmd(dev, CMD55, 0);
+    if (r1 > R1_IDLE) {
+        return r1;
+    }
+    return send_cmd(dev, cmd, arg);
+}
+
+static uint32_t card_addr(const sd_card_dev_t* dev, uint32_t lba) {
+    return dev->block_addr ? lba : lba * SD_CARD_BLOCK_SIZE;
+}
+
+// 準備ができたカードが、ブロックとbyteのどちらの単位で指すかを確かめる
+static bool card_finish(sd_card_dev_t* dev) {
+    dev->block_addr = false;
+    if (dev->v2) {
+        if (send_cmd(dev, CMD58, 0) != 0) {
+            return false;
+        }
+        uint8_t ocr[4];
+        for (uint8_t i = 0; i < sizeof(ocr); i++) {
+            ocr[i] = xfer(dev, 0xFF);
+        }
+        dev->block_addr = ocr[0] & 0x40;  // CCS
+    }
+    if (!dev->block_addr &&
+        send_cmd(dev, CMD16, SD_CARD_BLOCK_SIZE) != 0) {
+        return false;
+    }
+    return true;
+}
+
+// CMD0でSPIモードに入れ、CMD8でv2以降のカードかを確かめる
+static sd_card_init_result_t init_idle(sd_card_dev_t* dev) {
+    if (send_cmd(dev, CMD0, 0) != R1_IDLE) {
+        return sd_card_init_pending;
+    }
+
+    // v2以降のカードはCMD8で電圧の範囲とパターンを返す
+    dev->v2 = false;
+    uint8_t r1 = send_cmd(dev, CMD8, 0x1AA);
+    if (!(r1 & R1_ILLEGAL_COMMAND)) {
+        uint8_t r7[4];
+        for (uint8_t i = 0; i < sizeof(r7); i++) {
+            r7[i] = xfer(dev, 0xFF);
+        }
+        if ((r7[2] & 0x0F) != 0x01 || r7[3] != 0xAA) {
+            return sd_card_init_failed;
+        }
+        dev->v2 = true;
+    }
+
+    dev->state = state_init_ready;
+    dev->wait_start_us = time_us_32();
+    return sd_card_init_pending;
+}
+
+// ACMD41で準備ができたかを一度だけ問い合わせる
+static sd_card_init_result_t init_ready(sd_card_dev_t* dev) {
+    uint8_t r1 = send_acmd(dev, ACMD41, dev->v2 ? 0x40000000 : 0);
+    if (r1 == R1_IDLE) {
+        return sd_card_init_pending;
+    }
+    if (r1 != 0 || !card_finish(dev)) {
+        return sd_card_init_failed;
+    }
+    return sd_card_init_done;
+}
+
+void sd_card_init_start(sd_card_dev_t* dev) {
+    dev->offset = pio_add_program(dev->pio, &sd_card_program);
+    dev->sm = pio_claim_unused_sm(dev->pio, true);
+
+    pio_gpio_init(dev->pio, dev->pin_sck);
+    pio_gpio_init(dev->pio, dev->pin_mosi);
+    pio_gpio_init(dev->pio, dev->pin_miso);
+    gpio_pull_up(dev->pin_miso);
+    pio_sm_set_consecutive_pindirs(dev->pio, dev->sm, dev->pin_sck, 1, true);
+    pio_sm_set_consecutive_pindirs(dev->pio, dev->sm, dev->pin_mosi, 1, true);
+    pio_sm_set_consecutive_pindirs(dev->pio, dev->sm, dev->pin_miso, 1, false);
+
+    gpio_init(dev->pin_cs);
+    gpio_set_dir(dev->pin_cs, GPIO_OUT);
+    gpio_put(dev->pin_cs, 1);
+
+    pio_sm_config c = sd_card_program_get_default_config(dev->offset);
+    sm_config_set_out_pins(&c, dev->pin_mosi, 1);
+    sm_config_set_in_pins(&c, dev->pin_miso);
+    sm_config_set_sideset_pins(&c, dev->pin_sck);
+    sm_config_set_out_shift(&c, false, true, 8);  // autopull
+    sm_config_set_in_shift(&c, false, true, 8);   // autopush
+    pio_sm_init(dev->pio, dev->sm, dev->offset, &c);
+    set_baud(dev, SD_CARD_INIT_BAUD);
+    pio_sm_set_enabled(dev->pio, dev->sm, true);
+
+    dev->dma_tx = dma_claim_unused_channel(true);
+    dma_channel_config c_tx = dma_channel_get_default_config(dev->dma_tx);
+    channel_config_set_transfer_data_size(&c_tx, DMA_SIZE_8);
+    channel_config_set_dreq(&c_tx, pio_get_dreq(dev->pio, dev->sm, true));
+    channel_config_set_read_increment(&c_tx, true);
+    channel_config_set_write_increment(&c_tx, false);
+    dma_channel_configure(dev->dma_tx, &c_tx, &dev->pio->txf[dev->sm], NULL,
+                          0, false);
+
+    // 受け取ったものは捨てるが、読まないとFIFOが詰まって止まる
+    dev->dma_rx = dma_claim_unused_channel(true);
+    dma_channel_config c_rx = dma_channel_get_default_config(dev->dma_rx);
+    channel_config_set_transfer_data_size(&c_rx, DMA_SIZE_8);
+    channel_config_set_dreq(&c_rx, pio_get_dreq(dev->pio, dev->sm, false));
+    channel_config_set_read_increment(&c_rx, false);
+    channel_config_set_write_increment(&c_rx, false);
+    dma_channel_configure(dev->dma_rx, &c_rx, &dev->dma_dummy,
+                          &dev->pio->rxf[dev->sm], 0, false);
+
+    dev->error = false;
+
+    // CSをHighにしたまま74クロック以上送るとSPIモードに入れる
+    for (uint8_t i = 0; i < 10; i++) {
+        xfer(dev, 0xFF);
+    }
+    dev->state = state_init_idle;
+    dev->wait_start_us = time_us_32();
+}
+
+sd_card_init_result_t sd_card_init_step(sd_card_dev_t* dev) {
+    if (dev->state != state_init_idle && dev->state != state_init_ready) {
+        return dev->error ? sd_card_init_failed : sd_card_init_done;
+    }
+
+    chip_select(dev);
+    sd_card_init_result_t result =
+        dev->state == state_init_idle ? init_idle(dev) : init_ready(dev);
+    chip_deselect(dev);
+
+    if (result == sd_card_init_pending &&
+        time_us_32() - dev->wait_start_us > INIT_TIMEOUT_US) {
+        result = sd_card_init_failed;
+    }
+    if (result == sd_card_init_failed) {
+        dev->error = true;
+        dev->state = state_idle;
+    } else if (result == sd_card_init_done) {
+        dev->state = state_idle;
+        set_baud(dev, dev->baud);
+    }
+    return result;
+}
+
+bool sd_card_read(sd_card_dev_t* dev, uint32_t lba, uint8_t* buf) {
+    if (dev->state != state_idle) {
+        return false;
+    }
+    chip_select(dev);
+    bool ok = send_cmd(dev, CMD17, card_addr(dev, lba)) == 0 &&
+              wait_token(dev, TOKEN_SINGLE);
+    if (ok) {
+        for (uint32_t i = 0; i < SD_CARD_BLOCK_SIZE; i++) {
+            buf[i] = xfer(dev, 0xFF);
+        }
+        xfer(dev, 0xFF);  // CRC
+        xfer(dev, 0xFF);
+    }
+    chip_deselect(dev);
+    return ok;
+}
+
+bool sd_card_write(sd_card_dev_t* dev, uint32_t lba, const uint8_t* buf) {
+    if (dev->state != state_idle) {
+        return false;
+    }
+    chip_select(dev);
+    bool ok = send_cmd(dev, CMD24, card_addr(dev, lba)) == 0;
+    if (ok) {
+        xfer(dev, TOKEN_SINGLE);
+        for (uint32_t i = 0; i < SD_CARD_BLOCK_SIZE; i++) {
+            xfer(dev, buf[i]);
+        }
+        xfer(dev, 0xFF);  // CRC
+        xfer(dev, 0xFF);
+        ok = (xfer(dev, 0xFF) & 0x1F) == DATA_ACCEPTED &&
+             wait_ready(dev, SD_CARD_WRITE_TIMEOUT_US);
+    }
+    chip_deselect(dev);
+    return ok;
+}
+
+// トークンを送り、1ブロック分をDMAに任せる
+static void start_block(sd_card_dev_t* dev) {
+    xfer(dev, TOKEN_MULTI);
+    dma_channel_set_read_addr(dev->dma_tx, dev->write_buf, false);
+    dma_channel_set_trans_count(dev->dma_tx, SD_CARD_BLOCK_SIZE, false);
+    dma_channel_set_trans_count(dev->dma_rx, SD_CARD_BLOCK_SIZE, false);
+    dma_start_channel_mask((1u << dev->dma_rx) | (1u << dev->dma_tx));
+    dev->state = state_data;
+}
+
+static void fail(sd_card_dev_t* dev) {
+    dev->error = true;
+    chip_deselect(dev);
+    dev->state = state_idle;
+}
+
+bool sd_card_write_start(sd_card_dev_t* dev, uint32_t lba, const uint8_t* buf,
+                         uint32_t count) {
+    if (dev->state != state_idle || dev->error || count == 0) {
+        return false;
+    }
+    chip_select(dev);
+    // 先に消しておいてもらうと書き込みが速くなる
+    if (send_acmd(dev, ACMD23, count) != 0 ||
+        send_cmd(dev, CMD25, card_addr(dev, lba)) != 0) {
+        fail(dev);
+        return false;
+    }
+    dev->write_buf = buf;
+    dev->write_left = count;
+    start_block(dev);
+    return true;
+}
+
+void sd_card_task(sd_card_dev_t* dev) {
+    uint32_t start_us = time_us_32();
+    while (dev->state != state_idle &&
+           time_us_32() - start_us < SD_CARD_TASK_BUDGET_US) {
+        if (dev->state == state_data) {
+            // 受け取り終えていれば送り終えている
+            if (dma_channel_is_busy(dev->dma_rx)) {
+                return;
+            }
+            xfer(dev, 0xFF);  // CRC
+            xfer(dev, 0xFF);
+            if ((xfer(dev, 0xFF) & 0x1F) != DATA_ACCEPTED) {
+                fail(dev);
+                return;
+            }
+            dev->write_buf += SD_CARD_BLOCK_SIZE;
+            --dev->write_left;
+            dev->wait_start_us = time_us_32();
+            dev->state = state_busy;
+            continue;
+        }
+
+        // busyの間はDOがLowのまま
+        if (xfer(dev, 0xFF) != 0xFF) {
+            if (time_us_32() - dev->wait_start_us > SD_CARD_WRITE_TIMEOUT_US) {
+                fail(dev);
+                return;
+            }
+            continue;
+        }
+        if (dev->state == state_stop) {
+            chip_deselect(dev);
+            dev->state = state_idle;
+        } else if (dev->write_left != 0) {
+            start_block(dev);
+        } else {
+            xfer(dev, TOKEN_STOP);
+            xfer(dev, 0xFF);
+            dev->wait_start_us = time_us_32();
+            dev->state = state_stop;
+        }
+    }
+}
+
+bool sd_card_is_busy(const sd_card_dev_t* dev) {
+    return dev->state != state_idle;
+}
+
+bool sd_card_has_error(const sd_card_dev_t* dev) {
+    return dev->error;
+}
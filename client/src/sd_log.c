@@ -0,0 +1,619 @@
+#include "sd_log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <hardware/sync.h>
+#include <pico/platform.h>
+#include <pico/rand.h>
+#include <pico/time.h>
+
+#include "ring_buf.h"
+#include "sd_card.h"
+
+#define BLOCK_SIZE (SD_CARD_BLOCK_SIZE)
+#define DIR_ENTRY_SIZE (32)
+#define FAT_ENTRIES_PER_BLOCK (BLOCK_SIZE / 4)
+
+#define FAT_MASK (0x0FFFFFFF)
+#define FAT_EOC (0x0FFFFFFF)  // チェーンの終わり
+#define FAT_EOC_MIN (0x0FFFFFF8)
+
+#define ATTR_VOLUME_ID (0x08)
+#define ATTR_ARCHIVE (0x20)
+#define ATTR_LONG_NAME (0x0F)
+
+#define NO_BLOCK (0xFFFFFFFF)
+
+// 8文字の名前に入る番号
+#define MAX_NUMBER (99999999)
+
+// sd_log_init_stepの段階
+enum {
+    step_mount,
+    step_scan_dir,
+    step_find_free,
+    step_check_oldest,
+    step_write_chain,
+    step_write_entry,
+    step_write_fsinfo,
+    step_finish,
+    step_done,
+    step_failed,
+};
+
+static uint16_t get_le16(const uint8_t* p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+static void put_le16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t* p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static uint32_t cluster_lba(const sd_log_fat32_t* fat, uint32_t cluster) {
+    return fat->data_lba + (cluster - 2) * fat->cluster_blocks;
+}
+
+// この回に読み書きできるブロックが残っているか
+static bool has_budget(const sd_log_init_t* init) {
+    return init->blocks < SD_LOG_INIT_BLOCKS;
+}
+
+static bool read_block(sd_log_t* log, uint32_t lba, uint8_t* buf) {
+    log->init.blocks++;
+    return sd_card_read(log->card, lba, buf);
+}
+
+// 書き込みは始めるだけで、busyは次の回からsd_card_taskで見に行く
+// bufは書き終わるまで書き換えられないので、この回はここで終える
+static bool write_block(sd_log_t* log, uint32_t lba, const uint8_t* buf) {
+    log->init.blocks = SD_LOG_INIT_BLOCKS;
+    return sd_card_write_start(log->card, lba, buf, 1);
+}
+
+// パーティションテーブルが無くても、最初のパーティションでもよい
+static bool mount(sd_log_t* log, uint8_t* sec) {
+    sd_log_fat32_t* fat = &log->init.fat;
+    uint32_t part = 0;
+    if (!read_block(log, 0, sec) || get_le16(&sec[510]) != 0xAA55) {
+        return false;
+    }
+    if (memcmp(&sec[82], "FAT32   ", 8) != 0) {
+        const uint8_t* entry = &sec[0x1BE];
+        if (entry[4] != 0x0B && entry[4] != 0x0C) {
+            return false;
+        }
+        part = get_le32(&entry[8]);
+        if (!read_block(log, part, sec) || get_le16(&sec[510]) != 0xAA55) {
+            return false;
+        }
+    }
+
+    // ルートディレクトリの数が0で、FAT32のFATの大きさがあること
+    if (get_le16(&sec[11]) != BLOCK_SIZE || get_le16(&sec[17]) != 0 ||
+        get_le32(&sec[36]) == 0 || sec[13] == 0 || sec[16] == 0) {
+        return false;
+    }
+    fat->cluster_blocks = sec[13];
+    fat->fat_count = sec[16];
+    fat->fat_lba = part + get_le16(&sec[14]);
+    fat->fat_size = get_le32(&sec[36]);
+    fat->root_cluster = get_le32(&sec[44]);
+    fat->fsinfo_lba = part + get_le16(&sec[48]);
+    fat->data_lba = fat->fat_lba + fat->fat_count * fat->fat_size;
+
+    uint32_t total =
+        get_le16(&sec[19]) != 0 ? get_le16(&sec[19]) : get_le32(&sec[32]);
+    if (part + total <= fat->data_lba) {
+        return false;
+    }
+    fat->cluster_count = (part + total - fat->data_lba) / fat->cluster_blocks;
+    // FATに入り切る分だけ
+    uint32_t entries = fat->fat_size * FAT_ENTRIES_PER_BLOCK - 2;
+    if (fat->cluster_count > entries) {
+        fat->cluster_count = entries;
+    }
+    return true;
+}
+
+// 読んだブロックを覚えておき、同じブロックなら読み直さない
+static bool fat_get(sd_log_t* log, uint8_t* sec, uint32_t cluster,
+                    uint32_t* value) {
+    sd_log_init_t* init = &log->init;
+    uint32_t lba = init->fat.fat_lba + cluster / FAT_ENTRIES_PER_BLOCK;
+    if (lba != init->fat_cached) {
+        if (!read_block(log, lba, sec)) {
+            return false;
+        }
+        init->fat_cached = lba;
+    }
+    *value = get_le32(&sec[cluster % FAT_ENTRIES_PER_BLOCK * 4]) & FAT_MASK;
+    return true;
+}
+
+// "123     BIN" のような名前なら番号を返す
+static bool parse_name(const uint8_t* entry, uint32_t* number) {
+    if (memcmp(&entry[8], "BIN", 3) != 0) {
+        return false;
+    }
+    uint32_t n = 0;
+    uint8_t i = 0;
+    for (; i < 8 && entry[i] >= '0' && entry[i] <= '9'; i++) {
+        n = n * 10 + (entry[i] - '0');
+    }
+    if (i == 0) {
+        return false;
+    }
+    for (; i < 8; i++) {
+        if (entry[i] != ' ') {
+            return false;
+        }
+    }
+    *number = n;
+    return true;
+}
+
+// ディレクトリの1ブロックを見る。終わりの印があればtrue
+static bool scan_entries(sd_log_dir_t* dir, const uint8_t* sec, uint32_t lba,
+                         uint32_t file_size) {
+    for (uint32_t off = 0; off < BLOCK_SIZE; off += DIR_ENTRY_SIZE) {
+        const uint8_t* entry = &sec[off];
+        if (entry[0] == 0x00 || entry[0] == 0xE5) {
+            if (!dir->has_free) {
+                dir->has_free = true;
+                dir->free_lba = lba;
+                dir->free_off = off;
+            }
+            if (entry[0] == 0x00) {
+                return true;  // 以降は使われていない
+            }
+            continue;
+        }
+        uint32_t num;
+        if (entry[11] == ATTR_LONG_NAME || (entry[11] & ATTR_VOLUME_ID) ||
+            !parse_name(entry, &num)) {
+            continue;
+        }
+        if (num >= dir->number) {
+            dir->number = num + 1;
+        }
+        if (get_le32(&entry[28]) == file_size &&
+            (dir->files++ == 0 || num < dir->oldest_number)) {
+            dir->oldest_number = num;
+            dir->oldest_lba = lba;
+            dir->oldest_off = off;
+            dir->oldest_first = (uint32_t)get_le16(&entry[20]) << 16 |
+                                get_le16(&entry[26]);
+        }
+    }
+    return false;
+}
+
+// ルートディレクトリから次の番号、空いているエントリ、最も古いファイルを探す
+// 空いているエントリが無くても (クラスタを足してまでは作らない)、
+// 古いファイルを使い直せるので最後まで読む
+// 読み終えたらdoneを立てる
+static bool scan_dir(sd_log_t* log, uint8_t* sec, uint8_t* fat_sec,
+                     bool* done) {
+    sd_log_init_t* init = &log->init;
+    const sd_log_fat32_t* fat = &init->fat;
+    uint32_t file_size = init->clusters * fat->cluster_blocks * BLOCK_SIZE;
+    while (has_budget(init)) {
+        if (init->cluster < 2 || init->cluster >= FAT_EOC_MIN ||
+            init->count >= fat->cluster_count) {
+            *done = true;
+            return true;
+        }
+        if (init->pos == fat->cluster_blocks) {
+            if (!fat_get(log, fat_sec, init->cluster, &init->cluster)) {
+                return false;
+            }
+            init->pos = 0;
+            init->count++;
+            continue;
+        }
+        uint32_t lba = cluster_lba(fat, init->cluster) + init->pos;
+        if (!read_block(log, lba, sec)) {
+            return false;
+        }
+        if (scan_entries(&init->dir, sec, lba, file_size)) {
+            *done = true;
+            return true;
+        }
+        init->pos++;
+    }
+    return true;
+}
+
+// clusters個続けて空いているクラスタを前から探す
+// 見つかればfirstに、最後まで無ければ2未満にして戻る
+static bool find_free_run(sd_log_t* log, uint8_t* sec) {
+    sd_log_init_t* init = &log->init;
+    uint32_t end = init->fat.cluster_count + 2;
+    while (has_budget(init)) {
+        if (init->cluster >= end) {
+            init->first = 0;
+            return true;
+        }
+        uint32_t value;
+        if (!fat_get(log, sec, init->cluster, &value)) {
+            return false;
+        }
+        init->count = value == 0 ? init->count + 1 : 0;
+        if (init->count == init->clusters) {
+            init->first = init->cluster + 1 - init->clusters;
+            return true;
+        }
+        init->cluster++;
+    }
+    return true;
+}
+
+// firstからclusters個が一本に続くチェーンかを、clusterまで見たところ
+// PCで書き戻したファイルなどは途切れていることがあるので使い直さない
+static bool check_contiguous(sd_log_t* log, uint8_t* sec) {
+    sd_log_init_t* init = &log->init;
+    uint32_t last = init->first + init->clusters - 1;
+    while (has_budget(init) && init->cluster <= last) {
+        uint32_t value;
+        if (!fat_get(log, sec, init->cluster, &value)) {
+            return false;
+        }
+        if (init->cluster == last ? value < FAT_EOC_MIN
+                                  : value != init->cluster + 1) {
+            return false;
+        }
+        init->cluster++;
+    }
+    return true;
+}
+
+// firstからclusters個を一本のチェーンにして、すべてのFATに書く
+// 一回に書くのは一つのFATの一ブロックだけ
+// posは次に書くFATのブロック、fat_copyは次に書くFATの番号
+static bool write_chain(sd_log_t* log, uint8_t* sec) {
+    sd_log_init_t* init = &log->init;
+    const sd_log_fat32_t* fat = &init->fat;
+    uint32_t first = init->first;
+    uint32_t last = first + init->clusters - 1;
+    uint32_t block = init->pos;
+    // 二つ目からのFATには、前の回に作ったブロックをそのまま書く
+    if (init->fat_copy == 0) {
+        if (!read_block(log, fat->fat_lba + block, sec)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < FAT_ENTRIES_PER_BLOCK; i++) {
+            uint32_t cluster = block * FAT_ENTRIES_PER_BLOCK + i;
+            if (cluster < first || cluster > last) {
+                continue;
+            }
+            // 上位4bitは予約なので残す
+            uint32_t next = cluster == last ? FAT_EOC : cluster + 1;
+            put_le32(&sec[i * 4], (get_le32(&sec[i * 4]) & ~FAT_MASK) | next);
+        }
+        init->fat_cached = fat->fat_lba + block;
+    }
+    if (!write_block(log, fat->fat_lba + init->fat_copy * fat->fat_size + block,
+                     sec)) {
+        return false;
+    }
+    if (++init->fat_copy == fat->fat_count) {
+        init->fat_copy = 0;
+        init->pos++;
+    }
+    return true;
+}
+
+static bool write_entry(sd_log_t* log, uint8_t* sec, uint32_t lba,
+                        uint32_t off, uint32_t number, uint32_t first,
+                        uint32_t size) {
+    if (!read_block(log, lba, sec)) {
+        return false;
+    }
+    uint8_t* entry = &sec[off];
+    memset(entry, 0, DIR_ENTRY_SIZE);
+
+    char name[12];
+    snprintf(name, sizeof(name), "%03lu", (unsigned long)number);
+    memset(entry, ' ', 11);
+    memcpy(entry, name, strlen(name));
+    memcpy(&entry[8], "BIN", 3);
+    entry[11] = ATTR_ARCHIVE;
+
+    // 時計が無いので日付は1980-01-01にしておく
+    put_le16(&entry[16], 0x0021);
+    put_le16(&entry[18], 0x0021);
+    put_le16(&entry[24], 0x0021);
+
+    put_le16(&entry[20], first >> 16);
+    put_le16(&entry[26], first & 0xFFFF);
+    put_le32(&entry[28], size);
+    return write_block(log, lba, sec);
+}
+
+// 空きクラスタ数が合わなくなるので、分からないことにしておく
+static bool invalidate_fsinfo(sd_log_t* log, uint8_t* sec) {
+    uint32_t lba = log->init.fat.fsinfo_lba;
+    if (!read_block(log, lba, sec)) {
+        return false;
+    }
+    if (get_le32(&sec[0]) != 0x41615252 || get_le32(&sec[484]) != 0x61417272) {
+        return true;  // 無ければそのまま
+    }
+    put_le32(&sec[488], 0xFFFFFFFF);
+    put_le32(&sec[492], 0xFFFFFFFF);
+    return write_block(log, lba, sec);
+}
+
+// 最も古いファイルを使い直せるか確かめに行く
+static void reuse_oldest(sd_log_init_t* init) {
+    init->first = init->dir.oldest_first;
+    init->cluster = init->first;
+    init->entry_lba = init->dir.oldest_lba;
+    init->entry_off = init->dir.oldest_off;
+    init->is_new = false;
+    init->step = step_check_oldest;
+}
+
+void sd_log_init_start(sd_log_t* log, sd_card_dev_t* card) {
+    // もう一方のコアが積まないよう、先に止めておく
+    log->enabled = false;
+    __dmb();
+    memset(log, 0, sizeof(*log));
+    for (uint8_t i = 0; i < SD_LOG_PRODUCER_COUNT; i++) {
+        ring_buf_init(&log->ingress[i], log->ingress_storage[i],
+                      SD_LOG_INGRESS_SIZE);
+    }
+    log->card = card;
+    log->init.step = step_mount;
+    log->init.fat_cached = NO_BLOCK;
+}
+
+// 一段階ずつ、読み書きするブロック数を区切って進める
+static bool init_step(sd_log_t* log) {
+    sd_log_init_t* init = &log->init;
+    const sd_log_fat32_t* fat = &init->fat;
+    // 書き始めるまではバッファを作業領域に使う
+    uint8_t* sec = log->buf[0];
+    uint8_t* fat_sec = log->buf[1];
+
+    switch (init->step) {
+        case step_mount: {
+            if (!mount(log, sec)) {
+                return false;
+            }
+            uint32_t cluster_size = fat->cluster_blocks * BLOCK_SIZE;
+            init->clusters =
+                (SD_LOG_FILE_SIZE + cluster_size - 1) / cluster_size;
+            init->cluster = fat->root_cluster;
+            init->step = step_scan_dir;
+            return true;
+        }
+        case step_scan_dir: {
+            bool done = false;
+            if (!scan_dir(log, sec, fat_sec, &done)) {
+                return false;
+            }
+            if (!done) {
+                return true;
+            }
+            if (init->dir.number > MAX_NUMBER) {
+                return false;
+            }
+            log->number = init->dir.number;
+            // 数が上限に達していなければ新しく作る
+            if (init->dir.files < SD_LOG_MAX_FILES && init->dir.has_free) {
+                init->cluster = 2;
+                init->count = 0;
+                init->first = 0;
+                init->step = step_find_free;
+            } else {
+                reuse_oldest(init);
+            }
+            return true;
+        }
+        case step_find_free:
+            if (!find_free_run(log, fat_sec)) {
+                return false;
+            }
+            if (init->first >= 2) {
+                init->entry_lba = init->dir.free_lba;
+                init->entry_off = init->dir.free_off;
+                init->is_new = true;
+                init->pos = init->first / FAT_ENTRIES_PER_BLOCK;
+                init->step = step_write_chain;
+            } else if (init->cluster >= fat->cluster_count + 2) {
+                reuse_oldest(init);
+            }
+            return true;
+        case step_check_oldest:
+            // 最も古いファイルの名前だけを変え、領域はそのまま使う
+            // 残っているデータはnonceが違うので読まれない
+            if (init->dir.files == 0 || init->first < 2 ||
+                init->first >= fat->cluster_count + 2 ||
+                init->clusters > fat->cluster_count + 2 - init->first ||
+                !check_contiguous(log, fat_sec)) {
+                return false;
+            }
+            if (init->cluster > init->first + init->clusters - 1) {
+                init->step = step_write_entry;
+            }
+            return true;
+        case step_write_chain:
+            // FAT、ディレクトリの順に一つずつ書き終えてから次を書くので、
+            // 途中で切れても空きが減るだけで済む
+            if (!write_chain(log, fat_sec)) {
+                return false;
+            }
+            if (init->pos > (init->first + init->clusters - 1) /
+                                FAT_ENTRIES_PER_BLOCK) {
+                init->step = step_write_entry;
+            }
+            return true;
+        case step_write_entry:
+            if (!write_entry(log, sec, init->entry_lba, init->entry_off,
+                             log->number, init->first,
+                             init->clusters * fat->cluster_blocks *
+                                 BLOCK_SIZE)) {
+                return false;
+            }
+            init->step = init->is_new ? step_write_fsinfo : step_finish;
+            return true;
+        case step_write_fsinfo:
+            if (!invalidate_fsinfo(log, sec)) {
+                return false;
+            }
+            init->step = step_finish;
+            return true;
+        case step_finish:
+            // 最後の書き込みも終わったので、ファイルに書き始められる
+            init->step = step_done;
+            return true;
+        default:
+            return false;
+    }
+}
+
+sd_log_init_result_t sd_log_init_step(sd_log_t* log) {
+    sd_log_init_t* init = &log->init;
+    if (init->step == step_done) {
+        return sd_log_init_done;
+    }
+    init->blocks = 0;
+    // 前の回に始めた書き込みが終わるまでは、作業領域に触らず次へ進まない
+    sd_card_task(log->card);
+    if (sd_card_has_error(log->card)) {
+        init->step = step_failed;
+        return sd_log_init_failed;
+    }
+    if (sd_card_is_busy(log->card)) {
+        return sd_log_init_pending;
+    }
+    if (!init_step(log)) {
+        init->step = step_failed;
+        return sd_log_init_failed;
+    }
+    if (init->step != step_done) {
+        return sd_log_init_pending;
+    }
+
+    log->nonce = get_rand_32();
+    log->lba = cluster_lba(&init->fat, init->first);
+    log->end_lba = log->lba + init->clusters * init->fat.cluster_blocks;
+    log->fill_len = SD_LOG_UNIT_HEADER_SIZE;
+    // もう一方のコアが有効と見た時には、他が全て見えているように
+    __dmb();
+    log->enabled = true;
+    return sd_log_init_done;
+}
+
+bool sd_log_append(sd_log_t* log, const uint8_t* frame, uint16_t len) {
+    if (!log->enabled) {
+        return false;
+    }
+    uint8_t core = get_core_num();
+    if (len > SD_LOG_BUF_SIZE - SD_LOG_UNIT_HEADER_SIZE ||
+        !ring_buf_push(&log->ingress[core], frame, len)) {
+        ++log->drops[core];
+        return false;
+    }
+    return true;
+}
+
+// 溜めた方をカードに書き始め、もう一方に溜めていく
+static void submit(sd_log_t* log) {
+    uint8_t* buf = log->buf[log->fill];
+    uint32_t blocks = (log->fill_len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (log->lba + blocks > log->end_lba) {
+        log->enabled = false;  // ファイルがいっぱい
+        return;
+    }
+
+    put_le32(&buf[0], SD_LOG_MAGIC);
+    put_le32(&buf[4], log->nonce);
+    put_le32(&buf[8], log->fill_len - SD_LOG_UNIT_HEADER_SIZE);
+    memset(&buf[log->fill_len], 0xFF, blocks * BLOCK_SIZE - log->fill_len);
+    if (!sd_card_write_start(log->card, log->lba, buf, blocks)) {
+        log->enabled = false;
+        return;
+    }
+
+    log->stats_bytes += blocks * BLOCK_SIZE;
+    log->lba += blocks;
+    log->writing = true;
+    log->write_start_us = time_us_32();
+    log->fill ^= 1;
+    log->fill_len = SD_LOG_UNIT_HEADER_SIZE;
+    log->sealed = false;
+}
+
+void sd_log_task(sd_log_t* log, uint64_t now_us) {
+    if (!log->enabled) {
+        return;
+    }
+
+    sd_card_task(log->card);
+    if (sd_card_has_error(log->card)) {
+        log->enabled = false;
+        return;
+    }
+    if (log->writing && !sd_card_is_busy(log->card)) {
+        log->writing = false;
+        uint32_t elapsed_us = time_us_32() - log->write_start_us;
+        if (elapsed_us > log->stats_write_us_max) {
+            log->stats_write_us_max = elapsed_us;
+        }
+    }
+
+    // カードが遅れている間は溜めている方がいっぱいになり、残りは受け口で待つ
+    for (uint8_t i = 0; i < SD_LOG_PRODUCER_COUNT; i++) {
+        ring_buf_t* rb = &log->ingress[i];
+        for (uint16_t len;
+             !log->sealed && (len = ring_buf_peek_len(rb)) != 0;) {
+            if (log->fill_len + len > SD_LOG_BUF_SIZE) {
+                log->sealed = true;
+                break;
+            }
+            if (log->fill_len == SD_LOG_UNIT_HEADER_SIZE) {
+                log->fill_us = now_us;
+            }
+            ring_buf_pop(rb, &log->buf[log->fill][log->fill_len], len);
+            log->fill_len += len;
+        }
+    }
+    if (!log->sealed && log->fill_len > SD_LOG_UNIT_HEADER_SIZE &&
+        now_us - log->fill_us >= SD_LOG_FLUSH_US) {
+        log->sealed = true;
+    }
+
+    if (log->sealed && !log->writing) {
+        submit(log);
+    }
+}
+
+void sd_log_take_stats(sd_log_t* log, sd_log_stats_t* stats) {
+    stats->bytes = log->stats_bytes;
+    stats->write_us_max = log->stats_write_us_max;
+    stats->drops = 0;
+    for (uint8_t i = 0; i < SD_LOG_PRODUCER_COUNT; i++) {
+        stats->drops += log->drops[i];
+    }
+
+    log->stats_bytes = 0;
+    log->stats_write_us_max = 0;
+}
@@ -1,43 +1,118 @@
 #include "shift_out.h"
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
+#include <hardware/clocks.h>
+#include <hardware/dma.h>
 #include <hardware/gpio.h>
 #include <hardware/pio.h>
-#include <pico/time.h>
 
 #include "shift_out.pio.h"
 
+// 先頭からbrightness枚のサブフレームだけ点ける
+static void fill_cycle(uint8_t* cycle, const uint8_t* buf, const uint8_t* mask,
+                       uint8_t len, uint8_t brightness) {
+    for (uint8_t k = 0; k < SHIFT_OUT_SUBFRAMES; k++) {
+        uint8_t* frame = &cycle[k * len];
+        for (uint8_t i = 0; i < len; i++) {
+            frame[i] = k < brightness ? buf[i] & mask[i] : 0;
+        }
+    }
+}
+
+static bool bank_is_busy(const shift_out_dev_t* dev, uint8_t bank) {
+    uintptr_t addr = dma_channel_hw_addr(dev->dma_data)->read_addr;
+    uintptr_t lo = (uintptr_t)dev->frames[bank];
+    uintptr_t hi = lo + sizeof(dev->frames[bank]);
+    return lo <= addr && addr <= hi;
+}
+
 void shift_out_init(shift_out_dev_t* dev) {
+    memset(dev->frames, 0, sizeof(dev->frames));
+    for (uint8_t i = 0; i < SHIFT_OUT_PATTERN_LEN; i++) {
+        dev->cycles[i] = dev->frames[0][0];
+    }
+    dev->back = 1;
+
     dev->offset = pio_add_program(dev->pio, &shift_out_program);
 
     dev->sm = pio_claim_unused_sm(dev->pio, true);
 
     pio_gpio_init(dev->pio, dev->pin_data);
     pio_gpio_init(dev->pio, dev->pin_clock);
+    pio_gpio_init(dev->pio, dev->pin_latch);
     pio_sm_set_consecutive_pindirs(dev->pio, dev->sm, dev->pin_data, 1, true);
     pio_sm_set_consecutive_pindirs(dev->pio, dev->sm, dev->pin_clock, 1, true);
+    pio_sm_set_consecutive_pindirs(dev->pio, dev->sm, dev->pin_latch, 1, true);
+
+    // サブフレームの頻度がrefresh_hz * SHIFT_OUT_SUBFRAMESになるよう割る
+    uint32_t bits = dev->len * 8;
+    float cycles = (4.0f * bits + 4) * SHIFT_OUT_SUBFRAMES * dev->refresh_hz;
 
     pio_sm_config c = shift_out_program_get_default_config(dev->offset);
     sm_config_set_out_pins(&c, dev->pin_data, 1);
     sm_config_set_sideset_pins(&c, dev->pin_clock);
-    sm_config_set_out_shift(&c, true, false, 8);
-    sm_config_set_clkdiv(&c, 10.0f);
+    sm_config_set_set_pins(&c, dev->pin_latch, 1);
+    sm_config_set_out_shift(&c, true, true, 8);
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX);
+    sm_config_set_clkdiv(&c, (float)clock_get_hz(clk_sys) / cycles);
 
     pio_sm_init(dev->pio, dev->sm, dev->offset, &c);
+    pio_sm_put(dev->pio, dev->sm, bits - 1);
     pio_sm_set_enabled(dev->pio, dev->sm, true);
 
-    gpio_init(dev->pin_latch);
-    gpio_set_dir(dev->pin_latch, GPIO_OUT);
-    gpio_put(dev->pin_latch, 0);
+    dev->dma_data = dma_claim_unused_channel(true);
+    dev->dma_ctrl = dma_claim_unused_channel(true);
+
+    // 一周期を流し終えたら、次の周期の先頭を制御のチャネルに書かせる
+    dma_channel_config c_data = dma_channel_get_default_config(dev->dma_data);
+    channel_config_set_transfer_data_size(&c_data, DMA_SIZE_8);
+    channel_config_set_read_increment(&c_data, true);
+    channel_config_set_write_increment(&c_data, false);
+    channel_config_set_dreq(&c_data, pio_get_dreq(dev->pio, dev->sm, true));
+    channel_config_set_chain_to(&c_data, dev->dma_ctrl);
+    dma_channel_configure(dev->dma_data, &c_data, &dev->pio->txf[dev->sm],
+                          NULL, SHIFT_OUT_SUBFRAMES * dev->len, false);
+
+    dma_channel_config c_ctrl = dma_channel_get_default_config(dev->dma_ctrl);
+    channel_config_set_transfer_data_size(&c_ctrl, DMA_SIZE_32);
+    channel_config_set_read_increment(&c_ctrl, true);
+    channel_config_set_write_increment(&c_ctrl, false);
+    channel_config_set_ring(&c_ctrl, false,
+                            __builtin_ctz(sizeof(dev->cycles)));
+    dma_channel_configure(dev->dma_ctrl, &c_ctrl,
+                          &dma_hw->ch[dev->dma_data].al3_read_addr_trig,
+                          dev->cycles, 1, true);
 }
 
-void shift_out_send(shift_out_dev_t* dev, const uint8_t* buf, size_t len) {
-    for (size_t i = 0; i < len; i++) {
-        pio_sm_put_blocking(dev->pio, dev->sm, buf[i]);
+bool shift_out_show(shift_out_dev_t* dev, const uint8_t* buf,
+                    const uint8_t* blink, uint8_t brightness,
+                    uint64_t pattern) {
+    if (bank_is_busy(dev, dev->back)) {
+        return false;
+    }
+    if (brightness > SHIFT_OUT_SUBFRAMES) {
+        brightness = SHIFT_OUT_SUBFRAMES;
+    }
+
+    uint8_t on[SHIFT_OUT_MAX_LEN];
+    uint8_t off[SHIFT_OUT_MAX_LEN];
+    for (uint8_t i = 0; i < dev->len; i++) {
+        on[i] = 0xFF;
+        off[i] = blink ? ~blink[i] : 0xFF;
+    }
+
+    uint8_t(*bank)[SHIFT_OUT_SUBFRAMES * SHIFT_OUT_MAX_LEN] =
+        dev->frames[dev->back];
+    fill_cycle(bank[0], buf, on, dev->len, brightness);
+    fill_cycle(bank[1], buf, off, dev->len, brightness);
+
+    // 一つずつの書き換えなので、DMAが途中で読んでもどちらかの周期を指す
+    for (uint8_t i = 0; i < SHIFT_OUT_PATTERN_LEN; i++) {
+        dev->cycles[i] = (pattern >> i) & 1 ? bank[0] : bank[1];
     }
-    sleep_ms(1);
-    gpio_put(dev->pin_latch, 1);
-    sleep_ms(1);
-    gpio_put(dev->pin_latch, 0);
+    dev->back ^= 1;
+    return true;
 }
@@ -1,5 +1,7 @@
 #include "spi_slave.h"
 
+#include <assert.h>
+#include <stdalign.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
@@ -7,9 +9,13 @@
 #include <hardware/dma.h>
 #include <hardware/gpio.h>
 #include <hardware/pio.h>
-#include <pico/util/queue.h>
+#include <hardware/sync.h>
+#include <pico/platform.h>
+#include <pico/time.h>
 
+#include "outbox.h"
 #include "spi_slave.pio.h"
+#include "timesync.h"
 
 #define PIO_ID (pio1)
 #define DREQ_RX_BASE DREQ_PIO1_RX0
@@ -20,20 +26,166 @@
 #define PIN_RX (12)
 #define PIN_CS (13)
 
+static_assert((PIN_RX + spi_slave_SCK_INDEX) % 32 == PIN_SCK,
+              "SCK_INDEX in spi_slave.pio does not match PIN_SCK");
+
+// 送信はDMAを32bit単位で回す。受信はホストからのコマンドが1byteなので
+// CSが上がった時にISRに端数が残らないよう8bit単位のまま
+#define TX_WORDS (SPI_SLAVE_BUF_SIZE / 4)
+
 static uint sm, offset;
 static pio_sm_config pio_cfg;
 
 static int dma_chan_tx, dma_chan_rx;
 
-static uint8_t tx_buf[SPI_SLAVE_BUF_SIZE];
+static alignas(4) uint8_t tx_buf[SPI_SLAVE_BUF_SIZE];
 static uint8_t rx_buf[SPI_SLAVE_BUF_SIZE];
 
-static queue_t queue_tx;
+static outbox_t outbox_tx;
+
+static int ready_pin = -1;
+static uint32_t ready_high_bytes = 1;
+static uint32_t ready_low_bytes = 0;
+static bool tx_loaded = false;
+static volatile bool ready_held = false;
+
+typedef struct {
+    uint64_t time_us;
+    int32_t value;
+} reg_entry_t;
+
+// 最新値の表のチャンネル。k回目の書き込みはentry[k & 1]に書き、
+// 書いている間seqは2k-1、書き終えると2kになる
+// 読む側はseq / 2回目の面を読み、読み終えるまでに次の次の書き込みが
+// 始まっていなければ崩れていない
+typedef struct {
+    volatile uint32_t seq;
+    reg_entry_t entry[2];
+} reg_t;
+
+static reg_t regs[SPI_SLAVE_REG_MAX_COUNT];
+static uint8_t reg_count = 0;
+static uint8_t reg_map[SPI_SLAVE_REG_HEADER_SIZE +
+                       SPI_SLAVE_REG_MAX_COUNT * SPI_SLAVE_REG_ENTRY_SIZE];
+
+static volatile bool describe_requested = false;
+static volatile bool drain_requested = false;
+static volatile uint64_t drain_since_us = 0;
+
+// 転送の始まり (CSの立ち下がり) の時刻
+static uint64_t cs_fall_us = 0;
+
+// consumer側(cs_callback)から呼ぶ
+// producerはHighにしかしないので、Lowにした後に積まれていないか確認し直す
+static void update_data_ready() {
+    if (ready_pin < 0) {
+        return;
+    }
+
+    uint32_t pending = outbox_pending_bytes(&outbox_tx);
+    if (tx_loaded || pending >= ready_high_bytes) {
+        gpio_put(ready_pin, 1);
+    } else if (pending <= ready_low_bytes) {
+        gpio_put(ready_pin, 0);
+        __dmb();
+        if (outbox_ingress_bytes(&outbox_tx) >= ready_high_bytes) {
+            gpio_put(ready_pin, 1);
+        }
+    }
+}
+
+static uint64_t read_be64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+static uint16_t read_be16(const uint8_t* p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static void write_be(uint8_t* p, uint64_t v, int size) {
+    for (int i = size - 1; i >= 0; i--) {
+        p[i] = (uint8_t)(v & 0xFF);
+        v >>= 8;
+    }
+}
+
+// 割り込みから呼ぶ。同じコアの書き手が途中でも、書き終えた面を読むので待たない
+static void read_reg(uint8_t id, reg_entry_t* out) {
+    const reg_t* r = &regs[id];
+    uint32_t s;
+    do {
+        s = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+        __dmb();
+        *out = r->entry[(s >> 1) & 1];
+        __dmb();
+    } while (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) - (s & ~1u) >= 3);
+}
+
+// 表のoffsetからlen byteを送信バッファに載せる
+// 頼まれた範囲にかかるチャンネルだけを読み、時刻をホストの時刻に直す
+static void load_regs(uint16_t offset, uint16_t len) {
+    const uint16_t size =
+        SPI_SLAVE_REG_HEADER_SIZE + reg_count * SPI_SLAVE_REG_ENTRY_SIZE;
+    if (offset > size) {
+        offset = size;
+    }
+    if (len > size - offset) {
+        len = size - offset;
+    }
+
+    uint16_t first = 0;
+    if (offset > SPI_SLAVE_REG_HEADER_SIZE) {
+        first = (offset - SPI_SLAVE_REG_HEADER_SIZE) / SPI_SLAVE_REG_ENTRY_SIZE;
+    }
+    uint16_t end = 0;
+    if (offset + len > SPI_SLAVE_REG_HEADER_SIZE) {
+        end = (offset + len - SPI_SLAVE_REG_HEADER_SIZE +
+               SPI_SLAVE_REG_ENTRY_SIZE - 1) /
+              SPI_SLAVE_REG_ENTRY_SIZE;
+    }
+
+    bool synced = false;
+    for (uint16_t id = first; id < end; id++) {
+        reg_entry_t e;
+        read_reg(id, &e);
+        uint64_t time_us = e.time_us != 0 ? timesync_to_host(e.time_us, &synced)
+                                          : 0;
+        uint8_t* p =
+            &reg_map[SPI_SLAVE_REG_HEADER_SIZE + id * SPI_SLAVE_REG_ENTRY_SIZE];
+        write_be(p, time_us, 8);
+        write_be(p + 8, (uint32_t)e.value, 4);
+    }
+    reg_map[0] = reg_count;
+    reg_map[1] = synced ? SPI_SLAVE_REG_FLAG_SYNCED : 0;
+    reg_map[2] = 0;
+    reg_map[3] = 0;
+
+    memcpy(tx_buf, &reg_map[offset], len);
+    memset(tx_buf + len, 0x00, SPI_SLAVE_BUF_SIZE - len);
+}
 
 static void cs_callback(uint gpio, uint32_t events) {
+    if (events & GPIO_IRQ_EDGE_FALL) {
+        cs_fall_us = time_us_64();
+    }
     if (events & GPIO_IRQ_EDGE_RISE) {
+        // ホストは時刻を読んでからすぐに転送を始めるので、終わった時刻ではなく
+        // 始まった時刻と比べ、SCKの速さで変わる転送時間の分を除く
+        // 時刻を読んでからCSを下げるまでの遅れは残り、常に数十us遅れる
+        // 両方の端が一度に来たのは、割り込みを止めている間に転送が
+        // 終わったため。下がった時刻は分からないので時刻合わせに使わない
+        uint64_t start_us = (events & GPIO_IRQ_EDGE_FALL) ? 0 : cs_fall_us;
+        cs_fall_us = 0;
+
         pio_sm_set_enabled(PIO_ID, sm, false);
 
+        uint32_t rx_len = SPI_SLAVE_BUF_SIZE -
+                          dma_channel_hw_addr(dma_chan_rx)->transfer_count;
+
         dma_channel_abort(dma_chan_tx);
         dma_channel_abort(dma_chan_rx);
 
@@ -43,14 +195,31 @@ static void cs_callback(uint gpio, uint32_t events) {
         dma_channel_set_read_addr(dma_chan_tx, tx_buf, false);
         dma_channel_set_write_addr(dma_chan_rx, rx_buf, false);
         dma_channel_set_read_addr(dma_chan_rx, &PIO_ID->rxf[sm], false);
-        dma_channel_set_trans_count(dma_chan_tx, SPI_SLAVE_BUF_SIZE, false);
+        dma_channel_set_trans_count(dma_chan_tx, TX_WORDS, false);
         dma_channel_set_trans_count(dma_chan_rx, SPI_SLAVE_BUF_SIZE, false);
 
-        if (rx_buf[0] == 0x01) {
-            bool res = queue_try_remove(&queue_tx, tx_buf);
-            if (!res) {
-                memset(tx_buf, 0x00, SPI_SLAVE_BUF_SIZE);
-            }
+        if (rx_buf[0] == SPI_SLAVE_CMD_TIME_SYNC &&
+            rx_len >= SPI_SLAVE_TIME_SYNC_SIZE && start_us != 0) {
+            timesync_update(start_us, read_be64(&rx_buf[1]));
+        } else if (rx_buf[0] == SPI_SLAVE_CMD_NEXT) {
+            uint16_t len = outbox_pop(&outbox_tx, tx_buf, SPI_SLAVE_BUF_SIZE);
+            memset(tx_buf + len, 0x00, SPI_SLAVE_BUF_SIZE - len);
+            tx_loaded = len != 0;
+            update_data_ready();
+        } else if (rx_buf[0] == SPI_SLAVE_CMD_READ_REGS &&
+                   rx_len >= SPI_SLAVE_READ_REGS_SIZE) {
+            // 載せていたフレームはこの転送で送り終えている
+            load_regs(read_be16(&rx_buf[1]), read_be16(&rx_buf[3]));
+            tx_loaded = false;
+            update_data_ready();
+        } else if (rx_buf[0] == SPI_SLAVE_CMD_DESCRIBE) {
+            describe_requested = true;
+        } else if (rx_buf[0] == SPI_SLAVE_CMD_DRAIN &&
+                   rx_len >= SPI_SLAVE_DRAIN_SIZE) {
+            // 時刻を書いてからフラグを立てる
+            drain_since_us = read_be64(&rx_buf[1]);
+            __dmb();
+            drain_requested = true;
         }
 
         dma_start_channel_mask((1u << dma_chan_rx) | (1u << dma_chan_tx));
@@ -59,14 +228,62 @@ static void cs_callback(uint gpio, uint32_t events) {
     }
 }
 
+void spi_slave_set_data_ready(uint pin, uint32_t high_bytes,
+                              uint32_t low_bytes) {
+    ready_pin = pin;
+    ready_high_bytes = high_bytes != 0 ? high_bytes : 1;
+    ready_low_bytes = low_bytes < ready_high_bytes ? low_bytes
+                                                   : ready_high_bytes - 1;
+}
+
+void spi_slave_hold_data_ready(bool hold) {
+    ready_held = hold;
+    __dmb();
+    if (ready_pin < 0) {
+        return;
+    }
+    if (hold) {
+        gpio_put(ready_pin, 0);
+    } else {
+        update_data_ready();
+    }
+}
+
+void spi_slave_set_reg_count(uint8_t count) {
+    reg_count =
+        count < SPI_SLAVE_REG_MAX_COUNT ? count : SPI_SLAVE_REG_MAX_COUNT;
+}
+
+void spi_slave_set_reg(uint8_t id, uint64_t time_us, int32_t value) {
+    if (id >= reg_count) {
+        return;
+    }
+
+    reg_t* r = &regs[id];
+    uint32_t s = r->seq;
+    __atomic_store_n(&r->seq, s + 1, __ATOMIC_RELEASE);
+    __dmb();
+    reg_entry_t* e = &r->entry[((s >> 1) + 1) & 1];
+    e->time_us = time_us;
+    e->value = value;
+    __dmb();
+    __atomic_store_n(&r->seq, s + 2, __ATOMIC_RELEASE);
+}
+
 void spi_slave_init() {
-    queue_init(&queue_tx, SPI_SLAVE_BUF_SIZE, SPI_SLAVE_QUEUE_COUNT);
+    outbox_init(&outbox_tx);
+
+    if (ready_pin >= 0) {
+        gpio_init(ready_pin);
+        gpio_set_dir(ready_pin, GPIO_OUT);
+        gpio_put(ready_pin, 0);
+    }
 
     gpio_init(PIN_CS);
     gpio_set_dir(PIN_CS, GPIO_IN);
     gpio_pull_up(PIN_CS);
-    gpio_set_irq_enabled_with_callback(PIN_CS, GPIO_IRQ_EDGE_RISE, true,
-                                       &cs_callback);
+    gpio_set_irq_enabled_with_callback(
+        PIN_CS, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true, &cs_callback);
 
     offset = pio_add_program(PIO_ID, &spi_slave_program);
     sm = pio_claim_unused_sm(PIO_ID, true);
@@ -81,8 +298,8 @@ void spi_slave_init() {
     pio_cfg = spi_slave_program_get_default_config(offset);
     sm_config_set_out_pins(&pio_cfg, PIN_TX, 1);
     sm_config_set_in_pins(&pio_cfg, PIN_RX);
-    sm_config_set_out_shift(&pio_cfg, false, false, 8);
-    sm_config_set_in_shift(&pio_cfg, false, false, 8);
+    sm_config_set_out_shift(&pio_cfg, false, true, 32);  // autopull
+    sm_config_set_in_shift(&pio_cfg, false, true, 8);    // autopush
     sm_config_set_clkdiv(&pio_cfg, 1.0);
 
     pio_sm_init(PIO_ID, sm, offset, &pio_cfg);
@@ -90,15 +307,17 @@ void spi_slave_init() {
 
     dma_chan_tx = dma_claim_unused_channel(true);
     dma_channel_config c_tx = dma_channel_get_default_config(dma_chan_tx);
-    channel_config_set_transfer_data_size(&c_tx, DMA_SIZE_8);
+    channel_config_set_transfer_data_size(&c_tx, DMA_SIZE_32);
+    // MSBファーストで出すので、メモリ上の先頭byteがbit31-24に来るようにする
+    channel_config_set_bswap(&c_tx, true);
     channel_config_set_dreq(&c_tx, DREQ_TX_BASE + sm);  // 消すと1byteずれる
     channel_config_set_read_increment(&c_tx, true);
     channel_config_set_write_increment(&c_tx, false);
     dma_channel_configure(dma_chan_tx, &c_tx,
-                          &PIO_ID->txf[sm],    // 書き込み先
-                          tx_buf,              // 読み込み元
-                          SPI_SLAVE_BUF_SIZE,  // 転送サイズ
-                          false                // 自動スタートしない
+                          &PIO_ID->txf[sm],  // 書き込み先
+                          tx_buf,            // 読み込み元
+                          TX_WORDS,          // 転送サイズ
+                          false              // 自動スタートしない
     );
 
     dma_chan_rx = dma_claim_unused_channel(true);
@@ -115,6 +334,44 @@ void spi_slave_init() {
     dma_start_channel_mask((1u << dma_chan_rx) | (1u << dma_chan_tx));
 }
 
-bool spi_slave_push_bytes(uint8_t* data) {
-    return queue_try_add(&queue_tx, data);
+bool spi_slave_push_bytes(uint8_t topic, const uint8_t* data, uint16_t len) {
+    if (!outbox_push(&outbox_tx, get_core_num(), topic, data, len)) {
+        return false;
+    }
+    if (ready_pin >= 0 && !ready_held &&
+        outbox_ingress_bytes(&outbox_tx) >= ready_high_bytes) {
+        gpio_put(ready_pin, 1);
+    }
+    return true;
+}
+
+uint32_t spi_slave_get_drops(uint8_t topic) {
+    return outbox_get_drops(&outbox_tx, topic);
+}
+
+bool spi_slave_take_describe_request() {
+    // 消す直前に来た要求は一つにまとまるだけなので排他は要らない
+    if (!describe_requested) {
+        return false;
+    }
+    describe_requested = false;
+    return true;
+}
+
+bool spi_slave_take_drain_request(uint64_t* since_us) {
+    if (!drain_requested) {
+        return false;
+    }
+    drain_requested = false;
+    __dmb();
+    *since_us = drain_since_us;
+    return true;
+}
+
+uint32_t spi_slave_pending_bytes() {
+    return outbox_pending_bytes(&outbox_tx);
+}
+
+uint32_t spi_slave_replay_room() {
+    return outbox_replay_room(&outbox_tx, get_core_num());
 }
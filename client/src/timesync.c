@@ -0,0 +1,106 @@
+#include "timesync.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <hardware/sync.h>
+
+// 予測との差をどれだけ反映するか (2^-n)
+#define OFFSET_GAIN_SHIFT (2)
+#define DRIFT_GAIN_SHIFT (3)
+
+// driftの推定に使う最短の間隔
+#define MIN_DRIFT_INTERVAL_US (100000)
+
+// 起こりうるずれの上限 (水晶の精度から十分大きく)
+#define MAX_DRIFT_PPM (500)
+
+// 書き込みの前後でseqを進め、読む側はseqが偶数で前後一致するまで読み直す
+static volatile uint32_t seq;
+static bool valid;
+static uint64_t ref_local_us;
+static int64_t ref_offset_us;
+static int64_t drift_q32;
+
+static int32_t last_error_us;
+static uint32_t updates;
+static uint32_t steps;
+
+static inline int64_t predict(uint64_t local_us) {
+    int64_t dt = (int64_t)(local_us - ref_local_us);
+    return ref_offset_us + ((dt * drift_q32) >> 32);
+}
+
+static inline int64_t clamp_drift(int64_t d) {
+    const int64_t max = ((int64_t)MAX_DRIFT_PPM << 32) / 1000000;
+    return d > max ? max : d < -max ? -max : d;
+}
+
+void timesync_update(uint64_t local_us, uint64_t host_us) {
+    int64_t measured = (int64_t)(host_us - local_us);
+
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELEASE);
+    __dmb();
+
+    if (!valid) {
+        valid = true;
+        ref_local_us = local_us;
+        ref_offset_us = measured;
+        drift_q32 = 0;
+        last_error_us = 0;
+    } else {
+        int64_t error = measured - predict(local_us);
+        int64_t dt = (int64_t)(local_us - ref_local_us);
+
+        if (llabs(error) > TIMESYNC_STEP_US) {
+            ref_offset_us = measured;
+            drift_q32 = 0;
+            steps++;
+        } else {
+            ref_offset_us = predict(local_us) + (error >> OFFSET_GAIN_SHIFT);
+            if (dt >= MIN_DRIFT_INTERVAL_US) {
+                // 同期の度に一回だけなので割り算でよい
+                drift_q32 = clamp_drift(
+                    drift_q32 + (((error << 32) / dt) >> DRIFT_GAIN_SHIFT));
+            }
+        }
+        ref_local_us = local_us;
+        last_error_us = (int32_t)error;
+    }
+    updates++;
+
+    __dmb();
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t timesync_to_host(uint64_t local_us, bool* synced) {
+    uint32_t s;
+    bool v;
+    int64_t offset;
+    do {
+        s = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+        v = valid;
+        offset = v ? predict(local_us) : 0;
+        __dmb();
+    } while ((s & 1) != 0 || s != __atomic_load_n(&seq, __ATOMIC_ACQUIRE));
+
+    if (synced) {
+        *synced = v;
+    }
+    return v ? (uint64_t)((int64_t)local_us + offset) : local_us;
+}
+
+void timesync_get_status(timesync_status_t* status) {
+    uint32_t s;
+    do {
+        s = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+        status->valid = valid;
+        status->offset_us = ref_offset_us;
+        status->drift_ppb = (int32_t)((drift_q32 * 1000000000) >> 32);
+        status->last_error_us = last_error_us;
+        status->updates = updates;
+        status->steps = steps;
+        __dmb();
+    } while ((s & 1) != 0 || s != __atomic_load_n(&seq, __ATOMIC_ACQUIRE));
+}
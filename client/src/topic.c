@@ -0,0 +1,63 @@
+#include "topic.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct {
+    const char* name;
+    uint8_t cls;
+} topic_info_t;
+
+static const topic_info_t topic_table[TOPIC_COUNT] = {
+    [topic_unknown] = {"", topic_class_normal},
+    [topic_stroke_front] = {"stroke/front", topic_class_normal},
+    [topic_stroke_rear] = {"stroke/rear", topic_class_normal},
+    [topic_water] = {"water", topic_class_normal},
+    [topic_ecu] = {"ecu", topic_class_critical},
+    [topic_rpm] = {"rpm", topic_class_critical},
+    [topic_acc] = {"acc", topic_class_normal},
+    [topic_env] = {"env", topic_class_normal},
+    [topic_af] = {"af", topic_class_normal},
+    [topic_core1_front] = {"core1/front", topic_class_diag},
+    [topic_core1_rear] = {"core1/rear", topic_class_diag},
+    [topic_drop_front] = {"drop/front", topic_class_diag},
+    [topic_drop_rear] = {"drop/rear", topic_class_diag},
+    [topic_sync_front] = {"sync/front", topic_class_diag},
+    [topic_sync_rear] = {"sync/rear", topic_class_diag},
+    [topic_desc] = {"desc", topic_class_normal},
+    [topic_block_stroke_front] = {"block/stroke/front", topic_class_normal},
+    [topic_log_front] = {"log/front", topic_class_diag},
+    [topic_meter] = {"meter", topic_class_critical},
+    [topic_meter_front] = {"meter/front", topic_class_diag},
+    [topic_i2c_front] = {"i2c/front", topic_class_diag},
+    [topic_boot_front] = {"boot/front", topic_class_diag},
+    [topic_replay] = {"replay", topic_class_replay},
+};
+
+uint8_t topic_from_name(const char* name, size_t len) {
+    if (!name) {
+        return topic_unknown;
+    }
+    for (uint8_t id = 1; id < TOPIC_COUNT; id++) {
+        const char* s = topic_table[id].name;
+        if (strlen(s) == len && memcmp(s, name, len) == 0) {
+            return id;
+        }
+    }
+    return topic_unknown;
+}
+
+const char* topic_name(uint8_t id) {
+    if (id >= TOPIC_COUNT) {
+        id = topic_unknown;
+    }
+    return topic_table[id].name;
+}
+
+uint8_t topic_class(uint8_t id) {
+    if (id >= TOPIC_COUNT) {
+        id = topic_unknown;
+    }
+    return topic_table[id].cls;
+}
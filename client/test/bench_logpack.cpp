@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <vector>
+
+#include "capture.hpp"
+#include "check.h"
+#include "logpack.h"
+#include "lz.h"
+
+// 引数に渡した記録をflash_logと同じチャンクにし、縮んだ割合と
+// ホストでの圧縮、展開の速さを表示する
+// マイコンでの圧縮時間はlog/frontのenc_avg、enc_maxで見る
+
+#define ROUNDS (20)
+
+static logpack_work_t work;
+
+int main(int argc, char** argv) {
+    std::vector<std::vector<uint8_t>> all;
+    uint64_t lz_total = 0;
+    for (int i = 1; i < argc; i++) {
+        uint64_t raw = 0;
+        uint64_t stored = 0;
+        uint64_t lz_only = 0;
+        for (auto& records : capture_chunks(argv[i])) {
+            uint8_t chunk[LOGPACK_BOUND];
+            size_t n = logpack_encode(&work, records.data(), records.size(),
+                                      chunk, sizeof(chunk));
+            CHECK(n != 0);
+
+            // 列に分けずにlzだけで圧縮した時
+            uint8_t packed[LZ_BOUND(LOGPACK_CHUNK_SIZE)];
+            size_t m = lz_compress(records.data(), records.size(), packed,
+                                   sizeof(packed), work.table);
+            CHECK(m != 0);
+
+            raw += records.size();
+            stored += n;
+            lz_only += m < records.size() ? 1 + m : 1 + records.size();
+            all.push_back(std::move(records));
+        }
+        lz_total += lz_only;
+        printf("%s: %llu -> %llu B (%.1f%%, lz only %.1f%%)\n", argv[i],
+               (unsigned long long)raw, (unsigned long long)stored,
+               100.0 * stored / raw, 100.0 * lz_only / raw);
+    }
+    if (all.empty()) {
+        return 0;
+    }
+
+    std::vector<std::vector<uint8_t>> chunks;
+    uint64_t raw = 0;
+    uint64_t stored = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < ROUNDS; r++) {
+        chunks.clear();
+        for (auto& records : all) {
+            std::vector<uint8_t> chunk(LOGPACK_BOUND);
+            size_t n = logpack_encode(&work, records.data(), records.size(),
+                                      chunk.data(), chunk.size());
+            chunk.resize(n);
+            chunks.push_back(std::move(chunk));
+            raw += records.size();
+            stored += n;
+        }
+    }
+    double encode_s = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+
+    uint8_t out[LOGPACK_CHUNK_SIZE];
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (size_t i = 0; i < chunks.size(); i++) {
+            size_t n = logpack_decode(&work, chunks[i].data(),
+                                      chunks[i].size(), out, sizeof(out));
+            CHECK(n == all[i].size());
+        }
+    }
+    double decode_s = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+
+    printf("total: %.1f%% (lz only %.1f%%), encode %.1f MB/s, "
+           "decode %.1f MB/s\n",
+           100.0 * stored / raw, 100.0 * lz_total * ROUNDS / raw,
+           raw / encode_s / 1e6, raw / decode_s / 1e6);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "ring_buf.h"
+
+// 置き換える前のqueue_t (32スロット x 512byte、操作ごとにロック) と比べる
+#define SLOT_COUNT (32)
+#define SLOT_SIZE (512)
+#define RING_SIZE (4096)
+
+#define OPS (200000)
+
+typedef struct {
+    uint8_t slots[SLOT_COUNT][SLOT_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    pthread_mutex_t lock;
+} slot_queue_t;
+
+static bool slot_push(slot_queue_t* q, const uint8_t* data, uint16_t len) {
+    pthread_mutex_lock(&q->lock);
+    bool ok = q->head - q->tail < SLOT_COUNT;
+    if (ok) {
+        // queue_tは要素の大きさ分を丸ごと写す
+        uint8_t slot[SLOT_SIZE] = {0};
+        memcpy(slot, data, len);
+        memcpy(q->slots[q->head % SLOT_COUNT], slot, SLOT_SIZE);
+        q->head++;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+static bool slot_pop(slot_queue_t* q, uint8_t* data) {
+    pthread_mutex_lock(&q->lock);
+    bool ok = q->head != q->tail;
+    if (ok) {
+        memcpy(data, q->slots[q->tail % SLOT_COUNT], SLOT_SIZE);
+        q->tail++;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ok;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static ring_buf_t ring;
+static uint8_t ring_storage[RING_SIZE];
+static slot_queue_t slot_queue;
+static uint16_t record_len;
+
+static void* ring_producer(void* arg) {
+    (void)arg;
+    uint8_t buf[SLOT_SIZE] = {0};
+    for (uint32_t i = 0; i < OPS; i++) {
+        while (!ring_buf_push(&ring, buf, record_len)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void* slot_producer(void* arg) {
+    (void)arg;
+    uint8_t buf[SLOT_SIZE] = {0};
+    for (uint32_t i = 0; i < OPS; i++) {
+        while (!slot_push(&slot_queue, buf, record_len)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// 別のスレッドから積み、全て取り出し終えるまでの1レコードあたりの時間
+static double run_ring(void) {
+    ring_buf_init(&ring, ring_storage, RING_SIZE);
+    pthread_t producer;
+    double start = now_s();
+    pthread_create(&producer, NULL, ring_producer, NULL);
+    uint8_t buf[SLOT_SIZE];
+    for (uint32_t i = 0; i < OPS;) {
+        if (ring_buf_pop(&ring, buf, sizeof(buf)) != 0) {
+            i++;
+        } else {
+            sched_yield();
+        }
+    }
+    pthread_join(producer, NULL);
+    return (now_s() - start) / OPS * 1e9;
+}
+
+static double run_slot(void) {
+    slot_queue.head = 0;
+    slot_queue.tail = 0;
+    pthread_t producer;
+    double start = now_s();
+    pthread_create(&producer, NULL, slot_producer, NULL);
+    uint8_t buf[SLOT_SIZE];
+    for (uint32_t i = 0; i < OPS;) {
+        if (slot_pop(&slot_queue, buf)) {
+            i++;
+        } else {
+            sched_yield();
+        }
+    }
+    pthread_join(producer, NULL);
+    return (now_s() - start) / OPS * 1e9;
+}
+
+int main(void) {
+    pthread_mutex_init(&slot_queue.lock, NULL);
+
+    printf("memory: slot queue %d B, ring %d B\n", SLOT_COUNT * SLOT_SIZE,
+           RING_SIZE);
+    printf("%8s %12s %12s %10s %10s\n", "len", "slot ns/rec", "ring ns/rec",
+           "slot recs", "ring recs");
+    const uint16_t lens[] = {16, 60, 100, 256, 512};
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        record_len = lens[i];
+        double slot_ns = run_slot();
+        double ring_ns = run_ring();
+        // 同じ領域に同時に置ける数
+        uint32_t ring_recs = RING_SIZE / (record_len + RING_BUF_HEADER_SIZE);
+        printf("%8u %12.1f %12.1f %10d %10u\n", record_len, slot_ns, ring_ns,
+               SLOT_COUNT, ring_recs);
+    }
+    return 0;
+}
@@ -0,0 +1,113 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <stdint.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <cJSON.h>
+
+#include "check.h"
+#include "frame.h"
+#include "logpack.h"
+#include "msgpack.hpp"
+
+// analyze/dataの記録 (time,topic,"payload") を読むテストの共通部分
+
+struct capture_line_t {
+    std::string topic;
+    std::string payload;  // クォートを戻したJSON
+    uint64_t time_us;     // payloadのsec/usec
+};
+
+static inline bool capture_parse(const std::string& line,
+                                 capture_line_t* out) {
+    size_t a = line.find(',');
+    size_t b = line.find(',', a + 1);
+    if (a == std::string::npos || b == std::string::npos) {
+        return false;
+    }
+    out->topic = line.substr(a + 1, b - a - 1);
+
+    // "{""sec"":...}" のクォートを戻す
+    std::string quoted = line.substr(b + 1);
+    out->payload.clear();
+    for (size_t i = 1; i + 1 < quoted.size(); i++) {
+        out->payload += quoted[i];
+        if (quoted[i] == '"' && quoted[i + 1] == '"') {
+            i++;
+        }
+    }
+
+    cJSON* root = cJSON_Parse(out->payload.c_str());
+    if (!root) {
+        return false;
+    }
+    double sec = cJSON_GetNumberValue(cJSON_GetObjectItem(root, "sec"));
+    double usec = cJSON_GetNumberValue(cJSON_GetObjectItem(root, "usec"));
+    out->time_us = (uint64_t)(sec * 1e6 + usec);
+    cJSON_Delete(root);
+    return true;
+}
+
+// 記録を読み、一行ずつfに渡す
+template <typename F>
+static void capture_read(const char* path, F f) {
+    std::ifstream in(path);
+    CHECK(in.good());
+    std::string line;
+    std::getline(in, line);
+
+    capture_line_t cap;
+    while (std::getline(in, line)) {
+        if (capture_parse(line, &cap)) {
+            f(cap);
+        }
+    }
+}
+
+// フロントがリアの記録を転送する時と同じ形 (Float32、時刻を引き継ぐ) の
+// レコード [len][crc][フレームヘッダ][MsgPack] にする
+static inline std::vector<uint8_t> capture_record(const capture_line_t& cap) {
+    std::string json =
+        R"({"topic": ")" + cap.topic + R"(", "payload": )" + cap.payload + "}";
+    frame_header_t origin = {};
+    origin.version = FRAME_VERSION;
+    origin.flags = FRAME_FLAG_SYNCED;
+    origin.topic = topic_from_name(cap.topic.data(), cap.topic.size());
+    origin.seq = frame_next_seq(origin.topic);
+    origin.timestamp_us = cap.time_us;
+
+    MsgPack<1024, encoding::Float32> msgpack(json, &origin);
+    uint8_t* buf = msgpack.getBuf();
+    CHECK(buf != nullptr);
+    return std::vector<uint8_t>(buf, buf + msgpack.getSize());
+}
+
+// flash_logと同じく、4KBか1秒で区切ったレコードの列にする
+static inline std::vector<std::vector<uint8_t>> capture_chunks(
+    const char* path) {
+    std::vector<std::vector<uint8_t>> chunks(1);
+    uint64_t stage_us = 0;
+    capture_read(path, [&](const capture_line_t& cap) {
+        std::vector<uint8_t> rec = capture_record(cap);
+        std::vector<uint8_t>& stage = chunks.back();
+        if (!stage.empty() &&
+            (stage.size() + rec.size() > LOGPACK_CHUNK_SIZE ||
+             cap.time_us - stage_us >= 1000000)) {
+            chunks.emplace_back();
+        }
+        if (chunks.back().empty()) {
+            stage_us = cap.time_us;
+        }
+        chunks.back().insert(chunks.back().end(), rec.begin(), rec.end());
+    });
+    if (chunks.back().empty()) {
+        chunks.pop_back();
+    }
+    return chunks;
+}
+
+#endif /* end of include guard: CAPTURE_HPP */
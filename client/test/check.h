@@ -0,0 +1,19 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// ホストで動かすテストの共通部分
+// 条件が成り立たなければ場所を出して終わり、ctestに失敗を返す
+
+#define CHECK(cond)                                                \
+    do {                                                           \
+        if (!(cond)) {                                             \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, \
+                    __LINE__, #cond);                              \
+            exit(1);                                               \
+        }                                                          \
+    } while (0)
+
+#endif /* end of include guard: CHECK_H */
@@ -0,0 +1,18 @@
+#ifndef FAKE_HARDWARE_CLOCKS_H
+#define FAKE_HARDWARE_CLOCKS_H
+
+#include <stdint.h>
+
+// ホストでビルドするためのhardware/clocks.hの代わり
+// システムクロックは既定の125MHzとする
+
+enum clock_index {
+    clk_sys = 5,
+};
+
+static inline uint32_t clock_get_hz(enum clock_index clk_index) {
+    (void)clk_index;
+    return 125000000;
+}
+
+#endif /* end of include guard: FAKE_HARDWARE_CLOCKS_H */
@@ -0,0 +1,117 @@
+#ifndef FAKE_HARDWARE_DMA_H
+#define FAKE_HARDWARE_DMA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// ホストでビルドするためのhardware/dma.hの代わり
+// チャネルの設定は見ないので何もしない。転送の始まりと終わりは
+// 使うテストが関数を用意して追う
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned int uint;
+
+enum dma_channel_transfer_size {
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2,
+};
+
+#define DREQ_PIO0_TX0 (0)
+#define DREQ_PIO0_RX0 (4)
+#define DREQ_PIO1_TX0 (8)
+#define DREQ_PIO1_RX0 (12)
+
+// チャネルのレジスタはテストが用意し、DMAの進み具合を書き込む
+// ホストではアドレスが入るようuintptr_tで持つ
+typedef struct {
+    volatile uintptr_t read_addr;
+    volatile uintptr_t write_addr;
+    volatile uint32_t transfer_count;
+    volatile uintptr_t al3_read_addr_trig;
+} dma_channel_hw_t;
+
+typedef struct {
+    dma_channel_hw_t ch[12];
+} dma_hw_t;
+
+extern dma_hw_t fake_dma_hw;
+
+#define dma_hw (&fake_dma_hw)
+#define dma_channel_hw_addr(channel) (&dma_hw->ch[(channel)])
+
+typedef struct {
+    uint32_t ctrl;
+} dma_channel_config;
+
+static inline dma_channel_config dma_channel_get_default_config(uint channel) {
+    (void)channel;
+    dma_channel_config c = {0};
+    return c;
+}
+
+static inline void channel_config_set_transfer_data_size(
+    dma_channel_config* c, enum dma_channel_transfer_size size) {
+    (void)c;
+    (void)size;
+}
+
+static inline void channel_config_set_dreq(dma_channel_config* c, uint dreq) {
+    (void)c;
+    (void)dreq;
+}
+
+static inline void channel_config_set_bswap(dma_channel_config* c,
+                                            bool bswap) {
+    (void)c;
+    (void)bswap;
+}
+
+static inline void channel_config_set_chain_to(dma_channel_config* c,
+                                               uint chain_to) {
+    (void)c;
+    (void)chain_to;
+}
+
+static inline void channel_config_set_ring(dma_channel_config* c, bool write,
+                                           uint size_bits) {
+    (void)c;
+    (void)write;
+    (void)size_bits;
+}
+
+static inline void channel_config_set_read_increment(dma_channel_config* c,
+                                                     bool incr) {
+    (void)c;
+    (void)incr;
+}
+
+static inline void channel_config_set_write_increment(dma_channel_config* c,
+                                                      bool incr) {
+    (void)c;
+    (void)incr;
+}
+
+int dma_claim_unused_channel(bool required);
+void dma_channel_configure(uint channel, const dma_channel_config* config,
+                           volatile void* write_addr,
+                           const volatile void* read_addr,
+                           uint transfer_count, bool trigger);
+void dma_channel_set_read_addr(uint channel, const volatile void* read_addr,
+                               bool trigger);
+void dma_channel_set_write_addr(uint channel, volatile void* write_addr,
+                                bool trigger);
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count,
+                                 bool trigger);
+void dma_start_channel_mask(uint32_t chan_mask);
+void dma_channel_abort(uint channel);
+bool dma_channel_is_busy(uint channel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard: FAKE_HARDWARE_DMA_H */
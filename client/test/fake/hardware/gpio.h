@@ -0,0 +1,45 @@
+#ifndef FAKE_HARDWARE_GPIO_H
+#define FAKE_HARDWARE_GPIO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// ホストでビルドするためのhardware/gpio.hの代わり
+// ピンの状態は使うテストが関数を用意して持つ
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned int uint;
+
+#define GPIO_OUT (1)
+#define GPIO_IN (0)
+
+#define GPIO_IRQ_EDGE_FALL (0x4u)
+#define GPIO_IRQ_EDGE_RISE (0x8u)
+
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+
+enum gpio_function {
+    GPIO_FUNC_SPI = 1,
+    GPIO_FUNC_UART = 2,
+    GPIO_FUNC_I2C = 3,
+    GPIO_FUNC_SIO = 5,
+};
+
+void gpio_init(uint gpio);
+void gpio_set_function(uint gpio, enum gpio_function fn);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_pull_up(uint gpio);
+bool gpio_get(uint gpio);
+void gpio_put(uint gpio, bool value);
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask,
+                                        bool enabled,
+                                        gpio_irq_callback_t callback);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard: FAKE_HARDWARE_GPIO_H */
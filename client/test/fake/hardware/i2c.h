@@ -0,0 +1,52 @@
+#ifndef FAKE_HARDWARE_I2C_H
+#define FAKE_HARDWARE_I2C_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// ホストでビルドするためのhardware/i2c.hの代わり
+// レジスタは構造体のメンバーで、読み書きしても何も起きないので、
+// 割り込みの状態はテストがraw_intr_statに直接書く
+// 関数は使うテストが用意する
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned int uint;
+
+typedef struct {
+    volatile uint32_t enable;
+    volatile uint32_t tar;
+    volatile uint32_t data_cmd;
+    volatile uint32_t raw_intr_stat;
+    volatile uint32_t clr_tx_abrt;
+    volatile uint32_t clr_stop_det;
+} i2c_hw_t;
+
+typedef struct i2c_inst {
+    i2c_hw_t* hw;
+} i2c_inst_t;
+
+#define I2C_IC_DATA_CMD_CMD_BITS (0x100u)
+#define I2C_IC_DATA_CMD_STOP_BITS (0x200u)
+#define I2C_IC_DATA_CMD_RESTART_BITS (0x400u)
+#define I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS (0x040u)
+#define I2C_IC_RAW_INTR_STAT_STOP_DET_BITS (0x200u)
+
+static inline i2c_hw_t* i2c_get_hw(i2c_inst_t* i2c) {
+    return i2c->hw;
+}
+
+static inline uint i2c_get_dreq(i2c_inst_t* i2c, bool is_tx) {
+    (void)i2c;
+    return is_tx ? 32 : 33;
+}
+
+uint i2c_init(i2c_inst_t* i2c, uint baudrate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard: FAKE_HARDWARE_I2C_H */
@@ -0,0 +1,163 @@
+#ifndef FAKE_HARDWARE_PIO_H
+#define FAKE_HARDWARE_PIO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// ホストでビルドするためのhardware/pio.hの代わり
+// ステートマシンは動かさないので、設定は何もせずFIFOの置き場だけ持つ
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned int uint;
+
+typedef struct pio_hw {
+    volatile uint32_t txf[4];
+    volatile uint32_t rxf[4];
+} pio_hw_t;
+typedef pio_hw_t* PIO;
+
+static inline PIO fake_pio(uint index) {
+    static pio_hw_t hw[2];
+    return &hw[index];
+}
+
+#define pio0 (fake_pio(0))
+#define pio1 (fake_pio(1))
+
+typedef struct {
+    const uint16_t* instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+
+typedef struct {
+    uint32_t clkdiv;
+} pio_sm_config;
+
+enum pio_fifo_join {
+    PIO_FIFO_JOIN_NONE = 0,
+    PIO_FIFO_JOIN_TX = 1,
+    PIO_FIFO_JOIN_RX = 2,
+};
+
+static inline pio_sm_config pio_get_default_sm_config(void) {
+    pio_sm_config c = {0};
+    return c;
+}
+
+static inline void sm_config_set_out_pins(pio_sm_config* c, uint base,
+                                          uint count) {
+    (void)c;
+    (void)base;
+    (void)count;
+}
+
+static inline void sm_config_set_in_pins(pio_sm_config* c, uint base) {
+    (void)c;
+    (void)base;
+}
+
+static inline void sm_config_set_sideset_pins(pio_sm_config* c,
+                                              uint sideset_base) {
+    (void)c;
+    (void)sideset_base;
+}
+
+static inline void sm_config_set_set_pins(pio_sm_config* c, uint set_base,
+                                          uint set_count) {
+    (void)c;
+    (void)set_base;
+    (void)set_count;
+}
+
+static inline void sm_config_set_out_shift(pio_sm_config* c, bool right,
+                                           bool autopull, uint threshold) {
+    (void)c;
+    (void)right;
+    (void)autopull;
+    (void)threshold;
+}
+
+static inline void sm_config_set_in_shift(pio_sm_config* c, bool right,
+                                          bool autopush, uint threshold) {
+    (void)c;
+    (void)right;
+    (void)autopush;
+    (void)threshold;
+}
+
+static inline void sm_config_set_clkdiv(pio_sm_config* c, float div) {
+    (void)c;
+    (void)div;
+}
+
+static inline void sm_config_set_fifo_join(pio_sm_config* c,
+                                           enum pio_fifo_join join) {
+    (void)c;
+    (void)join;
+}
+
+static inline uint pio_add_program(PIO pio, const pio_program_t* program) {
+    (void)pio;
+    (void)program;
+    return 0;
+}
+
+static inline int pio_claim_unused_sm(PIO pio, bool required) {
+    (void)pio;
+    (void)required;
+    return 0;
+}
+
+static inline void pio_gpio_init(PIO pio, uint pin) {
+    (void)pio;
+    (void)pin;
+}
+
+static inline void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin,
+                                                  uint count, bool is_out) {
+    (void)pio;
+    (void)sm;
+    (void)pin;
+    (void)count;
+    (void)is_out;
+}
+
+static inline void pio_sm_init(PIO pio, uint sm, uint initial_pc,
+                               const pio_sm_config* config) {
+    (void)pio;
+    (void)sm;
+    (void)initial_pc;
+    (void)config;
+}
+
+static inline void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+    (void)pio;
+    (void)sm;
+    (void)enabled;
+}
+
+static inline void pio_sm_clear_fifos(PIO pio, uint sm) {
+    (void)pio;
+    (void)sm;
+}
+
+static inline void pio_sm_put(PIO pio, uint sm, uint32_t data) {
+    (void)pio;
+    (void)sm;
+    (void)data;
+}
+
+static inline uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+    (void)pio;
+    return sm + (is_tx ? 0 : 4);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard: FAKE_HARDWARE_PIO_H */
@@ -0,0 +1,8 @@
+#ifndef FAKE_HARDWARE_SYNC_H
+#define FAKE_HARDWARE_SYNC_H
+
+// ホストでビルドするためのhardware/sync.hの代わり
+
+#define __dmb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#endif /* end of include guard: FAKE_HARDWARE_SYNC_H */
@@ -0,0 +1,11 @@
+#ifndef FAKE_PICO_PLATFORM_H
+#define FAKE_PICO_PLATFORM_H
+
+// ホストでビルドするためのpico/platform.hの代わり
+// テストはコア0だけで動かす
+
+static inline unsigned int get_core_num(void) {
+    return 0;
+}
+
+#endif /* end of include guard: FAKE_PICO_PLATFORM_H */
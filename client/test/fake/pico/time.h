@@ -0,0 +1,28 @@
+#ifndef FAKE_PICO_TIME_H
+#define FAKE_PICO_TIME_H
+
+#include <stdint.h>
+
+// ホストでビルドするためのpico/time.hの代わり
+// 時刻はテストが決めた値をそのまま使う
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint64_t absolute_time_t;
+
+static inline uint64_t to_us_since_boot(absolute_time_t t) {
+    return t;
+}
+
+// 時計は使うテストが用意し、必要なら待った分だけ進める
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+void busy_wait_us_32(uint32_t delay_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard: FAKE_PICO_TIME_H */
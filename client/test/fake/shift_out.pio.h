@@ -0,0 +1,19 @@
+#ifndef FAKE_SHIFT_OUT_PIO_H
+#define FAKE_SHIFT_OUT_PIO_H
+
+#include <stddef.h>
+
+#include <hardware/pio.h>
+
+// ホストでビルドするための、pioasmが作るshift_out.pio.hの代わり
+// ステートマシンは動かさないので、プログラムの中身は持たない
+
+static const pio_program_t shift_out_program = {NULL, 0, -1};
+
+static inline pio_sm_config shift_out_program_get_default_config(
+    uint offset) {
+    (void)offset;
+    return pio_get_default_sm_config();
+}
+
+#endif /* end of include guard: FAKE_SHIFT_OUT_PIO_H */
@@ -0,0 +1,21 @@
+#ifndef FAKE_SPI_SLAVE_PIO_H
+#define FAKE_SPI_SLAVE_PIO_H
+
+#include <stddef.h>
+
+#include <hardware/pio.h>
+
+// ホストでビルドするための、pioasmが作るspi_slave.pio.hの代わり
+// プログラムの中身はtest_spi_slave_pioが.pioから読んで確かめる
+
+#define spi_slave_SCK_INDEX 30
+
+static const pio_program_t spi_slave_program = {NULL, 0, -1};
+
+static inline pio_sm_config spi_slave_program_get_default_config(
+    uint offset) {
+    (void)offset;
+    return pio_get_default_sm_config();
+}
+
+#endif /* end of include guard: FAKE_SPI_SLAVE_PIO_H */
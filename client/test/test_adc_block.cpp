@@ -0,0 +1,158 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "adc_block.h"
+#include "adc_block_decoder.hpp"
+#include "check.h"
+#include "msgpack.hpp"
+
+// front.cppのpublish_adc_blockと同じ形でフレームを作り、デコーダで戻す
+
+static const char* const names[] = {"left", "right", "c", "d"};
+
+static uint16_t code_of(uint8_t ch, uint16_t i) {
+    return (uint16_t)((i * 97 + ch * 1000 + 5) & 0x0FFF);
+}
+
+// payloadのマップの先頭を探し、そこから最後までを返す
+static std::vector<uint8_t> build(adc_block_t* block) {
+    size_t size = adc_block_finish(block);
+
+    MsgPack<1024> msgpack("block/stroke/front", 4);
+    msgpack.addTime(block->base_us);
+    msgpack.addNames("ch", block->channels,
+                     [](uint8_t i) { return names[i]; });
+    msgpack.add("dt", block->interval_us);
+    msgpack.add("n", block->count);
+    msgpack.addBin("codes", block->data, size);
+
+    uint8_t* buf = msgpack.getBuf();
+    CHECK(buf != nullptr);
+    const uint8_t* body = buf + 4 + FRAME_HEADER_SIZE;
+    size_t body_size = msgpack.getSize() - 4 - FRAME_HEADER_SIZE;
+
+    // {"topic": str, "payload": {...}} なので二つのキーの後ろ
+    const char* key = "payload";
+    for (size_t i = 0; i + 8 <= body_size; i++) {
+        if (body[i] == (0xA0 | 7) && memcmp(&body[i + 1], key, 7) == 0) {
+            return std::vector<uint8_t>(body + i + 8, body + body_size);
+        }
+    }
+    CHECK(false);
+    return {};
+}
+
+static void fill(adc_block_t* block, uint16_t n, uint64_t base_us) {
+    uint16_t codes[ADC_BLOCK_MAX_CHANNELS];
+    for (uint16_t i = 0; i < n; i++) {
+        for (uint8_t ch = 0; ch < block->channels; ch++) {
+            codes[ch] = code_of(ch, i);
+        }
+        CHECK(adc_block_add(block, base_us + i * block->interval_us, codes));
+    }
+}
+
+static void check_decoded(const AdcBlock& d, uint8_t channels, uint16_t n,
+                          uint64_t base_us, uint32_t interval_us) {
+    CHECK(d.channels.size() == channels);
+    for (uint8_t ch = 0; ch < channels; ch++) {
+        CHECK(d.channels[ch] == names[ch]);
+    }
+    CHECK(d.count == n);
+    CHECK(d.interval_us == interval_us);
+    CHECK(d.base_us == base_us);
+    CHECK(d.timeUs(n - 1) == base_us + (uint64_t)(n - 1) * interval_us);
+    for (uint8_t ch = 0; ch < channels; ch++) {
+        for (uint16_t i = 0; i < n; i++) {
+            CHECK(d.code(ch, i) == code_of(ch, i));
+        }
+    }
+}
+
+static void test_full_block() {
+    adc_block_t block;
+    CHECK(adc_block_init(&block, 2, 128, 1000));
+    fill(&block, 128, 123456789);
+    CHECK(adc_block_is_full(&block));
+    const uint16_t extra[2] = {0, 0};
+    CHECK(!adc_block_add(&block, 129000, extra));
+
+    std::vector<uint8_t> payload = build(&block);
+    AdcBlock d;
+    CHECK(d.decode(payload.data(), payload.size()));
+    check_decoded(d, 2, 128, 123456789, 1000);
+}
+
+// 途中で区切った奇数個のブロックも列の間を詰めて戻せる
+static void test_partial_block() {
+    const uint16_t counts[] = {1, 2, 5, 127};
+    for (uint16_t n : counts) {
+        adc_block_t block;
+        CHECK(adc_block_init(&block, 3, 128, 250));
+        fill(&block, n, 1000);
+
+        std::vector<uint8_t> payload = build(&block);
+        AdcBlock d;
+        CHECK(d.decode(payload.data(), payload.size()));
+        check_decoded(d, 3, n, 1000, 250);
+    }
+}
+
+// 間隔が半周期以上ずれたサンプルは受け付けない
+static void test_jitter() {
+    adc_block_t block;
+    CHECK(adc_block_init(&block, 1, 8, 1000));
+    const uint16_t code = 0xFFFF;
+    CHECK(adc_block_add(&block, 10000, &code));
+    CHECK(adc_block_add(&block, 11000 + 500, &code));
+    CHECK(!adc_block_add(&block, 12000 + 501, &code));
+    CHECK(!adc_block_add(&block, 12000 - 501, &code));
+    CHECK(adc_block_add(&block, 12000 - 500, &code));
+
+    // 下位12bitだけが残る
+    uint16_t out[3];
+    size_t size = adc_block_finish(&block);
+    CHECK(adc_block_unpack(block.data, size, 1, 3, out));
+    CHECK(out[0] == 0x0FFF && out[1] == 0x0FFF && out[2] == 0x0FFF);
+}
+
+static void test_init_range() {
+    adc_block_t block;
+    CHECK(!adc_block_init(&block, 0, 8, 1000));
+    CHECK(!adc_block_init(&block, ADC_BLOCK_MAX_CHANNELS + 1, 8, 1000));
+    CHECK(!adc_block_init(&block, 1, 0, 1000));
+    CHECK(!adc_block_init(&block, 1, ADC_BLOCK_MAX_SAMPLES + 1, 1000));
+    CHECK(!adc_block_init(&block, 1, 8, 0));
+}
+
+// 壊れたpayloadは途中で読み止め、範囲外を読まない
+static void test_broken_payload() {
+    adc_block_t block;
+    CHECK(adc_block_init(&block, 2, 16, 1000));
+    fill(&block, 16, 5000);
+    std::vector<uint8_t> payload = build(&block);
+
+    AdcBlock d;
+    for (size_t len = 0; len < payload.size(); len++) {
+        std::vector<uint8_t> cut(payload.begin(), payload.begin() + len);
+        CHECK(!d.decode(cut.data(), cut.size()));
+    }
+
+    uint16_t out[32];
+    size_t size = ADC_BLOCK_COLUMN_SIZE(16) * 2;
+    CHECK(!adc_block_unpack(block.data, size - 1, 2, 16, out));
+    CHECK(!adc_block_unpack(block.data, size, 2, 15, out));
+}
+
+int main() {
+    test_full_block();
+    test_partial_block();
+    test_jitter();
+    test_init_range();
+    test_broken_payload();
+    printf("adc_block: ok\n");
+    return 0;
+}
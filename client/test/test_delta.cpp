@@ -0,0 +1,176 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <cJSON.h>
+
+#include "capture.hpp"
+#include "check.h"
+#include "delta.h"
+#include "msgpack.hpp"
+
+// rear.cppと同じ間隔
+#define KEYFRAME_INTERVAL_US (5'000'000)
+#define HEARTBEAT_INTERVAL_US (1'000'000)
+#define WATER_DEADBAND (0.1)
+
+static void test_kinds() {
+    const double deadband[] = {0.5, 0.0};
+    delta_t delta;
+    CHECK(!delta_init(&delta, 0, deadband, 1000, 100));
+    CHECK(!delta_init(&delta, DELTA_MAX_FIELDS + 1, deadband, 1000, 100));
+    CHECK(delta_init(&delta, 2, deadband, 1000, 100));
+
+    uint32_t mask;
+    double v[] = {1.0, 2.0};
+    CHECK(delta_update(&delta, 0, v, &mask) == delta_keyframe);
+    CHECK(mask == 0x3);
+
+    // 不感帯以内の変化は送らない
+    v[0] = 1.5;
+    CHECK(delta_update(&delta, 10, v, &mask) == delta_skip);
+    v[0] = 1.6;
+    CHECK(delta_update(&delta, 20, v, &mask) == delta_changes);
+    CHECK(mask == 0x1);
+
+    // 比べる相手は最後に送った値なので、少しずつの変化も溜まれば送る
+    v[1] = 2.0 + 1e-9;
+    CHECK(delta_update(&delta, 30, v, &mask) == delta_changes);
+    CHECK(mask == 0x2);
+
+    CHECK(delta_update(&delta, 129, v, &mask) == delta_skip);
+    CHECK(delta_update(&delta, 130, v, &mask) == delta_heartbeat);
+    CHECK(mask == 0);
+
+    v[0] = NAN;
+    CHECK(delta_update(&delta, 140, v, &mask) == delta_changes);
+    CHECK(mask == 0x1);
+
+    CHECK(delta_update(&delta, 1000, v, &mask) == delta_keyframe);
+    delta_force_keyframe(&delta);
+    CHECK(delta_update(&delta, 1001, v, &mask) == delta_keyframe);
+}
+
+// 記録の一行分。時刻とsec/usec以外の数値の項目
+struct record_t {
+    std::string topic;
+    uint64_t time_us;
+    std::vector<std::string> keys;
+    std::vector<double> values;
+};
+
+static bool parse_line(const capture_line_t& cap, record_t* rec) {
+    cJSON* root = cJSON_Parse(cap.payload.c_str());
+    if (!root) {
+        return false;
+    }
+    rec->topic = cap.topic;
+    rec->time_us = cap.time_us;
+    rec->keys.clear();
+    rec->values.clear();
+    for (cJSON* item = root->child; item; item = item->next) {
+        if (cJSON_IsNumber(item) && strcmp(item->string, "sec") != 0 &&
+            strcmp(item->string, "usec") != 0) {
+            rec->keys.push_back(item->string);
+            rec->values.push_back(item->valuedouble);
+        }
+    }
+    cJSON_Delete(root);
+    return !rec->keys.empty() && rec->keys.size() <= DELTA_MAX_FIELDS;
+}
+
+// 送る項目だけでフレームを作った時のバイト数
+static uint16_t frame_size(const record_t& rec, uint32_t mask) {
+    uint8_t n = 0;
+    for (size_t i = 0; i < rec.keys.size(); i++) {
+        n += (mask >> i) & 1;
+    }
+    MsgPack<1024, encoding::Float32> msgpack(rec.topic, n);
+    msgpack.addTime(rec.time_us);
+    for (size_t i = 0; i < rec.keys.size(); i++) {
+        if (mask & (1u << i)) {
+            msgpack.add(rec.keys[i], rec.values[i]);
+        }
+    }
+    CHECK(msgpack.getBuf() != nullptr);
+    return msgpack.getSize();
+}
+
+struct replay_t {
+    std::vector<double> deadband;
+    delta_t delta;
+    std::vector<double> host;  // ホストで組み立て直した値
+    uint64_t full_bytes = 0;
+    uint64_t delta_bytes = 0;
+};
+
+// 記録を流し直し、ホストの値が常に不感帯以内に収まるかを確かめる
+static void replay(const char* path, std::map<std::string, replay_t>* topics) {
+    record_t rec;
+    capture_read(path, [&](const capture_line_t& cap) {
+        if (!parse_line(cap, &rec)) {
+            return;
+        }
+        replay_t& r = (*topics)[rec.topic];
+        if (r.deadband.empty() || r.deadband.size() != rec.keys.size()) {
+            double db = rec.topic == "water" ? WATER_DEADBAND : 0.0;
+            r.deadband.assign(rec.keys.size(), db);
+            r.host.assign(rec.keys.size(), NAN);
+            CHECK(delta_init(&r.delta, rec.keys.size(), r.deadband.data(),
+                             KEYFRAME_INTERVAL_US, HEARTBEAT_INTERVAL_US));
+        }
+
+        uint32_t mask;
+        delta_kind_t kind =
+            delta_update(&r.delta, rec.time_us, rec.values.data(), &mask);
+        if (kind != delta_skip) {
+            r.delta_bytes += frame_size(rec, mask);
+        }
+        for (size_t i = 0; i < rec.keys.size(); i++) {
+            if (kind != delta_skip && (mask & (1u << i))) {
+                r.host[i] = rec.values[i];
+            }
+            CHECK(fabs(r.host[i] - rec.values[i]) <= r.deadband[i]);
+        }
+        r.full_bytes += frame_size(rec, UINT32_MAX >> (32 - rec.keys.size()));
+    });
+}
+
+static void print_ratio(const char* label,
+                        const std::map<std::string, replay_t>& topics) {
+    uint64_t full = 0;
+    uint64_t sent = 0;
+    for (auto& [topic, r] : topics) {
+        printf("  %-14s %10llu -> %10llu B (%5.1f%%)\n", topic.c_str(),
+               (unsigned long long)r.full_bytes,
+               (unsigned long long)r.delta_bytes,
+               100.0 * r.delta_bytes / r.full_bytes);
+        full += r.full_bytes;
+        sent += r.delta_bytes;
+    }
+    printf("  %-14s %10llu -> %10llu B (%5.1f%%)\n", label,
+           (unsigned long long)full, (unsigned long long)sent,
+           100.0 * sent / full);
+    CHECK(sent < full);
+}
+
+// 引数にanalyze/dataの記録を渡すと、流し直して減ったバイト数を表示する
+// 不感帯はrear.cppと同じくwaterだけ0.1度、他は0
+int main(int argc, char** argv) {
+    test_kinds();
+
+    std::map<std::string, replay_t> topics;
+    for (int i = 1; i < argc; i++) {
+        replay(argv[i], &topics);
+    }
+    if (!topics.empty()) {
+        print_ratio("total", topics);
+    }
+    printf("delta: ok\n");
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "descriptor.hpp"
+#include "key.h"
+#include "outbox.h"
+#include "topic.h"
+
+// 表をdescのフレームに分けてoutboxに通し、ホストと同じく継ぎ足して戻す
+
+static outbox_t ob;
+
+struct reader_t {
+    const uint8_t* buf;
+    size_t size;
+    size_t pos;
+};
+
+static bool reader_read(cmp_ctx_t* ctx, void* data, size_t limit) {
+    reader_t* r = static_cast<reader_t*>(ctx->buf);
+    if (r->pos + limit > r->size) {
+        return false;
+    }
+    memcpy(data, &r->buf[r->pos], limit);
+    r->pos += limit;
+    return true;
+}
+
+static bool reader_skip(cmp_ctx_t* ctx, size_t count) {
+    reader_t* r = static_cast<reader_t*>(ctx->buf);
+    if (r->pos + count > r->size) {
+        return false;
+    }
+    r->pos += count;
+    return true;
+}
+
+static void push(uint8_t topic, const uint8_t* buf, uint16_t len) {
+    CHECK(topic == topic_desc);
+    CHECK(len <= OUTBOX_RECORD_SIZE);
+    CHECK(outbox_push(&ob, 1, topic, buf, len));
+}
+
+using tables_t = std::map<std::string, std::vector<std::string>>;
+
+// 一つのフレームを読み、その表のfirstの位置から名前を書き込む
+static void merge(const uint8_t* frame, uint16_t len, tables_t* tables) {
+    const size_t body = 4 + FRAME_HEADER_SIZE;
+    CHECK(len > body);
+    reader_t r = {frame + body, static_cast<size_t>(len - body), 0};
+    cmp_ctx_t ctx;
+    cmp_init(&ctx, &r, reader_read, reader_skip, nullptr);
+
+    char str[64];
+    uint32_t size;
+    CHECK(cmp_read_map(&ctx, &size) && size == 2);
+    CHECK(cmp_read_str(&ctx, str, &(size = sizeof(str))));
+    CHECK(cmp_read_str(&ctx, str, &(size = sizeof(str))));
+    CHECK(strcmp(str, "desc") == 0);
+    CHECK(cmp_read_str(&ctx, str, &(size = sizeof(str))));
+    CHECK(strcmp(str, "payload") == 0);
+
+    uint32_t count;
+    CHECK(cmp_read_map(&ctx, &count) && count == 4);
+    uint64_t first = UINT64_MAX;
+    std::vector<std::string>* names = nullptr;
+    for (uint32_t i = 0; i < count; i++) {
+        CHECK(cmp_read_str(&ctx, str, &(size = sizeof(str))));
+        if (strcmp(str, "us") == 0) {
+            uint64_t us;
+            CHECK(cmp_read_uinteger(&ctx, &us) && us == 1000);
+        } else if (strcmp(str, "table") == 0) {
+            CHECK(cmp_read_str(&ctx, str, &(size = sizeof(str))));
+            names = &(*tables)[str];
+        } else if (strcmp(str, "first") == 0) {
+            CHECK(cmp_read_uinteger(&ctx, &first));
+        } else {
+            CHECK(strcmp(str, "names") == 0);
+            CHECK(names != nullptr);
+            // 表の順に届くので、firstはいつも今の長さになる
+            CHECK(first == names->size());
+            uint32_t n;
+            CHECK(cmp_read_array(&ctx, &n));
+            for (uint32_t k = 0; k < n; k++) {
+                CHECK(cmp_read_str(&ctx, str, &(size = sizeof(str))));
+                names->push_back(str);
+            }
+        }
+    }
+    CHECK(r.pos == r.size);
+}
+
+// outboxから全て取り出して継ぎ足し、何フレームだったかを返す
+static int pop_all(tables_t* tables) {
+    uint8_t buf[OUTBOX_RECORD_SIZE];
+    int frames = 0;
+    while (uint16_t len = outbox_pop(&ob, buf, sizeof(buf))) {
+        merge(buf, len, tables);
+        frames++;
+    }
+    return frames;
+}
+
+// front.cppと同じく三つの表を一度に積んでも、どれも捨てられずに届く
+static void test_real_tables() {
+    static const char* const regs[] = {"stroke/front/left",
+                                       "stroke/front/right", "meter/rpm",
+                                       "meter/gp"};
+    auto reg_name = [](uint8_t i) { return regs[i]; };
+
+    outbox_init(&ob);
+    CHECK(describe_table<OUTBOX_RECORD_SIZE>("keys", key_count(), key_name,
+                                             1000, push));
+    CHECK(describe_table<OUTBOX_RECORD_SIZE>("topics", TOPIC_COUNT,
+                                             topic_name, 1000, push));
+    CHECK(describe_table<OUTBOX_RECORD_SIZE>("regs", 4, reg_name, 1000,
+                                             push));
+
+    tables_t tables;
+    CHECK(pop_all(&tables) >= 3);
+    CHECK(tables["keys"].size() == key_count());
+    for (uint8_t i = 0; i < key_count(); i++) {
+        CHECK(tables["keys"][i] == key_name(i));
+    }
+    CHECK(tables["topics"].size() == TOPIC_COUNT);
+    for (uint8_t i = 0; i < TOPIC_COUNT; i++) {
+        CHECK(tables["topics"][i] == topic_name(i));
+    }
+    CHECK(tables["regs"].size() == 4);
+    for (uint8_t i = 0; i < 4; i++) {
+        CHECK(tables["regs"][i] == regs[i]);
+    }
+    for (uint8_t t = 0; t < TOPIC_COUNT; t++) {
+        CHECK(outbox_get_drops(&ob, t) == 0);
+    }
+}
+
+// 一つに収まらない表は分け、どのフレームも上限に収める
+static void test_split() {
+    static char names[200][40];
+    for (int i = 0; i < 200; i++) {
+        snprintf(names[i], sizeof(names[i]), "channel/%03d/long_name_%030d",
+                 i, i);
+    }
+    auto name = [](uint8_t i) { return static_cast<const char*>(names[i]); };
+
+    tables_t tables;
+    outbox_init(&ob);
+    int frames = 0;
+    // 一度に積むとingressが溢れるので、一つずつ取り出す
+    auto publish = [&](uint8_t topic, const uint8_t* buf, uint16_t len) {
+        push(topic, buf, len);
+        frames += pop_all(&tables);
+    };
+    CHECK(describe_table<OUTBOX_RECORD_SIZE>("regs", 200, name, 1000,
+                                             publish));
+    CHECK(frames > 1);
+    CHECK(tables["regs"].size() == 200);
+    for (int i = 0; i < 200; i++) {
+        CHECK(tables["regs"][i] == names[i]);
+    }
+}
+
+// 空の表もfirstが0のフレームを一つ送る
+static void test_empty() {
+    outbox_init(&ob);
+    auto name = [](uint8_t) { return ""; };
+    CHECK(describe_table<OUTBOX_RECORD_SIZE>("regs", 0, name, 1000, push));
+    tables_t tables;
+    CHECK(pop_all(&tables) == 1);
+    CHECK(tables.count("regs") == 1 && tables["regs"].empty());
+}
+
+// 一つの名前も収まらなければ何も送らない
+static void test_too_long() {
+    outbox_init(&ob);
+    static char name[600];
+    memset(name, 'a', sizeof(name) - 1);
+    auto long_name = [](uint8_t) { return static_cast<const char*>(name); };
+    CHECK(!describe_table<OUTBOX_RECORD_SIZE>("regs", 1, long_name, 1000,
+                                              push));
+    tables_t tables;
+    CHECK(pop_all(&tables) == 0);
+}
+
+int main() {
+    test_real_tables();
+    test_split();
+    test_empty();
+    test_too_long();
+    printf("descriptor: ok\n");
+    return 0;
+}
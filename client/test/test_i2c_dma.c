@@ -0,0 +1,337 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hardware/dma.h>
+#include <hardware/gpio.h>
+#include <hardware/i2c.h>
+#include <pico/time.h>
+
+#include "check.h"
+#include "i2c_dma.h"
+
+// コントローラ、DMA、ピンを真似て、転送の終わり方ごとに
+// コールバックと統計、バスの解放を確かめる
+
+#define PIN_SDA (4)
+#define PIN_SCL (5)
+#define PIN_COUNT (30)
+#define DMA_COUNT (12)
+#define TIMEOUT_US (1000)
+
+static uint32_t now_us;
+
+static i2c_hw_t hw;
+static i2c_inst_t inst = {&hw};
+static uint32_t i2c_inits;
+
+typedef struct {
+    bool claimed;
+    bool busy;
+    uint32_t count;
+    uint32_t aborts;
+    volatile void* write_addr;
+    const volatile void* read_addr;
+} fake_dma_t;
+
+static fake_dma_t dma[DMA_COUNT];
+
+typedef struct {
+    enum gpio_function fn;
+    bool out;
+    bool pull_up;
+    uint32_t outs;  // 出力にした回数
+} fake_pin_t;
+
+static fake_pin_t pins[PIN_COUNT];
+static uint32_t sda_release;  // SCLをこの回数動かすとSDAが離される
+
+uint32_t time_us_32(void) {
+    return now_us;
+}
+
+void busy_wait_us_32(uint32_t delay_us) {
+    now_us += delay_us;
+}
+
+uint i2c_init(i2c_inst_t* i2c, uint baudrate) {
+    (void)i2c;
+    i2c_inits++;
+    return baudrate;
+}
+
+int dma_claim_unused_channel(bool required) {
+    for (int i = 0; i < DMA_COUNT; i++) {
+        if (!dma[i].claimed) {
+            dma[i].claimed = true;
+            return i;
+        }
+    }
+    CHECK(!required);
+    return -1;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config* config,
+                           volatile void* write_addr,
+                           const volatile void* read_addr,
+                           uint transfer_count, bool trigger) {
+    (void)config;
+    CHECK(!trigger);
+    dma[channel].write_addr = write_addr;
+    dma[channel].read_addr = read_addr;
+    dma[channel].count = transfer_count;
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void* read_addr,
+                               bool trigger) {
+    CHECK(!trigger);
+    dma[channel].read_addr = read_addr;
+}
+
+void dma_channel_set_write_addr(uint channel, volatile void* write_addr,
+                                bool trigger) {
+    CHECK(!trigger);
+    dma[channel].write_addr = write_addr;
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count,
+                                 bool trigger) {
+    CHECK(!trigger);
+    dma[channel].count = trans_count;
+}
+
+void dma_start_channel_mask(uint32_t chan_mask) {
+    for (int i = 0; i < DMA_COUNT; i++) {
+        if (chan_mask & (1u << i)) {
+            dma[i].busy = true;
+        }
+    }
+}
+
+void dma_channel_abort(uint channel) {
+    dma[channel].busy = false;
+    dma[channel].aborts++;
+}
+
+bool dma_channel_is_busy(uint channel) {
+    return dma[channel].busy;
+}
+
+void gpio_init(uint gpio) {
+    pins[gpio].fn = GPIO_FUNC_SIO;
+    pins[gpio].out = false;
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn) {
+    pins[gpio].fn = fn;
+}
+
+void gpio_set_dir(uint gpio, bool out) {
+    pins[gpio].out = out;
+    pins[gpio].outs += out;
+}
+
+void gpio_pull_up(uint gpio) {
+    pins[gpio].pull_up = true;
+}
+
+// 相手が掴んでいる間はLow。自分で出力にした時もLow
+bool gpio_get(uint gpio) {
+    if (pins[gpio].out) {
+        return false;
+    }
+    return gpio != PIN_SDA || pins[PIN_SCL].outs >= sda_release;
+}
+
+static i2c_dma_bus_t bus;
+static i2c_dma_result_t last_result;
+static uint32_t calls;
+
+static void on_done(i2c_dma_result_t result, void* ctx) {
+    CHECK(ctx == &bus);
+    last_result = result;
+    calls++;
+}
+
+static void setup(void) {
+    memset(&hw, 0, sizeof(hw));
+    memset(dma, 0, sizeof(dma));
+    memset(pins, 0, sizeof(pins));
+    i2c_inits = 0;
+    sda_release = 0;
+    calls = 0;
+    now_us = 1000;
+
+    memset(&bus, 0, sizeof(bus));
+    bus.i2c_id = &inst;
+    bus.pin_sda = PIN_SDA;
+    bus.pin_scl = PIN_SCL;
+    bus.baud = 400000;
+    i2c_dma_init(&bus);
+}
+
+static void start_read(uint8_t* buf, uint8_t len) {
+    CHECK(i2c_dma_read(&bus, 0x28, 0x08, buf, len, TIMEOUT_US, on_done,
+                       &bus));
+}
+
+// 初期化でピンとコントローラを設定し、DMAを二つ取る
+static void test_init(void) {
+    setup();
+    CHECK(i2c_inits == 1);
+    CHECK(pins[PIN_SDA].fn == GPIO_FUNC_I2C && pins[PIN_SDA].pull_up);
+    CHECK(pins[PIN_SCL].fn == GPIO_FUNC_I2C && pins[PIN_SCL].pull_up);
+    CHECK(dma[bus.dma_tx].claimed && dma[bus.dma_rx].claimed);
+    CHECK(bus.dma_tx != bus.dma_rx);
+    CHECK(dma[bus.dma_tx].write_addr == &hw.data_cmd);
+    CHECK(dma[bus.dma_rx].read_addr == &hw.data_cmd);
+    CHECK(!i2c_dma_is_busy(&bus));
+}
+
+// 読み出しは番地の後にRESTARTから読むコマンドを並べ、最後でSTOPを出す
+// STOPが出ても、受信のDMAが終わるまでは終わりにしない
+static void test_read_ok(void) {
+    setup();
+    uint8_t buf[6];
+    start_read(buf, sizeof(buf));
+    CHECK(i2c_dma_is_busy(&bus));
+    CHECK(hw.tar == 0x28 && hw.enable == 1);
+    CHECK(bus.cmds[0] == 0x08);
+    CHECK(bus.cmds[1] ==
+          (I2C_IC_DATA_CMD_CMD_BITS | I2C_IC_DATA_CMD_RESTART_BITS));
+    for (int i = 2; i < 6; i++) {
+        CHECK(bus.cmds[i] == I2C_IC_DATA_CMD_CMD_BITS);
+    }
+    CHECK(bus.cmds[6] ==
+          (I2C_IC_DATA_CMD_CMD_BITS | I2C_IC_DATA_CMD_STOP_BITS));
+    CHECK(dma[bus.dma_tx].busy && dma[bus.dma_tx].count == 7);
+    CHECK(dma[bus.dma_rx].busy && dma[bus.dma_rx].count == 6);
+    CHECK(dma[bus.dma_rx].write_addr == buf);
+
+    // 転送中は次を受け付けない
+    uint8_t other[2];
+    CHECK(!i2c_dma_read(&bus, 0x28, 0x00, other, 2, TIMEOUT_US, on_done,
+                        &bus));
+
+    i2c_dma_task(&bus);
+    CHECK(calls == 0);
+
+    dma[bus.dma_tx].busy = false;
+    hw.raw_intr_stat = I2C_IC_RAW_INTR_STAT_STOP_DET_BITS;
+    i2c_dma_task(&bus);
+    CHECK(calls == 0);
+
+    dma[bus.dma_rx].busy = false;
+    i2c_dma_task(&bus);
+    CHECK(calls == 1 && last_result == i2c_dma_ok);
+    CHECK(!i2c_dma_is_busy(&bus));
+    i2c_dma_task(&bus);
+    CHECK(calls == 1);
+
+    i2c_dma_stats_t stats;
+    i2c_dma_take_stats(&bus, &stats);
+    CHECK(stats.ok == 1 && stats.nacks == 0 && stats.timeouts == 0);
+    i2c_dma_take_stats(&bus, &stats);
+    CHECK(stats.ok == 0);
+}
+
+// 書き込みは番地とデータを並べ、受信のDMAは動かさない
+static void test_write(void) {
+    setup();
+    const uint8_t data[] = {0x12, 0x34};
+    CHECK(i2c_dma_write(&bus, 0x28, 0x3D, data, sizeof(data), TIMEOUT_US,
+                        on_done, &bus));
+    CHECK(bus.cmds[0] == 0x3D);
+    CHECK(bus.cmds[1] == 0x12);
+    CHECK(bus.cmds[2] == (0x34 | I2C_IC_DATA_CMD_STOP_BITS));
+    CHECK(dma[bus.dma_tx].busy && dma[bus.dma_tx].count == 3);
+    CHECK(!dma[bus.dma_rx].busy);
+
+    uint8_t big[I2C_DMA_MAX_LEN + 1] = {0};
+    dma[bus.dma_tx].busy = false;
+    hw.raw_intr_stat = I2C_IC_RAW_INTR_STAT_STOP_DET_BITS;
+    i2c_dma_task(&bus);
+    CHECK(calls == 1 && last_result == i2c_dma_ok);
+    CHECK(!i2c_dma_write(&bus, 0x28, 0x00, big, sizeof(big), TIMEOUT_US,
+                         on_done, &bus));
+}
+
+// 応答が無ければDMAを止めて応答なしで返し、すぐに次を始められる
+static void test_nack(void) {
+    setup();
+    uint8_t buf[6];
+    start_read(buf, sizeof(buf));
+    hw.raw_intr_stat = I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS;
+    i2c_dma_task(&bus);
+    CHECK(calls == 1 && last_result == i2c_dma_nack);
+    CHECK(dma[bus.dma_tx].aborts == 1 && dma[bus.dma_rx].aborts == 1);
+    CHECK(!dma[bus.dma_tx].busy && !dma[bus.dma_rx].busy);
+    // バスは解放しない
+    CHECK(i2c_inits == 1 && pins[PIN_SCL].outs == 0);
+
+    i2c_dma_stats_t stats;
+    i2c_dma_take_stats(&bus, &stats);
+    CHECK(stats.ok == 0 && stats.nacks == 1 && stats.timeouts == 0);
+
+    hw.raw_intr_stat = 0;
+    start_read(buf, sizeof(buf));
+    CHECK(i2c_dma_is_busy(&bus));
+}
+
+// 期限を過ぎたら、SDAが離されるまでSCLを動かしてSTOPを出し、
+// コントローラを初期化し直す
+static void test_timeout(uint32_t release, uint32_t clocks) {
+    setup();
+    sda_release = release;
+    uint8_t buf[6];
+    start_read(buf, sizeof(buf));
+
+    now_us += TIMEOUT_US;
+    i2c_dma_task(&bus);
+    CHECK(calls == 0);
+
+    now_us += 1;
+    i2c_dma_task(&bus);
+    CHECK(calls == 1 && last_result == i2c_dma_timeout);
+    CHECK(dma[bus.dma_tx].aborts == 1 && dma[bus.dma_rx].aborts == 1);
+    CHECK(pins[PIN_SCL].outs == clocks);
+    CHECK(pins[PIN_SDA].outs == 1);
+    CHECK(!pins[PIN_SCL].out && !pins[PIN_SDA].out);
+    CHECK(i2c_inits == 2);
+    CHECK(pins[PIN_SDA].fn == GPIO_FUNC_I2C);
+    CHECK(pins[PIN_SCL].fn == GPIO_FUNC_I2C);
+
+    i2c_dma_stats_t stats;
+    i2c_dma_take_stats(&bus, &stats);
+    CHECK(stats.ok == 0 && stats.nacks == 0 && stats.timeouts == 1);
+    CHECK(!i2c_dma_is_busy(&bus));
+}
+
+// 時計が一周しても期限は始めてからの時間で見る
+static void test_timeout_wrap(void) {
+    setup();
+    now_us = UINT32_MAX - TIMEOUT_US / 2;
+    uint8_t buf[1];
+    start_read(buf, sizeof(buf));
+    now_us += TIMEOUT_US;
+    i2c_dma_task(&bus);
+    CHECK(calls == 0);
+    now_us += 1;
+    i2c_dma_task(&bus);
+    CHECK(calls == 1 && last_result == i2c_dma_timeout);
+}
+
+int main(void) {
+    test_init();
+    test_read_ok();
+    test_write();
+    test_nack();
+    // SDAが離されていればSCLは動かさず、掴まれていれば離されるまで、
+    // 離されなくてもI2C_DMA_RECOVER_CLOCKS回で止める
+    test_timeout(0, 0);
+    test_timeout(3, 3);
+    test_timeout(UINT32_MAX, I2C_DMA_RECOVER_CLOCKS);
+    test_timeout_wrap();
+    printf("i2c_dma: ok\n");
+    return 0;
+}
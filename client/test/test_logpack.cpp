@@ -0,0 +1,273 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include "capture.hpp"
+#include "check.h"
+#include "crc16.h"
+#include "flash_log_decoder.hpp"
+#include "logpack.h"
+#include "lz.h"
+#include "msgpack.hpp"
+
+static uint16_t table[LZ_HASH_SIZE];
+static logpack_work_t work;
+
+static std::vector<uint8_t> random_bytes(size_t n, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> v(n);
+    for (uint8_t& b : v) {
+        b = rng() & 0xFF;
+    }
+    return v;
+}
+
+// 圧縮して戻すと元と一致する
+static size_t lz_round_trip(const std::vector<uint8_t>& in) {
+    std::vector<uint8_t> packed(LZ_BOUND(in.size()));
+    size_t n = lz_compress(in.data(), in.size(), packed.data(), packed.size(),
+                           table);
+    CHECK(n != 0);
+    std::vector<uint8_t> out(in.size());
+    CHECK(lz_decompress(packed.data(), n, out.data(), out.size()) ==
+          in.size());
+    CHECK(out == in);
+    return n;
+}
+
+static void test_lz() {
+    // 縮まない入力もLZ_BOUNDに収まる
+    const size_t sizes[] = {1, 3, 4, 15, 16, 270, 271, 4096, 65535};
+    for (size_t n : sizes) {
+        lz_round_trip(random_bytes(n, n));
+    }
+
+    // 長さが15と255をまたぐリテラルと一致
+    std::vector<uint8_t> in = random_bytes(300, 1);
+    std::vector<uint8_t> run(1000, 0xAA);
+    in.insert(in.end(), run.begin(), run.end());
+    std::vector<uint8_t> tail = random_bytes(20, 2);
+    in.insert(in.end(), tail.begin(), tail.end());
+    in.insert(in.end(), in.begin(), in.begin() + 290);
+    CHECK(lz_round_trip(in) < in.size() / 2);
+
+    // 入り切らなければ0
+    std::vector<uint8_t> small(16);
+    CHECK(lz_compress(in.data(), in.size(), small.data(), small.size(),
+                      table) == 0);
+    std::vector<uint8_t> big(65536);
+    CHECK(lz_compress(big.data(), big.size(), in.data(), in.size(), table) ==
+          0);
+}
+
+// 壊れた入力でも出力の外には書かず、書いた所は元の先頭と一致する
+static void test_lz_broken() {
+    std::vector<uint8_t> in = random_bytes(200, 3);
+    in.insert(in.end(), in.begin(), in.begin() + 150);
+    std::vector<uint8_t> packed(LZ_BOUND(in.size()));
+    size_t n = lz_compress(in.data(), in.size(), packed.data(), packed.size(),
+                           table);
+    CHECK(n != 0);
+
+    std::vector<uint8_t> out(in.size() + 16, 0x5A);
+    for (size_t len = 0; len < n; len++) {
+        size_t m = lz_decompress(packed.data(), len, out.data(), in.size());
+        CHECK(m <= in.size());
+        CHECK(memcmp(out.data(), in.data(), m) == 0);
+        CHECK(out[in.size()] == 0x5A);
+    }
+    // 出力が足りなければ0
+    CHECK(lz_decompress(packed.data(), n, out.data(), in.size() - 1) == 0);
+
+    // 戻した所より前を指すオフセット
+    const uint8_t bad[] = {0x10, 'a', 0x05, 0x00};
+    CHECK(lz_decompress(bad, sizeof(bad), out.data(), out.size()) == 0);
+    const uint8_t zero[] = {0x10, 'a', 0x00, 0x00};
+    CHECK(lz_decompress(zero, sizeof(zero), out.data(), out.size()) == 0);
+}
+
+// トピックごとに形の同じ本体が続くレコードの列
+static std::vector<uint8_t> sample_records(size_t count) {
+    std::vector<uint8_t> records;
+    for (size_t i = 0; i < count; i++) {
+        std::vector<uint8_t> rec;
+        if (i % 3 == 2) {
+            // 途中で項目の数と型が変わる
+            MsgPack<256> msgpack("ecu", i % 2 ? 3 : 2);
+            msgpack.addTime(1000 + i * 997);
+            msgpack.add("rpm", (int64_t)(i * 37) - 200);
+            msgpack.add("tps", 0.25 * i);
+            if (i % 2) {
+                msgpack.add("iap", UINT64_MAX - i);
+            }
+            uint8_t* buf = msgpack.getBuf();
+            CHECK(buf != nullptr);
+            rec.assign(buf, buf + msgpack.getSize());
+        } else {
+            MsgPack<256, encoding::Float32> msgpack("stroke/front", 3);
+            msgpack.addTime(1000 + i * 1003);
+            msgpack.add("left", 0.001 * i);
+            msgpack.add("right", -0.003 * i);
+            msgpack.add<encoding::Scaled<int16_t, -3>>("c", 0.1 * i);
+            uint8_t* buf = msgpack.getBuf();
+            CHECK(buf != nullptr);
+            rec.assign(buf, buf + msgpack.getSize());
+        }
+        records.insert(records.end(), rec.begin(), rec.end());
+    }
+    return records;
+}
+
+static size_t logpack_round_trip(const std::vector<uint8_t>& records) {
+    uint8_t chunk[LOGPACK_BOUND];
+    size_t n = logpack_encode(&work, records.data(), records.size(), chunk,
+                              sizeof(chunk));
+    CHECK(n != 0 && n <= 1 + records.size());
+
+    std::vector<uint8_t> out(LOGPACK_CHUNK_SIZE);
+    CHECK(logpack_decode(&work, chunk, n, out.data(), out.size()) ==
+          records.size());
+    CHECK(memcmp(out.data(), records.data(), records.size()) == 0);
+    return n;
+}
+
+static void test_logpack() {
+    std::vector<uint8_t> records = sample_records(40);
+    CHECK(records.size() <= LOGPACK_CHUNK_SIZE);
+    CHECK(logpack_round_trip(records) < records.size() / 2);
+
+    // seqが飛んでも戻せる
+    std::vector<uint8_t> skipped = sample_records(10);
+    frame_next_seq(topic_from_name("ecu", 3));
+    std::vector<uint8_t> more = sample_records(10);
+    skipped.insert(skipped.end(), more.begin(), more.end());
+    logpack_round_trip(skipped);
+
+    // 縮まなければそのまま入れる
+    MsgPack<512> msgpack("ecu", 1);
+    msgpack.addTime(1000);
+    std::vector<uint8_t> noise = random_bytes(400, 4);
+    msgpack.addBin("b", noise.data(), noise.size());
+    uint8_t* buf = msgpack.getBuf();
+    CHECK(buf != nullptr);
+    std::vector<uint8_t> rec(buf, buf + msgpack.getSize());
+    uint8_t chunk[LOGPACK_BOUND];
+    CHECK(logpack_encode(&work, rec.data(), rec.size(), chunk,
+                         sizeof(chunk)) == 1 + rec.size());
+    CHECK(chunk[0] == LOGPACK_METHOD_STORED);
+    logpack_round_trip(rec);
+}
+
+static void test_logpack_broken() {
+    std::vector<uint8_t> records = sample_records(30);
+    uint8_t chunk[LOGPACK_BOUND];
+
+    // レコードの途中で切れている、大きすぎる
+    CHECK(logpack_encode(&work, records.data(), records.size() - 1, chunk,
+                         sizeof(chunk)) == 0);
+    CHECK(logpack_encode(&work, records.data(), 0, chunk, sizeof(chunk)) ==
+          0);
+    std::vector<uint8_t> big(LOGPACK_CHUNK_SIZE + 1);
+    CHECK(logpack_encode(&work, big.data(), big.size(), chunk,
+                         sizeof(chunk)) == 0);
+
+    size_t n = logpack_encode(&work, records.data(), records.size(), chunk,
+                              sizeof(chunk));
+    CHECK(n != 0 && chunk[0] == LOGPACK_METHOD_LZ);
+
+    // 切れたり1byte化けたりしたチャンクでも出力の外には書かない
+    std::vector<uint8_t> out(LOGPACK_CHUNK_SIZE + 16, 0x5A);
+    for (size_t len = 0; len < n; len++) {
+        size_t m = logpack_decode(&work, chunk, len, out.data(),
+                                  LOGPACK_CHUNK_SIZE);
+        CHECK(m <= LOGPACK_CHUNK_SIZE);
+    }
+    for (size_t i = 1; i < n; i++) {
+        uint8_t saved = chunk[i];
+        chunk[i] ^= 0x41;
+        size_t m = logpack_decode(&work, chunk, n, out.data(),
+                                  LOGPACK_CHUNK_SIZE);
+        CHECK(m <= LOGPACK_CHUNK_SIZE);
+        chunk[i] = saved;
+    }
+    CHECK(out[LOGPACK_CHUNK_SIZE] == 0x5A);
+
+    chunk[0] = 2;
+    CHECK(logpack_decode(&work, chunk, n, out.data(), out.size()) == 0);
+}
+
+// ブロックを通し番号の順に読み、CRCの合わないチャンクで止める
+static void test_flash_log_decoder() {
+    std::vector<uint8_t> image(FLASH_LOG_SIZE, 0xFF);
+    std::vector<uint8_t> first = sample_records(20);
+    std::vector<uint8_t> second = sample_records(20);
+
+    auto put_block = [&](uint32_t block, uint32_t seq,
+                         const std::vector<uint8_t>& records, bool torn) {
+        uint8_t* p = &image[block * FLASH_LOG_BLOCK_SIZE];
+        for (int i = 0; i < 4; i++) {
+            p[i] = (FLASH_LOG_MAGIC >> (8 * i)) & 0xFF;
+            p[4 + i] = (seq >> (8 * i)) & 0xFF;
+        }
+        uint8_t chunk[LOGPACK_BOUND];
+        size_t n = logpack_encode(&work, records.data(), records.size(),
+                                  chunk, sizeof(chunk));
+        CHECK(n != 0);
+        uint32_t pos = FLASH_LOG_BLOCK_HEADER_SIZE;
+        for (int k = 0; k < 2; k++) {
+            uint16_t crc = crc16(chunk, n);
+            p[pos] = n >> 8;
+            p[pos + 1] = n & 0xFF;
+            p[pos + 2] = crc >> 8;
+            p[pos + 3] = crc & 0xFF;
+            memcpy(&p[pos + 4], chunk, n);
+            if (torn && k == 1) {
+                p[pos + 4 + n / 2] ^= 0xFF;
+            }
+            pos += 4 + n;
+        }
+    };
+    put_block(9, 41, second, true);
+    put_block(2, 40, first, false);
+
+    FlashLogDecoder decoder;
+    CHECK(!decoder.decode(image.data(), image.size() - 1));
+    CHECK(decoder.decode(image.data(), image.size()));
+    CHECK(decoder.bad_chunks == 0);
+
+    std::vector<uint8_t> joined;
+    for (auto& rec : decoder.records) {
+        joined.insert(joined.end(), rec.begin(), rec.end());
+    }
+    std::vector<uint8_t> expected = first;
+    expected.insert(expected.end(), first.begin(), first.end());
+    expected.insert(expected.end(), second.begin(), second.end());
+    CHECK(joined == expected);
+}
+
+// 引数にanalyze/dataの記録を渡すと、チャンクにして全て戻るかを確かめる
+int main(int argc, char** argv) {
+    test_lz();
+    test_lz_broken();
+    test_logpack();
+    test_logpack_broken();
+    test_flash_log_decoder();
+
+    uint64_t raw = 0;
+    uint64_t stored = 0;
+    for (int i = 1; i < argc; i++) {
+        for (auto& records : capture_chunks(argv[i])) {
+            raw += records.size();
+            stored += logpack_round_trip(records);
+        }
+    }
+    if (raw != 0) {
+        printf("  %llu -> %llu B (%.1f%%)\n", (unsigned long long)raw,
+               (unsigned long long)stored, 100.0 * stored / raw);
+    }
+    printf("logpack: ok\n");
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "check.h"
+#include "frame.h"
+#include "meter_link.h"
+#include "outbox.h"
+#include "topic.h"
+
+#define STRESS_UPDATES (1000000)
+
+// rear.cppのmsg_publish_meterと同じ形で積む
+static void publish(outbox_t* ob, uint16_t rpm, uint16_t gp_mv, uint64_t us) {
+    uint8_t buf[FRAME_HEADER_SIZE + METER_LINK_RECORD_SIZE];
+    frame_header_write(buf, 0, topic_meter, frame_next_seq(topic_meter), us);
+    meter_link_pack(&buf[FRAME_HEADER_SIZE], rpm, gp_mv);
+    CHECK(outbox_push(ob, 0, topic_meter, buf, sizeof(buf)));
+}
+
+static void test_pack(void) {
+    uint8_t body[METER_LINK_RECORD_SIZE];
+    meter_link_pack(body, 0x1234, 0xABCD);
+    CHECK(body[0] == 0x34 && body[1] == 0x12);
+    CHECK(body[2] == 0xCD && body[3] == 0xAB);
+
+    meter_value_t v;
+    CHECK(meter_link_unpack(body, sizeof(body), &v));
+    CHECK(v.rpm == 0x1234 && v.gp_mv == 0xABCD);
+    CHECK(!meter_link_unpack(body, sizeof(body) - 1, &v));
+    CHECK(!meter_link_unpack(body, sizeof(body) + 1, &v));
+}
+
+// リアで積んだものがバスに出るまでに何度更新されても最新の一つだけが届き、
+// フロントでスロットを通して取り出せる
+static void test_latest_only(void) {
+    static outbox_t ob;
+    CHECK(outbox_init(&ob));
+    for (uint16_t i = 0; i < 10; i++) {
+        publish(&ob, 1000 + i, 2000 + i, 5000 + i);
+    }
+
+    uint8_t rec[64];
+    uint16_t len = outbox_pop(&ob, rec, sizeof(rec));
+    CHECK(len == FRAME_HEADER_SIZE + METER_LINK_RECORD_SIZE);
+    CHECK(outbox_pop(&ob, rec, sizeof(rec)) == 0);
+
+    frame_header_t header;
+    CHECK(frame_header_read(rec, len, &header));
+    CHECK(header.topic == topic_meter && header.timestamp_us == 5009);
+
+    meter_link_t link;
+    meter_link_init(&link);
+    meter_value_t v;
+    CHECK(!meter_link_take(&link, &v));
+    CHECK(meter_link_unpack(&rec[FRAME_HEADER_SIZE], len - FRAME_HEADER_SIZE,
+                            &v));
+    v.input_us = header.timestamp_us;
+    meter_link_put(&link, &v);
+
+    meter_value_t shown;
+    CHECK(meter_link_take(&link, &shown));
+    CHECK(shown.rpm == 1009 && shown.gp_mv == 2009);
+    CHECK(!meter_link_take(&link, &shown));
+}
+
+static void test_stats(void) {
+    meter_link_t link;
+    meter_link_init(&link);
+    meter_value_t v = {3000, 1500, 1000};
+    meter_link_mark_shown(&link, &v, 1200);
+    meter_link_mark_shown(&link, &v, 1600);
+    // 時計が合う前の値と、時計が戻ったものは時間に数えない
+    v.input_us = 0;
+    meter_link_mark_shown(&link, &v, 2000);
+    v.input_us = 5000;
+    meter_link_mark_shown(&link, &v, 4000);
+
+    meter_link_stats_t stats;
+    meter_link_take_stats(&link, &stats);
+    CHECK(stats.updates == 4);
+    CHECK(stats.lat_avg_us == 400);
+    CHECK(stats.lat_max_us == 600);
+
+    meter_link_take_stats(&link, &stats);
+    CHECK(stats.updates == 0 && stats.lat_avg_us == 0);
+}
+
+static meter_link_t stress_link;
+static volatile bool stress_done;
+
+// rpmとgpを組にして書き、読む側で崩れていないかを見る
+static void* stress_writer(void* arg) {
+    (void)arg;
+    for (uint32_t i = 1; i <= STRESS_UPDATES; i++) {
+        meter_value_t v = {(uint16_t)i, (uint16_t)(i ^ 0x5A5A), i};
+        meter_link_put(&stress_link, &v);
+    }
+    __atomic_store_n(&stress_done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void test_stress(void) {
+    meter_link_init(&stress_link);
+    pthread_t writer;
+    CHECK(pthread_create(&writer, NULL, stress_writer, NULL) == 0);
+
+    uint64_t last = 0;
+    uint32_t taken = 0;
+    meter_value_t v;
+    while (!__atomic_load_n(&stress_done, __ATOMIC_ACQUIRE)) {
+        if (meter_link_take(&stress_link, &v)) {
+            CHECK(v.rpm == (uint16_t)v.input_us);
+            CHECK(v.gp_mv == (uint16_t)(v.input_us ^ 0x5A5A));
+            CHECK(v.input_us > last);
+            last = v.input_us;
+            taken++;
+        }
+    }
+    CHECK(pthread_join(writer, NULL) == 0);
+
+    // 最後に置いた値は必ず取り出せる
+    if (meter_link_take(&stress_link, &v)) {
+        last = v.input_us;
+        taken++;
+    }
+    CHECK(last == STRESS_UPDATES);
+    CHECK(taken > 0);
+}
+
+int main(void) {
+    test_pack();
+    test_latest_only();
+    test_stats();
+    test_stress();
+    printf("meter_link: ok\n");
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+
+#include "check.h"
+#include "msgpack.hpp"
+
+// 書いたフレームを読み戻し、値が書き方ごとの精度に収まるかを確かめる
+
+struct reader_t {
+    const uint8_t* buf;
+    size_t size;
+    size_t pos;
+};
+
+static bool reader_read(cmp_ctx_t* ctx, void* data, size_t limit) {
+    reader_t* r = static_cast<reader_t*>(ctx->buf);
+    if (r->pos + limit > r->size) {
+        return false;
+    }
+    memcpy(data, &r->buf[r->pos], limit);
+    r->pos += limit;
+    return true;
+}
+
+static bool reader_skip(cmp_ctx_t* ctx, size_t count) {
+    reader_t* r = static_cast<reader_t*>(ctx->buf);
+    if (r->pos + count > r->size) {
+        return false;
+    }
+    r->pos += count;
+    return true;
+}
+
+// 値をそのままの型で持つ。extはホストと同じく 整数 * 10^Exp に戻す
+struct value_t {
+    cmp_object_t obj;
+    double scaled;
+};
+
+static int64_t as_int(const value_t& v) {
+    int64_t i;
+    CHECK(cmp_object_as_sinteger(&v.obj, &i));
+    return i;
+}
+
+static uint64_t as_uint(const value_t& v) {
+    uint64_t u;
+    CHECK(cmp_object_as_uinteger(&v.obj, &u));
+    return u;
+}
+
+static double as_double(const value_t& v) {
+    double d;
+    CHECK(cmp_object_as_double(&v.obj, &d));
+    return d;
+}
+
+template <int N, typename E>
+static std::map<std::string, value_t> decode(MsgPack<N, E>& msgpack) {
+    uint8_t* buf = msgpack.getBuf();
+    CHECK(buf != nullptr);
+    const size_t body = 4 + FRAME_HEADER_SIZE;
+    reader_t r = {buf + body, msgpack.getSize() - body, 0};
+    cmp_ctx_t ctx;
+    cmp_init(&ctx, &r, reader_read, reader_skip, nullptr);
+
+    char key[32];
+    uint32_t size;
+    CHECK(cmp_read_map(&ctx, &size) && size == 2);
+    CHECK(cmp_read_str(&ctx, key, &(size = sizeof(key))));
+    CHECK(strcmp(key, "topic") == 0);
+    CHECK(cmp_read_str(&ctx, key, &(size = sizeof(key))));
+    CHECK(cmp_read_str(&ctx, key, &(size = sizeof(key))));
+    CHECK(strcmp(key, "payload") == 0);
+
+    uint32_t count;
+    CHECK(cmp_read_map(&ctx, &count));
+    std::map<std::string, value_t> out;
+    for (uint32_t i = 0; i < count; i++) {
+        CHECK(cmp_read_str(&ctx, key, &(size = sizeof(key))));
+        value_t v = {};
+        CHECK(cmp_read_object(&ctx, &v.obj));
+        int8_t type;
+        uint32_t len;
+        if (cmp_object_as_ext(&v.obj, &type, &len)) {
+            uint8_t data[4];
+            CHECK(len == 2 || len == 4);
+            CHECK(reader_read(&ctx, data, len));
+            int64_t raw = 0;
+            for (uint32_t k = 0; k < len; k++) {
+                raw = raw << 8 | data[k];
+            }
+            // 符号を広げる
+            raw = len == 2 ? (int16_t)raw : (int32_t)raw;
+            int exp = encoding::EXT_SCALED - type;
+            v.scaled = raw * pow(10.0, exp);
+        }
+        out[key] = v;
+    }
+    CHECK(r.pos == r.size);
+    CHECK(out.count("us") == 0 || as_uint(out["us"]) == 1000);
+    return out;
+}
+
+// int32を超える整数もdoubleにせず整数のまま書く
+static void test_json_integers() {
+    MsgPack<256> msgpack(
+        R"({"topic": "ecu", "payload": {"small": 42, "neg": -7,)"
+        R"( "big": 5000000000, "nbig": -3000000000,)"
+        R"( "p53": 9007199254740992, "half": 1.5, "huge": 1e300,)"
+        R"( "ntiny": -0.25}})");
+    auto v = decode(msgpack);
+
+    CHECK(as_int(v["small"]) == 42);
+    CHECK(as_int(v["neg"]) == -7);
+    CHECK(as_int(v["big"]) == 5000000000LL);
+    CHECK(as_int(v["nbig"]) == -3000000000LL);
+    CHECK(as_uint(v["p53"]) == 9007199254740992ULL);
+    CHECK(as_double(v["half"]) == 1.5);
+    // int64に収まらない整数値はdoubleのまま
+    CHECK(cmp_object_is_double(&v["huge"].obj));
+    CHECK(as_double(v["huge"]) == 1e300);
+    CHECK(as_double(v["ntiny"]) == -0.25);
+}
+
+// 丸めの誤差は最下位の桁の半分まで、範囲外は飽和する
+static void test_scaled() {
+    const double values[] = {0.0, 1.2345, -1.2345, 9.9995, -32.0, 0.0004999};
+    for (double x : values) {
+        MsgPack<128> msgpack("ecu", 2);
+        msgpack.addTime(1000);
+        msgpack.add<encoding::Scaled<int16_t, -3>>("a", x);
+        msgpack.add<encoding::Scaled<int32_t, -6>>("b", x);
+        auto v = decode(msgpack);
+        CHECK(fabs(v["a"].scaled - x) <= 0.5e-3 + 1e-12);
+        CHECK(fabs(v["b"].scaled - x) <= 0.5e-6 + 1e-12);
+    }
+
+    MsgPack<128> msgpack("ecu", 2);
+    msgpack.addTime(1000);
+    msgpack.add<encoding::Scaled<int16_t, -3>>("hi", 100.0);
+    msgpack.add<encoding::Scaled<int16_t, -3>>("lo", -100.0);
+    auto v = decode(msgpack);
+    CHECK(v["hi"].scaled == INT16_MAX * 1e-3);
+    CHECK(v["lo"].scaled == INT16_MIN * 1e-3);
+}
+
+static void test_float32_raw() {
+    MsgPack<128> msgpack("ecu", 3);
+    msgpack.addTime(1000);
+    msgpack.add<encoding::Float32>("f", 3.14159265358979);
+    msgpack.add<encoding::Raw>("r", 4094.6);
+    msgpack.add<encoding::Raw>("n", -2.5);
+    auto v = decode(msgpack);
+
+    float f;
+    CHECK(cmp_object_as_float(&v["f"].obj, &f));
+    CHECK(fabs(f - 3.14159265358979) <= 3.14159265358979 * 0x1p-24);
+    CHECK(as_int(v["r"]) == 4095);
+    CHECK(as_int(v["n"]) == -3);
+}
+
+// JSONを変換する時の既定の書き方も選べる
+static void test_json_default() {
+    MsgPack<128, encoding::Scaled<int32_t, -3>> msgpack(
+        R"({"topic": "ecu", "payload": {"t": 25.0625, "n": 3}})");
+    auto v = decode(msgpack);
+    CHECK(fabs(v["t"].scaled - 25.0625) <= 0.5e-3);
+    CHECK(as_int(v["n"]) == 3);
+}
+
+int main() {
+    test_json_integers();
+    test_scaled();
+    test_float32_raw();
+    test_json_default();
+    printf("msgpack: ok\n");
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "check.h"
+#include "outbox.h"
+#include "topic.h"
+
+static outbox_t ob;
+
+// 先頭の1byteにトピックを入れ、残りを長さから決まる値で埋める
+static void push(uint8_t topic, uint16_t len) {
+    uint8_t buf[OUTBOX_RECORD_SIZE];
+    buf[0] = topic;
+    memset(&buf[1], (uint8_t)len, len - 1);
+    CHECK(outbox_push(&ob, 0, topic, buf, len));
+}
+
+static void check_record(const uint8_t* buf, uint16_t len, uint8_t topic) {
+    CHECK(buf[0] == topic);
+    for (uint16_t i = 1; i < len; i++) {
+        CHECK(buf[i] == (uint8_t)len);
+    }
+}
+
+static void test_priority(void) {
+    outbox_init(&ob);
+    push(topic_core1_front, 10);
+    push(topic_stroke_front, 20);
+    push(topic_rpm, 30);
+
+    uint8_t buf[OUTBOX_RECORD_SIZE];
+    CHECK(outbox_pop(&ob, buf, sizeof(buf)) == 30);
+    check_record(buf, 30, topic_rpm);
+    CHECK(outbox_pop(&ob, buf, sizeof(buf)) == 20);
+    CHECK(outbox_pop(&ob, buf, sizeof(buf)) == 10);
+    CHECK(outbox_pop(&ob, buf, sizeof(buf)) == 0);
+}
+
+// 収まらない先頭は残し、後から届いた優先度の高いものは切り詰めずに返す
+static void test_pop_fit(void) {
+    outbox_init(&ob);
+    push(topic_stroke_front, 100);
+
+    uint8_t buf[OUTBOX_RECORD_SIZE];
+    CHECK(outbox_pop_fit(&ob, buf, 50) == 0);
+
+    push(topic_ecu, 40);
+    CHECK(outbox_pop_fit(&ob, buf, 50) == 40);
+    check_record(buf, 40, topic_ecu);
+
+    push(topic_rpm, 60);
+    CHECK(outbox_pop_fit(&ob, buf, 50) == 0);
+    CHECK(outbox_pop_fit(&ob, buf, 60) == 60);
+    check_record(buf, 60, topic_rpm);
+
+    CHECK(outbox_pop_fit(&ob, buf, 100) == 100);
+    check_record(buf, 100, topic_stroke_front);
+    CHECK(outbox_pop_fit(&ob, buf, sizeof(buf)) == 0);
+}
+
+// 最新の一つだけ残すトピックは上書きした数を捨てた数に数える
+static void test_coalesce(void) {
+    outbox_init(&ob);
+    push(topic_rpm, 10);
+    push(topic_rpm, 11);
+    push(topic_ecu, 12);
+
+    uint8_t buf[OUTBOX_RECORD_SIZE];
+    uint16_t a = outbox_pop(&ob, buf, sizeof(buf));
+    uint16_t b = outbox_pop(&ob, buf, sizeof(buf));
+    CHECK(a + b == 11 + 12);
+    CHECK(outbox_pop(&ob, buf, sizeof(buf)) == 0);
+    CHECK(outbox_get_drops(&ob, topic_rpm) == 1);
+}
+
+// 溢れたら通常のトピックは古いものから、診断情報は新しいものを捨てる
+static void test_drop_policy(void) {
+    outbox_init(&ob);
+    uint8_t buf[OUTBOX_RECORD_SIZE];
+    for (uint16_t i = 0; i < 40; i++) {
+        push(topic_stroke_front, 100);
+        push(topic_core1_front, 100);
+        // 何も取り出さず、ingressからレーンへ移すだけ
+        CHECK(outbox_pop_fit(&ob, buf, 0) == 0);
+    }
+    CHECK(outbox_get_drops(&ob, topic_stroke_front) > 0);
+    CHECK(outbox_get_drops(&ob, topic_core1_front) > 0);
+
+    uint16_t normal = 0;
+    uint16_t len;
+    while ((len = outbox_pop(&ob, buf, sizeof(buf))) != 0) {
+        if (buf[0] == topic_stroke_front) {
+            normal++;
+        }
+    }
+    CHECK(normal + outbox_get_drops(&ob, topic_stroke_front) == 40);
+}
+
+// 履歴は今のフレームを押しのけず、他に何も無い時だけ出てくる
+static void test_replay(void) {
+    outbox_init(&ob);
+    uint8_t buf[OUTBOX_RECORD_SIZE];
+    CHECK(outbox_replay_room(&ob, 0) > 0);
+
+    push(topic_stroke_front, 100);
+    // ingressに残っている間は積ませない
+    CHECK(outbox_replay_room(&ob, 0) == 0);
+    CHECK(outbox_pop_fit(&ob, buf, 0) == 0);
+
+    uint16_t pushed = 0;
+    while (outbox_replay_room(&ob, 0) >= 200 + RING_BUF_HEADER_SIZE + 1) {
+        push(topic_replay, 200);
+        CHECK(outbox_pop_fit(&ob, buf, 0) == 0);
+        pushed++;
+    }
+    CHECK(pushed > 0);
+    CHECK(outbox_get_drops(&ob, topic_replay) == 0);
+
+    push(topic_stroke_front, 100);
+    CHECK(outbox_pop(&ob, buf, sizeof(buf)) == 100);
+    CHECK(outbox_pop(&ob, buf, sizeof(buf)) == 100);
+    CHECK(buf[0] == topic_stroke_front);
+    for (uint16_t i = 0; i < pushed; i++) {
+        CHECK(outbox_pop(&ob, buf, sizeof(buf)) == 200);
+        check_record(buf, 200, topic_replay);
+    }
+    CHECK(outbox_pop(&ob, buf, sizeof(buf)) == 0);
+    CHECK(outbox_get_drops(&ob, topic_stroke_front) == 0);
+}
+
+int main(void) {
+    test_priority();
+    test_pop_fit();
+    test_coalesce();
+    test_drop_policy();
+    test_replay();
+    printf("outbox: ok\n");
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "check.h"
+#include "ring_buf.h"
+
+#define STRESS_RECORDS (1000000)
+#define STRESS_MAX_LEN (300)
+
+static void test_init(void) {
+    static uint8_t storage[64];
+    ring_buf_t rb;
+    CHECK(!ring_buf_init(&rb, storage, 48));
+    CHECK(!ring_buf_init(&rb, storage, 2));
+    CHECK(ring_buf_init(&rb, storage, 64));
+    CHECK(ring_buf_is_empty(&rb));
+    CHECK(ring_buf_free(&rb) == 64);
+    CHECK(ring_buf_peek_len(&rb) == 0);
+}
+
+static void test_push_pop(void) {
+    static uint8_t storage[64];
+    ring_buf_t rb;
+    ring_buf_init(&rb, storage, 64);
+
+    const uint8_t a[] = {1, 2, 3};
+    const uint8_t b[] = {4, 5, 6, 7, 8};
+    CHECK(ring_buf_push(&rb, a, sizeof(a)));
+    CHECK(ring_buf_push(&rb, b, sizeof(b)));
+    CHECK(!ring_buf_push(&rb, a, 0));
+    CHECK(ring_buf_used(&rb) == 2 * RING_BUF_HEADER_SIZE + 8);
+
+    uint8_t out[16];
+    CHECK(ring_buf_peek_len(&rb) == 3);
+    CHECK(ring_buf_pop(&rb, out, sizeof(out)) == 3);
+    CHECK(memcmp(out, a, 3) == 0);
+
+    // 入り切らない分は捨てて、次のレコードはそのまま読める
+    CHECK(ring_buf_pop(&rb, out, 2) == 2);
+    CHECK(out[0] == 4 && out[1] == 5);
+    CHECK(ring_buf_is_empty(&rb));
+    CHECK(ring_buf_pop(&rb, out, sizeof(out)) == 0);
+}
+
+static void test_full(void) {
+    static uint8_t storage[32];
+    ring_buf_t rb;
+    ring_buf_init(&rb, storage, 32);
+
+    uint8_t data[14] = {0};
+    CHECK(ring_buf_push(&rb, data, sizeof(data)));
+    CHECK(ring_buf_push(&rb, data, sizeof(data)));
+    CHECK(ring_buf_free(&rb) == 0);
+    CHECK(!ring_buf_push(&rb, data, 1));
+
+    CHECK(ring_buf_discard(&rb));
+    CHECK(ring_buf_push(&rb, data, 1));
+    CHECK(!ring_buf_push(&rb, data, 14));
+}
+
+// 格納領域の端をまたぐレコードも崩れない
+static void test_wrap(void) {
+    static uint8_t storage[32];
+    ring_buf_t rb;
+    ring_buf_init(&rb, storage, 32);
+
+    uint8_t in[20];
+    uint8_t out[20];
+    for (uint32_t round = 0; round < 100; round++) {
+        uint16_t len = 1 + round % 20;
+        for (uint16_t i = 0; i < len; i++) {
+            in[i] = (uint8_t)(round + i);
+        }
+        CHECK(ring_buf_push(&rb, in, len));
+        CHECK(ring_buf_pop(&rb, out, sizeof(out)) == len);
+        CHECK(memcmp(in, out, len) == 0);
+    }
+}
+
+static void test_push2(void) {
+    static uint8_t storage[32];
+    ring_buf_t rb;
+    ring_buf_init(&rb, storage, 32);
+
+    const uint8_t head[] = {0xAA, 0xBB};
+    const uint8_t body[] = {1, 2, 3};
+    CHECK(ring_buf_push2(&rb, head, sizeof(head), body, sizeof(body)));
+    CHECK(ring_buf_push2(&rb, head, sizeof(head), NULL, 0));
+
+    uint8_t out[8];
+    CHECK(ring_buf_pop(&rb, out, sizeof(out)) == 5);
+    CHECK(out[0] == 0xAA && out[1] == 0xBB && out[4] == 3);
+    CHECK(ring_buf_pop(&rb, out, sizeof(out)) == 2);
+}
+
+// レコードの長さと中身は番号から決まるので、読む側だけで確かめられる
+static uint16_t stress_len(uint32_t i) {
+    return 4 + (i * 7919) % (STRESS_MAX_LEN - 4);
+}
+
+static ring_buf_t stress_rb;
+static uint8_t stress_storage[1024];
+
+static void* stress_producer(void* arg) {
+    (void)arg;
+    uint8_t buf[STRESS_MAX_LEN];
+    for (uint32_t i = 0; i < STRESS_RECORDS; i++) {
+        uint16_t len = stress_len(i);
+        memcpy(buf, &i, sizeof(i));
+        memset(&buf[sizeof(i)], (uint8_t)i, len - sizeof(i));
+        while (!ring_buf_push(&stress_rb, buf, len)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// 別のスレッドから積み、取りこぼしや混ざりが無いかを見る
+static void test_stress(void) {
+    ring_buf_init(&stress_rb, stress_storage, sizeof(stress_storage));
+
+    pthread_t producer;
+    CHECK(pthread_create(&producer, NULL, stress_producer, NULL) == 0);
+
+    uint8_t buf[STRESS_MAX_LEN];
+    for (uint32_t i = 0; i < STRESS_RECORDS;) {
+        uint16_t len = ring_buf_pop(&stress_rb, buf, sizeof(buf));
+        if (len == 0) {
+            sched_yield();
+            continue;
+        }
+        CHECK(len == stress_len(i));
+        uint32_t seq;
+        memcpy(&seq, buf, sizeof(seq));
+        CHECK(seq == i);
+        for (uint16_t k = sizeof(seq); k < len; k++) {
+            CHECK(buf[k] == (uint8_t)i);
+        }
+        i++;
+    }
+
+    pthread_join(producer, NULL);
+    CHECK(ring_buf_is_empty(&stress_rb));
+}
+
+int main(void) {
+    test_init();
+    test_push_pop();
+    test_full();
+    test_wrap();
+    test_push2();
+    test_stress();
+    printf("ring_buf: ok\n");
+    return 0;
+}
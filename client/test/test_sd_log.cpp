@@ -0,0 +1,406 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "sd_card.h"
+#include "sd_log.h"
+
+// sd_cardの代わりにメモリ上のブロックデバイスにつなぎ、
+// FAT32のイメージを作って起動を繰り返す
+
+#define BLOCK SD_CARD_BLOCK_SIZE
+#define CLUSTER_BLOCKS (64)
+#define FILE_CLUSTERS (SD_LOG_FILE_SIZE / (CLUSTER_BLOCKS * BLOCK))
+#define RESERVED (32)
+#define ROOT_CLUSTER (2)
+
+// 書いたブロックだけを持ち、他は0を返す
+struct disk_t {
+    std::map<uint32_t, std::array<uint8_t, BLOCK>> blocks;
+    uint32_t total = 0;
+    uint32_t part = 0;  // パーティションの先頭
+    uint32_t fat_size = 0;
+
+    uint8_t* at(uint32_t lba) {
+        auto it = blocks.find(lba);
+        if (it == blocks.end()) {
+            it = blocks.emplace(lba, std::array<uint8_t, BLOCK>{}).first;
+        }
+        return it->second.data();
+    }
+    uint32_t fat_lba() const {
+        return part + RESERVED;
+    }
+    uint32_t data_lba() const {
+        return fat_lba() + 2 * fat_size;
+    }
+    uint32_t cluster_lba(uint32_t cluster) const {
+        return data_lba() + (cluster - 2) * CLUSTER_BLOCKS;
+    }
+};
+
+static disk_t disk;
+static uint32_t io_blocks;  // 読み書きしたブロック数
+static uint32_t io_writes;  // 始めた書き込みの数
+
+// 受け付けた書き込みは、sd_card_taskをBUSY_TASKS回呼ぶまで終わらない
+// DMAが送り終えるまでbufを読むので、書き換えられていればそれが残る
+#define BUSY_TASKS (3)
+
+struct write_t {
+    uint32_t lba;
+    const uint8_t* buf;
+    uint32_t count;
+    uint32_t tasks;  // 終わるまでに呼ばれる残りの回数
+};
+
+static write_t writing;
+
+extern "C" {
+
+bool sd_card_read(sd_card_dev_t* dev, uint32_t lba, uint8_t* buf) {
+    // busyの間はカードに触れない
+    CHECK(!sd_card_is_busy(dev));
+    io_blocks++;
+    if (lba >= disk.total) {
+        return false;
+    }
+    memcpy(buf, disk.at(lba), BLOCK);
+    return true;
+}
+
+bool sd_card_write_start(sd_card_dev_t* dev, uint32_t lba, const uint8_t* buf,
+                         uint32_t count) {
+    if (sd_card_is_busy(dev) || lba + count > disk.total) {
+        return false;
+    }
+    io_blocks += count;
+    io_writes++;
+    writing = {lba, buf, count, BUSY_TASKS};
+    return true;
+}
+
+void sd_card_task(sd_card_dev_t*) {
+    if (writing.tasks == 0 || --writing.tasks != 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < writing.count; i++) {
+        memcpy(disk.at(writing.lba + i), &writing.buf[i * BLOCK], BLOCK);
+    }
+}
+
+bool sd_card_is_busy(const sd_card_dev_t*) {
+    return writing.tasks != 0;
+}
+
+bool sd_card_has_error(const sd_card_dev_t*) {
+    return false;
+}
+
+// 書き込みの時間の集計にしか使わないので進めない
+uint32_t time_us_32() {
+    return 0;
+}
+
+}  // extern "C"
+
+static uint32_t get_le32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_le16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t* p, uint32_t v) {
+    put_le16(p, v & 0xFFFF);
+    put_le16(&p[2], v >> 16);
+}
+
+static uint32_t fat_entry(uint32_t cluster) {
+    const uint8_t* sec = disk.at(disk.fat_lba() + cluster / 128);
+    return get_le32(&sec[cluster % 128 * 4]);
+}
+
+// 二つのFATの両方に書く
+static void set_fat_entry(uint32_t cluster, uint32_t value) {
+    for (uint32_t k = 0; k < 2; k++) {
+        uint32_t lba = disk.fat_lba() + k * disk.fat_size + cluster / 128;
+        put_le32(&disk.at(lba)[cluster % 128 * 4], value);
+    }
+}
+
+// clusters個のデータ領域を持つFAT32。partなら前にMBRを置く
+static void format(uint32_t clusters, bool part) {
+    disk = disk_t();
+    writing = {};
+    disk.part = part ? 2048 : 0;
+    disk.fat_size = ((clusters + 2) * 4 + BLOCK - 1) / BLOCK;
+    uint32_t size = RESERVED + 2 * disk.fat_size + clusters * CLUSTER_BLOCKS;
+    disk.total = disk.part + size;
+
+    if (part) {
+        uint8_t* mbr = disk.at(0);
+        mbr[0x1BE + 4] = 0x0C;
+        put_le32(&mbr[0x1BE + 8], disk.part);
+        put_le32(&mbr[0x1BE + 12], size);
+        put_le16(&mbr[510], 0xAA55);
+    }
+
+    uint8_t* bs = disk.at(disk.part);
+    put_le16(&bs[11], BLOCK);
+    bs[13] = CLUSTER_BLOCKS;
+    put_le16(&bs[14], RESERVED);
+    bs[16] = 2;
+    put_le32(&bs[32], size);
+    put_le32(&bs[36], disk.fat_size);
+    put_le32(&bs[44], ROOT_CLUSTER);
+    put_le16(&bs[48], 1);
+    memcpy(&bs[82], "FAT32   ", 8);
+    put_le16(&bs[510], 0xAA55);
+
+    uint8_t* fsinfo = disk.at(disk.part + 1);
+    put_le32(&fsinfo[0], 0x41615252);
+    put_le32(&fsinfo[484], 0x61417272);
+    put_le32(&fsinfo[488], clusters - 1);
+    put_le32(&fsinfo[492], 3);
+
+    set_fat_entry(0, 0x0FFFFFF8);
+    set_fat_entry(1, 0x0FFFFFFF);
+    set_fat_entry(ROOT_CLUSTER, 0x0FFFFFFF);
+}
+
+struct entry_t {
+    std::string name;
+    uint32_t first;
+    uint32_t size;
+};
+
+// ルートディレクトリ (1クラスタ) のファイル
+static std::vector<entry_t> list_dir() {
+    std::vector<entry_t> out;
+    for (uint32_t b = 0; b < CLUSTER_BLOCKS; b++) {
+        const uint8_t* sec = disk.at(disk.cluster_lba(ROOT_CLUSTER) + b);
+        for (uint32_t off = 0; off < BLOCK; off += 32) {
+            const uint8_t* e = &sec[off];
+            if (e[0] == 0x00) {
+                return out;
+            }
+            if (e[0] == 0xE5) {
+                continue;
+            }
+            uint32_t first = (e[20] | e[21] << 8) << 16 | e[26] | e[27] << 8;
+            out.push_back({std::string((const char*)e, 11), first,
+                           get_le32(&e[28])});
+        }
+    }
+    return out;
+}
+
+// ルートディレクトリにファイルを置き、clusters個のチェーンを作る
+static void add_file(const char* name83, uint32_t first, uint32_t clusters,
+                     uint32_t size) {
+    size_t n = list_dir().size();
+    uint8_t* sec = disk.at(disk.cluster_lba(ROOT_CLUSTER) + n / 16);
+    uint8_t* e = &sec[n % 16 * 32];
+    memcpy(e, name83, 11);
+    e[11] = 0x20;
+    put_le16(&e[20], first >> 16);
+    put_le16(&e[26], first & 0xFFFF);
+    put_le32(&e[28], size);
+    for (uint32_t i = 0; i < clusters; i++) {
+        uint32_t next = i + 1 == clusters ? 0x0FFFFFFF : first + i + 1;
+        set_fat_entry(first + i, next);
+    }
+}
+
+static uint32_t used_clusters() {
+    uint32_t used = 0;
+    uint32_t clusters = (disk.total - disk.data_lba()) / CLUSTER_BLOCKS;
+    for (uint32_t c = 2; c < clusters + 2; c++) {
+        used += (fat_entry(c) & 0x0FFFFFFF) != 0;
+    }
+    return used;
+}
+
+// sd_logが書く "000     BIN" の形
+static std::string name_of(uint32_t number) {
+    char name[12];
+    snprintf(name, sizeof(name), "%03u", number);
+    std::string s(name);
+    s.resize(8, ' ');
+    return s + "BIN";
+}
+
+static sd_card_dev_t card;
+static sd_log_t sd;
+
+// 一回に読むのはSD_LOG_INIT_BLOCKSとFATの一ブロック、書くのは一ブロックまで
+// 終わるまでは積めない
+static bool init_log(uint32_t* steps = nullptr) {
+    sd_log_init_start(&sd, &card);
+    const uint8_t frame[] = {0x00, 0x00, 0x00, 0x00};
+    for (uint32_t n = 1;; n++) {
+        CHECK(!sd_log_append(&sd, frame, sizeof(frame)));
+        io_blocks = 0;
+        io_writes = 0;
+        sd_log_init_result_t result = sd_log_init_step(&sd);
+        CHECK(io_blocks <= SD_LOG_INIT_BLOCKS + 1);
+        CHECK(io_writes <= 1);
+        // 書き終える前に有効にすると、ファイルの書き込みを受け付けられない
+        CHECK(result != sd_log_init_done || !sd_card_is_busy(&card));
+        if (result != sd_log_init_pending) {
+            CHECK(sd_log_is_enabled(&sd) == (result == sd_log_init_done));
+            if (steps != nullptr) {
+                *steps = n;
+            }
+            return result == sd_log_init_done;
+        }
+    }
+}
+
+// 書いたフレームがファイルの先頭の単位として読める
+static void check_write() {
+    const uint8_t frame[] = {0x00, 0x03, 0x12, 0x34, 'a', 'b', 'c'};
+    CHECK(sd_log_append(&sd, frame, sizeof(frame)));
+    sd_log_task(&sd, 0);
+    sd_log_task(&sd, SD_LOG_FLUSH_US);
+    while (sd_card_is_busy(&card)) {
+        sd_log_task(&sd, SD_LOG_FLUSH_US);
+    }
+
+    entry_t file;
+    for (auto& e : list_dir()) {
+        if (e.name == name_of(sd.number)) {
+            file = e;
+        }
+    }
+    CHECK(!file.name.empty());
+    const uint8_t* unit = disk.at(disk.cluster_lba(file.first));
+    CHECK(get_le32(&unit[0]) == SD_LOG_MAGIC);
+    CHECK(get_le32(&unit[4]) == sd.nonce);
+    CHECK(get_le32(&unit[8]) == sizeof(frame));
+    CHECK(memcmp(&unit[12], frame, sizeof(frame)) == 0);
+    CHECK(unit[12 + sizeof(frame)] == 0xFF);
+}
+
+// 上限の数までは新しく作り、それからは最も古いものを使い直す
+static void test_max_files() {
+    format(FILE_CLUSTERS * (SD_LOG_MAX_FILES + 2) + 1, false);
+    std::vector<uint32_t> firsts;
+    for (uint32_t boot = 0; boot < SD_LOG_MAX_FILES + 3; boot++) {
+        CHECK(init_log());
+        CHECK(sd.number == boot);
+        check_write();
+
+        std::vector<entry_t> files = list_dir();
+        uint32_t expected = boot < SD_LOG_MAX_FILES ? boot + 1
+                                                    : SD_LOG_MAX_FILES;
+        CHECK(files.size() == expected);
+        CHECK(used_clusters() == 1 + expected * FILE_CLUSTERS);
+        for (auto& e : files) {
+            CHECK(e.size == SD_LOG_FILE_SIZE);
+        }
+        if (boot < SD_LOG_MAX_FILES) {
+            firsts.push_back(files.back().first);
+        } else {
+            // 同じ順に領域を使い回す
+            bool found = false;
+            for (auto& e : files) {
+                if (e.name == name_of(boot)) {
+                    CHECK(e.first == firsts[boot - SD_LOG_MAX_FILES]);
+                    found = true;
+                }
+            }
+            CHECK(found);
+        }
+    }
+}
+
+// 空きが無くなれば上限より少なくても使い直す
+static void test_full_card() {
+    format(FILE_CLUSTERS * 3 + 10, true);
+    for (uint32_t boot = 0; boot < 6; boot++) {
+        CHECK(init_log());
+        CHECK(sd.number == boot);
+        check_write();
+        CHECK(list_dir().size() == (boot < 3 ? boot + 1 : 3));
+    }
+    CHECK(used_clusters() == 1 + 3 * FILE_CLUSTERS);
+}
+
+// 大きさの違うファイルや途切れたファイルは使い直さない
+static void test_foreign_files() {
+    format(FILE_CLUSTERS * 2 + 20, false);
+    add_file("README  TXT", 3, 1, 100);
+    add_file("100     BIN", 4, 2, 40000);
+    // 同じ大きさでもチェーンが途中で別の所へ飛んでいる
+    add_file("050     BIN", 10, FILE_CLUSTERS, SD_LOG_FILE_SIZE);
+    set_fat_entry(20, 5 + FILE_CLUSTERS * 2);
+    set_fat_entry(5 + FILE_CLUSTERS * 2, 21);
+
+    // 空きは無く、使い直せるものも無い
+    CHECK(!init_log());
+    CHECK(!sd_log_is_enabled(&sd));
+
+    format(FILE_CLUSTERS * 2 + 20, false);
+    add_file("README  TXT", 3, 1, 100);
+    add_file("100     BIN", 4, 2, 40000);
+    CHECK(init_log());
+    CHECK(sd.number == 101);
+    CHECK(init_log());
+    CHECK(sd.number == 102);
+    CHECK(init_log());
+    CHECK(sd.number == 103);
+
+    std::vector<entry_t> files = list_dir();
+    CHECK(files.size() == 4);
+    CHECK(files[0].name == "README  TXT" && files[0].size == 100);
+    CHECK(files[1].name == "100     BIN" && files[1].size == 40000);
+    CHECK(files[2].name == "103     BIN");
+    CHECK(files[3].name == "102     BIN");
+}
+
+// 前の方が埋まった大きなカードでも、少しずつ読んで後ろの空きを見つける
+static void test_large_card() {
+    uint32_t clusters = FILE_CLUSTERS * 40;
+    format(clusters, true);
+    add_file("DATA    BIN", 3, clusters - FILE_CLUSTERS - 10, 1);
+    uint32_t steps = 0;
+    CHECK(init_log(&steps));
+    CHECK(sd.number == 0);
+    CHECK(steps > disk.fat_size / SD_LOG_INIT_BLOCKS / 2);
+    check_write();
+    CHECK(list_dir().size() == 2);
+    CHECK(used_clusters() == clusters - 10 + 1);
+
+    // 終わった後は呼んでも何もしない
+    io_blocks = 0;
+    CHECK(sd_log_init_step(&sd) == sd_log_init_done);
+    CHECK(io_blocks == 0);
+}
+
+static void test_not_fat32() {
+    format(FILE_CLUSTERS + 10, false);
+    memcpy(&disk.at(0)[82], "FAT16   ", 8);
+    CHECK(!init_log());
+    disk.at(0)[510] = 0;
+    CHECK(!init_log());
+}
+
+int main() {
+    test_max_files();
+    test_full_card();
+    test_foreign_files();
+    test_large_card();
+    test_not_fat32();
+    printf("sd_log: ok\n");
+    return 0;
+}
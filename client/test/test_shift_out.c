@@ -0,0 +1,140 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hardware/dma.h>
+#include <hardware/pio.h>
+
+#include "check.h"
+#include "shift_out.h"
+
+// DMAの読んでいる位置を真似て、サブフレームと周期の並びの組み立てと、
+// 流している最中のバンクに書かないことを確かめる
+
+#define DMA_COUNT (12)
+#define LEN (3)
+
+dma_hw_t fake_dma_hw;
+
+static int dma_claimed;
+static shift_out_dev_t dev;
+
+int dma_claim_unused_channel(bool required) {
+    CHECK(required && dma_claimed < DMA_COUNT);
+    return dma_claimed++;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config* config,
+                           volatile void* write_addr,
+                           const volatile void* read_addr,
+                           uint transfer_count, bool trigger) {
+    (void)config;
+    (void)trigger;
+    dma_hw->ch[channel].write_addr = (uintptr_t)write_addr;
+    dma_hw->ch[channel].read_addr = (uintptr_t)read_addr;
+    dma_hw->ch[channel].transfer_count = transfer_count;
+}
+
+static void init(void) {
+    memset(&dev, 0, sizeof(dev));
+    memset(&fake_dma_hw, 0, sizeof(fake_dma_hw));
+    dma_claimed = 0;
+    dev.pio = pio0;
+    dev.len = LEN;
+    dev.refresh_hz = 100;
+    shift_out_init(&dev);
+}
+
+// データのDMAが読んでいる位置
+static void set_read_addr(const void* addr) {
+    dma_hw->ch[dev.dma_data].read_addr = (uintptr_t)addr;
+}
+
+static const uint8_t* cycle(uint8_t bank, uint8_t on) {
+    return dev.frames[bank][on ? 0 : 1];
+}
+
+// 明るさの分だけ先頭のサブフレームを点け、消灯の周期では点滅するビットを消す
+static void test_fill_cycle(void) {
+    init();
+    CHECK(dev.back == 1);
+    for (int i = 0; i < SHIFT_OUT_PATTERN_LEN; i++) {
+        CHECK(dev.cycles[i] == cycle(0, 1));
+    }
+
+    const uint8_t buf[LEN] = {0xFF, 0x0F, 0xA5};
+    const uint8_t blink[LEN] = {0x01, 0xF0, 0x00};
+    const uint8_t brightness = 5;
+    CHECK(shift_out_show(&dev, buf, blink, brightness, 0));
+    CHECK(dev.back == 0);
+
+    for (uint8_t k = 0; k < SHIFT_OUT_SUBFRAMES; k++) {
+        for (uint8_t i = 0; i < LEN; i++) {
+            uint8_t on = cycle(1, 1)[k * LEN + i];
+            uint8_t off = cycle(1, 0)[k * LEN + i];
+            CHECK(on == (k < brightness ? buf[i] : 0));
+            CHECK(off == (k < brightness ? (uint8_t)(buf[i] & ~blink[i]) : 0));
+        }
+    }
+
+    // 上限を超える明るさは全てのサブフレームを点ける
+    CHECK(shift_out_show(&dev, buf, NULL, 255, 0));
+    for (uint8_t k = 0; k < SHIFT_OUT_SUBFRAMES; k++) {
+        CHECK(memcmp(&cycle(0, 1)[k * LEN], buf, LEN) == 0);
+        CHECK(memcmp(&cycle(0, 0)[k * LEN], buf, LEN) == 0);
+    }
+}
+
+// パターンのビットiが周期iの点灯と消灯を選ぶ
+static void test_pattern(void) {
+    init();
+    const uint8_t buf[LEN] = {1, 2, 3};
+    const uint64_t pattern = 0x8000000000000001ull | 0xF0ull << 8;
+    CHECK(shift_out_show(&dev, buf, buf, 8, pattern));
+    for (uint8_t i = 0; i < SHIFT_OUT_PATTERN_LEN; i++) {
+        bool on = (pattern >> i) & 1;
+        CHECK(dev.cycles[i] == cycle(1, on));
+    }
+
+    // 全て点ける並びは点滅しない
+    CHECK(shift_out_show(&dev, buf, buf, 8, SHIFT_OUT_BLINK_NONE));
+    for (uint8_t i = 0; i < SHIFT_OUT_PATTERN_LEN; i++) {
+        CHECK(dev.cycles[i] == cycle(0, 1));
+    }
+}
+
+// DMAが次に書くバンクを読んでいる間は書かない
+// 読み終えた直後は末尾の次を指すので、そこも含める
+static void test_busy_bounds(void) {
+    init();
+    const uint8_t buf[LEN] = {0};
+    const uint8_t* lo = dev.frames[1][0];
+    const uint8_t* hi = lo + sizeof(dev.frames[1]);
+
+    set_read_addr(lo);
+    CHECK(!shift_out_show(&dev, buf, NULL, 1, 0));
+    set_read_addr(lo + SHIFT_OUT_SUBFRAMES * LEN);
+    CHECK(!shift_out_show(&dev, buf, NULL, 1, 0));
+    set_read_addr(hi);
+    CHECK(!shift_out_show(&dev, buf, NULL, 1, 0));
+    CHECK(dev.back == 1);
+
+    set_read_addr(lo - 1);
+    CHECK(shift_out_show(&dev, buf, NULL, 1, 0));
+    CHECK(dev.back == 0);
+
+    // バンク0の末尾の次はバンク1の先頭なので、バンク0も使用中とみなす
+    set_read_addr(dev.frames[1][0]);
+    CHECK(!shift_out_show(&dev, buf, NULL, 1, 0));
+    set_read_addr(hi + 1);
+    CHECK(shift_out_show(&dev, buf, NULL, 1, 0));
+    CHECK(dev.back == 1);
+}
+
+int main(void) {
+    test_fill_cycle();
+    test_pattern();
+    test_busy_bounds();
+    printf("shift_out: ok\n");
+    return 0;
+}
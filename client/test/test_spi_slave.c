@@ -0,0 +1,205 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hardware/dma.h>
+#include <hardware/gpio.h>
+#include <pico/time.h>
+
+#include "check.h"
+#include "spi_slave.h"
+#include "timesync.h"
+#include "topic.h"
+
+// CSの割り込みとDMAを真似て、ホストから届いたコマンドの扱いと
+// DATA_READYの出し方を確かめる
+
+#define PIN_READY (22)
+#define DMA_COUNT (12)
+#define HOST_US (1700000000000000ull)
+
+dma_hw_t fake_dma_hw;
+
+static uint64_t now_us;
+static gpio_irq_callback_t cs_callback;
+static uint cs_pin;
+static bool ready;
+static int dma_claimed;
+static int dma_rx = -1;
+
+uint64_t time_us_64(void) {
+    return now_us;
+}
+
+void gpio_init(uint gpio) {
+    (void)gpio;
+}
+
+void gpio_set_dir(uint gpio, bool out) {
+    (void)gpio;
+    (void)out;
+}
+
+void gpio_pull_up(uint gpio) {
+    (void)gpio;
+}
+
+void gpio_put(uint gpio, bool value) {
+    CHECK(gpio == PIN_READY);
+    ready = value;
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask,
+                                        bool enabled,
+                                        gpio_irq_callback_t callback) {
+    CHECK(enabled);
+    CHECK(event_mask == (GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE));
+    cs_pin = gpio;
+    cs_callback = callback;
+}
+
+int dma_claim_unused_channel(bool required) {
+    CHECK(required && dma_claimed < DMA_COUNT);
+    return dma_claimed++;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config* config,
+                           volatile void* write_addr,
+                           const volatile void* read_addr,
+                           uint transfer_count, bool trigger) {
+    (void)config;
+    CHECK(!trigger);
+    dma_hw->ch[channel].write_addr = (uintptr_t)write_addr;
+    dma_hw->ch[channel].read_addr = (uintptr_t)read_addr;
+    dma_hw->ch[channel].transfer_count = transfer_count;
+    // 受信は1byte単位でバッファの大きさだけ回す
+    if (transfer_count == SPI_SLAVE_BUF_SIZE) {
+        dma_rx = channel;
+    }
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void* read_addr,
+                               bool trigger) {
+    CHECK(!trigger);
+    dma_hw->ch[channel].read_addr = (uintptr_t)read_addr;
+}
+
+void dma_channel_set_write_addr(uint channel, volatile void* write_addr,
+                                bool trigger) {
+    CHECK(!trigger);
+    dma_hw->ch[channel].write_addr = (uintptr_t)write_addr;
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count,
+                                 bool trigger) {
+    CHECK(!trigger);
+    dma_hw->ch[channel].transfer_count = trans_count;
+}
+
+void dma_start_channel_mask(uint32_t chan_mask) {
+    (void)chan_mask;
+}
+
+void dma_channel_abort(uint channel) {
+    (void)channel;
+}
+
+// ホストからlen byte届いたことにする
+static void receive(const uint8_t* data, uint32_t len) {
+    memcpy((uint8_t*)dma_hw->ch[dma_rx].write_addr, data, len);
+    dma_hw->ch[dma_rx].transfer_count = SPI_SLAVE_BUF_SIZE - len;
+}
+
+static void receive_time_sync(uint64_t host_us) {
+    uint8_t buf[SPI_SLAVE_TIME_SYNC_SIZE] = {SPI_SLAVE_CMD_TIME_SYNC};
+    for (int i = 0; i < 8; i++) {
+        buf[1 + i] = (uint8_t)(host_us >> (8 * (7 - i)));
+    }
+    receive(buf, sizeof(buf));
+}
+
+static uint32_t sync_updates(void) {
+    timesync_status_t status;
+    timesync_get_status(&status);
+    return status.updates;
+}
+
+// CSが下がった時と上がった時に割り込みが入れば、下がった時刻で合わせる
+static void test_time_sync(void) {
+    now_us = 1000;
+    cs_callback(cs_pin, GPIO_IRQ_EDGE_FALL);
+    now_us = 1100;
+    receive_time_sync(HOST_US);
+    cs_callback(cs_pin, GPIO_IRQ_EDGE_RISE);
+
+    bool synced;
+    CHECK(timesync_to_host(1000, &synced) == HOST_US);
+    CHECK(synced);
+    CHECK(sync_updates() == 1);
+}
+
+// 割り込みを止めている間に転送が終わると、両方の端が一度に届く
+// 下がった時刻は分からないので、その時刻合わせは使わない
+static void test_stale_time_sync(void) {
+    timesync_status_t before;
+    timesync_get_status(&before);
+
+    // 400ms止まっていた後に届いた、300ms前の転送
+    now_us = 401000;
+    receive_time_sync(HOST_US + 100000);
+    cs_callback(cs_pin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE);
+
+    timesync_status_t after;
+    timesync_get_status(&after);
+    CHECK(after.updates == before.updates);
+    CHECK(after.steps == before.steps);
+    CHECK(timesync_to_host(1000, NULL) == HOST_US);
+
+    // 次の転送は前の端に引きずられずに合わせる
+    now_us = 402000;
+    cs_callback(cs_pin, GPIO_IRQ_EDGE_FALL);
+    now_us = 402100;
+    receive_time_sync(HOST_US + 401000);
+    cs_callback(cs_pin, GPIO_IRQ_EDGE_RISE);
+    timesync_get_status(&after);
+    CHECK(after.updates == before.updates + 1);
+    CHECK(after.steps == before.steps);
+    CHECK(after.last_error_us == 0);
+}
+
+// 止まっている間はフレームが積まれてもDATA_READYをLowのままにする
+static void test_hold_data_ready(void) {
+    const uint8_t frame[] = {0, 1, 0, 0, 0xAA};
+    CHECK(!ready);
+    CHECK(spi_slave_push_bytes(topic_stroke_front, frame, sizeof(frame)));
+    CHECK(ready);
+
+    spi_slave_hold_data_ready(true);
+    CHECK(!ready);
+    CHECK(spi_slave_push_bytes(topic_stroke_front, frame, sizeof(frame)));
+    CHECK(!ready);
+
+    spi_slave_hold_data_ready(false);
+    CHECK(ready);
+
+    // 取り出し終えればLowに戻る
+    const uint8_t next[] = {SPI_SLAVE_CMD_NEXT};
+    for (int i = 0; i < 3; i++) {
+        cs_callback(cs_pin, GPIO_IRQ_EDGE_FALL);
+        receive(next, sizeof(next));
+        cs_callback(cs_pin, GPIO_IRQ_EDGE_RISE);
+    }
+    CHECK(!ready);
+}
+
+int main(void) {
+    spi_slave_set_data_ready(PIN_READY, 1, 0);
+    spi_slave_init();
+    CHECK(cs_callback != NULL && dma_rx >= 0);
+
+    test_time_sync();
+    test_stale_time_sync();
+    test_hold_data_ready();
+    printf("spi_slave: ok\n");
+    return 0;
+}
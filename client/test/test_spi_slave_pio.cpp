@@ -0,0 +1,326 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+
+// src/spi_slave.pioをそのまま読み、PIOを1サイクルずつ動かすモデルで
+// ホスト側のSPIマスタ (モード0) とループバックさせる
+// spi_slave.cと同じく sys_clk 125MHz、clkdiv 1、autopull 32bit、
+// autopush 8bit、どちらも左シフト (MSBファースト) で動かす
+
+#define CYCLE_NS (8.0)
+// 入力の2段の同期化で、ピンの変化が見えるまで2サイクル遅れる
+#define SYNC_NS (2 * CYCLE_NS)
+// 出力のパッドの遅れと、ホスト側で要るセットアップ時間
+#define PAD_NS (4.0)
+#define SETUP_NS (5.0)
+
+// spi_slave.cと同じピン
+#define PIN_SCK (10)
+#define PIN_TX (11)
+#define PIN_RX (12)
+
+enum op_t { op_wait, op_out, op_in, op_jmp, op_nop };
+
+struct instr_t {
+    op_t op;
+    int polarity;  // wait
+    bool gpio;     // wait gpioなら絶対番号、pinならin_baseからの位置
+    int index;
+    int bits;    // out/in
+    bool pins;   // out/inの対象がpins (falseならnull)
+    int target;  // jmp
+};
+
+struct program_t {
+    std::vector<instr_t> code;
+    int wrap_target = 0;
+    int wrap = -1;
+};
+
+static std::string strip(const std::string& s) {
+    size_t a = s.find_first_not_of(" \t\r");
+    size_t b = s.find_last_not_of(" \t\r");
+    return a == std::string::npos ? "" : s.substr(a, b - a + 1);
+}
+
+// モデルが知らない命令が出てきたら、テストを直すまで失敗にする
+static program_t parse(const char* path) {
+    std::ifstream in(path);
+    CHECK(in.good());
+
+    std::map<std::string, int> defines;
+    std::map<std::string, int> labels;
+    std::vector<std::pair<size_t, std::string>> pending_jmp;
+    program_t prog;
+
+    auto value = [&](const std::string& tok) {
+        auto it = defines.find(tok);
+        return it != defines.end() ? it->second : std::stoi(tok, nullptr, 0);
+    };
+
+    std::string line;
+    while (std::getline(in, line)) {
+        line = strip(line.substr(0, line.find(';')));
+        if (line.empty()) {
+            continue;
+        }
+        for (char& c : line) {
+            if (c == ',') {
+                c = ' ';
+            }
+        }
+        std::istringstream ss(line);
+        std::string word;
+        ss >> word;
+
+        if (word == ".define") {
+            std::string name;
+            ss >> name;
+            if (name == "PUBLIC") {
+                ss >> name;
+            }
+            std::string v;
+            ss >> v;
+            defines[name] = value(v);
+        } else if (word == ".wrap_target") {
+            prog.wrap_target = prog.code.size();
+        } else if (word == ".wrap") {
+            prog.wrap = prog.code.size() - 1;
+        } else if (word[0] == '.') {
+            // .program、.pio_versionなどは動きに関わらない
+        } else if (word.back() == ':') {
+            labels[word.substr(0, word.size() - 1)] = prog.code.size();
+        } else {
+            instr_t ins = {};
+            if (word == "wait") {
+                std::string pol, src, idx;
+                ss >> pol >> src >> idx;
+                CHECK(src == "pin" || src == "gpio");
+                ins.op = op_wait;
+                ins.polarity = value(pol);
+                ins.gpio = src == "gpio";
+                ins.index = value(idx);
+            } else if (word == "out" || word == "in") {
+                std::string dst, n;
+                ss >> dst >> n;
+                CHECK(dst == "pins" || dst == "null");
+                ins.op = word == "out" ? op_out : op_in;
+                ins.pins = dst == "pins";
+                ins.bits = value(n);
+                CHECK(ins.bits == 1 || !ins.pins);
+            } else if (word == "jmp") {
+                std::string label;
+                ss >> label;
+                ins.op = op_jmp;
+                pending_jmp.push_back({prog.code.size(), label});
+            } else if (word == "nop") {
+                ins.op = op_nop;
+            } else {
+                fprintf(stderr, "unknown instruction: %s\n", line.c_str());
+                CHECK(false);
+            }
+            prog.code.push_back(ins);
+        }
+    }
+    for (auto& [at, label] : pending_jmp) {
+        CHECK(labels.count(label) == 1);
+        prog.code[at].target = labels[label];
+    }
+    if (prog.wrap < 0) {
+        prog.wrap = prog.code.size() - 1;
+    }
+    CHECK(!prog.code.empty());
+    return prog;
+}
+
+// 時刻ごとの値の変化を並べたもの
+struct signal_t {
+    std::vector<std::pair<double, int>> changes;
+
+    int at(double t) const {
+        int v = 0;
+        for (auto& [ct, cv] : changes) {
+            if (ct > t) {
+                break;
+            }
+            v = cv;
+        }
+        return v;
+    }
+
+    // (from, to] の間に変わったか
+    bool changed(double from, double to) const {
+        for (auto& [ct, cv] : changes) {
+            if (ct > from && ct <= to) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+struct result_t {
+    std::vector<uint8_t> master_rx;  // マスタが受け取ったもの (MISO)
+    std::vector<uint8_t> slave_rx;   // スレーブが受け取ったもの (MOSI)
+    bool setup_ok;
+};
+
+// マスタはstart_nsから転送を始め、立ち下がりでMOSIを変え、立ち上がりで
+// MISOを読む。スレーブは前の転送の終わりに初期化されたところから動く
+static result_t run(const program_t& prog, double sck_hz, double start_ns,
+                    const std::vector<uint8_t>& mosi_bytes,
+                    const std::vector<uint8_t>& miso_bytes) {
+    const double period = 1e9 / sck_hz;
+    const size_t nbits = mosi_bytes.size() * 8;
+    auto rise = [&](size_t n) { return start_ns + period / 2 + n * period; };
+
+    auto sck = [&](double t) {
+        if (t < start_ns + period / 2) {
+            return 0;
+        }
+        double phase = (t - start_ns - period / 2) / period;
+        phase -= (long)phase;
+        return phase < 0.5 ? 1 : 0;
+    };
+    auto mosi = [&](double t) {
+        long n = t < start_ns ? 0 : (long)((t - start_ns) / period);
+        if ((size_t)n >= nbits) {
+            return 0;
+        }
+        return (mosi_bytes[n / 8] >> (7 - n % 8)) & 1;
+    };
+    auto pin = [&](int gpio, double t) {
+        if (gpio == PIN_SCK) {
+            return sck(t);
+        }
+        if (gpio == PIN_RX) {
+            return mosi(t);
+        }
+        return 0;
+    };
+
+    // TX FIFOはDMAが先に埋めておくので、送るbyteを32bitずつ読むだけ
+    // bswapしているのでメモリ上の先頭byteがbit31-24に来る
+    size_t tx_word = 0;
+    auto next_word = [&]() {
+        uint32_t w = 0;
+        for (int i = 0; i < 4; i++) {
+            size_t k = tx_word * 4 + i;
+            w = w << 8 | (k < miso_bytes.size() ? miso_bytes[k] : 0);
+        }
+        tx_word++;
+        return w;
+    };
+
+    result_t res = {{}, {}, true};
+    signal_t miso;
+    uint32_t osr = 0;
+    int osr_count = 32;  // 空なので最初のoutでautopullする
+    uint32_t isr = 0;
+    int isr_count = 0;
+    int pc = 0;
+
+    const double end_ns = rise(nbits) + period;
+    for (double t = 0; t < end_ns; t += CYCLE_NS) {
+        const instr_t& ins = prog.code[pc];
+        bool stall = false;
+        auto synced = [&](int gpio) { return pin(gpio, t - SYNC_NS); };
+        switch (ins.op) {
+            case op_wait: {
+                int gpio = ins.gpio ? ins.index : (PIN_RX + ins.index) % 32;
+                stall = synced(gpio) != ins.polarity;
+                break;
+            }
+            case op_out:
+                if (osr_count >= 32) {
+                    osr = next_word();
+                    osr_count = 0;
+                }
+                if (ins.pins) {
+                    // 命令の終わりにピンが変わり、パッドを通って外に出る
+                    int bit = osr >> 31;
+                    miso.changes.push_back({t + CYCLE_NS + PAD_NS, bit});
+                }
+                osr <<= ins.bits;
+                osr_count += ins.bits;
+                break;
+            case op_in:
+                isr = isr << ins.bits | (ins.pins ? synced(PIN_RX) : 0);
+                isr_count += ins.bits;
+                if (isr_count >= 8) {
+                    res.slave_rx.push_back(isr & 0xFF);
+                    isr = 0;
+                    isr_count = 0;
+                }
+                break;
+            case op_jmp:
+                pc = ins.target;
+                continue;
+            case op_nop:
+                break;
+        }
+        if (stall) {
+            continue;
+        }
+        pc = pc == prog.wrap ? prog.wrap_target : pc + 1;
+    }
+
+    res.master_rx.assign(mosi_bytes.size(), 0);
+    for (size_t n = 0; n < nbits; n++) {
+        double sample = rise(n);
+        if (miso.changed(sample - SETUP_NS, sample)) {
+            res.setup_ok = false;
+        }
+        res.master_rx[n / 8] |= miso.at(sample) << (7 - n % 8);
+    }
+    return res;
+}
+
+static bool loopback_ok(const program_t& prog, double sck_hz) {
+    std::vector<uint8_t> mosi_bytes;
+    std::vector<uint8_t> miso_bytes;
+    for (int i = 0; i < 16; i++) {
+        mosi_bytes.push_back(0x5A ^ (i * 37));
+        miso_bytes.push_back(0xC3 ^ (i * 91));
+    }
+    // ホストのクロックとPIOのサイクルの位相をずらして確かめる
+    for (double start = 100; start < 100 + CYCLE_NS; start += 1) {
+        result_t res = run(prog, sck_hz, start, mosi_bytes, miso_bytes);
+        if (!res.setup_ok || res.master_rx != miso_bytes ||
+            res.slave_rx.size() < mosi_bytes.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < mosi_bytes.size(); i++) {
+            if (res.slave_rx[i] != mosi_bytes[i]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main() {
+    program_t prog = parse(SPI_SLAVE_PIO_PATH);
+
+    // data-serverの既定の速度では余裕がある
+    CHECK(loopback_ok(prog, 1e6));
+
+    // 下から順に上げ、初めて崩れる手前を上限とする
+    double max_hz = 0;
+    for (double hz = 1e6; hz <= 30e6; hz += 0.5e6) {
+        if (!loopback_ok(prog, hz)) {
+            break;
+        }
+        max_hz = hz;
+    }
+    printf("spi_slave.pio: max SCK %.1f MHz (model)\n", max_hz / 1e6);
+    CHECK(max_hz >= 10e6);
+    return 0;
+}
@@ -7,6 +7,12 @@ use serde::Deserialize;
 pub struct SpiConfig {
     pub dev: String,
     pub baud: u32,
+    /// PicoのDATA_READYをつないだGPIO (sysfsの番号)。無ければ常にポーリングする
+    pub data_ready_gpio: Option<u32>,
+    /// 起動時にPicoのフラッシュから取り寄せる履歴の秒数。無ければ取り寄せない
+    pub drain_secs: Option<u64>,
+    /// Picoの最新値の表を読みに行く頻度 (Hz)。無ければ読まない
+    pub regs_hz: Option<u32>,
 }
 
 #[derive(Deserialize)]
@@ -1,12 +1,59 @@
-use std::{thread, time::Duration};
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+use std::{collections::BTreeMap, thread};
 
 use anyhow::{Context, Result};
 use crc::{CRC_16_IBM_3740, Crc};
+use nng::Socket;
+use serde::Serialize;
 use spidev::{SpiModeFlags, Spidev, SpidevOptions, SpidevTransfer};
 
 use crate::config::Config;
+use crate::util::delta::DeltaDecoder;
+use crate::util::frame::{
+    FRAME_FLAG_REPLAY, FRAME_HEADER_SIZE, LossTracker, TopicStats, parse_header, topic_name,
+};
+use crate::util::gpio::EdgeInput;
+use crate::util::keys::KeyTable;
+use crate::util::replay::tag_replay;
 use crate::util::socket;
 
+// エッジを取りこぼしても止まらないよう、この間隔では必ず取りに行く
+const DATA_READY_TIMEOUT: Duration = Duration::from_millis(100);
+
+const LOSS_REPORT_INTERVAL: Duration = Duration::from_secs(10);
+
+const TIME_SYNC_INTERVAL: Duration = Duration::from_secs(1);
+
+// Picoが起動してディスクリプタを載せるのを待つ上限
+const BOOT_TIMEOUT: Duration = Duration::from_secs(1);
+
+// 整数のキーを戻せない間、ディスクリプタを要求し直す間隔
+const DESCRIBE_INTERVAL: Duration = Duration::from_secs(1);
+
+// client/include/spi_slave.h のコマンド
+const CMD_NEXT: u8 = 0x01;
+const CMD_TIME_SYNC: u8 = 0x02;
+const CMD_DESCRIBE: u8 = 0x03;
+const CMD_DRAIN: u8 = 0x04;
+const CMD_READ_REGS: u8 = 0x05;
+
+// client/include/spi_slave.h の最新値の表
+const REG_MAX_COUNT: usize = 32;
+const REG_HEADER_SIZE: usize = 4;
+const REG_ENTRY_SIZE: usize = 12;
+
+#[derive(Serialize)]
+struct LossMsg<'a> {
+    topic: &'static str,
+    payload: BTreeMap<&'static str, &'a TopicStats>,
+}
+
+#[derive(Serialize)]
+struct RegsMsg<'a> {
+    topic: &'static str,
+    payload: BTreeMap<&'a str, (u64, i32)>,
+}
+
 fn spi_init(spi_dev: &str, spi_baud: u32) -> Result<Spidev> {
     let mut spi =
         Spidev::open(spi_dev).with_context(|| format!("spidev {} open failed.", spi_dev))?;
@@ -53,7 +100,35 @@ fn read_data(spi: &mut Spidev, len: u16) -> Result<(u16, Vec<u8>)> {
 }
 
 fn write_next(spi: &mut Spidev) -> Result<()> {
-    let tx_buf = [0x01u8];
+    let tx_buf = [CMD_NEXT];
+
+    let mut transfer = SpidevTransfer::write(&tx_buf);
+    spi.transfer(&mut transfer)
+        .context("spi transfer failed.")?;
+
+    Ok(())
+}
+
+/// ホストの時刻(UNIX時間のus)を送り、Picoの時計を合わせてもらう
+fn write_time_sync(spi: &mut Spidev) -> Result<()> {
+    let now = SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .context("system time is before UNIX epoch.")?;
+
+    let mut tx_buf = [0u8; 9];
+    tx_buf[0] = CMD_TIME_SYNC;
+    tx_buf[1..].copy_from_slice(&(now.as_micros() as u64).to_be_bytes());
+
+    let mut transfer = SpidevTransfer::write(&tx_buf);
+    spi.transfer(&mut transfer)
+        .context("spi transfer failed.")?;
+
+    Ok(())
+}
+
+/// キーとトピックの表(descトピック)を送り直してもらう
+fn write_describe(spi: &mut Spidev) -> Result<()> {
+    let tx_buf = [CMD_DESCRIBE];
 
     let mut transfer = SpidevTransfer::write(&tx_buf);
     spi.transfer(&mut transfer)
@@ -62,16 +137,176 @@ fn write_next(spi: &mut Spidev) -> Result<()> {
     Ok(())
 }
 
+/// 指定した秒数前からの履歴をフラッシュから送ってもらう
+fn write_drain(spi: &mut Spidev, secs: u64) -> Result<()> {
+    let now = SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .context("system time is before UNIX epoch.")?;
+    let since = now.saturating_sub(Duration::from_secs(secs));
+
+    let mut tx_buf = [0u8; 9];
+    tx_buf[0] = CMD_DRAIN;
+    tx_buf[1..].copy_from_slice(&(since.as_micros() as u64).to_be_bytes());
+
+    let mut transfer = SpidevTransfer::write(&tx_buf);
+    spi.transfer(&mut transfer)
+        .context("spi transfer failed.")?;
+
+    Ok(())
+}
+
+/// 最新値の表を丸ごと読む
+/// 読み出しを頼んだ次の転送で返ってくる
+fn read_regs(spi: &mut Spidev) -> Result<Vec<u8>> {
+    let len = REG_HEADER_SIZE + REG_MAX_COUNT * REG_ENTRY_SIZE;
+
+    let mut tx_buf = [0u8; 5];
+    tx_buf[0] = CMD_READ_REGS;
+    tx_buf[3..].copy_from_slice(&(len as u16).to_be_bytes());
+
+    let mut transfer = SpidevTransfer::write(&tx_buf);
+    spi.transfer(&mut transfer)
+        .context("spi transfer failed.")?;
+
+    let mut rx_buf = vec![0u8; len];
+    let mut transfer = SpidevTransfer::read(&mut rx_buf);
+    spi.transfer(&mut transfer)
+        .context("spi transfer failed.")?;
+
+    Ok(rx_buf)
+}
+
+/// 最新値の表をチャンネル名ごとの [時刻, 値] にしてregs/frontとして流す
+/// 送信バッファを書き換えるので、載っていたフレームを読み終えてから呼ぶこと
+/// 名前を受け取っていないチャンネルがあればtrueを返す
+fn send_regs(spi: &mut Spidev, socket: &Socket, keys: &KeyTable) -> Result<bool> {
+    let table = read_regs(spi)?;
+    let count = table[0] as usize;
+
+    let mut payload = BTreeMap::new();
+    let mut unnamed = false;
+    let entries = table[REG_HEADER_SIZE..].chunks_exact(REG_ENTRY_SIZE);
+    for (id, entry) in entries.take(count).enumerate() {
+        let us = u64::from_be_bytes(entry[..8].try_into()?);
+        let value = i32::from_be_bytes(entry[8..].try_into()?);
+        // まだ値が無いか、名前を受け取っていないチャンネルは飛ばす
+        if us == 0 {
+            continue;
+        }
+        match keys.reg_name(id) {
+            Some(name) => {
+                payload.insert(name, (us, value));
+            }
+            None => unnamed = true,
+        }
+    }
+
+    let msg = RegsMsg {
+        topic: "regs/front",
+        payload,
+    };
+    let bytes = rmp_serde::to_vec_named(&msg).context("MsgPack serialize error")?;
+    socket
+        .send(&bytes)
+        .map_err(|(_, e)| e)
+        .context("socket.send error")?;
+
+    Ok(unnamed)
+}
+
+fn send_loss_report(socket: &Socket, tracker: &LossTracker) {
+    let msg = LossMsg {
+        topic: "loss/spi",
+        payload: tracker.stats(),
+    };
+    match rmp_serde::to_vec_named(&msg) {
+        Ok(bytes) => {
+            if let Err((_, e)) = socket.send(&bytes) {
+                eprintln!("socket.send error: {e}");
+            }
+        }
+        Err(e) => eprintln!("MsgPack serialize error: {e}"),
+    }
+}
+
 pub fn spi(config: Config) -> Result<()> {
     let mut spi = spi_init(config.spi.dev.as_str(), config.spi.baud)?;
 
     let socket = socket::init_pub(config.socket.spi.as_str())?;
 
+    let mut data_ready = match config.spi.data_ready_gpio {
+        Some(gpio) => Some(EdgeInput::open(gpio)?),
+        None => None,
+    };
+
     let crc16 = Crc::<u16>::new(&CRC_16_IBM_3740);
 
-    thread::sleep(Duration::from_secs(1));
+    let mut tracker = LossTracker::new();
+    let mut last_report = Instant::now();
+    let mut last_sync: Option<Instant> = None;
+
+    let mut keys = KeyTable::default();
+    let mut last_describe: Option<Instant> = None;
+
+    // 送り直された履歴は今のフレームと混ざって届くので、別に組み立てる
+    let mut deltas = DeltaDecoder::default();
+    let mut replay_deltas = DeltaDecoder::default();
+
+    // 最新値の表は送るものが無い間も読みに行く
+    let regs_interval = config
+        .spi
+        .regs_hz
+        .filter(|&hz| hz != 0)
+        .map(|hz| Duration::from_secs(1) / hz);
+    let ready_timeout = regs_interval.map_or(DATA_READY_TIMEOUT, |i| i.min(DATA_READY_TIMEOUT));
+    let mut last_regs: Option<Instant> = None;
+
+    // チャンネルの名前はディスクリプタでしか届かないので、文字列のキーで
+    // ビルドしたPicoでも、最新値の表を読むなら初めに要求しておく
+    let mut need_describe = regs_interval.is_some();
+
+    // data_readyが上がればPicoは読める状態なので、決め打ちで待たない
+    match data_ready.as_mut() {
+        Some(ready) => {
+            if let Err(e) = ready.wait_high(BOOT_TIMEOUT) {
+                eprintln!("data_ready error: {e}");
+            }
+        }
+        None => thread::sleep(BOOT_TIMEOUT),
+    }
+
+    if let Some(secs) = config.spi.drain_secs {
+        if let Err(e) = write_drain(&mut spi, secs) {
+            eprintln!("write_drain error: {e}");
+        }
+    }
 
     loop {
+        // Lowのまま待ち切れなかった時は、Picoがフラッシュに書いていて
+        // CSの割り込みを受けられないかもしれない
+        let ready = match data_ready.as_mut() {
+            Some(ready) => ready.wait_high(ready_timeout).unwrap_or_else(|e| {
+                eprintln!("data_ready error: {e}");
+                false
+            }),
+            None => true,
+        };
+
+        // 転送の始まりの時刻が分からないと合わせられないので、Highになってから送る
+        if ready && last_sync.is_none_or(|t| TIME_SYNC_INTERVAL <= t.elapsed()) {
+            if let Err(e) = write_time_sync(&mut spi) {
+                eprintln!("write_time_sync error: {e}");
+            }
+            last_sync = Some(Instant::now());
+        }
+
+        if need_describe && last_describe.is_none_or(|t| DESCRIBE_INTERVAL <= t.elapsed()) {
+            if let Err(e) = write_describe(&mut spi) {
+                eprintln!("write_describe error: {e}");
+            }
+            last_describe = Some(Instant::now());
+        }
+
         let len = match read_length(&mut spi) {
             Ok(l) => l,
             Err(e) => {
@@ -80,7 +315,17 @@ pub fn spi(config: Config) -> Result<()> {
             }
         };
 
+        // 載っていたフレームを読み終えた後、次を載せてもらう前に読む
+        let regs_due = regs_interval.is_some_and(|i| last_regs.is_none_or(|t| i <= t.elapsed()));
+
         if len == 0 {
+            if regs_due {
+                match send_regs(&mut spi, &socket, &keys) {
+                    Ok(unnamed) => need_describe |= unnamed,
+                    Err(e) => eprintln!("send_regs error: {e}"),
+                }
+                last_regs = Some(Instant::now());
+            }
             if let Err(e) = write_next(&mut spi) {
                 eprintln!("write_next error: {e}")
             };
@@ -100,8 +345,84 @@ pub fn spi(config: Config) -> Result<()> {
             continue;
         }
 
-        if let Err((_, e)) = socket.send(&data) {
-            eprintln!("socket.send error: {e}");
+        // ヘッダで欠番を数え、本体のMsgPackだけを流す
+        // 整数のキーは文字列に戻し、差分は全項目を揃えてから流す
+        // 送り直された履歴は一度数えているので欠番には含めない
+        match parse_header(&data) {
+            Some(header) => {
+                let replay = header.flags & FRAME_FLAG_REPLAY != 0;
+                if !replay {
+                    tracker.record(&header);
+                }
+                let body = &data[FRAME_HEADER_SIZE..];
+                if topic_name(header.topic) == "desc" {
+                    // 取りこぼして継ぎ足せなければ、初めから送り直してもらう
+                    match keys.load(body) {
+                        Ok(()) => need_describe = false,
+                        Err(e) => {
+                            eprintln!("descriptor error: {e}");
+                            need_describe = true;
+                        }
+                    }
+                }
+                let sent = match keys.expand(body) {
+                    Ok(expanded) => {
+                        let body = expanded.as_deref().unwrap_or(body);
+                        let deltas = if replay {
+                            &mut replay_deltas
+                        } else {
+                            &mut deltas
+                        };
+                        match deltas.apply(&header, body) {
+                            Ok(rebuilt) => {
+                                let body = rebuilt.as_deref().unwrap_or(body);
+                                if replay {
+                                    // 前に保存したものと重なるので印を付けて流す
+                                    match tag_replay(body) {
+                                        Ok(tagged) => socket.send(tagged.as_slice()),
+                                        Err(e) => {
+                                            eprintln!("replay tag error: {e}");
+                                            tracker.undecoded(&header);
+                                            Ok(())
+                                        }
+                                    }
+                                } else {
+                                    socket.send(body)
+                                }
+                            }
+                            Err(e) => {
+                                eprintln!("delta error: {e}");
+                                tracker.undecoded(&header);
+                                Ok(())
+                            }
+                        }
+                    }
+                    Err(e) => {
+                        // ディスクリプタが届くまでのものは捨て、数だけ残す
+                        eprintln!("key expand error: {e}");
+                        need_describe = true;
+                        tracker.undecoded(&header);
+                        Ok(())
+                    }
+                };
+                if let Err((_, e)) = sent {
+                    eprintln!("socket.send error: {e}");
+                }
+            }
+            None => eprintln!("unknown frame header"),
+        }
+
+        if LOSS_REPORT_INTERVAL <= last_report.elapsed() {
+            send_loss_report(&socket, &tracker);
+            last_report = Instant::now();
+        }
+
+        if regs_due {
+            match send_regs(&mut spi, &socket, &keys) {
+                Ok(unnamed) => need_describe |= unnamed,
+                Err(e) => eprintln!("send_regs error: {e}"),
+            }
+            last_regs = Some(Instant::now());
         }
 
         if let Err(e) = write_next(&mut spi) {
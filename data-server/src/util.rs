@@ -1,2 +1,7 @@
 pub mod database;
+pub mod delta;
+pub mod frame;
+pub mod gpio;
+pub mod keys;
+pub mod replay;
 pub mod socket;
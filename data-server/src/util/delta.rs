@@ -0,0 +1,96 @@
+use std::collections::HashMap;
+
+use anyhow::{Context, Result, bail};
+use rmpv::Value;
+use rmpv::decode::read_value;
+use rmpv::encode::write_value;
+
+use crate::util::frame::{FRAME_FLAG_DELTA, FRAME_FLAG_KEYFRAME, FrameHeader, topic_name};
+
+/// client/src/delta.c で差分にしたトピックを組み立て直す
+///
+/// キーフレームの項目を覚えておき、差分のフレームで届いた項目だけを書き換えて
+/// 全項目の揃った本体にする。保存側は差分かどうかを気にしなくてよい。
+/// 欠番があると途中の変化が分からないので、次のキーフレームまで捨てる。
+#[derive(Default)]
+pub struct DeltaDecoder {
+    topics: HashMap<u8, TopicState>,
+}
+
+struct TopicState {
+    seq: u16,
+    /// "us"を除いたpayloadの項目
+    fields: Vec<(Value, Value)>,
+}
+
+fn is_time(key: &Value) -> bool {
+    key.as_str() == Some("us")
+}
+
+fn payload_mut(val: &mut Value) -> Option<&mut Vec<(Value, Value)>> {
+    let Value::Map(map) = val else {
+        return None;
+    };
+    match map
+        .iter_mut()
+        .find(|(k, _)| k.as_str() == Some("payload"))?
+    {
+        (_, Value::Map(payload)) => Some(payload),
+        _ => None,
+    }
+}
+
+impl DeltaDecoder {
+    /// 組み立て直した本体を返す。そのまま流せるものはNone
+    ///
+    /// キーは文字列に戻した後の本体を渡すこと。
+    pub fn apply(&mut self, header: &FrameHeader, body: &[u8]) -> Result<Option<Vec<u8>>> {
+        if header.flags & (FRAME_FLAG_KEYFRAME | FRAME_FLAG_DELTA) == 0 {
+            return Ok(None);
+        }
+
+        let mut val = read_value(&mut &body[..]).context("Failed to decode message")?;
+        let payload = payload_mut(&mut val).context("Missing 'payload' field")?;
+
+        if header.flags & FRAME_FLAG_KEYFRAME != 0 {
+            let fields = payload
+                .iter()
+                .filter(|(k, _)| !is_time(k))
+                .cloned()
+                .collect();
+            self.topics.insert(
+                header.topic,
+                TopicState {
+                    seq: header.seq,
+                    fields,
+                },
+            );
+            return Ok(None);
+        }
+
+        let topic = topic_name(header.topic);
+        let Some(state) = self.topics.get_mut(&header.topic) else {
+            bail!("No keyframe for '{topic}'");
+        };
+        if header.seq != state.seq.wrapping_add(1) {
+            self.topics.remove(&header.topic);
+            bail!("Lost a frame of '{topic}' since the keyframe");
+        }
+        state.seq = header.seq;
+
+        for (key, value) in payload.iter().filter(|(k, _)| !is_time(k)) {
+            match state.fields.iter_mut().find(|(k, _)| k == key) {
+                Some((_, v)) => *v = value.clone(),
+                None => state.fields.push((key.clone(), value.clone())),
+            }
+        }
+
+        // 時刻はこのフレームのものを残し、覚えている全項目を後ろに並べる
+        payload.retain(|(k, _)| is_time(k));
+        payload.extend(state.fields.iter().cloned());
+
+        let mut buf = Vec::with_capacity(body.len() * 2);
+        write_value(&mut buf, &val).context("Failed to encode message")?;
+        Ok(Some(buf))
+    }
+}
@@ -0,0 +1,137 @@
+use std::collections::{BTreeMap, HashMap};
+
+use serde::Serialize;
+
+/// client/include/frame.h と同じ形式
+/// [version][flags][topic][seq_hi][seq_lo][timestamp_us (8byte, big endian)]
+pub const FRAME_VERSION: u8 = 2;
+pub const FRAME_HEADER_SIZE: usize = 13;
+
+/// timestamp_usがホストの時刻(UNIX時間)に合わせてある
+pub const FRAME_FLAG_SYNCED: u8 = 0x01;
+
+/// 差分で送っているトピックのキーフレーム
+pub const FRAME_FLAG_KEYFRAME: u8 = 0x04;
+
+/// 前のフレームから変わった項目だけが入っている
+pub const FRAME_FLAG_DELTA: u8 = 0x08;
+
+/// Picoのフラッシュに残っていたものを送り直したもの
+pub const FRAME_FLAG_REPLAY: u8 = 0x10;
+
+/// client/include/topic.h の topic_id_t と同じ並び
+const TOPIC_NAMES: [&str; 23] = [
+    "unknown",
+    "stroke/front",
+    "stroke/rear",
+    "water",
+    "ecu",
+    "rpm",
+    "acc",
+    "env",
+    "af",
+    "core1/front",
+    "core1/rear",
+    "drop/front",
+    "drop/rear",
+    "sync/front",
+    "sync/rear",
+    "desc",
+    "block/stroke/front",
+    "log/front",
+    "meter",
+    "meter/front",
+    "i2c/front",
+    "boot/front",
+    "replay",
+];
+
+pub fn topic_name(id: u8) -> &'static str {
+    TOPIC_NAMES.get(id as usize).copied().unwrap_or("unknown")
+}
+
+#[derive(Debug, Clone, Copy)]
+pub struct FrameHeader {
+    pub flags: u8,
+    pub topic: u8,
+    pub seq: u16,
+    pub timestamp_us: u64,
+}
+
+pub fn parse_header(data: &[u8]) -> Option<FrameHeader> {
+    if data.len() < FRAME_HEADER_SIZE || data[0] != FRAME_VERSION {
+        return None;
+    }
+
+    Some(FrameHeader {
+        flags: data[1],
+        topic: data[2],
+        seq: u16::from_be_bytes([data[3], data[4]]),
+        timestamp_us: u64::from_be_bytes(data[5..13].try_into().ok()?),
+    })
+}
+
+#[derive(Debug, Default, Serialize)]
+pub struct TopicStats {
+    pub received: u64,
+    pub lost: u64,
+    pub duplicated: u64,
+    pub resets: u64,
+    /// ホストの時刻に合わせられていなかったもの
+    pub unsynced: u64,
+    /// 届いたが、キーや差分を戻せずに流せなかったもの
+    pub undecoded: u64,
+}
+
+/// トピックごとの番号の飛びから欠落数を数える
+#[derive(Default)]
+pub struct LossTracker {
+    last: HashMap<u8, FrameHeader>,
+    stats: BTreeMap<u8, TopicStats>,
+}
+
+impl LossTracker {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn record(&mut self, header: &FrameHeader) {
+        let stats = self.stats.entry(header.topic).or_default();
+        stats.received += 1;
+        if header.flags & FRAME_FLAG_SYNCED == 0 {
+            stats.unsynced += 1;
+        }
+
+        let Some(last) = self.last.get(&header.topic) else {
+            self.last.insert(header.topic, *header);
+            return;
+        };
+
+        // 時刻が戻ったらマイコンが再起動したので数え直す
+        if header.timestamp_us < last.timestamp_us {
+            stats.resets += 1;
+            self.last.insert(header.topic, *header);
+            return;
+        }
+
+        let gap = header.seq.wrapping_sub(last.seq.wrapping_add(1));
+        if gap < 0x8000 {
+            stats.lost += gap as u64;
+            self.last.insert(header.topic, *header);
+        } else {
+            // 前より古い番号は重複として数え、基準は動かさない
+            stats.duplicated += 1;
+        }
+    }
+
+    pub fn undecoded(&mut self, header: &FrameHeader) {
+        self.stats.entry(header.topic).or_default().undecoded += 1;
+    }
+
+    pub fn stats(&self) -> BTreeMap<&'static str, &TopicStats> {
+        self.stats
+            .iter()
+            .map(|(id, stats)| (topic_name(*id), stats))
+            .collect()
+    }
+}
@@ -0,0 +1,73 @@
+use std::fs::{self, File};
+use std::io::{self, Read, Seek, SeekFrom};
+use std::os::fd::AsRawFd;
+use std::path::PathBuf;
+use std::{thread, time::Duration};
+
+use anyhow::{Context, Result};
+
+/// sysfsのGPIOを入力として開き、立ち上がりエッジを待てるようにしたもの
+pub struct EdgeInput {
+    value: File,
+}
+
+impl EdgeInput {
+    pub fn open(gpio: u32) -> Result<Self> {
+        let dir = PathBuf::from(format!("/sys/class/gpio/gpio{gpio}"));
+        if !dir.exists() {
+            fs::write("/sys/class/gpio/export", gpio.to_string())
+                .with_context(|| format!("gpio {gpio} export failed."))?;
+            // udevがパーミッションを設定し終わるのを待つ
+            thread::sleep(Duration::from_millis(100));
+        }
+
+        fs::write(dir.join("direction"), "in")
+            .with_context(|| format!("gpio {gpio} set direction failed."))?;
+        fs::write(dir.join("edge"), "rising")
+            .with_context(|| format!("gpio {gpio} set edge failed."))?;
+
+        let value =
+            File::open(dir.join("value")).with_context(|| format!("gpio {gpio} open failed."))?;
+
+        Ok(Self { value })
+    }
+
+    pub fn is_high(&mut self) -> Result<bool> {
+        let mut buf = [0u8; 1];
+        self.value
+            .seek(SeekFrom::Start(0))
+            .context("gpio seek failed.")?;
+        self.value
+            .read_exact(&mut buf)
+            .context("gpio read failed.")?;
+
+        Ok(buf[0] == b'1')
+    }
+
+    /// Highになるまで待つ。すでにHighならすぐ返る
+    ///
+    /// 値を読んだ後に来たエッジはpollで拾えるので取りこぼさない。
+    /// タイムアウトした時はfalseを返す。
+    pub fn wait_high(&mut self, timeout: Duration) -> Result<bool> {
+        if self.is_high()? {
+            return Ok(true);
+        }
+
+        let mut fds = libc::pollfd {
+            fd: self.value.as_raw_fd(),
+            events: libc::POLLPRI | libc::POLLERR,
+            revents: 0,
+        };
+        let timeout_ms = timeout.as_millis().min(libc::c_int::MAX as u128) as libc::c_int;
+        let ret = unsafe { libc::poll(&mut fds, 1, timeout_ms) };
+        if ret < 0 {
+            let err = io::Error::last_os_error();
+            if err.kind() == io::ErrorKind::Interrupted {
+                return Ok(false);
+            }
+            return Err(err).context("gpio poll failed.");
+        }
+
+        self.is_high()
+    }
+}
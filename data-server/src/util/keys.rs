@@ -0,0 +1,148 @@
+use anyhow::{Context, Result, bail};
+use rmpv::Value;
+use rmpv::decode::read_value;
+use rmpv::encode::write_value;
+
+/// client/include/msgpack.hpp の encoding::EXT_SCALED
+/// typeが EXT_SCALED - exp のextは big endianの整数 * 10^exp を表す
+const EXT_SCALED: i8 = 0x20;
+const EXT_SCALED_MAX_DIGITS: i8 = 9;
+
+/// client/src/key.c と topic.c の表
+///
+/// MSGPACK_KEY_IDでビルドしたPicoはキーとトピック名を整数で送ってくるので、
+/// descトピックで受け取った表を使って文字列に戻す。
+/// 保存側が書き方を気にしなくて済むよう、スケール付きの整数も小数に戻す。
+#[derive(Default)]
+pub struct KeyTable {
+    keys: Vec<String>,
+    topics: Vec<String>,
+    regs: Vec<String>,
+}
+
+fn map_get<'a>(val: &'a Value, key: &str) -> Option<&'a Value> {
+    val.as_map()?
+        .iter()
+        .find(|(k, _)| k.as_str() == Some(key))
+        .map(|(_, v)| v)
+}
+
+fn names(payload: &Value) -> Result<Vec<String>> {
+    let array = map_get(payload, "names")
+        .and_then(Value::as_array)
+        .context("Missing 'names' array")?;
+    array
+        .iter()
+        .map(|v| v.as_str().map(String::from).context("Expected a string"))
+        .collect()
+}
+
+fn decode_scaled(ty: i8, data: &[u8]) -> Option<f64> {
+    let digits = ty.checked_sub(EXT_SCALED)?;
+    if !(0..=EXT_SCALED_MAX_DIGITS).contains(&digits) {
+        return None;
+    }
+    let raw = match *data {
+        [a, b] => i16::from_be_bytes([a, b]) as f64,
+        [a, b, c, d] => i32::from_be_bytes([a, b, c, d]) as f64,
+        _ => return None,
+    };
+    Some(raw / 10f64.powi(digits as i32))
+}
+
+impl KeyTable {
+    pub fn is_loaded(&self) -> bool {
+        !self.keys.is_empty()
+    }
+
+    /// descトピックの本体を読み込む
+    ///
+    /// 一つのフレームには一つの表のfirstからの一部だけが載るので、その位置に継ぎ足す。
+    /// firstが0なら表を送り直してきたので、前に受け取った分は捨てる。
+    pub fn load(&mut self, body: &[u8]) -> Result<()> {
+        let val = read_value(&mut &body[..]).context("Failed to decode descriptor")?;
+        let payload = map_get(&val, "payload").context("Missing 'payload' field")?;
+        let table = map_get(payload, "table")
+            .and_then(Value::as_str)
+            .context("Missing 'table' field")?;
+        let first = map_get(payload, "first")
+            .and_then(Value::as_u64)
+            .context("Missing 'first' field")? as usize;
+        let names = names(payload)?;
+
+        let target = match table {
+            "keys" => &mut self.keys,
+            "topics" => &mut self.topics,
+            "regs" => &mut self.regs,
+            _ => bail!("unknown table '{table}'"),
+        };
+        if first == 0 {
+            target.clear();
+        }
+        // 前のフレームを取りこぼしていれば、続きとして継ぎ足せない
+        if first != target.len() {
+            bail!("table '{table}' is missing names before {first}");
+        }
+        target.extend(names);
+        Ok(())
+    }
+
+    /// 最新値の表のチャンネル名
+    pub fn reg_name(&self, id: usize) -> Option<&str> {
+        self.regs.get(id).map(String::as_str)
+    }
+
+    /// 整数のキーなどを戻した本体を返す。戻すものが無ければNone
+    pub fn expand(&self, body: &[u8]) -> Result<Option<Vec<u8>>> {
+        let mut val = read_value(&mut &body[..]).context("Failed to decode message")?;
+        if !self.expand_map(&mut val)? {
+            return Ok(None);
+        }
+
+        let mut buf = Vec::with_capacity(body.len() * 2);
+        write_value(&mut buf, &val).context("Failed to encode message")?;
+        Ok(Some(buf))
+    }
+
+    fn expand_map(&self, val: &mut Value) -> Result<bool> {
+        let Value::Map(map) = val else {
+            return Ok(false);
+        };
+
+        let mut changed = false;
+        for (k, v) in map.iter_mut() {
+            if let Some(id) = k.as_u64() {
+                if !self.is_loaded() {
+                    bail!("descriptor not received yet");
+                }
+                let name = self
+                    .keys
+                    .get(id as usize)
+                    .with_context(|| format!("unknown key id {id}"))?;
+                *k = Value::from(name.as_str());
+                changed = true;
+            }
+
+            if k.as_str() == Some("topic") {
+                if let Some(id) = v.as_u64() {
+                    let name = self
+                        .topics
+                        .get(id as usize)
+                        .with_context(|| format!("unknown topic id {id}"))?;
+                    *v = Value::from(name.as_str());
+                    changed = true;
+                }
+            }
+
+            if let Value::Ext(ty, data) = v {
+                if let Some(f) = decode_scaled(*ty, data) {
+                    *v = Value::F64(f);
+                    changed = true;
+                }
+            }
+
+            changed |= self.expand_map(v)?;
+        }
+        Ok(changed)
+    }
+}
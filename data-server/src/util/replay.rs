@@ -0,0 +1,34 @@
+use anyhow::{Context, Result, bail};
+use rmpv::Value;
+use rmpv::decode::read_value;
+use rmpv::encode::write_value;
+
+/// 送り直された履歴のトピック名に付ける接頭辞
+///
+/// 履歴は起動する度に取り寄せるので、前に保存したものと重なる。
+/// 今のデータと見分けられるよう、保存側へは "replay/stroke/front" のように渡す。
+pub const REPLAY_TOPIC_PREFIX: &str = "replay/";
+
+/// トピック名に接頭辞を付けた本体を返す
+///
+/// キーは文字列に戻した後の本体を渡すこと。
+pub fn tag_replay(body: &[u8]) -> Result<Vec<u8>> {
+    let mut val = read_value(&mut &body[..]).context("Failed to decode message")?;
+    let Value::Map(map) = &mut val else {
+        bail!("Expected a map but found {:?}", val);
+    };
+    let topic = map
+        .iter_mut()
+        .find(|(k, _)| k.as_str() == Some("topic"))
+        .map(|(_, v)| v)
+        .context("Missing 'topic' field")?;
+    let name = format!(
+        "{REPLAY_TOPIC_PREFIX}{}",
+        topic.as_str().context("Expected a topic name")?
+    );
+    *topic = Value::from(name);
+
+    let mut buf = Vec::with_capacity(body.len() + REPLAY_TOPIC_PREFIX.len());
+    write_value(&mut buf, &val).context("Failed to encode message")?;
+    Ok(buf)
+}